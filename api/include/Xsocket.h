@@ -66,6 +66,7 @@ extern "C" {
 // Cache policy
 #define POLICY_LRU				0x00000001
 #define POLICY_FIFO				0x00000002
+#define POLICY_S3FIFO			0x00000004
 #define POLICY_REMOVE_ON_EXIT	0x00001000
 #define POLICY_RETAIN_ON_EXIT	0x00002000
 #define POLICY_DEFAULT			(POLICY_LRU | POLICY_RETAIN_ON_EXIT)
@@ -96,6 +97,33 @@ typedef struct {
 	int status; // 1: ready to be read, 0: waiting for chunk response, -1: failed
 } ChunkStatus;
 
+// Xring operations
+#define XRING_OP_CONNECT		1
+#define XRING_OP_ACCEPT			2
+#define XRING_OP_SEND			3
+#define XRING_OP_RECV			4
+#define XRING_OP_REQUESTCHUNK	5
+
+/* Xring submission entry */
+typedef struct {
+	int op;					// XRING_OP_xxx
+	int sockfd;				// Xsocket the operation acts on
+	void *buf;				// data to send, receive buffer, or the CID DAG to request
+	size_t len;				// size of buf
+	int flags;
+	struct sockaddr *addr;	// peer to connect to, or receives the peer's address
+	socklen_t addrlen;		// size of addr
+	uint64_t user_data;		// returned untouched in the completion
+} XringSqe;
+
+/* Xring completion entry */
+typedef struct {
+	uint64_t user_data;
+	int res;				// bytes transferred, new Xsocket for accept, or -errno
+} XringCqe;
+
+typedef struct Xring Xring;
+
 
 // XIA specific addrinfo flags
 #define XAI_DAGHOST	AI_NUMERICHOST	// if set, name is a dag instead of a generic name string
@@ -111,6 +139,7 @@ typedef struct {
 #define XOPT_NEXT_PROTO	0x07002	// change the next proto field of the XIA header
 #define XOPT_BLOCK		0x07003
 #define XOPT_ERROR_PEEK 0x07004
+#define XOPT_ROUTE_EVENTS 0x07005	// send route table changes to this raw socket
 
 // XIA protocol types
 #define XPROTO_XIA_TRANSPORT	0x0e
@@ -151,11 +180,19 @@ extern int Xselect(int nfds, fd_set *readfds, fd_set *writefds, fd_set *errorfds
 extern int Xfork(void);
 extern int Xnotify(void);
 
+extern Xring *Xring_create(unsigned depth);
+extern int Xring_destroy(Xring *ring);
+extern int Xring_fd(const Xring *ring);
+extern int Xring_submit(Xring *ring, const XringSqe *sqes, unsigned count);
+extern int Xring_reap(Xring *ring, XringCqe *cqes, unsigned count, int timeout);
+
 extern int XrequestChunk(int sockfd, char* dag, size_t dagLen);
 extern int XrequestChunks(int sockfd, const ChunkStatus *chunks, int numChunks);
 extern int XgetChunkStatus(int sockfd, char* dag, size_t dagLen);
 extern int XgetChunkStatuses(int sockfd, ChunkStatus *statusList, int numCids);
 extern int XreadChunk(int sockfd, void *rbuf, size_t len, int flags, char *cid, size_t cidLen);
+extern int XfetchChunks(int sockfd, const ChunkStatus *chunks, int numChunks);
+extern int XreadFetchedChunk(int sockfd, void *rbuf, size_t len, int *status);
 extern int XpushChunkto(const ChunkContext* ctx, const char* buf, size_t len, int flags, const struct sockaddr *addr, socklen_t addrlen, ChunkInfo* info);
 extern int XpushBufferto(const ChunkContext *ctx, const char *data, size_t len, int flags, const struct sockaddr *addr, socklen_t addrlen, ChunkInfo **info, unsigned chunkSize);
 extern int XpushFileto(const ChunkContext *ctx, const char *fname, int flags, const struct sockaddr *addr, socklen_t addrlen, ChunkInfo **info, unsigned chunkSize);
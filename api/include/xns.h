@@ -35,9 +35,17 @@ extern "C" {
 #define NS_TYPE_RESPONSE_QUERY		0x05
 #define NS_TYPE_RESPONSE_RQUERY		0x06
 #define NS_TYPE_RESPONSE_ERROR		0x07
+#define NS_TYPE_MQUERY				0x08
+#define NS_TYPE_RESPONSE_MQUERY		0x09
 
 #define NS_FLAGS_MIGRATE 0x01
 
+#define NS_MAX_BATCH 32		// names in one NS_TYPE_MQUERY
+
+// seconds clients may cache answers, the nameserver sends its own
+#define NS_DEFAULT_TTL	30
+#define NS_NEGATIVE_TTL	5	// for names that aren't registered
+
 #define SID_NS "SID:1110000000000000000000000000000000001113"
 
 
@@ -46,6 +54,15 @@ typedef struct ns_pkt {
 	char flags;
 	const char* name;
 	const char* dag;
+
+	// batched lookups, NS_TYPE_MQUERY carries names and the response carries
+	// a dag for each of them in the same order, "" if the name isn't known
+	int count;
+	const char *names[NS_MAX_BATCH];
+	const char *dags[NS_MAX_BATCH];
+
+	// seconds a query response or error may be cached, 0 if not given
+	unsigned ttl;
 } ns_pkt;
 
 extern int XregisterHost(const char *name, sockaddr_x *addr);
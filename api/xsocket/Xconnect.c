@@ -57,10 +57,9 @@ int _connDgram(int sockfd, const sockaddr *addr, socklen_t addrlen)
 	return rc;
 }
 
-int _connStream(int sockfd, const sockaddr *addr, socklen_t addrlen)
+// validate the stream connect and fill in the XCONNECT request for click
+int _connStreamMsg(int sockfd, const sockaddr *addr, xia::XSocketMsg *xsm)
 {
-	UNUSED(addrlen);
-	int rc;
 	char src_SID[strlen("SID:") + XIA_SHA_DIGEST_STR_LEN];
 	struct addrinfo *ai;
 
@@ -86,12 +85,9 @@ int _connStream(int sockfd, const sockaddr *addr, socklen_t addrlen)
 		return -1;
 	}
 
-	xia::XSocketMsg xsm;
-	xsm.set_type(xia::XCONNECT);
-	unsigned seq = seqNo(sockfd);
-	xsm.set_sequence(seq);
+	xsm->set_type(xia::XCONNECT);
 
-	xia::X_Connect_Msg *x_connect_msg = xsm.mutable_x_connect();
+	xia::X_Connect_Msg *x_connect_msg = xsm->mutable_x_connect();
 	x_connect_msg->set_ddag(g.dag_string().c_str());
 
 	// Assign a SID with corresponding keys (unless assigned by bind already)
@@ -120,6 +116,21 @@ int _connStream(int sockfd, const sockaddr *addr, socklen_t addrlen)
 		setTempSID(sockfd, src_SID);
 	}
 
+	return 0;
+}
+
+int _connStream(int sockfd, const sockaddr *addr, socklen_t addrlen)
+{
+	UNUSED(addrlen);
+	int rc;
+
+	xia::XSocketMsg xsm;
+	if (_connStreamMsg(sockfd, addr, &xsm) < 0)
+		return -1;
+
+	unsigned seq = seqNo(sockfd);
+	xsm.set_sequence(seq);
+
 	// In Xtransport: send SYN to destination server
 	if ((rc = click_send(sockfd, &xsm)) < 0) {
 		LOGF("Error talking to Click: %s", strerror(errno));
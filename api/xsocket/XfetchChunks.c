@@ -0,0 +1,231 @@
+/*
+** Copyright 2011 Carnegie Mellon University
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**    http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/*!
+** @file XfetchChunks.c
+** @brief implements XfetchChunks() and XreadFetchedChunk()
+*/
+
+#include <errno.h>
+#include "Xsocket.h"
+#include "Xinit.h"
+#include "Xutil.h"
+
+// # of DAGs that safely fit in a single message to click
+#define FETCH_BATCH		300
+
+// # of chunks click may send up before the application reads them
+#define FETCH_CREDIT	32
+
+static int sendFetchMsg(int sockfd, unsigned seq, const ChunkStatus *chunks, int numChunks, unsigned credit, bool more)
+{
+	xia::XSocketMsg xsm;
+	xsm.set_type(xia::XFETCHCHUNKS);
+	xsm.set_sequence(seq);
+
+	xia::X_Fetchchunks_Msg *x_fetchchunks_msg = xsm.mutable_x_fetchchunks();
+
+	for (int i = 0; i < numChunks; i++) {
+		// keep the slot so chunks still come back in the caller's order,
+		// click fails DAGs it can't parse
+		x_fetchchunks_msg->add_dag(chunks[i].cid ? chunks[i].cid : "");
+	}
+	if (credit)
+		x_fetchchunks_msg->set_credit(credit);
+	if (numChunks)
+		x_fetchchunks_msg->set_more(more);
+
+	if (click_send(sockfd, &xsm) < 0) {
+		LOGF("Error talking to Click: %s", strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+// tell click to drop the fetch, chunks it already sent up are ignored
+static void cancelFetch(int sockfd, unsigned seq)
+{
+	xia::XSocketMsg xsm;
+	xsm.set_type(xia::XFETCHCHUNKS);
+	xsm.set_sequence(seq);
+	xsm.mutable_x_fetchchunks()->set_cancel(true);
+
+	if (click_send(sockfd, &xsm) < 0) {
+		LOGF("Error cancelling fetch: %s", strerror(errno));
+	}
+}
+
+/*!
+** @brief fetch a list of content chunks.
+**
+** XfetchChunks() hands the whole list of chunks to click in one call. Click
+** keeps a window of requests in flight, sized to what the network can
+** carry, retransmits the ones that get lost, and sends the chunks up in the
+** order they were listed as fast as the application reads them with
+** XreadFetchedChunk(). This replaces the XrequestChunks(),
+** XgetChunkStatuses(), XreadChunk() round trips needed for each chunk.
+**
+** Only one fetch can be in progress on a socket, and the socket should not
+** be used for other chunk calls until all of the chunks have been read.
+**
+** @param sockfd the control socket (must be of type XSOCK_CHUNK)
+** @param chunks A list of content DAGs to retrieve, only the cid field is used
+** @param numChunks number of CIDs in the chunk list
+**
+** @returns 0 on success
+** @returns -1 on error with errno set. errno is set to EALREADY if a fetch
+** is already in progress on the socket.
+*/
+int XfetchChunks(int sockfd, const ChunkStatus *chunks, int numChunks)
+{
+	unsigned seq, left, unacked;
+	int rc;
+
+	if (validateSocket(sockfd, XSOCK_CHUNK, EAFNOSUPPORT) < 0) {
+		LOGF("Socket %d must be a chunk socket", sockfd);
+		return -1;
+	}
+
+	if (numChunks == 0)
+		return 0;
+
+	if (!chunks || numChunks < 0) {
+		LOG("null pointer error!");
+		errno = EFAULT;
+		return -1;
+	}
+
+	getFetchState(sockfd, &seq, &left, &unacked);
+	if (seq != 0) {
+		LOGF("Socket %d is already fetching %u chunks", sockfd, left);
+		errno = EALREADY;
+		return -1;
+	}
+
+	// the first batch starts the fetch, and is the only one click answers
+	int num = MIN(numChunks, FETCH_BATCH);
+
+	seq = seqNo(sockfd);
+	if (sendFetchMsg(sockfd, seq, chunks, num, FETCH_CREDIT, num < numChunks) < 0)
+		return -1;
+
+	xia::XSocketMsg xsm;
+	if ((rc = click_reply(sockfd, seq, &xsm)) < 0) {
+		LOGF("Error retrieving status from Click: %s", strerror(errno));
+		return -1;
+	}
+
+	setFetchState(sockfd, seq, numChunks, 0);
+
+	for (int i = num; i < numChunks; i += FETCH_BATCH) {
+		num = MIN(numChunks - i, FETCH_BATCH);
+
+		if (sendFetchMsg(sockfd, seq, &chunks[i], num, 0, i + num < numChunks) < 0) {
+			// click would wait forever for the rest of the list
+			int e = errno;
+			setFetchState(sockfd, 0, 0, 0);
+			cancelFetch(sockfd, seq);
+			errno = e;
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/*!
+** @brief read the next chunk of the fetch started by XfetchChunks().
+**
+** Chunks are returned in the order they were passed to XfetchChunks(),
+** blocking until the next one is in.
+**
+** @param sockfd the control socket (must be of type XSOCK_CHUNK)
+** @param rbuf buffer to receive the data
+** @param len length of rbuf
+** @param status if not NULL, receives READY_TO_READ, INVALID_HASH if the
+** data does not match its CID, or REQUEST_FAILED if the chunk could not be
+** retrieved
+**
+** @returns number of bytes in the chunk, 0 if it could not be retrieved
+** @returns -1 on error with errno set. errno is set to ENOENT if there is no
+** fetch in progress, or to EFAULT if rbuf is too small for the chunk, in
+** which case the chunk stays queued for a call with a bigger buffer.
+*/
+int XreadFetchedChunk(int sockfd, void *rbuf, size_t len, int *status)
+{
+	unsigned seq, left, unacked;
+	int rc;
+
+	if (validateSocket(sockfd, XSOCK_CHUNK, EAFNOSUPPORT) < 0) {
+		LOGF("Socket %d must be a chunk socket\n", sockfd);
+		return -1;
+	}
+
+	if (!rbuf) {
+		LOG("null pointer error!");
+		errno = EFAULT;
+		return -1;
+	}
+
+	getFetchState(sockfd, &seq, &left, &unacked);
+	if (seq == 0) {
+		errno = ENOENT;
+		return -1;
+	}
+
+	// a chunk that didn't fit last time is held on to until it is read
+	xia::XSocketMsg xsm;
+	unsigned buflen = api_mtu();
+	char *buf = (char *)malloc(buflen);
+	bool held = false;
+
+	if ((rc = getCachedPacket(sockfd, seq, buf, buflen)) > 0)
+		held = xsm.ParseFromArray(buf, rc);
+	free(buf);
+
+	if (!held && (rc = click_reply(sockfd, seq, &xsm)) < 0) {
+		LOGF("Error retrieving chunk from Click: %s", strerror(errno));
+		return -1;
+	}
+
+	const xia::X_Fetchchunks_Msg &msg = xsm.x_fetchchunks();
+	unsigned paylen = msg.payload().size();
+
+	if (paylen > len) {
+		LOGF("CID is %u bytes, but rbuf is only %lu bytes", paylen, len);
+		std::string p_buf;
+		xsm.SerializeToString(&p_buf);
+		cachePacket(sockfd, seq, (char *)p_buf.data(), p_buf.size());
+		errno = EFAULT;
+		return -1;
+	}
+
+	// let click send more once half of the credit has been used up
+	left--;
+	unacked++;
+	if (left == 0)
+		setFetchState(sockfd, 0, 0, 0);
+	else if (unacked >= FETCH_CREDIT / 2) {
+		setFetchState(sockfd, seq, left, 0);
+		sendFetchMsg(sockfd, seq, NULL, 0, unacked, false);
+	} else
+		setFetchState(sockfd, seq, left, unacked);
+
+	if (status)
+		*status = msg.status();
+
+	memcpy(rbuf, msg.payload().c_str(), paylen);
+	return paylen;
+}
@@ -29,8 +29,7 @@
 static int makeList(bool increment)
 {
 	SocketMap *socketmap = SocketMap::getMap();
-	SMap *sockets = socketmap->smap();
-	SMap::iterator it;
+	int limit = socketmap->limit();
 	int rc = 0;
 	int sock = 0;
 	int count = 0;
@@ -42,23 +41,21 @@ static int makeList(bool increment)
 
 	xia::X_Fork_Msg *fm = xsm.mutable_x_fork();
 
-	socketmap->lock();
-	LOGF("XFORK: count = %d\n", sockets->size());
-
-	for (it = sockets->begin(); it != sockets->end(); it++) {
-		int sock = it->first;
+	for (int fd = 0; fd < limit; fd++) {
+		if (socketmap->get(fd) == NULL)
+			continue;
 
 		// find the port number associated with this Xsocket
 		struct sockaddr_in sin;
 		socklen_t slen = sizeof(sin);
-		(_f_getsockname)(sock, (struct sockaddr*)&sin, &slen);
+		(_f_getsockname)(fd, (struct sockaddr*)&sin, &slen);
 
 		fm->add_ports(sin.sin_port);
 		count++;
 
-		LOGF("adding socket:%d port:%d", sock, sin.sin_port);
+		LOGF("adding socket:%d port:%d", fd, sin.sin_port);
 	}
-	socketmap->unlock();
+	LOGF("XFORK: count = %d\n", count);
 
 	if (count) {
 		fm->set_increment(increment);
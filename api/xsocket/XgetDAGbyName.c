@@ -21,63 +21,13 @@
 #include <errno.h>
 #include <unistd.h>
 #include <syslog.h>
+#include <arpa/inet.h>
 #include "Xsocket.h"
 #include "Xinit.h"
 #include "Xutil.h"
 #include "xns.h"
 #include "dagaddr.hpp"
 
-#define ETC_HOSTS "/etc/hosts.xia"
-
-/*!
-** @brief Lookup a DAG in the hosts.xia file
-**
-** @param name The name of an XIA service or host.
-**
-** @returns a character point to the dag on success
-** @returns NULL on failure
-**
-*/
-char *hostsLookup(const char *name) {
-	char line[512];
-	char *linend;
-	char *dag;
-	char _dag[NS_MAX_DAG_LENGTH];
-
-	// look for an hosts_xia file locally
-	char buf[BUF_SIZE];
-	FILE *hostsfp = fopen(strcat(XrootDir(buf, BUF_SIZE), ETC_HOSTS), "r");
-	int answer_found = 0;
-	if (hostsfp != NULL) {
-		while (fgets(line, 511, hostsfp) != NULL) {
-			linend = line+strlen(line)-1;
-			while (*linend == '\r' || *linend == '\n' || *linend == '\0') {
-				linend--;
-			}
-			*(linend+1) = '\0';
-			if (line[0] == '#') {
-				continue;
-			} else if (!strncmp(line, name, strlen(name))
-						&& line[strlen(name)] == ' ') {
-				strncpy(_dag, line+strlen(name)+1, strlen(line)-strlen(name)-1);
-				_dag[strlen(line)-strlen(name)-1] = '\0';
-				answer_found = 1;
-			}
-		}
-		fclose(hostsfp);
-		if (answer_found) {
-			dag = (char*)malloc(sizeof(_dag) + 1);
-			strcpy(dag, _dag);
-			return dag;
-		}
-	} else {
-		//printf("XIAResolver file error\n");
-	}
-
-	//printf("Name not found in ./hosts_xia\n");
-	return NULL;
-}
-
 // User passes a buffer and we fill it in
 int XgetNamebyDAG(char *name, int namelen, const sockaddr_x *addr, socklen_t *addrlen)
 {
@@ -220,6 +170,10 @@ int XgetNamebyDAG(char *name, int namelen, const sockaddr_x *addr, socklen_t *ad
 ** The memory returned is dynamically allocated and should be released with a
 ** call to free() when the caller is done with it.
 **
+** Names listed in hosts.xia are answered from a precompiled copy of it.
+** Nameserver answers, including names it doesn't know, are cached in the
+** process for as long as the nameserver allows.
+**
 ** This is a very simple implementation of the name query function.
 ** It will be replaces in a future release.
 **
@@ -236,7 +190,6 @@ int XgetDAGbyName(const char *name, sockaddr_x *addr, socklen_t *addrlen)
 	int result;
 	sockaddr_x ns_dag;
 	char pkt[NS_MAX_PACKET_SIZE];
-	char *dag;
 
 	if (!name || *name == 0) {
 		errno = EINVAL;
@@ -249,18 +202,9 @@ int XgetDAGbyName(const char *name, sockaddr_x *addr, socklen_t *addrlen)
 	}
 
 	// see if name is registered in the local hosts.xia file
-	if((dag = hostsLookup(name))) {
-		Graph g(dag);
-		free(dag);
-
-		// check to see if the returned dag was valid
-		// we may want a better check for this in the future
-		if (g.num_nodes() > 0) {
-			std::string s = g.dag_string();
-			g.fill_sockaddr((sockaddr_x*)addr);
-			*addrlen = sizeof(sockaddr_x);
-			return 0;
-		}
+	if (hostsLookup(name, addr) == 0) {
+		*addrlen = sizeof(sockaddr_x);
+		return 0;
 	}
 
 	if (!strncmp(name, "RE ", 3) || !strncmp(name, "DAG ", 4)) {
@@ -278,6 +222,15 @@ int XgetDAGbyName(const char *name, sockaddr_x *addr, socklen_t *addrlen)
         }
     }
 
+	// see if the name server answered recently
+	switch (nameCacheLookup(name, addr)) {
+	case 1:
+		*addrlen = sizeof(sockaddr_x);
+		return 0;
+	case 0:
+		return -1;
+	}
+
 	// not found locally, check the name server
 	if ((sock = Xsocket(AF_XIA, SOCK_DGRAM, 0)) < 0)
 		return -1;
@@ -324,6 +277,7 @@ int XgetDAGbyName(const char *name, sockaddr_x *addr, socklen_t *addrlen)
 		result = 1;
 		break;
 	case NS_TYPE_RESPONSE_ERROR:
+		nameCacheAdd(name, NULL, resp_pkt.ttl);
 		result = -1;
 		break;
 	default:
@@ -340,6 +294,7 @@ int XgetDAGbyName(const char *name, sockaddr_x *addr, socklen_t *addrlen)
 	Graph g(resp_pkt.dag);
 	g.fill_sockaddr(addr);
 	*addrlen = sizeof(sockaddr_x);
+	nameCacheAdd(name, addr, resp_pkt.ttl);
 	return 0;
 }
 
@@ -480,6 +435,8 @@ int _xregister(const char *name, sockaddr_x *DAG, short flags) {
 
 	switch (resp_pkt.type) {
 	case NS_TYPE_RESPONSE_REGISTER:
+		// don't answer our own lookups with the old dag
+		nameCacheRemove(name);
 		result = 0;
 		break;
 	case NS_TYPE_RESPONSE_ERROR:
@@ -683,6 +640,49 @@ int Xgetsockname(int sockfd, struct sockaddr *addr, socklen_t *addrlen)
 	return 0;
 }
 
+/*
+** appends count strings to a batched packet, stopping at the first one that
+** doesn't fit. Returns the number appended.
+*/
+static int put_ns_strings(char **end, const char *limit, const char **strs, int count)
+{
+	int i;
+
+	for (i = 0; i < count; i++) {
+		const char *s = strs[i] ? strs[i] : "";
+		int len = strlen(s) + 1;
+
+		if (*end + len > limit)
+			break;
+		memcpy(*end, s, len);
+		*end += len;
+	}
+	return i;
+}
+
+/*
+** points strs at the count strings following p, returns where they end or
+** NULL if the packet ends first
+*/
+static char *get_ns_strings(char *p, char *limit, const char **strs, int count)
+{
+	for (int i = 0; i < count; i++) {
+		char *nul = p < limit ? (char *)memchr(p, 0, limit - p) : NULL;
+
+		if (!nul)
+			return NULL;
+		strs[i] = p;
+		p = nul + 1;
+	}
+	return p;
+}
+
+/*
+** Batched packets (NS_TYPE_MQUERY and its response) hold as many of the
+** np->count entries as fit in pkt_sz, np->count is set to the number packed.
+** Query responses and errors end with np->ttl if it is set, older clients
+** stop reading before it.
+*/
 int make_ns_packet(ns_pkt *np, char *pkt, int pkt_sz)
 {
 	char *end = pkt;
@@ -735,15 +735,48 @@ int make_ns_packet(ns_pkt *np, char *pkt, int pkt_sz)
 			end += strlen(np->name) + 1;
 			break;
 
+		case NS_TYPE_MQUERY:
+		case NS_TYPE_RESPONSE_MQUERY:
+		{
+			// leave room for the ttl
+			char *limit = pkt + pkt_sz;
+			if (np->type == NS_TYPE_RESPONSE_MQUERY && np->ttl)
+				limit -= 4;
+
+			if (np->count < 0 || np->count > NS_MAX_BATCH || limit < pkt + 3)
+				return 0;
+			end++;
+			np->count = put_ns_strings(&end, limit,
+				np->type == NS_TYPE_MQUERY ? np->names : np->dags, np->count);
+			pkt[2] = np->count;
+			break;
+		}
+
 		default:
 			break;
 	}
 
+	switch (np->type) {
+		case NS_TYPE_RESPONSE_QUERY:
+		case NS_TYPE_RESPONSE_MQUERY:
+		case NS_TYPE_RESPONSE_ERROR:
+			if (np->ttl && end + 4 <= pkt + pkt_sz) {
+				uint32_t ttl = htonl(np->ttl);
+				memcpy(end, &ttl, 4);
+				end += 4;
+			}
+			break;
+	}
+
 	return end - pkt;
 }
 
 void get_ns_packet(char *pkt, int sz, ns_pkt *np)
 {
+	char *end = NULL;		// where the strings stop
+
+	np->count = 0;
+	np->ttl = 0;
 	if (sz < 2) {
 		// hacky error check
 		np->type = NS_TYPE_RESPONSE_ERROR;
@@ -770,13 +803,36 @@ void get_ns_packet(char *pkt, int sz, ns_pkt *np)
 
 		case NS_TYPE_RESPONSE_QUERY:
 			np->dag = &pkt[2];
+			end = get_ns_strings(&pkt[2], pkt + sz, &np->dag, 1);
 			break;
 
 		case NS_TYPE_RESPONSE_RQUERY:
 			np->name = &pkt[2];
 			break;
 
+		case NS_TYPE_MQUERY:
+		case NS_TYPE_RESPONSE_MQUERY:
+			np->count = sz > 2 ? (unsigned char)pkt[2] : 0;
+			end = np->count > NS_MAX_BATCH ? NULL : get_ns_strings(&pkt[3], pkt + sz,
+				np->type == NS_TYPE_MQUERY ? np->names : np->dags, np->count);
+			if (!end) {
+				np->type = NS_TYPE_RESPONSE_ERROR;
+				np->count = 0;
+			}
+			break;
+
+		case NS_TYPE_RESPONSE_ERROR:
+			end = &pkt[2];
+			break;
+
 		default:
 			break;
 	}
+
+	// a ttl follows the answers
+	if (end && end + 4 <= pkt + sz) {
+		uint32_t ttl;
+		memcpy(&ttl, end, 4);
+		np->ttl = ntohl(ttl);
+	}
 }
@@ -130,11 +130,11 @@ void __attribute__ ((destructor)) api_destruct(void)
 {
 	// loop through left open sockets and close them
 	SocketMap *socketmap = SocketMap::getMap();
-	SMap *sockets = socketmap->smap();
-	SMap::iterator it;
+	int limit = socketmap->limit();
 
-	for (it = sockets->begin(); it != sockets->end(); it++) {
-		Xclose(it->first);
+	for (int sock = 0; sock < limit; sock++) {
+		if (socketmap->get(sock) != NULL)
+			Xclose(sock);
 	}
 }
 
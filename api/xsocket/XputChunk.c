@@ -23,7 +23,12 @@
 #include "Xinit.h"
 #include "Xutil.h"
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include <errno.h>
+#include <openssl/sha.h>
 
 /*!
 ** @brief Allocate content cache space for use by the XputChunk(),
@@ -180,11 +185,117 @@ int XputChunk(const ChunkContext *ctx, const char *data, unsigned length, ChunkI
     }
 }
 
+// # of chunk descriptors sent to click in one message
+#define PUT_BATCH			512
+
+// upper bound on the threads used to hash a file
+#define MAX_HASH_THREADS	8
+
+/*
+** Chunks of a mapped file being hashed. Hash threads take the next chunk
+** off the list until it runs out, and the publishing thread sends each
+** batch to click as soon as every chunk in it has been hashed.
+*/
+typedef struct {
+	const char *base;
+	size_t size;
+	unsigned chunkSize;
+	unsigned numChunks;
+	ChunkInfo *info;
+	int32_t ttl;
+
+	unsigned next;			// next chunk to hash
+	unsigned hashed;		// chunks [0, hashed) are done
+	char *done;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+} HashJob;
+
+static void *hashChunks(void *arg)
+{
+	HashJob *job = (HashJob *)arg;
+	unsigned char digest[SHA_DIGEST_LENGTH];
+	unsigned i;
+
+	while ((i = __sync_fetch_and_add(&job->next, 1)) < job->numChunks) {
+		size_t offset = (size_t)i * job->chunkSize;
+		unsigned len = MIN(job->size - offset, job->chunkSize);
+		ChunkInfo *ci = &job->info[i];
+
+		SHA1((const unsigned char *)job->base + offset, len, digest);
+		for (int j = 0; j < SHA_DIGEST_LENGTH; j++)
+			sprintf(&ci->cid[j * 2], "%02x", digest[j]);
+		ci->size = len;
+		ci->ttl = job->ttl;
+
+		pthread_mutex_lock(&job->lock);
+		job->done[i] = 1;
+		if (i == job->hashed) {
+			while (job->hashed < job->numChunks && job->done[job->hashed])
+				job->hashed++;
+			pthread_cond_broadcast(&job->cond);
+		}
+		pthread_mutex_unlock(&job->lock);
+	}
+	return NULL;
+}
+
+/*
+** Hands click the descriptors of chunks [first, first + count) of the file
+** open on fd. Click reads the chunks straight from our descriptor and checks
+** each against its hash. Returns the number of chunks click published, or -1
+** if it could not open the file.
+*/
+static int putFileBatch(const ChunkContext *ctx, int fd, HashJob *job, unsigned first, unsigned count)
+{
+	xia::XSocketMsg xsm;
+	xsm.set_type(xia::XPUTFILE);
+	unsigned seq = seqNo(ctx->sockfd);
+	xsm.set_sequence(seq);
+
+	xia::X_Putfile_Msg *x_putfile_msg = xsm.mutable_x_putfile();
+	x_putfile_msg->set_pid(getpid());
+	x_putfile_msg->set_fd(fd);
+	x_putfile_msg->set_sock(ctx->sockfd);
+	x_putfile_msg->set_contextid(ctx->contextID);
+	x_putfile_msg->set_ttl(ctx->ttl);
+	x_putfile_msg->set_cachesize(ctx->cacheSize);
+	x_putfile_msg->set_cachepolicy(ctx->cachePolicy);
+
+	for (unsigned i = first; i < first + count; i++) {
+		x_putfile_msg->add_cid(job->info[i].cid);
+		x_putfile_msg->add_offset((uint64_t)i * job->chunkSize);
+		x_putfile_msg->add_length(job->info[i].size);
+	}
+
+	if (click_send(ctx->sockfd, &xsm) < 0) {
+		LOGF("Error talking to Click: %s", strerror(errno));
+		return -1;
+	}
+
+	xia::XSocketMsg reply;
+	if (click_reply(ctx->sockfd, seq, &reply) < 0) {
+		LOGF("Error getting status from Click: %s", strerror(errno));
+		return -1;
+	}
+
+	if (reply.type() != xia::XPUTFILE)
+		return -1;
+	return reply.x_putfile().status();
+}
+
 /*!
 ** @brief Publish a file by breaking it into one or more content chunks.
 **
-** XputFile() calls XputChunk() internally and has the same requiremts as that
-** function.
+** XputFile() maps the file and hashes its chunks on several threads. Click
+** is sent the (CID, offset, length) descriptors of each batch of chunks
+** rather than the data, and reads the chunks straight from the file through
+** the descriptor this call holds open, so publishing a large file takes one
+** round trip per batch instead of one per chunk. Click hashes every chunk
+** again on its own threads before caching it. If click can't open the file,
+** the chunks are published one at a time with XputChunk().
+**
+** The chunk size has the same limit as XputChunk().
 **
 ** On success, the CID of the chunk is set to the 40 character hash of the
 ** content data. The CID is not a full DAG, and must be converted to a DAG
@@ -209,14 +320,15 @@ int XputChunk(const ChunkContext *ctx, const char *data, unsigned length, ChunkI
 **/
 int XputFile(ChunkContext *ctx, const char *fname, unsigned chunkSize, ChunkInfo **info)
 {
-	FILE *fp;
 	struct stat fs;
-	ChunkInfo *infoList;
-	unsigned numChunks;
+	struct timeval now;
+	HashJob job;
+	pthread_t threads[MAX_HASH_THREADS];
+	int numThreads;
 	unsigned i;
+	int fd;
 	int rc;
-	int count;
-	char *buf;
+	bool shared = true;
 
 	if (ctx == NULL) {
 		errno = EFAULT;
@@ -233,50 +345,110 @@ int XputFile(ChunkContext *ctx, const char *fname, unsigned chunkSize, ChunkInfo
 	else if (chunkSize > XIA_MAXBUF)
 		chunkSize = XIA_MAXBUF;
 
-	if (stat(fname, &fs) != 0)
-		return -1;
-
-	if (!(fp= fopen(fname, "rb")))
+	if ((fd = open(fname, O_RDONLY)) < 0)
 		return -1;
 
-	numChunks = fs.st_size / chunkSize;
-	if (fs.st_size % chunkSize)
-		numChunks ++;
-	//FIXME: this should be numChunks, sizeof(ChunkInfo)
-	if (!(infoList = (ChunkInfo*)calloc(numChunks, chunkSize))) {
-		fclose(fp);
+	if (fstat(fd, &fs) != 0) {
+		close(fd);
 		return -1;
 	}
 
-	if (!(buf = (char*)malloc(chunkSize))) {
-		free(infoList);
-		fclose(fp);
-		return -1;
+	if (fs.st_size == 0) {
+		close(fd);
+		*info = NULL;
+		return 0;
 	}
 
-	i = 0;
-	while (!feof(fp)) {
-
-		if ((count = fread(buf, sizeof(char), chunkSize, fp)) > 0) {
+	memset(&job, 0, sizeof(job));
+	job.size = fs.st_size;
+	job.chunkSize = chunkSize;
+	job.numChunks = (job.size + chunkSize - 1) / chunkSize;
+	job.ttl = ctx->ttl;
 
-			if ((rc = XputChunk(ctx, buf, count, &infoList[i])) < 0)
-				break;
-			i++;
+	// fd stays open, it's how click gets at the file
+	job.base = (const char *)mmap(NULL, job.size, PROT_READ, MAP_SHARED, fd, 0);
+	if (job.base == MAP_FAILED) {
+		close(fd);
+		return -1;
+	}
+	madvise((void *)job.base, job.size, MADV_SEQUENTIAL);
+
+	job.info = (ChunkInfo *)calloc(job.numChunks, sizeof(ChunkInfo));
+	job.done = (char *)calloc(job.numChunks, 1);
+	if (!job.info || !job.done) {
+		free(job.info);
+		free(job.done);
+		munmap((void *)job.base, job.size);
+		close(fd);
+		errno = ENOMEM;
+		return -1;
+	}
+	pthread_mutex_init(&job.lock, NULL);
+	pthread_cond_init(&job.cond, NULL);
+
+	numThreads = sysconf(_SC_NPROCESSORS_ONLN);
+	numThreads = MAX(numThreads, 1);
+	numThreads = MIN(numThreads, MAX_HASH_THREADS);
+	numThreads = MIN(numThreads, (int)job.numChunks);
+	for (i = 0; i < (unsigned)numThreads; i++) {
+		if (pthread_create(&threads[i], NULL, hashChunks, &job) != 0)
+			break;
+	}
+	numThreads = i;
+
+	// no threads to be had, hash everything up front
+	if (numThreads == 0)
+		hashChunks(&job);
+
+	rc = 0;
+	for (i = 0; i < job.numChunks && rc >= 0; ) {
+		unsigned count = MIN(job.numChunks - i, PUT_BATCH);
+
+		pthread_mutex_lock(&job.lock);
+		while (job.hashed < i + count)
+			pthread_cond_wait(&job.cond, &job.lock);
+		pthread_mutex_unlock(&job.lock);
+
+		if (shared) {
+			rc = putFileBatch(ctx, fd, &job, i, count);
+			if (rc < 0 && i == 0) {
+				// older click, or it can't open the file
+				LOGF("Click can't open %s, publishing it a chunk at a time", fname);
+				shared = false;
+				rc = 0;
+				continue;
+			}
+			if (rc >= 0 && (unsigned)rc != count) {
+				errno = EIO;
+				rc = -1;
+			}
+		} else {
+			for (unsigned j = i; j < i + count && rc >= 0; j++)
+				rc = XputChunk(ctx, job.base + (size_t)j * chunkSize, job.info[j].size, &job.info[j]);
 		}
+
+		gettimeofday(&now, NULL);
+		for (unsigned j = i; j < i + count; j++)
+			job.info[j].timestamp = now;
+		i += count;
 	}
 
-	if (i != numChunks) {
-		// FIXME: something happened, what do we want to do in this case?
-		rc = -1;
+	if (rc < 0) {
+		// stop the hash threads early, there's no point finishing
+		__sync_lock_test_and_set(&job.next, job.numChunks);
 	}
-	else
-		rc = i;
 
-	*info = infoList;
-	fclose(fp);
-	free(buf);
+	for (int t = 0; t < numThreads; t++)
+		pthread_join(threads[t], NULL);
 
-	return rc;
+	pthread_cond_destroy(&job.cond);
+	pthread_mutex_destroy(&job.lock);
+	munmap((void *)job.base, job.size);
+	close(fd);
+	free(job.done);
+
+	*info = job.info;
+	return rc < 0 ? -1 : (int)job.numChunks;
 }
 
 
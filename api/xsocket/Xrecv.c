@@ -36,12 +36,16 @@
 ** return the stored data until it is drained, and will then resume requesting
 ** data from the transport.
 **
+** A blocking Xrecv is held in the transport until at least SO_RCVLOWAT bytes
+** (default 1) are available, and then returns the data buffered at that
+** point, up to len bytes.
+**
 ** @param sockfd The socket to receive with
 ** @param rbuf where to put the received data
 ** @param len maximum amount of data to receive. the amount of data
 ** returned may be less than len bytes.
-** @param flags (This is not currently used but is kept to be compatible
-** with the standard sendto socket call).
+** @param flags MSG_PEEK leaves the data in the receive buffer, MSG_WAITALL
+** waits until len bytes are available or the peer closes the connection.
 **
 ** @returns the number of bytes received, which may be less than the number
 ** requested by the caller
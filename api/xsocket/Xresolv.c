@@ -0,0 +1,376 @@
+/* ts=4 */
+/*
+** Copyright 2016 Carnegie Mellon University
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**    http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/*!
+** @file Xresolv.c
+** @brief the hosts.xia lookup and name cache used by XgetDAGbyName()
+*/
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <tr1/unordered_map>
+#include "Xsocket.h"
+#include "Xinit.h"
+#include "Xutil.h"
+#include "xns.h"
+#include "dagaddr.hpp"
+
+#define ETC_HOSTS		"/etc/hosts.xia"
+#define ETC_HOSTS_DB	"/etc/hosts.xia.db"
+
+#define HOSTS_MAGIC		0x58484f31	// "XHO1"
+#define HOSTS_NAME_LEN	128			// longer names in hosts.xia are skipped
+#define HOSTS_CHECK		1			// seconds between looks for an edited hosts.xia
+
+#define CACHE_SIZE		1024		// names remembered per process
+#define CACHE_TTL		30			// for answers from servers that don't give one
+#define CACHE_MAX_TTL	3600
+
+/*
+** hosts.xia is compiled into a sorted table of names and ready to use
+** sockaddrs the first time a process needs it, and kept next to it in
+** hosts.xia.db so other processes can just map it. The table is rebuilt if
+** hosts.xia is newer or a different size than the one it was built from.
+*/
+typedef struct {
+	uint32_t magic;
+	uint32_t count;
+	int64_t mtime;		// of the hosts.xia it was built from, in ns
+	int64_t size;
+} HostsHeader;
+
+typedef struct {
+	char name[HOSTS_NAME_LEN];
+	sockaddr_x addr;
+} HostsRecord;
+
+static struct {
+	pthread_mutex_t lock;
+	std::string path;		// hosts.xia the table came from
+	time_t checked;
+	int64_t mtime;
+	int64_t size;
+	char *table;			// header then records, NULL if there's no hosts.xia
+	size_t len;
+	bool mapped;
+} hosts = { PTHREAD_MUTEX_INITIALIZER, "", 0, 0, 0, NULL, 0, false };
+
+typedef struct {
+	bool found;				// false caches the fact that the name isn't registered
+	sockaddr_x addr;
+	time_t expires;
+} CacheEntry;
+
+typedef std::tr1::unordered_map<std::string, CacheEntry> NameCache;
+
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static NameCache cache;
+
+static time_t now()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec;
+}
+
+static bool recordLess(const HostsRecord &a, const HostsRecord &b)
+{
+	return strcmp(a.name, b.name) < 0;
+}
+
+static bool recordEqual(const HostsRecord &a, const HostsRecord &b)
+{
+	return strcmp(a.name, b.name) == 0;
+}
+
+static void hostsUnload()
+{
+	if (hosts.table) {
+		if (hosts.mapped)
+			munmap(hosts.table, hosts.len);
+		else
+			free(hosts.table);
+	}
+	hosts.table = NULL;
+	hosts.len = 0;
+	hosts.mapped = false;
+}
+
+// map the compiled table if it was built from the current hosts.xia
+static bool hostsMap(const char *dbpath)
+{
+	struct stat st;
+	int fd = open(dbpath, O_RDONLY);
+
+	if (fd < 0)
+		return false;
+
+	if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(HostsHeader)) {
+		close(fd);
+		return false;
+	}
+
+	void *p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED)
+		return false;
+
+	const HostsHeader *h = (const HostsHeader *)p;
+	if (h->magic != HOSTS_MAGIC || h->mtime != hosts.mtime || h->size != hosts.size
+			|| (size_t)st.st_size != sizeof(HostsHeader) + h->count * sizeof(HostsRecord)) {
+		munmap(p, st.st_size);
+		return false;
+	}
+
+	hosts.table = (char *)p;
+	hosts.len = st.st_size;
+	hosts.mapped = true;
+	return true;
+}
+
+/*
+** Parse hosts.xia into a new table, a name listed more than once keeps its
+** last DAG. Saving it for other processes is best effort.
+*/
+static void hostsCompile(FILE *f, const char *dbpath)
+{
+	std::vector<HostsRecord> records;
+	char line[2048];
+
+	while (fgets(line, sizeof(line), f) != NULL) {
+		HostsRecord r;
+		char *p = line;
+
+		if (*p == '#')
+			continue;
+		p += strcspn(p, " \t\r\n");
+		if (p == line || *p == '\0' || *p == '\r' || *p == '\n' || p - line >= HOSTS_NAME_LEN)
+			continue;
+
+		*p++ = '\0';
+		p += strspn(p, " \t");
+		p[strcspn(p, "\r\n")] = '\0';
+
+		// skip anything that doesn't look like a dag before handing it to the parser
+		if (strncmp(p, "RE ", 3) != 0 && strncmp(p, "DAG ", 4) != 0)
+			continue;
+
+		Graph g(p);
+		if (g.num_nodes() <= 0)
+			continue;
+
+		memset(&r, 0, sizeof(r));
+		strcpy(r.name, line);
+		g.fill_sockaddr(&r.addr);
+		records.push_back(r);
+	}
+
+	// stable, so the last of any duplicates is the one kept
+	std::stable_sort(records.begin(), records.end(), recordLess);
+	std::reverse(records.begin(), records.end());
+	records.erase(std::unique(records.begin(), records.end(), recordEqual), records.end());
+	std::reverse(records.begin(), records.end());
+
+	HostsHeader h;
+	h.magic = HOSTS_MAGIC;
+	h.count = records.size();
+	h.mtime = hosts.mtime;
+	h.size = hosts.size;
+
+	hosts.len = sizeof(h) + records.size() * sizeof(HostsRecord);
+	hosts.table = (char *)malloc(hosts.len);
+	hosts.mapped = false;
+	if (!hosts.table) {
+		hosts.len = 0;
+		return;
+	}
+	memcpy(hosts.table, &h, sizeof(h));
+	if (records.size())
+		memcpy(hosts.table + sizeof(h), &records[0], records.size() * sizeof(HostsRecord));
+
+	// write a private copy and rename it so readers never see half a table
+	char tmp[PATH_SIZE];
+	snprintf(tmp, sizeof(tmp), "%s.%d", dbpath, getpid());
+	int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		return;
+	if (write(fd, hosts.table, hosts.len) != (ssize_t)hosts.len || rename(tmp, dbpath) < 0) {
+		LOGF("unable to save %s", dbpath);
+		unlink(tmp);
+	}
+	close(fd);
+}
+
+// called with hosts.lock held
+static void hostsRefresh()
+{
+	char root[PATH_SIZE];
+	struct stat st;
+
+	XrootDir(root, sizeof(root) - sizeof(ETC_HOSTS_DB));
+	std::string path = std::string(root) + ETC_HOSTS;
+	time_t t = now();
+
+	if (path == hosts.path && t - hosts.checked < HOSTS_CHECK)
+		return;
+	hosts.checked = t;
+
+	if (stat(path.c_str(), &st) < 0) {
+		hostsUnload();
+		hosts.path = path;
+		return;
+	}
+
+	int64_t mtime = st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+	if (path == hosts.path && hosts.table && mtime == hosts.mtime && st.st_size == hosts.size)
+		return;
+
+	hostsUnload();
+	hosts.path = path;
+	hosts.mtime = mtime;
+	hosts.size = st.st_size;
+
+	std::string dbpath = std::string(root) + ETC_HOSTS_DB;
+	if (hostsMap(dbpath.c_str()))
+		return;
+
+	FILE *f = fopen(path.c_str(), "r");
+	if (f) {
+		hostsCompile(f, dbpath.c_str());
+		fclose(f);
+	}
+}
+
+/*!
+** @brief Lookup a DAG in the hosts.xia file
+**
+** @param name The name of an XIA service or host.
+** @param addr filled in with the DAG if name is listed
+**
+** @returns 0 on success
+** @returns -1 if name isn't in hosts.xia
+*/
+int hostsLookup(const char *name, sockaddr_x *addr)
+{
+	int rc = -1;
+
+	pthread_mutex_lock(&hosts.lock);
+	hostsRefresh();
+
+	if (hosts.table) {
+		const HostsHeader *h = (const HostsHeader *)hosts.table;
+		const HostsRecord *first = (const HostsRecord *)(hosts.table + sizeof(HostsHeader));
+		const HostsRecord *last = first + h->count;
+		HostsRecord key;
+
+		strncpy(key.name, name, HOSTS_NAME_LEN - 1);
+		key.name[HOSTS_NAME_LEN - 1] = '\0';
+
+		const HostsRecord *r = std::lower_bound(first, last, key, recordLess);
+		if (r != last && strcmp(r->name, name) == 0) {
+			memcpy(addr, &r->addr, sizeof(sockaddr_x));
+			rc = 0;
+		}
+	}
+
+	pthread_mutex_unlock(&hosts.lock);
+	return rc;
+}
+
+/*!
+** @brief Look for a name the nameserver answered recently
+**
+** @param name The name of an XIA service or host.
+** @param addr filled in with the DAG if the name was found
+**
+** @returns 1 if the nameserver had a DAG for name
+** @returns 0 if the nameserver said name isn't registered
+** @returns -1 if name isn't in the cache or has expired
+*/
+int nameCacheLookup(const char *name, sockaddr_x *addr)
+{
+	int rc = -1;
+
+	pthread_mutex_lock(&cache_lock);
+	NameCache::iterator it = cache.find(name);
+	if (it != cache.end()) {
+		if (it->second.expires <= now()) {
+			cache.erase(it);
+		} else if (it->second.found) {
+			memcpy(addr, &it->second.addr, sizeof(sockaddr_x));
+			rc = 1;
+		} else {
+			rc = 0;
+		}
+	}
+	pthread_mutex_unlock(&cache_lock);
+	return rc;
+}
+
+/*!
+** @brief Remember a nameserver answer for ttl seconds
+**
+** @param name The name that was looked up.
+** @param addr its DAG, or NULL if the nameserver didn't know the name
+** @param ttl how long the nameserver said the answer is good for, 0 if it
+**	didn't say
+*/
+void nameCacheAdd(const char *name, const sockaddr_x *addr, unsigned ttl)
+{
+	time_t t = now();
+
+	if (ttl == 0)
+		ttl = addr ? CACHE_TTL : NS_NEGATIVE_TTL;
+	ttl = MIN(ttl, CACHE_MAX_TTL);
+
+	pthread_mutex_lock(&cache_lock);
+	if (cache.size() >= CACHE_SIZE && cache.find(name) == cache.end()) {
+		// drop what has expired, or everything if nothing has
+		for (NameCache::iterator it = cache.begin(); it != cache.end(); ) {
+			if (it->second.expires <= t)
+				cache.erase(it++);
+			else
+				++it;
+		}
+		if (cache.size() >= CACHE_SIZE)
+			cache.clear();
+	}
+
+	CacheEntry &e = cache[name];
+	e.found = addr != NULL;
+	if (addr)
+		memcpy(&e.addr, addr, sizeof(sockaddr_x));
+	e.expires = t + ttl;
+	pthread_mutex_unlock(&cache_lock);
+}
+
+/*!
+** @brief Forget a name, called when this process registers it
+*/
+void nameCacheRemove(const char *name)
+{
+	pthread_mutex_lock(&cache_lock);
+	cache.erase(name);
+	pthread_mutex_unlock(&cache_lock);
+}
@@ -0,0 +1,614 @@
+/* ts=4 */
+/*
+** Copyright 2016 Carnegie Mellon University
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**    http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/*!
+** @file Xring.c
+** @brief implements Xring_create(), Xring_destroy(), Xring_fd(),
+** Xring_submit() and Xring_reap()
+*/
+#include <errno.h>
+#include <time.h>
+#include <map>
+#include <deque>
+#include "Xsocket.h"
+#include "Xinit.h"
+#include "Xutil.h"
+#include "dagaddr.hpp"
+
+// largest message of completions click will send us
+#define RING_REPLY_SIZE 65536
+
+// how long Xring_destroy waits for click to drop the ring's ops, in ms
+#define RING_CANCEL_WAIT 1000
+
+// an operation that has been sent to click and not completed yet
+typedef struct {
+	XringSqe sqe;
+	int new_sockfd;			// socket created for an accept
+} XringOp;
+
+struct Xring {
+	int sockfd;				// API socket used to talk to click
+	unsigned depth;			// max # of operations in flight
+	std::map<unsigned, XringOp> pending;	// in flight operations, by sequence #
+	std::deque<XringCqe> ready;				// completions not reaped yet
+};
+
+
+
+// current time in milliseconds, for working out how long is left to wait
+static long long _ringNow()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+
+
+static void _ringComplete(Xring *ring, const XringSqe *sqe, int res)
+{
+	XringCqe cqe;
+
+	cqe.user_data = sqe->user_data;
+	cqe.res = res;
+	ring->ready.push_back(cqe);
+}
+
+
+
+// fill in the click request for a single submission entry
+static int _ringPrepare(Xring *ring, const XringSqe *sqe, xia::XSocketMsg *op, XringOp *rop)
+{
+	UNUSED(ring);
+	int stype = getSocketType(sqe->sockfd);
+
+	rop->sqe = *sqe;
+	rop->new_sockfd = -1;
+
+	switch (sqe->op) {
+		case XRING_OP_CONNECT:
+			if (stype != XSOCK_STREAM) {
+				errno = EOPNOTSUPP;
+				return -1;
+			}
+			if (!sqe->addr) {
+				errno = EINVAL;
+				return -1;
+			}
+			if (_connStreamMsg(sqe->sockfd, sqe->addr, op) < 0)
+				return -1;
+
+			setConnState(sqe->sockfd, CONNECTING);
+			break;
+
+		case XRING_OP_ACCEPT:
+			if (stype != XSOCK_STREAM) {
+				errno = EOPNOTSUPP;
+				return -1;
+			}
+			if ((rop->new_sockfd = MakeApiSocket(SOCK_STREAM)) < 0)
+				return -1;
+
+			op->set_type(xia::XACCEPT);
+			op->mutable_x_accept()->set_new_port(getPort(rop->new_sockfd));
+			break;
+
+		case XRING_OP_SEND:
+			if (stype != XSOCK_STREAM || getConnState(sqe->sockfd) != CONNECTED) {
+				errno = ENOTCONN;
+				return -1;
+			}
+			if (!sqe->buf) {
+				errno = EFAULT;
+				return -1;
+			}
+
+			rop->sqe.len = MIN(sqe->len, XIA_MAXBUF);
+			op->set_type(xia::XSEND);
+			op->mutable_x_send()->set_payload(sqe->buf, rop->sqe.len);
+			break;
+
+		case XRING_OP_RECV:
+			if (!sqe->buf) {
+				errno = EFAULT;
+				return -1;
+			}
+
+			if (stype == XSOCK_STREAM) {
+				if (getConnState(sqe->sockfd) != CONNECTED) {
+					errno = ENOTCONN;
+					return -1;
+				}
+				op->set_type(xia::XRECV);
+				op->mutable_x_recv()->set_bytes_requested(sqe->len);
+				op->mutable_x_recv()->set_flags(sqe->flags);
+
+			} else if (stype == XSOCK_DGRAM) {
+				op->set_type(xia::XRECVFROM);
+				op->mutable_x_recvfrom()->set_bytes_requested(sqe->len);
+				op->mutable_x_recvfrom()->set_flags(sqe->flags);
+
+			} else {
+				errno = EOPNOTSUPP;
+				return -1;
+			}
+			break;
+
+		case XRING_OP_REQUESTCHUNK:
+			if (stype != XSOCK_CHUNK) {
+				errno = EAFNOSUPPORT;
+				return -1;
+			}
+			if (!sqe->buf) {
+				errno = EFAULT;
+				return -1;
+			}
+
+			op->set_type(xia::XREQUESTCHUNK);
+			op->mutable_x_requestchunk()->add_dag((const char *)sqe->buf, strnlen((const char *)sqe->buf, sqe->len));
+			op->mutable_x_requestchunk()->set_payload("Chunk request");
+			break;
+
+		default:
+			errno = EINVAL;
+			return -1;
+	}
+
+	// everything in a ring waits for its result, the ring itself never blocks
+	op->set_blocking(true);
+	op->set_port(getPort(sqe->sockfd));
+	return 0;
+}
+
+
+
+// turn a result from click into a completion entry
+static void _ringResult(Xring *ring, const xia::XSocketMsg &msg)
+{
+	std::map<unsigned, XringOp>::iterator it = ring->pending.find(msg.sequence());
+
+	if (it == ring->pending.end()) {
+		LOGF("No ring operation with sequence %d", msg.sequence());
+		return;
+	}
+
+	XringOp rop = it->second;
+	XringSqe *sqe = &rop.sqe;
+	ring->pending.erase(it);
+
+	int rc = msg.x_result().return_code();
+	int res = (rc < 0 ? -msg.x_result().err_code() : rc);
+
+	switch (sqe->op) {
+		case XRING_OP_CONNECT:
+			if (rc < 0 || msg.x_connect().status() != xia::X_Connect_Msg::XCONNECTED) {
+				setConnState(sqe->sockfd, UNCONNECTED);
+				res = (rc < 0 ? res : -ECONNREFUSED);
+			} else {
+				setConnState(sqe->sockfd, CONNECTED);
+				res = 0;
+			}
+			break;
+
+		case XRING_OP_ACCEPT:
+			if (rc < 0) {
+				freeSocketState(rop.new_sockfd);
+				(_f_close)(rop.new_sockfd);
+				break;
+			}
+
+			if (sqe->addr && sqe->addrlen >= sizeof(sockaddr_x)) {
+				Graph g(msg.x_accept().remote_dag().c_str());
+				g.fill_sockaddr((sockaddr_x *)sqe->addr);
+			}
+
+			setConnState(rop.new_sockfd, CONNECTED);
+			res = rop.new_sockfd;
+			break;
+
+		case XRING_OP_SEND:
+			if (rc >= 0)
+				res = sqe->len;
+			break;
+
+		case XRING_OP_RECV:
+			if (rc < 0)
+				break;
+
+			if (msg.type() == xia::XRECVFROM) {
+				const xia::X_Recvfrom_Msg &xrm = msg.x_recvfrom();
+
+				res = MIN((size_t)xrm.bytes_returned(), sqe->len);
+				memcpy(sqe->buf, xrm.payload().data(), res);
+
+				if (sqe->addr && sqe->addrlen >= sizeof(sockaddr_x)) {
+					Graph g(xrm.sender_dag().c_str());
+					g.fill_sockaddr((sockaddr_x *)sqe->addr);
+				}
+
+			} else {
+				res = MIN((size_t)rc, sqe->len);
+				memcpy(sqe->buf, msg.x_recv().payload().data(), res);
+			}
+			break;
+
+		case XRING_OP_REQUESTCHUNK:
+			if (rc >= 0)
+				res = 0;
+			break;
+	}
+
+	_ringComplete(ring, sqe, res);
+}
+
+
+
+// send a batch to click, failing every op in it if that doesn't work
+static void _ringSend(Xring *ring, xia::XSocketMsg *xsm)
+{
+	if (xsm->x_ring().ops_size() == 0)
+		return;
+
+	if (click_send(ring->sockfd, xsm) < 0) {
+		int err = errno;
+		LOGF("Error talking to Click: %s", strerror(err));
+
+		for (int i = 0; i < xsm->x_ring().ops_size(); i++) {
+			std::map<unsigned, XringOp>::iterator it = ring->pending.find(xsm->x_ring().ops(i).sequence());
+
+			if (it->second.new_sockfd >= 0) {
+				freeSocketState(it->second.new_sockfd);
+				(_f_close)(it->second.new_sockfd);
+			}
+			_ringComplete(ring, &it->second.sqe, -err);
+			ring->pending.erase(it);
+		}
+	}
+
+	xsm->mutable_x_ring()->clear_ops();
+}
+
+
+
+// read and process every completion message click has queued for us
+static int _ringDrain(Xring *ring, char *buf)
+{
+	int count = 0;
+	int rc;
+
+	while ((rc = (_f_recvfrom)(ring->sockfd, buf, RING_REPLY_SIZE, MSG_DONTWAIT, NULL, NULL)) > 0) {
+		xia::XSocketMsg xsm;
+
+		if (!xsm.ParseFromArray(buf, rc) || xsm.type() != xia::XRING) {
+			LOG("Ignoring unexpected message on ring socket");
+			continue;
+		}
+
+		for (int i = 0; i < xsm.x_ring().ops_size(); i++) {
+			_ringResult(ring, xsm.x_ring().ops(i));
+			count++;
+		}
+	}
+
+	if (rc < 0 && !WOULDBLOCK())
+		return -1;
+
+	return count;
+}
+
+
+
+// have click drop the ops still waiting on their sockets, so nothing is
+// completed to the ring after it's gone and the sockets take new receives
+static void _ringCancel(Xring *ring)
+{
+	xia::XSocketMsg xsm;
+	unsigned seq = seqNo(ring->sockfd);
+
+	xsm.set_type(xia::XRING);
+	xsm.set_sequence(seq);
+	xsm.mutable_x_ring()->set_cancel(true);
+
+	if (click_send(ring->sockfd, &xsm) < 0) {
+		LOGF("Error talking to Click: %s", strerror(errno));
+		return;
+	}
+
+	char *buf = (char *)malloc(RING_REPLY_SIZE);
+	long long deadline = _ringNow() + RING_CANCEL_WAIT;
+	bool cancelled = false;
+
+	while (!cancelled) {
+		struct pollfd pfd;
+		long long left = deadline - _ringNow();
+
+		pfd.fd = ring->sockfd;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+
+		if (left <= 0 || (_f_poll)(&pfd, 1, (int)left) <= 0) {
+			LOG("Click did not answer the ring cancel");
+			break;
+		}
+
+		int rc = (_f_recvfrom)(ring->sockfd, buf, RING_REPLY_SIZE, MSG_DONTWAIT, NULL, NULL);
+		if (rc < 0 && !WOULDBLOCK())
+			break;
+
+		xia::XSocketMsg reply;
+		if (rc <= 0 || !reply.ParseFromArray(buf, rc) || reply.type() != xia::XRING)
+			continue;
+
+		cancelled = ((unsigned)reply.sequence() == seq);
+
+		// ops that finished before the cancel got there
+		for (int i = 0; i < reply.x_ring().ops_size(); i++) {
+			const xia::XSocketMsg &op = reply.x_ring().ops(i);
+			std::map<unsigned, XringOp>::iterator it = ring->pending.find(op.sequence());
+
+			if (it == ring->pending.end())
+				continue;
+
+			if (it->second.new_sockfd >= 0 && op.x_result().return_code() >= 0) {
+				// nobody will reap the connection, so hang up
+				Xclose(it->second.new_sockfd);
+				it->second.new_sockfd = -1;
+			}
+			ring->pending.erase(it);
+		}
+	}
+
+	free(buf);
+}
+
+
+
+/*!
+** @brief Create a submission/completion ring
+**
+** A ring lets an application hand a batch of connect, accept, send, recv,
+** and chunk request operations to the transport in a single message with
+** Xring_submit(), and collect the results later with Xring_reap(). Operations
+** that can't finish right away (an accept with no pending connections, or a
+** receive with no data) are held by the transport and complete when they are
+** satisfied, so a single thread can keep many sockets busy without blocking
+** on any one of them.
+**
+** @param depth the maximum number of operations that can be in flight at once
+**
+** @returns a pointer to the new ring on success
+** @returns NULL on failure with errno set
+*/
+Xring *Xring_create(unsigned depth)
+{
+	if (depth == 0) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	// the ring socket isn't an Xsocket, so Xpoll treats it like a normal fd
+	int sockfd = MakeApiSocket(XSOCK_INVALID);
+	if (sockfd < 0) {
+		LOGF("Error creating ring socket: %s", strerror(errno));
+		return NULL;
+	}
+
+	Xring *ring = new Xring;
+	ring->sockfd = sockfd;
+	ring->depth = depth;
+
+	return ring;
+}
+
+
+
+/*!
+** @brief Destroy a submission/completion ring
+**
+** Operations still in flight are cancelled in the transport and never
+** complete, and any sockets created for accepts that have not completed
+** are closed. A receive the ring was waiting on no longer holds its socket,
+** so the socket can be read again right away. A connect carries on as if it
+** were non-blocking; Xpoll() or XOPT_ERROR tell how it went. Otherwise the
+** sockets the operations were submitted on are not affected.
+**
+** @param ring the ring to destroy
+**
+** @returns 0 on success
+** @returns -1 on failure with errno set
+*/
+int Xring_destroy(Xring *ring)
+{
+	if (!ring) {
+		errno = EFAULT;
+		return -1;
+	}
+
+	if (!ring->pending.empty())
+		_ringCancel(ring);
+
+	std::map<unsigned, XringOp>::iterator it;
+	for (it = ring->pending.begin(); it != ring->pending.end(); ++it) {
+		if (it->second.new_sockfd >= 0) {
+			freeSocketState(it->second.new_sockfd);
+			(_f_close)(it->second.new_sockfd);
+		}
+	}
+
+	freeSocketState(ring->sockfd);
+	(_f_close)(ring->sockfd);
+	delete ring;
+
+	return 0;
+}
+
+
+
+/*!
+** @brief Get the file descriptor completions arrive on
+**
+** The descriptor becomes readable when completions are waiting, and can be
+** handed to poll, select or an event loop along with the application's other
+** descriptors. It should only be read with Xring_reap().
+**
+** @param ring the ring
+**
+** @returns the ring's file descriptor
+** @returns -1 if ring is invalid
+*/
+int Xring_fd(const Xring *ring)
+{
+	if (!ring) {
+		errno = EFAULT;
+		return -1;
+	}
+
+	return ring->sockfd;
+}
+
+
+
+/*!
+** @brief Submit a batch of operations
+**
+** The operations are packed into as few messages to the transport as will
+** fit and are started in order. Buffers and addresses referenced by an entry
+** must stay valid until its completion has been reaped. Entries that can't
+** be started (invalid socket, socket in the wrong state, click not
+** reachable, etc.) are completed immediately with an error rather than
+** failing the whole batch.
+**
+** @param ring the ring
+** @param sqes array of submission entries
+** @param count number of entries in sqes
+**
+** @returns the number of entries accepted, which is less than count if the
+** ring is full
+** @returns -1 on failure with errno set. EBUSY means the ring is full.
+*/
+int Xring_submit(Xring *ring, const XringSqe *sqes, unsigned count)
+{
+	unsigned submitted = 0;
+	size_t mtu = api_mtu();
+
+	if (!ring || (count > 0 && !sqes)) {
+		errno = EFAULT;
+		return -1;
+	}
+
+	xia::XSocketMsg xsm;
+	xsm.set_type(xia::XRING);
+	xsm.set_sequence(seqNo(ring->sockfd));
+
+	for (; submitted < count; submitted++) {
+		const XringSqe *sqe = &sqes[submitted];
+		XringOp rop;
+
+		if (ring->pending.size() + ring->ready.size() >= ring->depth)
+			break;
+
+		xia::XSocketMsg op;
+		unsigned seq = seqNo(ring->sockfd);
+		op.set_sequence(seq);
+
+		if (_ringPrepare(ring, sqe, &op, &rop) < 0) {
+			_ringComplete(ring, sqe, -errno);
+			continue;
+		}
+
+		// don't let a batch grow past what click can read in one go
+		if ((size_t)(xsm.ByteSizeLong() + op.ByteSizeLong()) > mtu)
+			_ringSend(ring, &xsm);
+
+		ring->pending[seq] = rop;
+		xsm.mutable_x_ring()->add_ops()->Swap(&op);
+	}
+
+	_ringSend(ring, &xsm);
+
+	if (submitted == 0 && count > 0) {
+		errno = EBUSY;
+		return -1;
+	}
+
+	return submitted;
+}
+
+
+
+/*!
+** @brief Collect completed operations
+**
+** Waits up to timeout milliseconds for at least one operation to complete
+** and returns as many completions as are available, up to count.
+**
+** @param ring the ring
+** @param cqes array to receive the completions
+** @param count number of entries in cqes
+** @param timeout milliseconds to wait, 0 to return immediately, or -1 to
+** wait until something completes
+**
+** @returns the number of completions stored in cqes, 0 if the timeout expired
+** @returns -1 on failure with errno set
+*/
+int Xring_reap(Xring *ring, XringCqe *cqes, unsigned count, int timeout)
+{
+	if (!ring || !cqes) {
+		errno = EFAULT;
+		return -1;
+	}
+
+	if (ring->ready.size() < count) {
+		char *buf = (char *)malloc(RING_REPLY_SIZE);
+		int rc = _ringDrain(ring, buf);
+		long long deadline = timeout > 0 ? _ringNow() + timeout : 0;
+		int wait = timeout;
+
+		while (rc >= 0 && ring->ready.empty() && !ring->pending.empty()) {
+			struct pollfd pfd;
+
+			pfd.fd = ring->sockfd;
+			pfd.events = POLLIN;
+			pfd.revents = 0;
+
+			// replies that complete nothing mustn't restart the timeout
+			if (timeout > 0) {
+				long long left = deadline - _ringNow();
+				wait = left > 0 ? (int)left : 0;
+			}
+
+			if ((rc = (_f_poll)(&pfd, 1, wait)) <= 0)
+				break;
+
+			rc = _ringDrain(ring, buf);
+		}
+
+		free(buf);
+
+		if (rc < 0 && ring->ready.empty())
+			return -1;
+	}
+
+	unsigned n = 0;
+	while (n < count && !ring->ready.empty()) {
+		cqes[n++] = ring->ready.front();
+		ring->ready.pop_front();
+	}
+
+	return n;
+}
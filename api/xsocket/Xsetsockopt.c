@@ -122,6 +122,14 @@ int ssoGetParam(int param, void *optval, socklen_t *optlen)
 **	\n XOPT_HLIM	Sets the 'hop limit' (hlim) element of the XIA header to the
 **		specified integer value. (Default is 250)
 **	\n XOPT_NEXT_PROTO Sets the next proto field in the XIA header
+**	\n XOPT_ROUTE_EVENTS Has click send the raw socket a message for each
+**		batch of changes to the local route tables. The value is a mask of
+**		the CLICK_XIA_ROUTE_EVENT_* kinds in clicknetxia.h, 0 turns it off.
+**	\n SO_RCVLOWAT	Minimum number of bytes a blocking Xrecv waits for on a
+**		stream socket before returning. (Default is 1)
+**	\n SO_REUSEPORT	Lets datagram sockets bind to the same DAG. Must be set on
+**		each of them before Xbind, incoming datagrams are spread across them.
+**		Fails with ENOPROTOOPT if click runs a sharded transport.
 **
 ** @param sockfd	The control socket
 ** @param optname	The socket option to set
@@ -189,6 +197,18 @@ int Xsetsockopt(int sockfd, int optname, const void *optval, socklen_t optlen)
 			break;
 		}
 
+		case XOPT_ROUTE_EVENTS:
+			if (ssoCheckSize(&optlen, sizeof(int)) < 0) {
+				rc = -1;
+			} else if (getSocketType(sockfd) != SOCK_RAW) {
+				LOG("XOPT_ROUTE_EVENTS is only supported on raw sockets");
+				errno = ENOPROTOOPT;
+				rc = -1;
+			} else {
+				rc = ssoPutInt(sockfd, optname, (const int *)optval, optlen);
+			}
+			break;
+
 		// firefox wants to set this for some reason???
 		case SO_ERROR:
 			if (ssoCheckSize(&optlen, sizeof(int)) < 0) {
@@ -237,6 +257,30 @@ int Xsetsockopt(int sockfd, int optname, const void *optval, socklen_t optlen)
 			break;
 
 		case SO_RCVLOWAT:
+			if (ssoCheckSize(&optlen, sizeof(int)) < 0) {
+				rc = -1;
+			} else if (*(const int *)optval < 0) {
+				LOGF("SO_RCVLOWAT (%d) out of range", *(const int *)optval);
+				errno = EINVAL;
+				rc = -1;
+			} else {
+				// click holds blocking stream receives until this much data is ready
+				rc = ssoPutInt(sockfd, optname, (const int *)optval, optlen);
+			}
+			break;
+
+		case SO_REUSEPORT:
+			if (ssoCheckSize(&optlen, sizeof(int)) < 0) {
+				rc = -1;
+			} else if (getSocketType(sockfd) != SOCK_DGRAM) {
+				LOG("SO_REUSEPORT is only supported on datagram sockets");
+				errno = ENOPROTOOPT;
+				rc = -1;
+			} else {
+				rc = ssoPutInt(sockfd, optname, (const int *)optval, optlen);
+			}
+			break;
+
 		case SO_SNDLOWAT:
 			// Probably will never need to support this
 			// return the default linux value of 1
@@ -305,7 +349,10 @@ int Xsetsockopt(int sockfd, int optname, const void *optval, socklen_t optlen)
 ** Supported Options:
 **	\n XOPT_HLIM	Retrieves the 'hop limit' element of the XIA header as an integer value
 **	\n XOPT_NEXT_PROTO Gets the next proto field in the XIA header
+**	\n XOPT_ROUTE_EVENTS Gets the route changes the socket is sent
 **	\n SO_TYPE 		Returns the type of socket (SOCK_STREAM, etc...)
+**	\n SO_RCVLOWAT	Returns the receive low water mark
+**	\n SO_REUSEPORT	Returns whether the socket can share its DAG
 **
 ** @param sockfd	The control socket
 ** @param optname	The socket option to set (currently must be IP_TTL)
@@ -343,6 +390,7 @@ int Xgetsockopt(int sockfd, int optname, void *optval, socklen_t *optlen)
 		case XOPT_HLIM:
 		case XOPT_NEXT_PROTO:
 		case XOPT_ERROR_PEEK:
+		case XOPT_ROUTE_EVENTS:
 		case SO_ACCEPTCONN:
 		case SO_ERROR:
 			rc = ssoGetInt(sockfd, optname, (int *)optval, optlen);
@@ -398,6 +446,10 @@ int Xgetsockopt(int sockfd, int optname, void *optval, socklen_t *optlen)
 			break;
 
 		case SO_RCVLOWAT:
+		case SO_REUSEPORT:
+			rc = ssoGetInt(sockfd, optname, (int *)optval, optlen);
+			break;
+
 		case SO_SNDLOWAT:
 			// Probably will never need to support this
 			// return the default linux value of 1
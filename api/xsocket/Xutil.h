@@ -80,6 +80,8 @@ int getDebug(int sock);
 void setRecvTimeout(int sock, struct timeval *timeout);
 void getRecvTimeout(int sock, struct timeval *timeout);
 unsigned seqNo(int sock);
+int getFetchState(int sock, unsigned *seq, unsigned *left, unsigned *unacked);
+void setFetchState(int sock, unsigned seq, unsigned left, unsigned unacked);
 void cachePacket(int sock, unsigned seq, char *buf, unsigned buflen);
 int getCachedPacket(int sock, unsigned seq, char *buf, unsigned buflen);
 int connectDgram(int sock, sockaddr_x *addr);
@@ -87,6 +89,7 @@ int MakeApiSocket(int transport_type);
 const sockaddr_x *dgramPeer(int sock);
 
 int _xsendto(int sockfd, const void *buf, size_t len, int flags, const sockaddr_x *addr, socklen_t addrlen);
+int _connStreamMsg(int sockfd, const sockaddr *addr, xia::XSocketMsg *xsm);
 int _xrecvfromconn(int sockfd, void *buf, size_t len, int flags);
 
 size_t _iovSize(const struct iovec *iov, size_t iovcnt);
@@ -96,6 +99,13 @@ int _iovUnpack(const struct iovec *iov, size_t iovcnt, char *buf, size_t len);
 int _xrecvfromconn(int sockfd, void *buf, size_t len, int flags, int *iface);
 int _xrecvfrom(int sockfd, void *rbuf, size_t len, int flags, sockaddr_x *addr, socklen_t *addrlen, int *iface);
 
+// name lookups answered without the nameserver
+// implementation is in Xresolv.c
+int hostsLookup(const char *name, sockaddr_x *addr);
+int nameCacheLookup(const char *name, sockaddr_x *addr);
+void nameCacheAdd(const char *name, const sockaddr_x *addr, unsigned ttl);
+void nameCacheRemove(const char *name);
+
 
 extern "C" {
 const char *xferFlags(size_t f);
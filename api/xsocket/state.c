@@ -49,7 +49,6 @@ SocketState::~SocketState()
 	if (m_temp_sid)
 		delete(m_temp_sid);
 	m_packets.clear();
-	pthread_mutex_destroy(&m_sequence_lock);
 }
 
 void SocketState::init()
@@ -66,7 +65,9 @@ void SocketState::init()
 	m_timeout.tv_sec = 0;
 	m_timeout.tv_usec = 0;
 	m_port = 0;
-	pthread_mutex_init(&m_sequence_lock, NULL);
+	m_fetch_seq = 0;
+	m_fetch_left = 0;
+	m_fetch_unacked = 0;
 }
 
 void SocketState::setTempSID(const char *sid)
@@ -110,11 +111,7 @@ void SocketState::insertPacket(unsigned seq, char *buf, unsigned buflen)
 
 unsigned SocketState::seqNo()
 {
-	pthread_mutex_lock(&m_sequence_lock);
-	unsigned seq = m_sequence++;
-	pthread_mutex_unlock(&m_sequence_lock);
-
-	return seq;
+	return __atomic_fetch_add(&m_sequence, 1, __ATOMIC_RELAXED);
 }
 
 
@@ -123,12 +120,29 @@ unsigned SocketState::seqNo()
 
 SocketMap::SocketMap()
 {
-	pthread_rwlock_init(&rwlock, NULL);
+	struct rlimit rl;
+
+	// size the table to the largest fd this process could ever be handed
+	m_size = MAX_SOCKET_TABLE;
+	if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_max != RLIM_INFINITY &&
+			rl.rlim_max < (rlim_t)MAX_SOCKET_TABLE) {
+		m_size = rl.rlim_max;
+	}
+
+	m_limit = 0;
+	m_sockets = (SocketState **)calloc(m_size, sizeof(SocketState *));
+	if (!m_sockets) {
+		LOG("unable to allocate the socket state table");
+		m_size = 0;
+	}
 }
 
 SocketMap::~SocketMap()
 {
-	pthread_rwlock_destroy(&rwlock);
+	for (int i = 0; i < m_limit; i++) {
+		delete m_sockets[i];
+	}
+	free(m_sockets);
 }
 
 SocketMap *SocketMap::instance = (SocketMap *)0;
@@ -136,56 +150,63 @@ SocketMap *SocketMap::instance = (SocketMap *)0;
 SocketMap *SocketMap::getMap()
 {
 	static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+	SocketMap *map = __atomic_load_n(&instance, __ATOMIC_ACQUIRE);
 
-	if (!instance) {
+	if (!map) {
 
 		pthread_mutex_lock(&lock);
 
-		if (!instance)
-			instance = new SocketMap();
+		map = instance;
+		if (!map) {
+			map = new SocketMap();
+			__atomic_store_n(&instance, map, __ATOMIC_RELEASE);
+		}
 
 		pthread_mutex_unlock(&lock);
 	}
-	return instance;
+	return map;
 }
 
 void SocketMap::add(int sock, int tt, unsigned short port)
 {
-	pthread_rwlock_wrlock(&rwlock);
-	SocketMap *state = getMap();
+	if (sock < 0 || sock >= m_size) {
+		LOGF("socket %d is outside of the state table (size %d)", sock, m_size);
+		return;
+	}
 
-	if (state->sockets.count(sock) == 0) {
-		state->sockets[sock] = new SocketState(tt, port);
+	// if the fd already has state, keep it
+	if (get(sock) != NULL) {
+		return;
 	}
-	pthread_rwlock_unlock(&rwlock);
-}
 
-void SocketMap::remove(int sock)
-{
-	SocketMap *state = getMap();
+	SocketState *expected = NULL;
+	SocketState *sstate = new SocketState(tt, port);
+
+	if (!__atomic_compare_exchange_n(&m_sockets[sock], &expected, sstate,
+			false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+		// lost a race with another thread adding the same fd
+		delete sstate;
+		return;
+	}
 
-	pthread_rwlock_wrlock(&rwlock);
-	delete state->sockets[sock];
-	state->sockets.erase(sock);
-	pthread_rwlock_unlock(&rwlock);
+	// bump the iteration limit if this is the highest fd seen so far
+	int limit = __atomic_load_n(&m_limit, __ATOMIC_RELAXED);
+	while (sock >= limit) {
+		if (__atomic_compare_exchange_n(&m_limit, &limit, sock + 1,
+				true, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+			break;
+		}
+	}
 }
 
-SocketState *SocketMap::get(int sock)
+void SocketMap::remove(int sock)
 {
-	// because a socket will only be acted on by one thread at a time,
-	// we don't need to be more protective of the stat structure
-
-	pthread_rwlock_rdlock(&rwlock);
-
-	SocketState *p = NULL;
-	SocketMap *s = SocketMap::getMap();
-
-	if (s->sockets.count(sock) > 0) {
-		p = s->sockets[sock];
+	if (sock < 0 || sock >= m_size) {
+		return;
 	}
 
-	pthread_rwlock_unlock(&rwlock);
-	return p;
+	SocketState *sstate = __atomic_exchange_n(&m_sockets[sock], (SocketState *)NULL, __ATOMIC_ACQ_REL);
+	delete sstate;
 }
 
 int SocketState::setPeer(const sockaddr_x *peer)
@@ -375,9 +396,26 @@ unsigned short getPort(int sock)
 		return 0;
 }
 
+int getFetchState(int sock, unsigned *seq, unsigned *left, unsigned *unacked)
+{
+	SocketState *sstate = SocketMap::getMap()->get(sock);
+	if (sstate) {
+		sstate->getFetch(seq, left, unacked);
+		return 0;
+	}
+	*seq = *left = *unacked = 0;
+	return -1;
+}
+
+void setFetchState(int sock, unsigned seq, unsigned left, unsigned unacked)
+{
+	SocketState *sstate = SocketMap::getMap()->get(sock);
+	if (sstate)
+		sstate->setFetch(seq, left, unacked);
+}
+
 void cachePacket(int sock, unsigned seq, char *buf, unsigned buflen)
 {
-printf("adding cached packet\n");
 	SocketState *sstate = SocketMap::getMap()->get(sock);
 	if (sstate) {
 		sstate->insertPacket(seq, buf, buflen);
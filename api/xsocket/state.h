@@ -21,6 +21,7 @@
 #include <map>
 #include <string>
 #include <pthread.h>
+#include <sys/resource.h>
 #include <string.h>
 #include <assert.h>
 #include "Xsocket.h"
@@ -72,6 +73,10 @@ public:
 	void setTempSID(const char *sid);
 	const char *getTempSID() {return m_temp_sid;};
 
+	// XfetchChunks() in progress on a chunk socket
+	void getFetch(unsigned *seq, unsigned *left, unsigned *unacked) { *seq = m_fetch_seq; *left = m_fetch_left; *unacked = m_fetch_unacked; };
+	void setFetch(unsigned seq, unsigned left, unsigned unacked) { m_fetch_seq = seq; m_fetch_left = left; m_fetch_unacked = unacked; };
+
 	void init();
 private:
 	int m_transportType;
@@ -82,16 +87,24 @@ private:
 	sockaddr_x *m_peer;
 	char *m_temp_sid;
 	int m_sid_assigned;
-	unsigned m_sequence;
+	unsigned m_sequence;	// updated atomically, see seqNo()
 	unsigned short m_port;
 	struct timeval m_timeout;
-	pthread_mutex_t m_sequence_lock;
 	map<unsigned, string> m_packets;
+	unsigned m_fetch_seq;		// sequence # the fetched chunks come back with, 0 if none
+	unsigned m_fetch_left;		// chunks not read yet
+	unsigned m_fetch_unacked;	// chunks read since credit was last granted
 };
 
-typedef map<int, SocketState *> SMap;
-
+// upper bound on the size of the fd indexed state table
+#define MAX_SOCKET_TABLE (1 << 20)
 
+/*
+** Socket state is kept in an array indexed by the socket's fd. Entries are
+** published and retired with atomic pointer swaps so that the accessors in
+** state.c never need to take a lock. A socket is only acted on by one thread
+** at a time, so a reader never races with the removal of its own socket.
+*/
 class SocketMap
 {
 public:
@@ -101,16 +114,21 @@ public:
 
 	void add(int sock, int tt, unsigned short port);
 	void remove(int sock);
-	SocketState *get(int sock);
-	void lock(void) { pthread_rwlock_rdlock(&rwlock); };
-	void unlock(void) { pthread_rwlock_unlock(&rwlock); };
-	SMap *smap(void) { return &sockets; };
+	SocketState *get(int sock) {
+		if (sock < 0 || sock >= m_size)
+			return NULL;
+		return __atomic_load_n(&m_sockets[sock], __ATOMIC_ACQUIRE);
+	};
+
+	// one past the highest fd that has ever been added, used for iteration
+	int limit(void) { return __atomic_load_n(&m_limit, __ATOMIC_ACQUIRE); };
 
 private:
 	SocketMap();
 
-	SMap sockets;
-	pthread_rwlock_t rwlock;
+	SocketState **m_sockets;
+	int m_size;
+	int m_limit;
 
 	static SocketMap *instance;
 };
@@ -0,0 +1,172 @@
+/*
+** Tests the hosts.xia table and the name cache XgetDAGbyName() uses, and
+** the TTL nameserver answers carry. Xresolv.c is included so the test can
+** age the cache and the hosts.xia check without waiting. hosts.xia is
+** written to a scratch XIADIR.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "../Xresolv.c"
+
+#define DAG1 "RE AD:1000000000000000000000000000000000000000 HID:7e66283480d4b0ce964cb4df678bf8459bd73399"
+#define DAG2 "RE AD:2000000000000000000000000000000000000000 HID:7e66283480d4b0ce964cb4df678bf8459bd73399"
+#define DAG3 "RE AD:3000000000000000000000000000000000000000 HID:7e66283480d4b0ce964cb4df678bf8459bd73399"
+
+#define BIG_HOSTS 10000
+#define LOOKUPS 100000
+
+static int test = 0;
+static char hostsPath[PATH_SIZE];
+
+static void check(const char *name, bool passed)
+{
+	printf("%s Test %d: %s\n", name, test++, passed ? "PASS" : "FAIL");
+	if (!passed)
+		exit(-1);
+}
+
+static double usec()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void writeHosts(const char *mode, const char *lines)
+{
+	FILE *f = fopen(hostsPath, mode);
+
+	fputs(lines, f);
+	fclose(f);
+}
+
+static bool lookup(const char *name, const char *dag)
+{
+	sockaddr_x sa;
+
+	if (hostsLookup(name, &sa) != 0)
+		return false;
+	return dag == NULL || Graph(&sa).dag_string() == Graph(dag).dag_string();
+}
+
+// makes the next lookup behave as if it were in a new process
+static void forget()
+{
+	hostsUnload();
+	hosts.path = "";
+}
+
+int main()
+{
+	char dir[] = "/tmp/resolv_testXXXXXX";
+	char path[PATH_SIZE];
+
+	if (!mkdtemp(dir)) {
+		perror("mkdtemp");
+		exit(-1);
+	}
+	setenv("XIADIR", dir, 1);
+	snprintf(path, sizeof(path), "%s/etc", dir);
+	mkdir(path, 0755);
+	snprintf(hostsPath, sizeof(hostsPath), "%s%s", dir, ETC_HOSTS);
+
+	// hosts.xia
+	writeHosts("w", "# a comment\n"
+		"host1 " DAG1 "\n"
+		"host2\t" DAG2 "\r\n"
+		"junk notadag\n"
+		"host1 " DAG3 "\n");
+	check("Hosts", lookup("host2", DAG2));
+	check("Hosts", lookup("host1", DAG3));		// the last of a duplicate wins
+	check("Hosts", !lookup("host", NULL));
+	check("Hosts", !lookup("junk", NULL));
+	check("Hosts", !hosts.mapped);
+
+	snprintf(path, sizeof(path), "%s%s", dir, ETC_HOSTS_DB);
+	check("Hosts", access(path, R_OK) == 0);
+	forget();
+	check("Hosts", lookup("host2", DAG2) && hosts.mapped);
+
+	// an edit is noticed once the check interval is up
+	writeHosts("a", "host4 " DAG1 "\n");
+	check("Hosts", !lookup("host4", NULL));
+	hosts.checked -= HOSTS_CHECK + 1;
+	check("Hosts", lookup("host4", DAG1) && !hosts.mapped);
+
+	// a big hosts.xia
+	FILE *f = fopen(hostsPath, "w");
+	for (int i = 0; i < BIG_HOSTS; i++)
+		fprintf(f, "h%d RE AD:%040x HID:%040x\n", i, i % 50, i);
+	fclose(f);
+	hosts.checked -= HOSTS_CHECK + 1;
+	double t0 = usec();
+	check("Hosts", lookup("h5", NULL));
+	double t1 = usec();
+	forget();
+	check("Hosts", lookup("h5", NULL) && hosts.mapped);
+	double t2 = usec();
+	sockaddr_x sa, out;
+	for (int i = 0; i < LOOKUPS; i++)
+		hostsLookup("h9999", &sa);
+	double t3 = usec();
+	printf("%d hosts: compile %.1f ms, map %.3f ms, lookup %.2f us\n",
+		BIG_HOSTS, (t1 - t0) / 1e3, (t2 - t1) / 1e3, (t3 - t2) / LOOKUPS);
+
+	// name cache
+	Graph(DAG1).fill_sockaddr(&sa);
+
+	check("Cache", nameCacheLookup("a", &out) == -1);
+	nameCacheAdd("a", &sa, 2);
+	nameCacheAdd("b", NULL, 0);
+	check("Cache", nameCacheLookup("a", &out) == 1 && memcmp(&out, &sa, sizeof(sa)) == 0);
+	check("Cache", nameCacheLookup("b", &out) == 0);
+	check("Cache", cache["b"].expires - now() == NS_NEGATIVE_TTL);
+	cache["a"].expires -= 3;
+	check("Cache", nameCacheLookup("a", &out) == -1);
+	nameCacheAdd("c", &sa, 100);
+	nameCacheRemove("c");
+	check("Cache", nameCacheLookup("c", &out) == -1);
+	nameCacheAdd("d", &sa, 0);
+	check("Cache", cache["d"].expires - now() == CACHE_TTL);
+	nameCacheAdd("e", &sa, CACHE_MAX_TTL * 2);
+	check("Cache", cache["e"].expires - now() == CACHE_MAX_TTL);
+	for (int i = 0; i < CACHE_SIZE * 3; i++) {
+		char name[32];
+		snprintf(name, sizeof(name), "n%d", i);
+		nameCacheAdd(name, &sa, 100);
+	}
+	check("Cache", cache.size() <= CACHE_SIZE);
+
+	// TTLs on the wire
+	char pkt[NS_MAX_PACKET_SIZE];
+	ns_pkt p, r;
+	int len;
+
+	memset(&p, 0, sizeof(p));
+	p.type = NS_TYPE_RESPONSE_QUERY;
+	p.dag = DAG1;
+	p.ttl = 77;
+	len = make_ns_packet(&p, pkt, sizeof(pkt));
+	get_ns_packet(pkt, len, &r);
+	check("TTL", r.ttl == 77 && strcmp(r.dag, DAG1) == 0);
+
+	p.ttl = 0;
+	len = make_ns_packet(&p, pkt, sizeof(pkt));
+	get_ns_packet(pkt, len, &r);
+	check("TTL", r.ttl == 0);
+
+	p.type = NS_TYPE_RESPONSE_ERROR;
+	p.ttl = 5;
+	len = make_ns_packet(&p, pkt, sizeof(pkt));
+	get_ns_packet(pkt, len, &r);
+	check("TTL", r.type == NS_TYPE_RESPONSE_ERROR && r.ttl == 5);
+
+	snprintf(path, sizeof(path), "rm -rf %s", dir);
+	if (system(path) != 0)
+		printf("unable to remove %s\n", dir);
+
+	printf("all tests successful\n");
+	return 0;
+}
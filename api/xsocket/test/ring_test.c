@@ -0,0 +1,241 @@
+/*
+** Tests Xring_submit(), Xring_reap() and Xring_destroy() against a stand-in
+** for click that reads the ring's requests and answers them by hand. Xring.c
+** is included so the test runs the code in this tree.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "../Xring.c"
+
+#define DAG "RE AD:1000000000000000000000000000000000000000 HID:7e66283480d4b0ce964cb4df678bf8459bd73399 SID:0f00000000000000000000000000000000000000"
+
+static int test = 0;
+static int click;
+
+static void check(const char *name, bool passed)
+{
+	printf("%s Test %d: %s\n", name, test++, passed ? "PASS" : "FAIL");
+	if (!passed)
+		exit(-1);
+}
+
+// stand in for click on a port of our own
+static void clickStart()
+{
+	struct sockaddr_in sa;
+	socklen_t len = sizeof(sa);
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_addr.s_addr = inet_addr("127.0.0.1");
+
+	click = socket(AF_INET, SOCK_DGRAM, 0);
+	if (click < 0 || bind(click, (struct sockaddr *)&sa, sizeof(sa)) < 0
+			|| getsockname(click, (struct sockaddr *)&sa, &len) < 0) {
+		perror("click socket");
+		exit(-1);
+	}
+	snprintf(get_conf()->click_port, __PORT_LEN, "%d", ntohs(sa.sin_port));
+}
+
+// the next request sent to click, false if nothing came within timeout ms
+static bool clickGet(xia::XSocketMsg *msg, struct sockaddr_in *from, int timeout)
+{
+	struct pollfd pfd = { click, POLLIN, 0 };
+	socklen_t len = sizeof(*from);
+	char buf[RING_REPLY_SIZE];
+
+	if (poll(&pfd, 1, timeout) <= 0)
+		return false;
+
+	int rc = recvfrom(click, buf, sizeof(buf), 0, (struct sockaddr *)from, &len);
+	return rc > 0 && msg->ParseFromArray(buf, rc);
+}
+
+static void clickPut(xia::XSocketMsg *msg, const struct sockaddr_in *to)
+{
+	std::string buf;
+
+	msg->SerializeToString(&buf);
+	sendto(click, buf.data(), buf.size(), 0, (const struct sockaddr *)to, sizeof(*to));
+}
+
+// complete a single op the way xtransport does once it is satisfied
+static void clickComplete(const xia::XSocketMsg &op, int rc, const char *payload, const struct sockaddr_in *to)
+{
+	xia::XSocketMsg xsm;
+
+	xsm.set_type(xia::XRING);
+	xsm.set_sequence(0);
+
+	xia::XSocketMsg *done = xsm.mutable_x_ring()->add_ops();
+	done->CopyFrom(op);
+	done->mutable_x_result()->set_return_code(rc);
+	done->mutable_x_result()->set_err_code(0);
+	if (payload)
+		done->mutable_x_recv()->set_payload(payload);
+	clickPut(&xsm, to);
+}
+
+static long long msec()
+{
+	return _ringNow();
+}
+
+static void *destroy(void *ring)
+{
+	long rc = Xring_destroy((Xring *)ring);
+	return (void *)rc;
+}
+
+static int streamSocket(int state)
+{
+	int fd = MakeApiSocket(SOCK_STREAM);
+
+	setConnState(fd, state);
+	return fd;
+}
+
+int main()
+{
+	xia::XSocketMsg msg;
+	struct sockaddr_in from;
+	XringSqe sqes[5];
+	XringCqe cqes[4];
+	char data[] = "ping";
+	char buf[4][16];
+	sockaddr_x addr;
+	void *rv;
+	pthread_t t;
+
+	clickStart();
+	Graph(DAG).fill_sockaddr(&addr);
+
+	int sock = streamSocket(CONNECTED);
+	int sock2 = streamSocket(CONNECTED);
+	int listener = streamSocket(UNCONNECTED);
+	int client = streamSocket(UNCONNECTED);
+	setSIDAssigned(client);
+
+	Xring *ring = Xring_create(4);
+	check("Create", ring != NULL && Xring_fd(ring) >= 0);
+	check("Create", Xring_create(0) == NULL && errno == EINVAL);
+
+	// a send and a receive go to click together
+	memset(sqes, 0, sizeof(sqes));
+	sqes[0].op = XRING_OP_SEND;
+	sqes[0].sockfd = sock;
+	sqes[0].buf = data;
+	sqes[0].len = 4;
+	sqes[0].user_data = 1;
+	sqes[1].op = XRING_OP_RECV;
+	sqes[1].sockfd = sock;
+	sqes[1].buf = buf[0];
+	sqes[1].len = sizeof(buf[0]);
+	sqes[1].user_data = 2;
+	check("Submit", Xring_submit(ring, sqes, 2) == 2);
+
+	check("Submit", clickGet(&msg, &from, 1000) && msg.type() == xia::XRING
+		&& msg.x_ring().ops_size() == 2);
+	xia::XSocketMsg send = msg.x_ring().ops(0);
+	xia::XSocketMsg recv = msg.x_ring().ops(1);
+	check("Submit", send.type() == xia::XSEND && send.port() == getPort(sock)
+		&& send.x_send().payload() == "ping");
+	check("Submit", recv.type() == xia::XRECV && recv.port() == getPort(sock)
+		&& recv.x_recv().bytes_requested() == sizeof(buf[0]));
+	check("Submit", from.sin_port == getPort(Xring_fd(ring)));
+
+	// the send completes, the receive waits for data
+	clickComplete(send, 4, NULL, &from);
+	check("Reap", Xring_reap(ring, cqes, 4, 1000) == 1 && cqes[0].user_data == 1 && cqes[0].res == 4);
+
+	long long start = msec();
+	check("Reap", Xring_reap(ring, cqes, 4, 50) == 0 && msec() - start >= 40);
+
+	clickComplete(recv, 4, "pong", &from);
+	check("Reap", Xring_reap(ring, cqes, 4, 1000) == 1 && cqes[0].user_data == 2
+		&& cqes[0].res == 4 && memcmp(buf[0], "pong", 4) == 0);
+
+	// bad entries complete straight away without reaching click
+	sqes[0].op = XRING_OP_SEND;
+	sqes[0].sockfd = listener;
+	sqes[0].user_data = 3;
+	check("Submit", Xring_submit(ring, sqes, 1) == 1 && !clickGet(&msg, &from, 50));
+	check("Reap", Xring_reap(ring, cqes, 4, 0) == 1 && cqes[0].user_data == 3 && cqes[0].res == -ENOTCONN);
+
+	// fill the ring with ops click can't finish yet
+	memset(sqes, 0, sizeof(sqes));
+	sqes[0].op = XRING_OP_RECV;
+	sqes[0].sockfd = sock;
+	sqes[0].buf = buf[0];
+	sqes[0].len = sizeof(buf[0]);
+	sqes[0].user_data = 10;
+	sqes[1].op = XRING_OP_ACCEPT;
+	sqes[1].sockfd = listener;
+	sqes[1].user_data = 11;
+	sqes[2].op = XRING_OP_CONNECT;
+	sqes[2].sockfd = client;
+	sqes[2].addr = (struct sockaddr *)&addr;
+	sqes[2].addrlen = sizeof(addr);
+	sqes[2].user_data = 12;
+	sqes[3].op = XRING_OP_RECV;
+	sqes[3].sockfd = sock2;
+	sqes[3].buf = buf[1];
+	sqes[3].len = sizeof(buf[1]);
+	sqes[3].user_data = 13;
+	sqes[4] = sqes[0];
+	check("Submit", Xring_submit(ring, sqes, 5) == 4);
+	check("Submit", Xring_submit(ring, sqes, 1) == -1 && errno == EBUSY);
+
+	check("Submit", clickGet(&msg, &from, 1000) && msg.x_ring().ops_size() == 4);
+	xia::XSocketMsg recv2 = msg.x_ring().ops(3);
+	unsigned short accepted = msg.x_ring().ops(1).x_accept().new_port();
+	check("Submit", accepted != 0 && getConnState(client) == CONNECTING);
+
+	// destroying it cancels them in click; one finishes before the cancel lands
+	pthread_create(&t, NULL, destroy, ring);
+	check("Destroy", clickGet(&msg, &from, 1000) && msg.type() == xia::XRING
+		&& msg.x_ring().cancel() && msg.x_ring().ops_size() == 0);
+	check("Destroy", from.sin_port == getPort(Xring_fd(ring)));
+	clickComplete(recv2, 2, "hi", &from);
+	msg.clear_x_ring();
+	msg.mutable_x_result()->set_return_code(0);
+	clickPut(&msg, &from);
+	start = msec();
+	pthread_join(t, &rv);
+	check("Destroy", rv == 0 && msec() - start < RING_CANCEL_WAIT / 2);
+
+	// the accept's socket is gone, the connect carries on as non-blocking
+	bool found = false;
+	for (int fd = 0; fd < 1024; fd++)
+		found = found || (getPort(fd) == accepted);
+	check("Destroy", !found);
+	check("Destroy", getConnState(client) == CONNECTING && getConnState(sock) == CONNECTED);
+
+	// nothing pending, nothing to tell click
+	ring = Xring_create(4);
+	check("Destroy", Xring_destroy(ring) == 0 && !clickGet(&msg, &from, 50));
+
+	// click not answering doesn't hang the caller
+	ring = Xring_create(4);
+	sqes[0].user_data = 20;
+	check("Destroy", Xring_submit(ring, sqes, 1) == 1 && clickGet(&msg, &from, 1000));
+	start = msec();
+	check("Destroy", Xring_destroy(ring) == 0);
+	long long waited = msec() - start;
+	check("Destroy", clickGet(&msg, &from, 0) && msg.x_ring().cancel()
+		&& waited >= RING_CANCEL_WAIT - 50 && waited < RING_CANCEL_WAIT * 2);
+
+	check("Destroy", Xring_destroy(NULL) == -1 && errno == EFAULT);
+
+	// nobody would answer the Xclose()s the library sends at exit
+	int fds[] = { sock, sock2, listener, client };
+	for (unsigned i = 0; i < sizeof(fds) / sizeof(fds[0]); i++) {
+		freeSocketState(fds[i]);
+		close(fds[i]);
+	}
+
+	printf("all tests successful\n");
+	return 0;
+}
@@ -0,0 +1,285 @@
+/*
+ * xiadiskstoretest.{cc,hh} -- regression test element for XIADiskStore
+ *
+ * Copyright 2012 Carnegie Mellon University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <click/config.h>
+#include "xiadiskstoretest.hh"
+#include "../xia/xiadiskstore.hh"
+#include <click/confparse.hh>
+#include <click/error.hh>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <algorithm>
+#include <openssl/sha.h>
+CLICK_DECLS
+
+#define CHECK(x) if (!(x)) return errh->error("%s:%d: test %<%s%> failed", __FILE__, __LINE__, #x);
+
+XIADiskStoreTest::XIADiskStoreTest()
+{
+}
+
+XIADiskStoreTest::~XIADiskStoreTest()
+{
+}
+
+int
+XIADiskStoreTest::configure(Vector<String> &conf, ErrorHandler *errh)
+{
+	return cp_va_kparse(conf, this, errh,
+						"DIR", cpkP + cpkM, cpFilename, &_dir,
+						cpEnd);
+}
+
+String
+XIADiskStoreTest::payload(int i, unsigned length)
+{
+	char *buf = new char[length];
+
+	for (unsigned k = 0; k < length; k++)
+		buf[k] = (char)(i * 31 + k);
+	String s(buf, length);
+	delete[] buf;
+	return s;
+}
+
+XID
+XIADiskStoreTest::cid(const String &payload)
+{
+	unsigned char digest[SHA_DIGEST_LENGTH];
+	char hex[SHA_DIGEST_LENGTH * 2 + 1];
+
+	SHA1((const unsigned char *)payload.data(), payload.length(), digest);
+	for (int k = 0; k < SHA_DIGEST_LENGTH; k++)
+		sprintf(&hex[k * 2], "%02x", digest[k]);
+	return XID(String("CID:") + hex);
+}
+
+/* 1 once cid is read back into data, 0 if the read failed, -1 if it never finished */
+int
+XIADiskStoreTest::read_back(XIADiskStore &ds, const XID &cid, String &data)
+{
+	for (int tries = 0; tries < 100; tries++) {
+		XID got;
+		char *buf;
+		unsigned length;
+
+		while (ds.next_read(got, buf, length)) {
+			if (got != cid) {
+				delete[] buf;
+				continue;
+			}
+			int ok = buf != 0;
+			data = ok ? String(buf, length) : String();
+			delete[] buf;
+			return ok;
+		}
+
+		struct pollfd pfd = { ds.notify_fd(), POLLIN, 0 };
+		poll(&pfd, 1, 50);
+	}
+	return -1;
+}
+
+/* the segment files in dir, oldest first */
+void
+XIADiskStoreTest::segments(const String &dir, Vector<String> &paths)
+{
+	DIR *d = opendir(dir.c_str());
+
+	paths.clear();
+	if (!d)
+		return;
+	while (struct dirent *e = readdir(d)) {
+		String name(e->d_name);
+		if (name.length() > 7 && name.substring(-7) == ".chunks")
+			paths.push_back(dir + "/" + name);
+	}
+	closedir(d);
+	std::sort(paths.begin(), paths.end());
+}
+
+off_t
+XIADiskStoreTest::file_size(const String &path)
+{
+	struct stat st;
+
+	return stat(path.c_str(), &st) < 0 ? -1 : st.st_size;
+}
+
+/* put, read back, scan on reopen, trim and corrupt chunks */
+int
+XIADiskStoreTest::test_store(ErrorHandler *errh)
+{
+	String dir = _dir + "/store";
+	XIADiskStore ds;
+	Vector<XID> dropped;
+	String p[4], data;
+	XID c[4];
+
+	for (int i = 0; i < 4; i++) {
+		p[i] = payload(i, 1000 + i * 100);
+		c[i] = cid(p[i]);
+	}
+
+	CHECK(ds.open(dir, 64 << 20, errh) == 0 && ds.is_open());
+	CHECK(ds.count() == 0 && ds.bytes() == 0);
+
+	for (int i = 0; i < 3; i++)
+		CHECK(ds.put(c[i], p[i].data(), p[i].length(), dropped));
+	CHECK(ds.put(c[0], p[0].data(), p[0].length(), dropped));
+	CHECK(ds.count() == 3 && dropped.size() == 0);
+	CHECK(ds.contains(c[2]) && !ds.contains(c[3]));
+
+	// read back, whether or not the writer has got to it yet
+	CHECK(ds.read(c[0]) && read_back(ds, c[0], data) == 1 && data == p[0]);
+	CHECK(!ds.read(c[3]));
+
+	// reopening finds the chunks again by scanning the segment
+	uint64_t bytes = ds.bytes();
+	ds.close();
+	CHECK(!ds.is_open() && ds.count() == 0);
+	CHECK(ds.open(dir, 64 << 20, errh) == 0);
+	CHECK(ds.count() == 3 && ds.bytes() == bytes);
+
+	Vector<XID> cids;
+	ds.cids(cids);
+	CHECK(cids.size() == 3);
+	CHECK(ds.read(c[1]) && read_back(ds, c[1], data) == 1 && data == p[1]);
+	ds.close();
+
+	// a record cut short by a crash is trimmed off
+	Vector<String> paths;
+	segments(dir, paths);
+	CHECK(paths.size() == 1);
+	off_t size = file_size(paths[0]);
+	CHECK(size == (off_t)bytes);
+
+	struct {
+		uint32_t magic;
+		uint32_t length;
+		struct click_xia_xid xid;
+		char data[10];
+	} partial;
+	partial.magic = 0x58434b31;
+	partial.length = 1000;
+	partial.xid = c[3].xid();
+	memset(partial.data, 0, sizeof(partial.data));
+
+	int fd = open(paths[0].c_str(), O_WRONLY | O_APPEND);
+	CHECK(fd >= 0);
+	CHECK(write(fd, &partial, sizeof(partial)) == (ssize_t)sizeof(partial));
+	close(fd);
+
+	CHECK(ds.open(dir, 64 << 20, errh) == 0);
+	CHECK(ds.count() == 3 && ds.bytes() == bytes && !ds.contains(c[3]));
+	CHECK(file_size(paths[0]) == size);
+
+	// the next record goes where the partial one was
+	CHECK(ds.put(c[3], p[3].data(), p[3].length(), dropped));
+	CHECK(ds.read(c[3]) && read_back(ds, c[3], data) == 1 && data == p[3]);
+	ds.close();
+	CHECK(file_size(paths[0]) > size);
+
+	// a chunk that no longer matches its CID is dropped when it is read
+	fd = open(paths[0].c_str(), O_RDWR);
+	CHECK(fd >= 0);
+	size = file_size(paths[0]);
+	char last = p[3][p[3].length() - 1] ^ 0xff;
+	CHECK(pwrite(fd, &last, 1, size - 1) == 1);
+	close(fd);
+
+	CHECK(ds.open(dir, 64 << 20, errh) == 0);
+	CHECK(ds.count() == 4 && ds.contains(c[3]));
+	CHECK(ds.read(c[3]) && read_back(ds, c[3], data) == 0);
+	CHECK(!ds.contains(c[3]) && ds.count() == 3);
+	CHECK(ds.read(c[2]) && read_back(ds, c[2], data) == 1 && data == p[2]);
+	ds.close();
+	return 0;
+}
+
+/* the oldest segments go once the store is full */
+int
+XIADiskStoreTest::test_drop(ErrorHandler *errh)
+{
+	enum { N = 12, LENGTH = 1 << 20, LIMIT = 8 << 20 };
+	String dir = _dir + "/drop";
+	XIADiskStore ds;
+	Vector<XID> dropped;
+	Vector<String> paths;
+	String p[N], data;
+	XID c[N];
+
+	for (int i = 0; i < N; i++) {
+		p[i] = payload(i, LENGTH);
+		c[i] = cid(p[i]);
+	}
+
+	CHECK(ds.open(dir, LIMIT, errh) == 0);
+
+	// the first chunk is still being read when its segment is dropped
+	CHECK(ds.put(c[0], p[0].data(), LENGTH, dropped));
+	CHECK(ds.read(c[0]));
+
+	for (int i = 1; i < N; i++) {
+		CHECK(ds.put(c[i], p[i].data(), LENGTH, dropped));
+		CHECK(ds.bytes() <= LIMIT);
+	}
+
+	// whole segments go, oldest first, and the chunks in them with them
+	CHECK(dropped.size() > 0 && dropped.size() < N);
+	for (int i = 0; i < dropped.size(); i++) {
+		CHECK(dropped[i] == c[i]);
+		CHECK(!ds.contains(c[i]) && !ds.read(c[i]));
+	}
+	for (int i = dropped.size(); i < N; i++)
+		CHECK(ds.contains(c[i]));
+	CHECK(ds.count() == (unsigned)(N - dropped.size()));
+
+	segments(dir, paths);
+	CHECK(paths.size() > 1 && paths[0].substring(-16) != "/00000000.chunks");
+
+	CHECK(read_back(ds, c[0], data) == 1 && data == p[0]);
+	CHECK(ds.read(c[N - 1]) && read_back(ds, c[N - 1], data) == 1 && data == p[N - 1]);
+
+	// a smaller limit next time drops more
+	ds.close();
+	CHECK(ds.open(dir, LIMIT / 2, errh) == 0);
+	CHECK(ds.bytes() <= LIMIT / 2 && ds.count() > 0 && ds.contains(c[N - 1]));
+	CHECK(ds.count() < (unsigned)(N - dropped.size()));
+	ds.close();
+	return 0;
+}
+
+int
+XIADiskStoreTest::initialize(ErrorHandler *errh)
+{
+	if (test_store(errh) < 0 || test_drop(errh) < 0)
+		return -1;
+
+	errh->message("All tests pass!");
+	return 0;
+}
+
+CLICK_ENDDECLS
+ELEMENT_REQUIRES(userlevel XIADiskStore)
+EXPORT_ELEMENT(XIADiskStoreTest)
+ELEMENT_LIBS(-lcrypto)
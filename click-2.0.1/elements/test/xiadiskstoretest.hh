@@ -0,0 +1,55 @@
+#ifndef CLICK_XIADISKSTORETEST_HH
+#define CLICK_XIADISKSTORETEST_HH
+#include <click/element.hh>
+#include <click/xid.hh>
+CLICK_DECLS
+
+/*
+=c
+
+XIADiskStoreTest(DIR)
+
+=s test
+
+runs regression tests for XIADiskStore
+
+=d
+
+XIADiskStoreTest runs XIADiskStore regression tests at initialization time,
+keeping its stores in directories under DIR. It checks that chunks are stored
+and read back, that the index is rebuilt from the segments when a store is
+reopened and a record cut short is trimmed off, that a corrupt chunk is taken
+out of the index when it is read, and that the oldest segments are dropped
+once the store is full, without breaking reads already in flight. It does not
+route packets.
+
+=a XIADiskStore, XIACache
+*/
+
+class XIADiskStore;
+
+class XIADiskStoreTest : public Element { public:
+
+	XIADiskStoreTest();
+	~XIADiskStoreTest();
+
+	const char *class_name() const	{ return "XIADiskStoreTest"; }
+
+	int configure(Vector<String> &, ErrorHandler *);
+	int initialize(ErrorHandler *);
+
+private:
+	String _dir;
+
+	static String payload(int i, unsigned length);
+	static XID cid(const String &payload);
+	static int read_back(XIADiskStore &ds, const XID &cid, String &data);
+	static void segments(const String &dir, Vector<String> &paths);
+	static off_t file_size(const String &path);
+
+	int test_store(ErrorHandler *errh);
+	int test_drop(ErrorHandler *errh);
+};
+
+CLICK_ENDDECLS
+#endif
@@ -0,0 +1,411 @@
+/*
+ * xiatransportdispatchtest.{cc,hh} -- regression test element for
+ * XIATransportDispatch
+ *
+ * Copyright 2012 Carnegie Mellon University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "../../userlevel/xia.pb.h"
+#include <click/config.h>
+#include "xiatransportdispatchtest.hh"
+#include "../xia/xiatransportdispatch.hh"
+#include "../xia/xiaxidroutetable.hh"
+#include "../xia/xtransport.hh"
+#include <click/confparse.hh>
+#include <click/error.hh>
+#include <click/packet_anno.hh>
+#include <clicknet/xia.h>
+#include <poll.h>
+CLICK_DECLS
+
+#define CHECK(x) if (!(x)) return errh->error("%s:%d: test %<%s%> failed", __FILE__, __LINE__, #x);
+
+XIATransportDispatchTest::XIATransportDispatchTest()
+	: _dispatch(0), _table(0), _nshards(0)
+{
+}
+
+XIATransportDispatchTest::~XIATransportDispatchTest()
+{
+	clear();
+}
+
+int
+XIATransportDispatchTest::configure(Vector<String> &conf, ErrorHandler *errh)
+{
+	Element *dispatch;
+
+	if (cp_va_kparse(conf, this, errh,
+					 "DISPATCH", cpkP + cpkM, cpElement, &dispatch,
+					 "TABLE", cpkP + cpkM, cpElement, &_table,
+					 cpEnd) < 0)
+		return -1;
+
+	if (!(_dispatch = (XIATransportDispatch *)dispatch->cast("XIATransportDispatch")))
+		return errh->error("DISPATCH must be an XIATransportDispatch");
+
+	_nshards = ninputs() / 5;
+	if (_nshards < 2 || ninputs() != 5 * _nshards)
+		return errh->error("connect all the outputs of a dispatcher with 2 or more shards");
+	return 0;
+}
+
+void
+XIATransportDispatchTest::push(int port, Packet *p)
+{
+	_ports.push_back(port);
+	_packets.push_back(p);
+}
+
+void
+XIATransportDispatchTest::clear()
+{
+	for (int i = 0; i < _packets.size(); i++)
+		_packets[i]->kill();
+	_ports.clear();
+	_packets.clear();
+}
+
+/* the shard that got the only packet emitted, if it came out on port */
+int
+XIATransportDispatchTest::only(int port) const
+{
+	if (_ports.size() != 1 || _ports[0] / _nshards != port)
+		return -1;
+	return _ports[0] % _nshards;
+}
+
+/* index of the packet shard got on port, -1 if there is none */
+int
+XIATransportDispatchTest::find(int port, int shard) const
+{
+	for (int i = 0; i < _ports.size(); i++)
+		if (_ports[i] == port * _nshards + shard)
+			return i;
+	return -1;
+}
+
+bool
+XIATransportDispatchTest::parse(int i, xia::XSocketMsg &xsm) const
+{
+	return i >= 0 && xsm.ParseFromArray(_packets[i]->data(), _packets[i]->length());
+}
+
+void
+XIATransportDispatchTest::api(const xia::XSocketMsg &xsm, unsigned short sport)
+{
+	std::string buf;
+
+	xsm.SerializeToString(&buf);
+	WritablePacket *p = Packet::make(256, buf.c_str(), buf.size(), 0);
+	SET_SRC_PORT_ANNO(p, sport);
+	_dispatch->push(API_PORT, p);
+}
+
+void
+XIATransportDispatchTest::api(xia::XSocketCallType type, unsigned short sport)
+{
+	xia::XSocketMsg xsm;
+
+	xsm.set_type(type);
+	xsm.set_sequence(0);
+	api(xsm, sport);
+}
+
+/* a bare XIA header whose destination DAG is just intent */
+void
+XIATransportDispatchTest::network(int port, const XID &intent, uint8_t nxt)
+{
+	size_t len = sizeof(click_xia) + sizeof(click_xia_xid_node);
+	WritablePacket *p = Packet::make(256, (const void *)0, len, 0);
+	click_xia *xiah = reinterpret_cast<click_xia *>(p->data());
+
+	memset(xiah, 0, len);
+	xiah->ver = 1;
+	xiah->nxt = nxt;
+	xiah->hlim = 250;
+	xiah->dnode = 1;
+	xiah->last = -1;
+	xiah->node[0].xid = intent.xid();
+	p->set_xia_header(xiah, len);
+	_dispatch->push(port, p);
+}
+
+/* sockets go to the shard that owns their API port */
+int
+XIATransportDispatchTest::test_api(ErrorHandler *errh)
+{
+	unsigned short a = 5000 - 5000 % _nshards, b = a + 1, c = a + 2 * _nshards + 1;
+
+	// new sockets are spread by port number
+	for (unsigned short port = a; port < a + 2 * _nshards; port++) {
+		clear();
+		api(xia::XSOCKET, port);
+		CHECK(only(API_PORT) == port % _nshards);
+	}
+
+	// so are requests on ports that never made a socket
+	clear();
+	api(xia::XSEND, 6001);
+	CHECK(only(API_PORT) == 6001 % _nshards);
+
+	// an accepted socket stays with its listener, whatever its number
+	xia::XSocketMsg xsm;
+	xsm.set_type(xia::XACCEPT);
+	xsm.set_sequence(1);
+	xsm.mutable_x_accept()->set_new_port(c);
+	clear();
+	api(xsm, a);
+	CHECK(only(API_PORT) == 0);
+
+	clear();
+	api(xia::XSEND, c);
+	CHECK(only(API_PORT) == 0);
+
+	// Xclose comes in on a temporary port and names the socket
+	xsm.Clear();
+	xsm.set_type(xia::XCLOSE);
+	xsm.set_sequence(2);
+	xsm.mutable_x_close()->set_port(c);
+	clear();
+	api(xsm, b);
+	CHECK(only(API_PORT) == 0);
+
+	// host wide changes reach every shard, the owner's copy isn't a mirror
+	clear();
+	api(xia::XCHANGEAD, b);
+	CHECK(_packets.size() == _nshards);
+	for (int shard = 0; shard < _nshards; shard++) {
+		int i = find(API_PORT, shard);
+		CHECK(i >= 0);
+		CHECK(XTRANSPORT_MIRROR_ANNO(_packets[i]) == (shard != 1));
+		CHECK(SRC_PORT_ANNO(_packets[i]) == b);
+	}
+
+	clear();
+	return 0;
+}
+
+/* network and cache packets follow the XIDs the shards claim */
+int
+XIATransportDispatchTest::test_xids(ErrorHandler *errh)
+{
+	XID sid("SID:0f00000000000000000000000000000000000001");
+	String cmd = sid.unparse() + " " + String(DESTINED_FOR_LOCALHOST);
+
+	// nobody has claimed it yet
+	clear();
+	network(NETWORK_PORT, sid, CLICK_XIA_NXT_TRN);
+	CHECK(only(NETWORK_PORT) == 0);
+
+	// the claim takes effect once the dispatcher's task has run
+	_dispatch->add_route(1, _table, sid, cmd);
+	_dispatch->run_task(0);
+
+	clear();
+	network(NETWORK_PORT, sid, CLICK_XIA_NXT_TRN);
+	CHECK(only(NETWORK_PORT) == 1);
+
+	clear();
+	network(CACHE_PORT, sid, CLICK_XIA_NXT_CID);
+	CHECK(only(CACHE_PORT) == 1);
+
+	// any shard may have a socket listening for xcmp
+	clear();
+	network(NETWORK_PORT, sid, CLICK_XIA_NXT_XCMP);
+	CHECK(_packets.size() == _nshards);
+	for (int shard = 0; shard < _nshards; shard++)
+		CHECK(find(NETWORK_PORT, shard) >= 0);
+
+	clear();
+	network(XHCP_PORT, sid, CLICK_XIA_NXT_NO);
+	CHECK(_packets.size() == _nshards);
+	for (int shard = 0; shard < _nshards; shard++)
+		CHECK(find(XHCP_PORT, shard) >= 0);
+
+	// once it's given up, packets go back to shard 0
+	_dispatch->remove_route(1, _table, sid);
+	_dispatch->run_task(0);
+
+	clear();
+	network(NETWORK_PORT, sid, CLICK_XIA_NXT_TRN);
+	CHECK(only(NETWORK_PORT) == 0);
+
+	clear();
+	return 0;
+}
+
+/* an Xpoll is split between the shards that own its sockets */
+int
+XIATransportDispatchTest::test_poll(ErrorHandler *errh)
+{
+	unsigned short a = 5000 - 5000 % _nshards, b = a + 1, c = a + 2 * _nshards + 1;
+	unsigned short pollport = 7000;
+	xia::XSocketMsg xsm, sub;
+
+	xsm.set_type(xia::XPOLL);
+	xsm.set_sequence(7);
+	xia::X_Poll_Msg *poll = xsm.mutable_x_poll();
+	poll->set_type(xia::X_Poll_Msg::DOPOLL);
+	poll->set_nfds(3);
+	xia::X_Poll_Msg::PollFD *pfd = poll->add_pfds();
+	pfd->set_port(a);
+	pfd->set_flags(POLLIN);
+	pfd = poll->add_pfds();
+	pfd->set_port(b);
+	pfd->set_flags(POLLOUT);
+	pfd = poll->add_pfds();
+	pfd->set_port(c);
+	pfd->set_flags(POLLIN);
+
+	// each shard polls only its own sockets
+	clear();
+	api(xsm, pollport);
+	CHECK(_packets.size() == 2);
+
+	int i = find(API_PORT, 0);
+	CHECK(parse(i, sub) && sub.type() == xia::XPOLL && sub.sequence() == 7);
+	CHECK(SRC_PORT_ANNO(_packets[i]) == pollport);
+	CHECK(sub.x_poll().type() == xia::X_Poll_Msg::DOPOLL && sub.x_poll().nfds() == 2);
+	CHECK(sub.x_poll().pfds(0).port() == a && sub.x_poll().pfds(0).flags() == POLLIN);
+	CHECK(sub.x_poll().pfds(1).port() == c && sub.x_poll().pfds(1).flags() == POLLIN);
+
+	i = find(API_PORT, 1);
+	CHECK(parse(i, sub) && sub.type() == xia::XPOLL && sub.sequence() == 7);
+	CHECK(SRC_PORT_ANNO(_packets[i]) == pollport);
+	CHECK(sub.x_poll().nfds() == 1 && sub.x_poll().pfds_size() == 1);
+	CHECK(sub.x_poll().pfds(0).port() == b && sub.x_poll().pfds(0).flags() == POLLOUT);
+
+	// the API only reads the first answer, the other shard is cancelled
+	clear();
+	_dispatch->poll_answered(pollport, 1);
+	CHECK(only(API_PORT) == 0);
+	CHECK(parse(0, sub) && sub.x_poll().type() == xia::X_Poll_Msg::CANCEL);
+	CHECK(SRC_PORT_ANNO(_packets[0]) == pollport);
+
+	// later answers and the API's own cancel have nobody left to tell
+	clear();
+	_dispatch->poll_answered(pollport, 0);
+	CHECK(_packets.size() == 0);
+
+	xia::XSocketMsg cancel;
+	cancel.set_type(xia::XPOLL);
+	cancel.set_sequence(8);
+	cancel.mutable_x_poll()->set_type(xia::X_Poll_Msg::CANCEL);
+	cancel.mutable_x_poll()->set_nfds(0);
+	api(cancel, pollport);
+	CHECK(_packets.size() == 0);
+
+	// cancelled by the API before anyone answers, every shard hears of it
+	api(xsm, pollport);
+	clear();
+	api(cancel, pollport);
+	CHECK(_packets.size() == 2);
+	for (int shard = 0; shard < 2; shard++) {
+		CHECK(parse(find(API_PORT, shard), sub) && sub.x_poll().type() == xia::X_Poll_Msg::CANCEL);
+	}
+
+	// a poll within one shard goes through whole
+	poll->mutable_pfds()->SwapElements(1, 2);
+	poll->mutable_pfds()->RemoveLast();
+	poll->set_nfds(2);
+	clear();
+	api(xsm, pollport);
+	CHECK(only(API_PORT) == 0);
+	CHECK(parse(0, sub) && sub.x_poll().nfds() == 2 && sub.x_poll().pfds_size() == 2);
+
+	clear();
+	_dispatch->poll_answered(pollport, 0);
+	CHECK(_packets.size() == 0);
+
+	clear();
+	return 0;
+}
+
+/* each shard gets the ring ops for its own sockets */
+int
+XIATransportDispatchTest::test_ring(ErrorHandler *errh)
+{
+	unsigned short a = 5000 - 5000 % _nshards, b = a + 1, d = a + 4 * _nshards + 1;
+	unsigned short ringport = 7001;
+	xia::XSocketMsg xsm, sub;
+
+	xsm.set_type(xia::XRING);
+	xsm.set_sequence(9);
+	xia::XSocketMsg *op = xsm.mutable_x_ring()->add_ops();
+	op->set_type(xia::XRECV);
+	op->set_port(a);
+	op = xsm.mutable_x_ring()->add_ops();
+	op->set_type(xia::XSEND);
+	op->set_port(b);
+	op = xsm.mutable_x_ring()->add_ops();
+	op->set_type(xia::XACCEPT);
+	op->set_port(a);
+	op->mutable_x_accept()->set_new_port(d);
+
+	clear();
+	api(xsm, ringport);
+	CHECK(_packets.size() == 2);
+
+	int i = find(API_PORT, 0);
+	CHECK(parse(i, sub) && sub.type() == xia::XRING && sub.sequence() == 9);
+	CHECK(SRC_PORT_ANNO(_packets[i]) == ringport);
+	CHECK(sub.x_ring().ops_size() == 2);
+	CHECK(sub.x_ring().ops(0).type() == xia::XRECV && sub.x_ring().ops(1).type() == xia::XACCEPT);
+
+	i = find(API_PORT, 1);
+	CHECK(parse(i, sub) && sub.sequence() == 9 && SRC_PORT_ANNO(_packets[i]) == ringport);
+	CHECK(sub.x_ring().ops_size() == 1 && sub.x_ring().ops(0).type() == xia::XSEND);
+
+	// the ring's accept put its socket with the listener
+	clear();
+	api(xia::XSEND, d);
+	CHECK(only(API_PORT) == 0);
+
+	// a ring going away may have ops parked in any shard
+	xsm.Clear();
+	xsm.set_type(xia::XRING);
+	xsm.set_sequence(10);
+	xsm.mutable_x_ring()->set_cancel(true);
+	clear();
+	api(xsm, ringport);
+	CHECK(_packets.size() == _nshards);
+	for (int shard = 0; shard < _nshards; shard++) {
+		i = find(API_PORT, shard);
+		CHECK(parse(i, sub) && sub.x_ring().cancel());
+		CHECK(XTRANSPORT_MIRROR_ANNO(_packets[i]) == (shard != ringport % _nshards));
+	}
+
+	clear();
+	return 0;
+}
+
+int
+XIATransportDispatchTest::initialize(ErrorHandler *errh)
+{
+	if (test_api(errh) < 0 || test_xids(errh) < 0 || test_poll(errh) < 0
+			|| test_ring(errh) < 0) {
+		clear();
+		return -1;
+	}
+
+	errh->message("All tests pass!");
+	return 0;
+}
+
+CLICK_ENDDECLS
+ELEMENT_REQUIRES(userlevel XIATransportDispatch)
+EXPORT_ELEMENT(XIATransportDispatchTest)
+ELEMENT_LIBS(-lprotobuf)
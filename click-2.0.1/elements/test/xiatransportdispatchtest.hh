@@ -0,0 +1,77 @@
+#ifndef CLICK_XIATRANSPORTDISPATCHTEST_HH
+#define CLICK_XIATRANSPORTDISPATCHTEST_HH
+#include <click/element.hh>
+#include <click/xid.hh>
+#include "../../userlevel/xia.pb.h"
+CLICK_DECLS
+
+/*
+=c
+
+XIATransportDispatchTest(DISPATCH, TABLE)
+
+=s test
+
+runs regression tests for XIATransportDispatch
+
+=d
+
+XIATransportDispatchTest pushes API, network, cache and xhcp packets into the
+XIATransportDispatch element DISPATCH at initialization time, and checks that
+each one comes out on the output of the shard that owns it. Every output of
+DISPATCH must be connected to the input of the same number on this element,
+in place of the shards. TABLE is the route table the shards would add their
+SIDs to.
+
+It checks that sockets are spread by API port, that accepted sockets stay
+with their listener, that host wide requests reach every shard, that network
+and cache packets follow the XIDs the shards claim, and that Xpoll and Xring
+requests are split between shards, with the shards that didn't answer a poll
+cancelled.
+
+=a XIATransportDispatch
+*/
+
+class XIATransportDispatch;
+
+class XIATransportDispatchTest : public Element { public:
+
+	XIATransportDispatchTest();
+	~XIATransportDispatchTest();
+
+	const char *class_name() const	{ return "XIATransportDispatchTest"; }
+	const char *port_count() const	{ return "-/0"; }
+	const char *processing() const	{ return PUSH; }
+
+	int configure_phase() const		{ return CONFIGURE_PHASE_LAST; }
+	int configure(Vector<String> &, ErrorHandler *);
+	int initialize(ErrorHandler *);
+
+	void push(int port, Packet *);
+
+private:
+	XIATransportDispatch *_dispatch;
+	Element *_table;
+	int _nshards;
+
+	// what the dispatcher emitted since the last clear()
+	Vector<int> _ports;
+	Vector<Packet *> _packets;
+
+	void clear();
+	int only(int port) const;
+	int find(int port, int shard) const;
+	bool parse(int i, xia::XSocketMsg &xsm) const;
+
+	void api(const xia::XSocketMsg &xsm, unsigned short sport);
+	void api(xia::XSocketCallType type, unsigned short sport);
+	void network(int port, const XID &intent, uint8_t nxt);
+
+	int test_api(ErrorHandler *errh);
+	int test_xids(ErrorHandler *errh);
+	int test_poll(ErrorHandler *errh);
+	int test_ring(ErrorHandler *errh);
+};
+
+CLICK_ENDDECLS
+#endif
@@ -7,10 +7,17 @@
 #include <click/packet_anno.hh>
 #include <click/xiacontentheader.hh>
 #include <click/string.hh>
+#include <click/straccum.hh>
 #include <clicknet/xia.h>
 #include <click/packet.hh>
 #include <click/vector.hh>
 #include <click/xid.hh>
+#if CLICK_USERLEVEL
+# include <sys/ioctl.h>
+# include <sys/socket.h>
+# include <net/if.h>
+# include <unistd.h>
+#endif
 
 
 CLICK_DECLS
@@ -27,6 +34,7 @@ XIACache::XIACache()
 #endif
 
     _content_module = new XIAContentModule(xt);
+    _disk_size = 10000000000ULL;
 }
 
 XIACache::~XIACache()
@@ -42,6 +50,10 @@ XIACache::configure(Vector<String> &conf, ErrorHandler *errh)
     int pkt_size=0;
 	int malicious=0;
     bool cache_content_from_network =true;
+    bool verify=false;
+    String policy="LRU";
+    String port_mtu;
+    XIACachePolicy::Type policy_type;
 
     if (cp_va_kparse(conf, this, errh,
 		"LOCAL_ADDR", cpkP+cpkM, cpXIAPath, &local_addr,
@@ -49,9 +61,18 @@ XIACache::configure(Vector<String> &conf, ErrorHandler *errh)
 		"CACHE_CONTENT_FROM_NETWORK", cpkP, cpBool, &cache_content_from_network,
 		"PACKET_SIZE", 0, cpInteger, &pkt_size,
 		"MALICIOUS", 0, cpInteger, &malicious,
+		"POLICY", 0, cpWord, &policy,
+		"PORT_MTU", 0, cpArgument, &port_mtu,
+		"VERIFY", 0, cpBool, &verify,
+		"DISK_DIR", 0, cpFilename, &_disk_dir,
+		"DISK_SIZE", 0, cpUnsigned64, &_disk_size,
 		cpEnd) < 0)
 	return -1;   
 
+    if (!XIACachePolicy::parse(policy, &policy_type))
+	return errh->error("POLICY must be LRU, FIFO or S3FIFO");
+    _content_module->_routerPolicy.set_type(policy_type);
+
 	// Tell the content module whether or not it is malicious
 	_content_module->malicious = malicious;
 
@@ -63,8 +84,11 @@ XIACache::configure(Vector<String> &conf, ErrorHandler *errh)
     _local_addr = local_addr;
     _local_hid = local_addr.xid(local_addr.destination_node());
 
-    if (pkt_size) XIAContentModule::PKTSIZE= pkt_size;
+    if (pkt_size) _content_module->_pktsize = pkt_size;
+    if (port_mtu && set_port_mtu(port_mtu, errh) < 0)
+	return -1;
     _content_module->_cache_content_from_network = cache_content_from_network;
+    _content_module->_verify = verify;
     /*
        std::cout<<"Route Table Name: "<<routing_table_name.c_str()<<std::endl;
        if(routeTable==NULL) 
@@ -87,6 +111,59 @@ XIACache::configure(Vector<String> &conf, ErrorHandler *errh)
 }
 
 
+int
+XIACache::initialize(ErrorHandler *errh)
+{
+    // responses are sized for the port the route tables send them out, and
+    // the CID table's siblings are the rest of the router's tables
+    XIAXIDRouteTable *rt = _content_module->_routeTable;
+    if (rt) {
+	String dir = rt->name().substring(0, rt->name().find_right('/') + 1);
+
+	for (int i = 0; i < router()->nelements(); i++) {
+	    Element *e = router()->element(i);
+
+	    if (e->name().length() > dir.length() && e->name().starts_with(dir)
+		    && e->name().find_left('/', dir.length()) < 0 && e->cast("XIAXIDRouteTable"))
+		_content_module->_egressTables.push_back(static_cast<XIAXIDRouteTable *>(e));
+	}
+    }
+
+    if (!_disk_dir)
+	return 0;
+
+    XIADiskStore &disk = _content_module->_disk;
+    if (disk.open(_disk_dir, _disk_size, errh) < 0)
+	return -1;
+
+    // what was on disk from the last run can be served again
+    Vector<XID> cids;
+    disk.cids(cids);
+    for (int i = 0; i < cids.size(); i++)
+	_content_module->addRoute(cids[i], false);
+    if (cids.size())
+	click_chatter("%s: %d chunks on disk in %s", declaration().c_str(), cids.size(), _disk_dir.c_str());
+
+    add_select(disk.notify_fd(), SELECT_READ);
+    return 0;
+}
+
+void
+XIACache::cleanup(CleanupStage)
+{
+    XIADiskStore &disk = _content_module->_disk;
+
+    if (disk.is_open()) {
+	remove_select(disk.notify_fd(), SELECT_READ);
+	disk.close();
+    }
+}
+
+void
+XIACache::selected(int, int)
+{
+    _content_module->promoted();
+}
 
 void XIACache::push(int port, Packet *p)
 {
@@ -144,6 +221,52 @@ void XIACache::push(int port, Packet *p)
     }
 }
 
+/*
+ * each entry is an MTU, the name of a device to read it from, or - to use
+ * PACKET_SIZE for that port
+ */
+int
+XIACache::set_port_mtu(const String &conf, ErrorHandler *errh)
+{
+	Vector<String> words;
+	Vector<unsigned int> mtus;
+
+	cp_spacevec(conf, words);
+	for (int i = 0; i < words.size(); i++) {
+		uint32_t mtu = 0;
+
+		if (words[i] == "-")
+			;
+		else if (cp_integer(words[i], &mtu))
+			;
+		else {
+#if CLICK_USERLEVEL
+			struct ifreq ifr;
+			int fd = socket(AF_INET, SOCK_DGRAM, 0);
+
+			memset(&ifr, 0, sizeof(ifr));
+			strncpy(ifr.ifr_name, words[i].c_str(), sizeof(ifr.ifr_name) - 1);
+			if (fd < 0 || ioctl(fd, SIOCGIFMTU, &ifr) < 0) {
+				if (fd >= 0)
+					close(fd);
+				return errh->error("PORT_MTU: can't get the MTU of %s: %s", words[i].c_str(), strerror(errno));
+			}
+			close(fd);
+			mtu = ifr.ifr_mtu;
+#else
+			return errh->error("PORT_MTU: %s is not an MTU", words[i].c_str());
+#endif
+		}
+
+		if (mtu && (mtu < 256 || mtu > 65535))
+			return errh->error("PORT_MTU: %u is out of range for port %d", mtu, i);
+		mtus.push_back(mtu);
+	}
+
+	_content_module->_port_mtu.swap(mtus);
+	return 0;
+}
+
 int
 XIACache::set_malicious(int m)
 {
@@ -156,7 +279,7 @@ int XIACache::get_malicious()
 	return _content_module->malicious;
 }
 
-enum {H_MOVE, MALICIOUS};
+enum {H_MOVE, MALICIOUS, POLICY, USED_SIZE, SLABS, PORT_MTU, VERIFY, REJECTED, DISK};
 
 int XIACache::write_param(const String &conf, Element *e, void *vparam,
                 ErrorHandler *errh)
@@ -180,6 +303,16 @@ int XIACache::write_param(const String &conf, Element *e, void *vparam,
 			f->set_malicious(atoi(conf.c_str()));
 		} break;
 
+		case PORT_MTU:
+			return f->set_port_mtu(conf, errh);
+
+		case VERIFY: {
+			bool verify;
+			if (!cp_bool(cp_uncomment(conf), &verify))
+				return errh->error("verify must be a boolean");
+			f->_content_module->_verify = verify;
+		} break;
+
         default: break;
     }
     return 0;
@@ -193,6 +326,42 @@ XIACache::read_handler(Element *e, void *thunk)
 		case MALICIOUS:
 			return String(c->get_malicious());
 
+		case POLICY:
+			return XIACachePolicy::name(c->_content_module->_routerPolicy.type());
+
+		case USED_SIZE:
+			return String(c->_content_module->usedSize());
+
+		case SLABS:
+			return c->_content_module->_slab.stats();
+
+		case PORT_MTU: {
+			StringAccum sa;
+			const Vector<unsigned int> &mtus = c->_content_module->_port_mtu;
+			for (int i = 0; i < mtus.size(); i++) {
+				if (i)
+					sa << ' ';
+				if (mtus[i])
+					sa << mtus[i];
+				else
+					sa << '-';
+			}
+			return sa.take_string();
+		}
+
+		case VERIFY:
+			return String(c->_content_module->_verify);
+
+		case REJECTED:
+			return String(c->_content_module->_rejected);
+
+		case DISK: {
+			const XIADiskStore &disk = c->_content_module->_disk;
+			if (!disk.is_open())
+				return String();
+			return disk.stats() + "promotions " + String(c->_content_module->_promotions) + "\n";
+		}
+
 		default:
 			return "<error>";
     }
@@ -202,6 +371,15 @@ void XIACache::add_handlers() {
     add_write_handler("local_addr", write_param, (void *)H_MOVE);
 	add_write_handler("malicious", write_param, (void*)MALICIOUS);
 	add_read_handler("malicious", read_handler, (void*)MALICIOUS);
+	add_read_handler("policy", read_handler, (void*)POLICY);
+	add_read_handler("used_size", read_handler, (void*)USED_SIZE);
+	add_read_handler("slabs", read_handler, (void*)SLABS);
+	add_read_handler("port_mtu", read_handler, (void*)PORT_MTU);
+	add_write_handler("port_mtu", write_param, (void*)PORT_MTU);
+	add_read_handler("verify", read_handler, (void*)VERIFY);
+	add_write_handler("verify", write_param, (void*)VERIFY);
+	add_read_handler("rejected", read_handler, (void*)REJECTED);
+	add_read_handler("disk", read_handler, (void*)DISK);
 }
 
 
@@ -26,6 +26,50 @@ XIATransport:   input port[0]:  get CID request or reponse from network, should
 output[0] : if the cache has the chunk, it will serve the CID request by pushing chunk pkts to RouteEngine
 input port[1]:  connect with RPC, in server, the RPC will pushCID into cache before serve it.
 output port[1]: connect with RPC, in client, when a chunk is complete, cache will push it to RPC (higher level)
+
+POLICY (LRU, FIFO or S3FIFO, default LRU) picks the replacement policy for
+chunks cached while forwarding. Chunks stored by local applications use the
+policy of their cache context instead. The policy and used_size read handlers
+report the router cache's policy and the number of bytes it holds. Chunk
+payloads live in size-classed slabs, and sizes are counted in whole slab
+blocks; the slabs read handler reports the blocks and slabs in use per size
+class.
+
+Cached chunks are served in packets of up to PACKET_SIZE bytes (default
+1024). PORT_MTU gives the largest packet for each line card, by port number,
+as a space separated list of MTUs or of device names whose MTU is read from
+the system; - leaves a port at PACKET_SIZE. The port a response goes out is
+looked up in the route tables next to ROUTETABLENAME, so a 1MB chunk takes
+about 120 packets on a 9000 byte link instead of over 1000. If the port can't
+be found, the smallest MTU of any port is used. Ports that tunnel XIA over IP
+should be given their MTU less the IP and UDP headers, and jumbo links need a
+FromDevice SNAPLEN big enough for the frames at the other end. The port_mtu
+handler reads or replaces the list.
+
+Chunks are hashed as their fragments arrive, so checking one against its CID
+costs little once it is complete. End hosts always check what they receive.
+With VERIFY true (default false) the router checks the chunks it caches while
+forwarding too, and drops the ones that don't match their CID instead of
+serving them. The verify handler reads or changes the setting, and the
+rejected handler counts the chunks dropped.
+
+DISK_DIR names a directory for a second tier of the cache on local disk,
+holding up to DISK_SIZE bytes (default 10GB). Chunks evicted from memory
+are appended to it instead of being dropped, and keep their route, and a
+request for one is answered once the chunk has been read back into memory.
+Both the writes and the reads happen off the Click thread. A request is
+dropped if the cache has no room for the chunk when it comes back, and the
+requester asks again. The oldest chunks on disk are dropped
+as it fills. Chunks on disk survive a restart, so a router comes back with
+what it had cached. Chunks that local applications publish are not moved to
+disk, their cache slices are sized by the application. The disk read
+handler reports what the store holds.
+
+=e
+
+  cache :: XIACache($local_addr, n/proc/rt_CID, PACKET_SIZE 1400, PORT_MTU "eth0 9000 -", VERIFY true);
+
+  cache :: XIACache($local_addr, n/proc/rt_CID, DISK_DIR /var/cache/xia, DISK_SIZE 100000000000);
 */
 
 class XIAContentModule;    
@@ -38,13 +82,17 @@ class XIACache : public Element {
     const char *port_count() const		{ return "2/2"; }
     const char *processing() const		{ return PUSH; }
     int configure(Vector<String> &, ErrorHandler *);         
+    int initialize(ErrorHandler *);
+    void cleanup(CleanupStage);
     void push(int port, Packet *);            
+    void selected(int fd, int mask);
     XID local_hid() { return _local_hid; };
     XIAPath local_addr() { return _local_addr; };
     void add_handlers();
     static int write_param(const String &, Element *, void *vparam, ErrorHandler *);
 	static String read_handler(Element *e, void *thunk);
 	int set_malicious(int m);
+	int set_port_mtu(const String &conf, ErrorHandler *errh);
 	int get_malicious();
 
   private:
@@ -52,6 +100,8 @@ class XIACache : public Element {
     XID _local_hid;
     XIAPath _local_addr;
     XIAContentModule* _content_module;
+    String _disk_dir;
+    uint64_t _disk_size;
 
 };
 
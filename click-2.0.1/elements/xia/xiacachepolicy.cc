@@ -0,0 +1,236 @@
+#include <click/config.h>
+#include "xiacachepolicy.hh"
+CLICK_DECLS
+
+XIACachePolicy::XIACachePolicy(Type type)
+	: _type(type), _main_bytes(0), _small_bytes(0), _count(0), _next_ghost(0)
+{
+}
+
+XIACachePolicy::~XIACachePolicy()
+{
+	// the entries belong to the caller and may already be gone, leave them be
+}
+
+XIACachePolicy::Type
+XIACachePolicy::parse(uint32_t policy)
+{
+	if (policy & POLICY_S3FIFO)
+		return S3FIFO;
+	else if (policy & POLICY_FIFO)
+		return FIFO;
+	return LRU;
+}
+
+bool
+XIACachePolicy::parse(const String &name, Type *type)
+{
+	String s = name.upper();
+
+	if (s == "LRU")
+		*type = LRU;
+	else if (s == "FIFO")
+		*type = FIFO;
+	else if (s == "S3FIFO" || s == "S3-FIFO")
+		*type = S3FIFO;
+	else
+		return false;
+	return true;
+}
+
+const char *
+XIACachePolicy::name(Type type)
+{
+	switch (type) {
+		case LRU:		return "LRU";
+		case FIFO:		return "FIFO";
+		case S3FIFO:	return "S3FIFO";
+	}
+	return "unknown";
+}
+
+void
+XIACachePolicy::set_type(Type type)
+{
+	if (type == _type)
+		return;
+
+	// keep the current order, everything starts over in the main queue
+	while (CacheEntry *e = _small.front()) {
+		unlink(e);
+		link(e, QUEUE_MAIN);
+	}
+	_ghosts.clear();
+	_ghost_seq.clear();
+	_type = type;
+}
+
+void
+XIACachePolicy::link(CacheEntry *e, int queue)
+{
+	e->_queue = queue;
+	if (queue == QUEUE_SMALL) {
+		_small.push_back(e);
+		_small_bytes += e->_bytes;
+	} else {
+		_main.push_back(e);
+		_main_bytes += e->_bytes;
+	}
+}
+
+void
+XIACachePolicy::unlink(CacheEntry *e)
+{
+	if (e->_queue == QUEUE_SMALL) {
+		_small.erase(e);
+		_small_bytes -= e->_bytes;
+	} else if (e->_queue == QUEUE_MAIN) {
+		_main.erase(e);
+		_main_bytes -= e->_bytes;
+	}
+	e->_queue = QUEUE_NONE;
+}
+
+void
+XIACachePolicy::insert(CacheEntry *e, const XID &key, unsigned bytes, unsigned now)
+{
+	if (e->_policy)
+		e->_policy->remove(e);
+
+	e->_policy = this;
+	e->_key = &key;
+	e->_bytes = bytes;
+	e->_freq = 0;
+	e->_stamp = now;
+	_count++;
+
+	if (_type == S3FIFO && !take_ghost(key))
+		link(e, QUEUE_SMALL);
+	else
+		link(e, QUEUE_MAIN);
+}
+
+void
+XIACachePolicy::touch(CacheEntry *e, unsigned now)
+{
+	assert(e->_policy == this);
+	e->_stamp = now;
+
+	switch (_type) {
+		case LRU:
+			_main.erase(e);
+			_main.push_back(e);
+			break;
+
+		case S3FIFO:
+			if (e->_freq < MAX_FREQ)
+				e->_freq++;
+			break;
+
+		case FIFO:
+			break;
+	}
+}
+
+void
+XIACachePolicy::remove(CacheEntry *e)
+{
+	assert(e->_policy == this);
+
+	unlink(e);
+	e->_policy = 0;
+	e->_key = 0;
+	_count--;
+}
+
+CacheEntry *
+XIACachePolicy::victim()
+{
+	CacheEntry *e;
+
+	if (_type != S3FIFO) {
+		if ((e = _main.front()))
+			remove(e);
+		return e;
+	}
+
+	while (_count > 0) {
+		if (_small.front() && (_small_bytes * 10 >= bytes() || !_main.front())) {
+			e = _small.front();
+			unlink(e);
+
+			if (e->_freq > 0) {
+				// used again while on probation, keep it
+				e->_freq = 0;
+				link(e, QUEUE_MAIN);
+				continue;
+			}
+
+			add_ghost(*e->_key);
+			remove(e);
+			return e;
+		}
+
+		e = _main.front();
+		unlink(e);
+
+		if (e->_freq > 0) {
+			e->_freq--;
+			link(e, QUEUE_MAIN);
+			continue;
+		}
+
+		remove(e);
+		return e;
+	}
+
+	return 0;
+}
+
+CacheEntry *
+XIACachePolicy::oldest() const
+{
+	const CacheEntry *e = _small.front();
+
+	if (!e)
+		e = _main.front();
+	return const_cast<CacheEntry *>(e);
+}
+
+void
+XIACachePolicy::add_ghost(const XID &key)
+{
+	Ghost g;
+	g.key = key;
+	g.seq = ++_next_ghost;
+
+	_ghosts.push_back(g);
+	_ghost_seq.set(key, g.seq);
+
+	// remember about as many keys as the main queue holds
+	unsigned limit = _count > MIN_GHOSTS ? _count : MIN_GHOSTS;
+	while ((unsigned)_ghosts.size() > limit) {
+		const Ghost &old = _ghosts.front();
+		HashTable<XID, unsigned>::iterator it = _ghost_seq.find(old.key);
+
+		// the key may have been added again since
+		if (it != _ghost_seq.end() && it->second == old.seq)
+			_ghost_seq.erase(it);
+		_ghosts.pop_front();
+	}
+}
+
+bool
+XIACachePolicy::take_ghost(const XID &key)
+{
+	HashTable<XID, unsigned>::iterator it = _ghost_seq.find(key);
+
+	if (it == _ghost_seq.end())
+		return false;
+
+	_ghost_seq.erase(it);
+	return true;
+}
+
+CLICK_ENDDECLS
+ELEMENT_PROVIDES(XIACachePolicy)
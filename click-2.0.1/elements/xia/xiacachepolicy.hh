@@ -0,0 +1,113 @@
+#ifndef CLICK_XIACACHEPOLICY_HH
+#define CLICK_XIACACHEPOLICY_HH
+#include <click/config.h>
+#include <click/list.hh>
+#include <click/dequeue.hh>
+#include <click/hashtable.hh>
+#include <click/xid.hh>
+
+// cache policy bits, shared with the Xsocket API (see Xsocket.h)
+#define POLICY_LRU		0x00000001
+#define POLICY_FIFO		0x00000002
+#define POLICY_S3FIFO	0x00000004
+
+CLICK_DECLS
+
+class XIACachePolicy;
+
+/*
+** Replacement state for a cached object. Objects that can be cached derive
+** from this so the policies can link them into their queues without any
+** allocation.
+*/
+class CacheEntry {
+  public:
+	CacheEntry() : _policy(0), _key(0), _bytes(0), _queue(0), _freq(0), _stamp(0) {}
+
+	XIACachePolicy *policy() const	{ return _policy; }
+	unsigned stamp() const			{ return _stamp; }
+
+  private:
+	List_member<CacheEntry> _link;
+	XIACachePolicy *_policy;	// policy tracking the entry, NULL if none
+	const XID *_key;
+	unsigned _bytes;
+	uint8_t _queue;				// which of the policy's queues the entry is on
+	uint8_t _freq;				// S3-FIFO access count, saturates at 3
+	unsigned _stamp;			// caller supplied time of the last access
+
+	friend class XIACachePolicy;
+};
+
+/*
+** O(1) replacement policies for the content cache
+**
+** LRU moves an entry to the back of its queue whenever it is used, and FIFO
+** leaves entries in insertion order. S3-FIFO keeps new entries in a small
+** FIFO queue holding about 10% of the bytes, promotes the ones that are used
+** again before they reach its head to a main queue, and remembers the keys of
+** recently dropped entries in a ghost queue so they go straight to the main
+** queue if they come back. Entries in the main queue get another trip
+** through it for each time they were used.
+**
+** The policy only orders entries; the caller owns them, and frees whatever
+** victim() hands back.
+*/
+class XIACachePolicy {
+  public:
+	enum Type { LRU, FIFO, S3FIFO };
+
+	XIACachePolicy(Type type = LRU);
+	~XIACachePolicy();
+
+	static Type parse(uint32_t policy);
+	static bool parse(const String &name, Type *type);
+	static const char *name(Type type);
+
+	Type type() const				{ return _type; }
+	void set_type(Type type);
+
+	void insert(CacheEntry *e, const XID &key, unsigned bytes, unsigned now = 0);
+	void touch(CacheEntry *e, unsigned now = 0);
+	void remove(CacheEntry *e);
+
+	// unlinks and returns the entry that should be evicted next
+	CacheEntry *victim();
+
+	// least recently inserted or used entry, without removing it
+	CacheEntry *oldest() const;
+
+	uint64_t bytes() const			{ return _main_bytes + _small_bytes; }
+	unsigned count() const			{ return _count; }
+
+  private:
+	enum { QUEUE_NONE = 0, QUEUE_MAIN, QUEUE_SMALL };
+	enum { MAX_FREQ = 3, MIN_GHOSTS = 64 };
+
+	typedef List<CacheEntry, &CacheEntry::_link> EntryList;
+
+	struct Ghost {
+		XID key;
+		unsigned seq;
+	};
+
+	Type _type;
+	EntryList _main;
+	EntryList _small;
+	uint64_t _main_bytes;
+	uint64_t _small_bytes;
+	unsigned _count;
+
+	// keys recently evicted from the small queue
+	DEQueue<Ghost> _ghosts;
+	HashTable<XID, unsigned> _ghost_seq;
+	unsigned _next_ghost;
+
+	void link(CacheEntry *e, int queue);
+	void unlink(CacheEntry *e);
+	void add_ghost(const XID &key);
+	bool take_ghost(const XID &key);
+};
+
+CLICK_ENDDECLS
+#endif
@@ -0,0 +1,122 @@
+#include <click/config.h>
+#include "xiachunkbench.hh"
+#include "xiacontentmodule.hh"
+#include <click/confparse.hh>
+#include <click/error.hh>
+#include <click/glue.hh>
+#include <click/packet_anno.hh>
+#include <click/timestamp.hh>
+#include <click/vector.hh>
+CLICK_DECLS
+
+XIAChunkBench::XIAChunkBench()
+{
+}
+
+XIAChunkBench::~XIAChunkBench()
+{
+}
+
+int
+XIAChunkBench::configure(Vector<String> &conf, ErrorHandler *errh)
+{
+    _chunk_size = 1024 * 1024;
+    _fragment = 1000;
+    _rounds = 10;
+    _duplicates = 0;
+    _in_order = false;
+    _hash = false;
+
+    if (cp_va_kparse(conf, this, errh,
+		"CHUNK_SIZE", 0, cpUnsigned, &_chunk_size,
+		"FRAGMENT", 0, cpUnsigned, &_fragment,
+		"ROUNDS", 0, cpUnsigned, &_rounds,
+		"DUPLICATES", 0, cpUnsigned, &_duplicates,
+		"IN_ORDER", 0, cpBool, &_in_order,
+		"HASH", 0, cpBool, &_hash,
+		cpEnd) < 0)
+	return -1;
+
+    if (_chunk_size == 0 || _fragment == 0)
+	return errh->error("CHUNK_SIZE and FRAGMENT must be positive");
+    if (_duplicates > 100)
+	return errh->error("DUPLICATES is a percentage");
+    return 0;
+}
+
+int
+XIAChunkBench::initialize(ErrorHandler *errh)
+{
+    XIASlabAllocator slab;
+    XID xid;
+    Vector<unsigned char> data(_chunk_size, 0);
+
+    for (uint32_t i = 0; i < _chunk_size; i++)
+	data[i] = click_random() & 0xff;
+
+    if (_hash) {
+	struct click_xia_xid x;
+	x.type = htonl(CLICK_XIA_XID_TYPE_CID);
+	SHA1(data.begin(), _chunk_size, x.id);
+	xid = x;
+    }
+
+    // every fragment once, then some of them again
+    Vector<uint32_t> order;
+    for (uint32_t off = 0; off < _chunk_size; off += _fragment)
+	order.push_back(off);
+    int nfragments = order.size();
+    for (int i = 0; i < nfragments; i++)
+	if (click_random(0, 99) < _duplicates)
+	    order.push_back(order[i]);
+
+    Timestamp total, tail;
+    for (uint32_t r = 0; r < _rounds; r++) {
+	for (int i = order.size() - 1; i > 0 && !_in_order; i--) {
+	    int j = click_random(0, i);
+	    uint32_t t = order[i];
+	    order[i] = order[j];
+	    order[j] = t;
+	}
+
+	Timestamp start = Timestamp::now();
+	Timestamp last = start;
+	CChunk *chunk = new CChunk(xid, _chunk_size, &slab);
+	if (_hash)
+	    chunk->startHash();
+	for (int i = 0; i < order.size(); i++) {
+	    uint32_t off = order[i];
+	    uint32_t len = _chunk_size - off < _fragment ? _chunk_size - off : _fragment;
+	    if (i == nfragments - 1)
+		last = Timestamp::now();
+	    chunk->fill(data.begin() + off, off, len);
+	}
+	bool full = chunk->full();
+	Timestamp done = Timestamp::now();
+	total += done - start;
+	tail += done - last;
+
+	if (!full || memcmp(chunk->GetPayload(), data.begin(), _chunk_size) != 0) {
+	    delete chunk;
+	    return errh->error("round %u: chunk was not reassembled correctly", r);
+	}
+	if (_hash && chunk->hashState() != XIA_CID_HASH_VALID) {
+	    delete chunk;
+	    return errh->error("round %u: chunk does not match its CID", r);
+	}
+	delete chunk;
+    }
+
+    double usec = total.doubleval() * 1e6 / (_rounds ? _rounds : 1);
+    errh->message("%u byte chunks from %d fragments (%d duplicates): %.1f us per chunk, %.1f MB/s",
+		  _chunk_size, nfragments, order.size() - nfragments, usec,
+		  usec > 0 ? _chunk_size / usec : 0.);
+    if (_hash)
+	errh->message("CID checked %.1f us after the last fragment",
+		      tail.doubleval() * 1e6 / (_rounds ? _rounds : 1));
+    return 0;
+}
+
+CLICK_ENDDECLS
+ELEMENT_REQUIRES(XIAContentModule)
+EXPORT_ELEMENT(XIAChunkBench)
@@ -0,0 +1,54 @@
+#ifndef CLICK_XIACHUNKBENCH_HH
+#define CLICK_XIACHUNKBENCH_HH
+#include <click/element.hh>
+CLICK_DECLS
+
+/*
+=c
+
+XIAChunkBench([I<keywords> CHUNK_SIZE, FRAGMENT, ROUNDS, DUPLICATES, IN_ORDER, HASH])
+
+=s test
+
+benchmarks content chunk reassembly
+
+=d
+
+At initialization time, XIAChunkBench reassembles ROUNDS chunks of
+CHUNK_SIZE bytes (default 1MB) from FRAGMENT byte pieces (default 1000)
+arriving in random order, checks the reassembled payload, and reports the
+time taken per chunk. DUPLICATES is the percentage of fragments that are
+delivered a second time (default 0). IN_ORDER true delivers the fragments
+in order instead (duplicates go last). HASH true checks each chunk against
+its CID as the cache does, and also reports how long that leaves after the
+last fragment arrives. It does not route packets.
+
+=e
+
+  click -e 'XIAChunkBench(ROUNDS 100, DUPLICATES 10)'
+  click -e 'XIAChunkBench(ROUNDS 100, IN_ORDER true, HASH true)'
+
+=a XIACache
+*/
+
+class XIAChunkBench : public Element { public:
+
+    XIAChunkBench();
+    ~XIAChunkBench();
+
+    const char *class_name() const		{ return "XIAChunkBench"; }
+
+    int configure(Vector<String> &, ErrorHandler *);
+    int initialize(ErrorHandler *);
+
+  private:
+    uint32_t _chunk_size;
+    uint32_t _fragment;
+    uint32_t _rounds;
+    uint32_t _duplicates;
+    bool _in_order;
+    bool _hash;
+};
+
+CLICK_ENDDECLS
+#endif
@@ -0,0 +1,272 @@
+#include <click/config.h>
+#include "xiachunkfetch.hh"
+CLICK_DECLS
+
+XIAChunkFetch::XIAChunkFetch(int sequence)
+	: _sequence(sequence), _next(0), _delivered(0), _credit(0),
+	  _more(false), _buffered_bytes(0), _cwnd(INITIAL_WINDOW), _ssthresh(MAX_WINDOW),
+	  _rto(Timestamp::make_msec(INITIAL_RTO)), _round_count(0),
+	  _best_rate(0), _flat_rounds(0)
+{
+}
+
+XIAChunkFetch::~XIAChunkFetch()
+{
+	for (int i = _delivered; i < _entries.size(); i++)
+		if (_entries[i].response)
+			_entries[i].response->kill();
+}
+
+void
+XIAChunkFetch::add(const XIAPath &dag)
+{
+	Entry e;
+	e.dag = dag;
+	e.cid = dag.xid(dag.destination_node());
+	e.response = 0;
+	e.status = 0;
+	e.state = QUEUED;
+	e.tries = 0;
+	e.slot = -1;
+	e.same = -1;
+
+	int i = _entries.size();
+	_entries.push_back(e);
+
+	// the same chunk may be listed more than once, one request serves all
+	HashTable<XID, int>::iterator it = _pending.find(e.cid);
+	if (it == _pending.end())
+		_pending.set(e.cid, i);
+	else {
+		int j = it->second;
+		while (_entries[j].same >= 0)
+			j = _entries[j].same;
+		_entries[j].same = i;
+	}
+}
+
+void
+XIAChunkFetch::add_failed(int status)
+{
+	Entry e;
+	e.response = 0;
+	e.status = status;
+	e.state = RECEIVED;
+	e.tries = 0;
+	e.slot = -1;
+	e.same = -1;
+
+	_entries.push_back(e);
+}
+
+void
+XIAChunkFetch::unlink_inflight(Entry &e)
+{
+	if (e.slot < 0)
+		return;
+
+	int last = _inflight.back();
+	_inflight[e.slot] = last;
+	_entries[last].slot = e.slot;
+	_inflight.pop_back();
+	e.slot = -1;
+}
+
+int
+XIAChunkFetch::next_request(const Timestamp &now)
+{
+	while (_next < _entries.size()
+		   && _inflight.size() < (int)_cwnd
+		   && _next - _delivered < MAX_BUFFERED) {
+		int i = _next++;
+		Entry &e = _entries[i];
+
+		// already in, or waiting on the request for an earlier copy
+		if (e.state != QUEUED || _pending.get(e.cid) != i)
+			continue;
+
+		e.state = REQUESTED;
+		e.tries = 1;
+		e.sent = now;
+		e.expiry = now + _rto;
+		e.slot = _inflight.size();
+		_inflight.push_back(i);
+
+		if (!_round_start)
+			_round_start = now;
+		return i;
+	}
+	return -1;
+}
+
+void
+XIAChunkFetch::complete(int head, Packet *p, int status)
+{
+	for (int i = head; i >= 0; i = _entries[i].same) {
+		Entry &e = _entries[i];
+
+		unlink_inflight(e);
+		e.state = RECEIVED;
+		e.status = status;
+		e.response = p ? p->clone() : 0;
+		if (e.response)
+			_buffered_bytes += e.response->length();
+	}
+	_pending.erase(_entries[head].cid);
+}
+
+void
+XIAChunkFetch::sample_rtt(const Timestamp &rtt)
+{
+	if (!_srtt) {
+		_srtt = rtt;
+		_rttvar = rtt / 2;
+	} else {
+		Timestamp delta = _srtt > rtt ? _srtt - rtt : rtt - _srtt;
+		_rttvar = (_rttvar * 3 + delta) / 4;
+		_srtt = (_srtt * 7 + rtt) / 8;
+	}
+
+	Timestamp granularity = Timestamp::make_msec(1);
+	_rto = _srtt + (_rttvar * 4 > granularity ? _rttvar * 4 : granularity);
+	if (_rto < Timestamp::make_msec(MIN_RTO))
+		_rto = Timestamp::make_msec(MIN_RTO);
+	else if (_rto > Timestamp::make_msec(MAX_RTO))
+		_rto = Timestamp::make_msec(MAX_RTO);
+}
+
+/*
+** Counts arrivals per round trip. While the window doubles every round the
+** arrival rate should keep climbing; once it stops, the path is full and
+** growing the window further only builds queues.
+*/
+void
+XIAChunkFetch::on_arrival(const Timestamp &now)
+{
+	_round_count++;
+
+	if (!_srtt || now - _round_start < _srtt)
+		return;
+
+	double rate = _round_count / (now - _round_start).doubleval();
+	if (rate > _best_rate * 1.25) {
+		_best_rate = rate;
+		_flat_rounds = 0;
+	} else if (++_flat_rounds >= FLAT_ROUNDS && _cwnd < _ssthresh)
+		_ssthresh = _cwnd;
+
+	_round_start = now;
+	_round_count = 0;
+}
+
+bool
+XIAChunkFetch::received(const XID &cid, Packet *p, int status, const Timestamp &now)
+{
+	HashTable<XID, int>::iterator it = _pending.find(cid);
+	if (it == _pending.end())
+		return false;
+
+	int head = it->second;
+	Entry &e = _entries[head];
+
+	if (e.state == REQUESTED) {
+		// Karn: a retransmitted request can't tell which copy was answered
+		if (e.tries == 1)
+			sample_rtt(now - e.sent);
+
+		if (_cwnd < _ssthresh)
+			_cwnd += 1;
+		else
+			_cwnd += 1 / _cwnd;
+		if (_cwnd > MAX_WINDOW)
+			_cwnd = MAX_WINDOW;
+
+		on_arrival(now);
+	}
+
+	complete(head, p, status);
+	return true;
+}
+
+void
+XIAChunkFetch::expire(const Timestamp &now, Vector<int> &resend, int failed_status)
+{
+	bool lost = false;
+
+	for (int k = 0; k < _inflight.size(); ) {
+		int i = _inflight[k];
+		Entry &e = _entries[i];
+
+		if (e.expiry > now) {
+			k++;
+			continue;
+		}
+
+		lost = true;
+		if (e.tries >= MAX_TRIES) {
+			// complete() takes the entry off _inflight, k now holds another
+			complete(i, 0, failed_status);
+			continue;
+		}
+
+		e.tries++;
+		e.sent = now;
+
+		Timestamp rto = _rto * (1 << (e.tries - 1));
+		if (rto > Timestamp::make_msec(MAX_RTO))
+			rto = Timestamp::make_msec(MAX_RTO);
+		e.expiry = now + rto;
+
+		resend.push_back(i);
+		k++;
+	}
+
+	if (lost && now >= _recovery_end) {
+		_ssthresh = _cwnd / 2 > 2 ? _cwnd / 2 : 2;
+		_cwnd = _ssthresh;
+		_recovery_end = now + (_srtt ? _srtt : _rto);
+	}
+}
+
+bool
+XIAChunkFetch::next_expiry(Timestamp &when) const
+{
+	bool found = false;
+
+	for (int k = 0; k < _inflight.size(); k++) {
+		const Timestamp &t = _entries[_inflight[k]].expiry;
+		if (!found || t < when) {
+			when = t;
+			found = true;
+		}
+	}
+	return found;
+}
+
+int
+XIAChunkFetch::next_delivery() const
+{
+	if (_credit == 0 || _delivered >= _entries.size())
+		return -1;
+	return _entries[_delivered].state == RECEIVED ? _delivered : -1;
+}
+
+void
+XIAChunkFetch::delivered(int i)
+{
+	assert(i == _delivered);
+	Entry &e = _entries[i];
+
+	if (e.response) {
+		_buffered_bytes -= e.response->length();
+		e.response->kill();
+		e.response = 0;
+	}
+	e.state = DELIVERED;
+	e.dag = XIAPath();
+	_delivered++;
+	_credit--;
+}
+
+CLICK_ENDDECLS
+ELEMENT_PROVIDES(XIAChunkFetch)
@@ -0,0 +1,140 @@
+#ifndef CLICK_XIACHUNKFETCH_HH
+#define CLICK_XIACHUNKFETCH_HH
+#include <click/config.h>
+#include <click/packet.hh>
+#include <click/vector.hh>
+#include <click/hashtable.hh>
+#include <click/timestamp.hh>
+#include <click/xid.hh>
+#include <click/xiapath.hh>
+CLICK_DECLS
+
+/*
+** Windowed fetch of a list of chunks for one chunk socket
+**
+** The API hands XTRANSPORT a manifest of content DAGs, and the fetch keeps a
+** window of CID requests outstanding until every chunk is in, handing the
+** chunks back to the application in manifest order.
+**
+** The window starts at INITIAL_WINDOW and grows by one chunk per response
+** (slow start) until the first loss or until the rate at which chunks
+** arrive stops growing for a few round trips, then by one chunk per round
+** trip. A timeout halves it, at most once per round trip. Each chunk is
+** retransmitted on its own timer, from an RTO computed as in TCP and backed
+** off exponentially for that chunk, and is given up on after MAX_TRIES.
+**
+** Chunks that arrive out of order are held until the ones before them are
+** in, and no more than MAX_BUFFERED chunks past the next one to deliver are
+** requested. Delivery is further limited by the credit the application
+** grants, so a slow reader stalls the fetch instead of overrunning its
+** socket.
+**
+** The fetch only keeps state; XTRANSPORT sends the requests and delivers the
+** chunks.
+*/
+class XIAChunkFetch {
+  public:
+	enum {
+		INITIAL_WINDOW = 4,
+		MAX_WINDOW = 256,
+		MAX_BUFFERED = 1024,
+		MAX_TRIES = 8,
+		INITIAL_RTO = 300,			// msec, same as the single chunk requests
+		MIN_RTO = 20,
+		MAX_RTO = 10000,
+		FLAT_ROUNDS = 3				// rounds without faster arrivals to leave slow start
+	};
+
+	XIAChunkFetch(int sequence);
+	~XIAChunkFetch();
+
+	// sequence # of the request that started the fetch, deliveries carry it
+	int sequence() const				{ return _sequence; }
+
+	// appends a chunk to the manifest, or an entry that has already failed
+	void add(const XIAPath &dag);
+	void add_failed(int status);
+	void add_credit(unsigned n)			{ _credit += n; }
+
+	// set while the application still has more of the manifest to send
+	void set_more(bool more)			{ _more = more; }
+
+	int size() const					{ return _entries.size(); }
+	const XIAPath &dag(int i) const		{ return _entries[i].dag; }
+	const XID &cid(int i) const			{ return _entries[i].cid; }
+	bool wants(const XID &cid) const	{ return _pending.find(cid) != _pending.end(); }
+
+	// index of the next chunk to request, or -1 if the window is full
+	int next_request(const Timestamp &now);
+
+	// records the response for cid. the fetch keeps a clone of p
+	bool received(const XID &cid, Packet *p, int status, const Timestamp &now);
+
+	// collects the chunks whose request should be sent again, chunks out of
+	// tries are completed with failed_status
+	void expire(const Timestamp &now, Vector<int> &resend, int failed_status);
+	bool next_expiry(Timestamp &when) const;
+
+	// next chunk the application may have, in manifest order, or -1
+	int next_delivery() const;
+	Packet *response(int i) const		{ return _entries[i].response; }
+	int status(int i) const				{ return _entries[i].status; }
+	void delivered(int i);
+
+	bool done() const					{ return !_more && _delivered == _entries.size(); }
+
+	unsigned window() const				{ return (unsigned)_cwnd; }
+	unsigned inflight() const			{ return _inflight.size(); }
+	Timestamp rto() const				{ return _rto; }
+	uint64_t buffered_bytes() const		{ return _buffered_bytes; }
+
+  private:
+	enum { QUEUED, REQUESTED, RECEIVED, DELIVERED };
+
+	struct Entry {
+		XIAPath dag;
+		XID cid;
+		Packet *response;
+		int status;
+		uint8_t state;
+		uint8_t tries;
+		int slot;					// position in _inflight, -1 if not in flight
+		int same;					// next entry for the same CID, -1 if none
+		Timestamp sent;
+		Timestamp expiry;
+	};
+
+	int _sequence;
+	Vector<Entry> _entries;
+	HashTable<XID, int> _pending;	// first entry not yet received for each CID
+	Vector<int> _inflight;			// entries with a request outstanding
+	int _next;						// next entry to request
+	int _delivered;					// entries handed to the application
+	unsigned _credit;
+	bool _more;
+	uint64_t _buffered_bytes;
+
+	// congestion window, in chunks
+	double _cwnd;
+	double _ssthresh;
+	Timestamp _recovery_end;		// no further cut until then
+
+	// round trip time estimate (RFC 6298)
+	Timestamp _srtt;
+	Timestamp _rttvar;
+	Timestamp _rto;
+
+	// arrival rate per round, used to leave slow start once it levels off
+	Timestamp _round_start;
+	unsigned _round_count;
+	double _best_rate;
+	int _flat_rounds;
+
+	void unlink_inflight(Entry &e);
+	void complete(int head, Packet *p, int status);
+	void sample_rtt(const Timestamp &rtt);
+	void on_arrival(const Timestamp &now);
+};
+
+CLICK_ENDDECLS
+#endif
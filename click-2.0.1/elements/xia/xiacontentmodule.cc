@@ -2,15 +2,20 @@
 #include <click/xiacontentheader.hh>
 #include <click/config.h>
 #include <click/glue.hh>
+#include <click/packet_anno.hh>
 CLICK_DECLS
 
 #define CACHE_DEBUG 1
 
-unsigned int XIAContentModule::PKTSIZE = PACKETSIZE;
 XIAContentModule::XIAContentModule(XIATransport *transport)
 {
     _transport = transport;
+    _pktsize=PACKETSIZE;
     _timer=0;
+    _clock=0;
+    _verify=false;
+    _rejected=0;
+    _promotions=0;
 }
 
 XIAContentModule::~XIAContentModule()
@@ -29,6 +34,97 @@ XIAContentModule::~XIAContentModule()
         chunk=it->second;
         delete chunk;
     }
+
+    HashTable<int, cacheMeta*>::iterator mit;
+    for(mit=_cacheMetaTable.begin(); mit!=_cacheMetaTable.end(); mit++) {
+        struct cacheMeta *cm=mit->second;
+        HashTable<XID, struct contentMeta*>::iterator cit;
+        for(cit=cm->contentMetaTable->begin(); cit!=cm->contentMetaTable->end(); cit++)
+            free(cit->second);
+        delete cm->contentMetaTable;
+        delete cm->replacement;
+        free(cm);
+    }
+
+    HashTable<XID, Vector<Waiting> >::iterator pit;
+    for(pit=_promoting.begin(); pit!=_promoting.end(); pit++)
+        for(int i=0; i<pit->second.size(); i++)
+            pit->second[i].p->kill();
+}
+
+/*
+ * returns where the value of key is stored in an encoded extension header,
+ * so it can be rewritten in place. the value keeps its size
+ */
+uint8_t *XIAContentModule::extValue(unsigned char *ext, uint8_t key)
+{
+    struct click_xia_ext *h = reinterpret_cast<struct click_xia_ext *>(ext);
+    uint8_t *d = h->data;
+    uint8_t *end = ext + h->hlen;
+
+    while (d + 2 <= end && d[0] != 0) {
+        if (d[1] == key)
+            return d + 2;
+        d += 1 + d[0];
+    }
+    assert(false);
+    return 0;
+}
+
+/*
+ * follows dst the way the route engine would from this node: the first XID
+ * in edge order that has a route picks the port, and XIDs routed to this
+ * host move on to the nodes after them. returns -1 if no line card is found
+ */
+int XIAContentModule::egressPort(const XIAPath &dst) const
+{
+    XIAPath::handle_t node = dst.source_node();
+
+    // a path is a DAG, so no walk is longer than its node count
+    for (size_t hops = 0; hops < dst.unparse_node_size(); hops++) {
+        Vector<XIAPath::handle_t> next = dst.next_nodes(node);
+        bool local = false;
+
+        for (int i = 0; i < next.size() && !local; i++) {
+            XID xid = dst.xid(next[i]);
+
+            for (int t = 0; t < _egressTables.size(); t++) {
+                if (_egressTables[t]->xid_type() != xid.xid().type)
+                    continue;
+
+                int port = _egressTables[t]->lookup_port(xid);
+                if (port >= 0)
+                    return port;
+                if (port == DESTINED_FOR_LOCALHOST) {
+                    node = next[i];
+                    local = true;
+                }
+                break;
+            }
+        }
+        if (!local)
+            break;
+    }
+    return -1;
+}
+
+/*
+ * the response goes to the request's source. if its port can't be found
+ * the smallest MTU is used, so the packets fit whichever port it is
+ */
+unsigned int XIAContentModule::packetSize(Packet *request) const
+{
+    XIAHeader hdr(request);
+    int port = egressPort(hdr.src_path());
+
+    if (port >= 0 && port < _port_mtu.size())
+        return _port_mtu[port] ? _port_mtu[port] : _pktsize;
+
+    unsigned int size = _pktsize;
+    for (int i = 0; i < _port_mtu.size(); i++)
+        if (_port_mtu[i] && _port_mtu[i] < size)
+            size = _port_mtu[i];
+    return size;
 }
 
 Packet * XIAContentModule::makeChunkResponse(CChunk * chunk, Packet *p_in)
@@ -49,6 +145,7 @@ Packet * XIAContentModule::makeChunkResponse(CChunk * chunk, Packet *p_in)
 
     p=contenth.encap(p);		// add XIA header
     p=encap.encap( p, false );
+    SET_XIA_CID_HASH_ANNO(p, chunk->hashState());
 
     return p;
 }
@@ -88,6 +185,7 @@ Packet * XIAContentModule::makeChunkPush(CChunk * chunk, Packet *p_in)
 
     p=contenth.encap(p);		// add XIA header
     p=encap.encap( p, false );
+    SET_XIA_CID_HASH_ANNO(p, chunk->hashState());
 	
     if(CACHE_DEBUG)
       click_chatter("Push message built in contentmodule \n");
@@ -147,6 +245,9 @@ void XIAContentModule::process_request(Packet *p, const XID & srcHID, const XID
         ContentHeader ch(p);
         if(it!=_contentTable.end() && (content[dstCID]=1)  /* This is an intended assignemnt */
                 && (ch.opcode()==ContentHeader::OP_REQUEST)) { /* Filter out redundant request for RPT reliability */
+            if (it->second->policy())
+                it->second->policy()->touch(it->second);
+
             XIAHeaderEncap encap;
             XIAHeader hdr(p);
 
@@ -181,6 +282,9 @@ void XIAContentModule::process_request(Packet *p, const XID & srcHID, const XID
             //std::cout<<"In client"<<std::endl;
             //std::cout<<"payload: "<<pl<<std::endl;
             //std::cout<<"have pushed out"<<std::endl;
+        } else if(it==_contentTable.end() && ch.opcode()==ContentHeader::OP_REQUEST
+                && promote(p, srcHID, dstCID)) {
+            return;
         }
         p->kill();
         return ;
@@ -189,6 +293,9 @@ void XIAContentModule::process_request(Packet *p, const XID & srcHID, const XID
     // server, router
     if(it!=_contentTable.end()) {
         //std::cout<<"look up cache in router or server"<<std::endl;
+        if (it->second->policy() == &_routerPolicy)
+            _routerPolicy.touch(it->second, _clock);
+
         XIAHeaderEncap encap;
         XIAHeader hdr(p);
         XIAPath myown_source;  // AD:HID:CID add_node, add_edge
@@ -206,26 +313,51 @@ void XIAContentModule::process_request(Packet *p, const XID & srcHID, const XID
         encap.set_dst_path(hdr.src_path());
         encap.set_nxt(CLICK_XIA_NXT_CID);
 
-        // add content header   dataoffset
-        unsigned int cp=0;
-        ContentHeaderEncap  dummy_contenth(0, 0, 0, 0);
+        // the headers of the fragments only differ in the offset and length
+        // fields, so they are encoded once and patched for each fragment
+        ContentHeaderEncap  contenth(0, 0, 0, s);
+        size_t xhlen = encap.hdr_size();
+        size_t hdrsize = xhlen + contenth.hlen();
+        unsigned char *tmpl = new unsigned char[hdrsize];
+
+        memcpy(tmpl, encap.hdr(), xhlen);
+        memcpy(tmpl + xhlen, contenth.hdr(), contenth.hlen());
+        uint8_t *f_offset = extValue(tmpl + xhlen, ContentHeader::CHUNK_OFFSET);
+        uint8_t *f_length = extValue(tmpl + xhlen, ContentHeader::LENGTH);
+        Timestamp now = Timestamp::now();
+
+        unsigned int pktsize = packetSize(p);
+        if (pktsize <= hdrsize) {
+            click_chatter("packet size %u leaves no room for content\n", pktsize);
+            delete[] tmpl;
+            p->kill();
+            return;
+        }
 
+        unsigned int cp=0;
         while(cp < s) {
-            uint16_t hdrsize = encap.hdr_size()+ dummy_contenth.hlen();
-            int l= (s-cp) < (PKTSIZE - hdrsize) ? (s-cp) : (PKTSIZE - hdrsize);
-            ContentHeaderEncap  contenth(0, cp, l, s);
-            //build packet
-            WritablePacket *newp = Packet::make(hdrsize, pl + cp , l, 20 );
-            newp=contenth.encap(newp);
-            encap.set_plen(l);	// add XIA header
-            newp=encap.encap( newp, false );
-// 	    click_chatter("Found in router cache! CID: %s, Local Address: %s\n", dstCID.unparse().c_str(),  _transport->local_hid().unparse().c_str());
-	    
+            uint16_t l= (s-cp) < (pktsize - hdrsize) ? (s-cp) : (pktsize - hdrsize);
+
+            memcpy(f_offset, &cp, sizeof(uint32_t));
+            memcpy(f_length, &l, sizeof(uint16_t));
+            reinterpret_cast<struct click_xia *>(tmpl)->plen = htons(l);
+
+            // a single copy of the payload, straight out of the cache
+            WritablePacket *newp = Packet::make(0, 0, hdrsize + l, 20);
+            if (!newp)
+                break;
+            memcpy(newp->data(), tmpl, hdrsize);
+            memcpy(newp->data() + hdrsize, pl + cp, l);
+            newp->set_xia_header(reinterpret_cast<struct click_xia *>(newp->data()), xhlen);
+            newp->timestamp_anno() = now;
+
             _transport->checked_output_push(0 , newp);
-            //std::cout<<"have pushed out"<<std::endl;
             cp += l;
         }
+        delete[] tmpl;
         p->kill();
+    } else if(promote(p, srcHID, dstCID)) {
+        // answered once the chunk is back from disk
     } else { //printf("dstID is not found in cache, pkt killed\n");
         //std::cout<<"not found, kill pkt"<<std::endl;
 		click_chatter("no content found\n");
@@ -245,53 +377,55 @@ void XIAContentModule::cache_incoming_forward(Packet *p, const XID& srcCID)
 
     //std::cout<<"dst is not myself"<<std::endl;
     HashTable<XID,CChunk*>::iterator it;
+    _clock++;
     it=_contentTable.find(srcCID);
     if (it!=_contentTable.end()) {  //already in contentTable
-        content[it->first]=1;
+        if (it->second->policy() == &_routerPolicy)
+            _routerPolicy.touch(it->second, _clock);
     } else {
         it=_partialTable.find(srcCID);
         if(it!=_partialTable.end()) { //found in partialTable
-            partial[it->first]=1;
             CChunk *chunk=it->second;
             chunk->fill(payload, offset, length);
             if(chunk->full()) {
-                _contentTable[srcCID]=chunk;
-                content[srcCID]=1;
-                addRoute(srcCID);
-                partial.erase(it->first);
+                _partialPolicy.remove(chunk);
                 _partialTable.erase(it);
+                if(chunk->hashState()==XIA_CID_HASH_INVALID) {
+                    rejectChunk(chunk);
+                } else {
+                    _contentTable[srcCID]=chunk;
+                    _routerPolicy.insert(chunk, chunk->id(), chunk->footprint(), _clock);
+                    addRoute(srcCID);
+                }
+            } else {
+                _partialPolicy.touch(chunk, _clock);
+            }
+        } else if(chunkSize > 0 && chunkSize <= MAX_CHUNKSIZE) {  //first pkt of a chunk
+            MakeSpace(XIASlabAllocator::block_size(chunkSize));
+            CChunk *chunk=new CChunk(srcCID, chunkSize, &_slab);
+            if(!chunk->valid()) {
+                click_chatter("no memory to cache %s", srcCID.unparse().c_str());
+                delete chunk;
+                p->kill();
+                return;
             }
-        } else {                     //first pkt of a chunk
-            CChunk *chunk=new CChunk(srcCID, chunkSize);
+            if(_verify)
+                chunk->startHash();
             chunk->fill(payload, offset, length);//  allocate space for new chunk
-            MakeSpace(chunkSize);  //lru
 
-            if(chunk->full()) {
+            if(chunk->full() && chunk->hashState()==XIA_CID_HASH_INVALID) {
+                rejectChunk(chunk);
+            } else if(chunk->full()) {
                 _contentTable[srcCID]=chunk;
-                content[srcCID]=1;
+                _routerPolicy.insert(chunk, chunk->id(), chunk->footprint(), _clock);
                 //modify routing table	  //add
                 addRoute(srcCID);
             } else {
                 _partialTable[srcCID]=chunk;
-                partial[srcCID]=1;
+                _partialPolicy.insert(chunk, chunk->id(), chunk->footprint(), _clock);
             }
-            usedSize += chunkSize;
         }
     }
-    //lru refresh
-    //printf("lru refresh\n");
-    //std::cout<<timer<<std::endl;
-    _timer++;
-    if(_timer>=REFRESH) {
-        HashTable<XID,int>::iterator iter;
-        for(iter=content.begin(); iter!=content.end(); iter++) {
-            iter->second=0;
-        }
-        for(iter=partial.begin(); iter!=partial.end(); iter++) {
-            iter->second=0;
-        }
-        _timer=0;
-    }
     p->kill();
     //printf("end: dstHID is not myself\n");
 
@@ -320,9 +454,9 @@ void XIAContentModule::cache_incoming_local(Packet* p, const XID& srcCID, bool l
 
     if(cacheEntry==NULL){
         struct cacheMeta *cm=(struct cacheMeta *)malloc(sizeof(cacheMeta));
-        cm->curSize=0;
         cm->maxSize=cacheSize;
         cm->policy=cachePolicy;
+        cm->replacement=new XIACachePolicy(XIACachePolicy::parse(cachePolicy));
         cm->contentMetaTable=new HashTable<XID, struct contentMeta*>();
         _cacheMetaTable[contextID]=cm;
         if(CACHE_DEBUG){
@@ -386,7 +520,17 @@ void XIAContentModule::cache_incoming_local(Packet* p, const XID& srcCID, bool l
                 _partialTable[srcCID]=chunk;
             }
         } else {			//first pkt to the client
-            chunk=new CChunk(srcCID, chunkSize);
+            chunk=new CChunk(srcCID, chunkSize, &_slab);
+            if(!chunk->valid()) {
+                click_chatter("dropping %s, bad chunk size %d or out of memory", srcCID.unparse().c_str(), chunkSize);
+                delete chunk;
+                p->kill();
+                return;
+            }
+            // the transport checks the CID of everything it didn't publish
+            // itself, spare it hashing the whole chunk once it is in
+            if(!local_putcid)
+                chunk->startHash();
             chunk->fill(payload, offset, length);
             if(chunk->full()){
                 chunkFull=true;
@@ -405,17 +549,25 @@ void XIAContentModule::cache_incoming_local(Packet* p, const XID& srcCID, bool l
             _transport->checked_output_push(1 , newp);
         }
 #ifdef CLIENTCACHE
-        if (local_putcid || _cache_content_from_network) {
+        if (local_putcid || (_cache_content_from_network && chunk->hashState()!=XIA_CID_HASH_INVALID)) {
             struct cacheMeta *cm= _cacheMetaTable[contextID];
-            cm->curSize+=chunkSize;
             struct contentMeta *ctm=(struct contentMeta *)malloc(sizeof(contentMeta));
             ctm->chunkSize=chunkSize;
             ctm->ttl=ttl;
             gettimeofday(&(ctm->timestamp),NULL);
             HashTable <XID, struct contentMeta*> *cmTable=cm->contentMetaTable;
+            free(cmTable->get(srcCID));
             (*cmTable)[srcCID]=ctm;
-            
+
+            // an older copy of the chunk may still be cached
+            CChunk *old=_contentTable.get(srcCID);
+            if (old && old!=chunk) {
+                if (old->policy())
+                    old->policy()->remove(old);
+                delete old;
+            }
             _contentTable[srcCID]=chunk;
+            cm->replacement->insert(chunk, chunk->id(), chunk->footprint());
             if (local_putcid) {
                 assert(ContentHeader::OP_LOCAL_PUTCID>1);
                 content[srcCID]= ContentHeader::OP_LOCAL_PUTCID;
@@ -447,113 +599,45 @@ void XIAContentModule::cache_incoming_local(Packet* p, const XID& srcCID, bool l
 /** 
  * @brief Clean up local cache based on policy 
  *
+ * Evicts chunks in the order chosen by the context's replacement policy
+ * until the context fits in its maximum size again.
+ *
  * @returns Void
  */ 
 void XIAContentModule::applyLocalCachePolicy(int contextID){
 #ifdef CLIENTCACHE
     struct cacheMeta *cm=_cacheMetaTable[contextID];
-    switch(cm->policy){
-    case POLICY_FIFO:
+    XIACachePolicy *policy=cm->replacement;
+
     if(CACHE_DEBUG){
-        click_chatter("Cache Size %d/%d\n", cm->curSize, cm->maxSize);
-    }
-    if(cm->maxSize!=0 && cm->curSize>cm->maxSize){
-        bool done=false;
-        HashTable<XID, struct contentMeta*> *cmTable=cm->contentMetaTable;
-        /* Remove expired content until curSize < maxSize */
-        struct contentMeta *cPtr;
-        int chunkSize;
-        HashTable<XID,CChunk*>::iterator cit;
-        cit=_contentTable.begin();
-        while(cit!=_contentTable.end()) {
-            int contentType=content[cit->first];
-            if(contentType == ContentHeader::OP_LOCAL_PUTCID){
-                cPtr=(*cmTable)[cit->first];
-                if(isExpiredContent(cPtr)){
-                    chunkSize=cPtr->chunkSize;
-                    cm->curSize-=chunkSize;
-                    cmTable->erase(cit->first);
-                    content.erase(cit->first);
-                    if(CACHE_DEBUG){
-                    click_chatter("RM [%s] Size: %d\n", cit->first.unparse().c_str(), 
-                            chunkSize);
-                    }
-                    _contentTable.erase(cit);
-                    free(cPtr);
-                    if(cm->curSize < cm->maxSize){
-                        done=true;                        
-                        break;
-                    }
-                }       
-            }
-            cit++;
-        }
-        /* Remove old but active contents to make space for new one */
-        if(!done){
-            while(cm->curSize>cm->maxSize){
-                const XID *minID=findOldestContent(contextID);
-                if(minID!=NULL){
-                    const XID tmp=*minID;
-                    cPtr=(*cmTable)[tmp];
-                    chunkSize=cPtr->chunkSize;
-                    cm->curSize-=chunkSize;
-                    cmTable->erase(tmp);
-                    content.erase(tmp);
-                    if(CACHE_DEBUG){
-                    click_chatter("RM [%s] Size: %d\n", _contentTable.find(tmp)->first.unparse().c_str(), 
-                            chunkSize);
-                    }
-                    _contentTable.erase(tmp);
-                    free(cPtr);
-                }
-            }
-        }
+        click_chatter("Cache Size %d/%d\n", (int)policy->bytes(), cm->maxSize);
     }
-    break;
-        default:
-    break;
+    while(cm->maxSize!=0 && policy->bytes() > (unsigned)cm->maxSize) {
+        CChunk *chunk=static_cast<CChunk *>(policy->victim());
+        if(chunk==NULL)
+            break;
+        if(CACHE_DEBUG){
+            click_chatter("RM [%s] Size: %d\n", chunk->id().unparse().c_str(), chunk->GetSize());
+        }
+        removeLocalContent(cm, chunk);
     }
 #endif
 }
 
 /**
- * @brief check if a content is expired
- * 
- * @returns True if it is expired
+ * @brief forget a chunk cached in a local context
+ *
+ * The chunk must already be out of the context's replacement policy.
  */
-bool XIAContentModule::isExpiredContent(struct contentMeta* cm){
-    int ttl=cm->ttl;
-    struct timeval *thisTime=&(cm->timestamp);    
-    struct timeval curTime;
-    gettimeofday(&curTime,NULL);
-    if(thisTime->tv_sec+ttl >= curTime.tv_sec){
-        return true;
-    }else{
-        return false;
-    }
-}
-
-const XID* XIAContentModule::findOldestContent(int contextID){
-    struct cacheMeta *cm=_cacheMetaTable[contextID];
-    HashTable<XID,CChunk*>::iterator cit;
-    cit=_contentTable.begin();
-    const XID *minID=NULL;
-    struct timeval minTime;
-    gettimeofday(&minTime, NULL);
-    HashTable<XID, struct contentMeta*>* cmTable=cm->contentMetaTable;
-    struct contentMeta *cPtr;
-    while(cit!=_contentTable.end()) {
-        int contentType=content[cit->first];
-        if(contentType == ContentHeader::OP_LOCAL_PUTCID){
-            cPtr=(*cmTable)[cit->first];
-            if(cPtr->timestamp.tv_sec<=minTime.tv_sec){
-                minTime=cPtr->timestamp;
-                minID=&(cit->first);
-            }
-        }
-        cit++;
-    }
-    return minID;
+void XIAContentModule::removeLocalContent(struct cacheMeta *cm, CChunk *chunk){
+    XID cid=chunk->id();
+
+    free(cm->contentMetaTable->get(cid));
+    cm->contentMetaTable->erase(cid);
+    content.erase(cid);
+    delRoute(cid);
+    _contentTable.erase(cid);
+    delete chunk;
 }
 
 void XIAContentModule::cache_incoming_remove(Packet *p, const XID& srcCID){
@@ -561,24 +645,17 @@ void XIAContentModule::cache_incoming_remove(Packet *p, const XID& srcCID){
     ContentHeader ch(p);
 
 	uint32_t contextID=ch.contextID();
-    struct cacheMeta *cm=_cacheMetaTable[contextID];
+    struct cacheMeta *cm=_cacheMetaTable.get(contextID);
     if(cm!=NULL){
-        HashTable<XID, struct contentMeta*> *cmTable=cm->contentMetaTable;
-        struct contentMeta* cPtr=(*cmTable)[srcCID];
-        if(cPtr!=NULL){
-            int chunkSize=cPtr->chunkSize;
-            cm->curSize-=chunkSize;
-            cmTable->erase(srcCID);
-            content.erase(srcCID);
+        CChunk *chunk=_contentTable.get(srcCID);
+        if(chunk!=NULL && chunk->policy()==cm->replacement){
             if(CACHE_DEBUG){
-            click_chatter("RMCID Request [%s] Size: %d\n", _contentTable.find(srcCID)->first.unparse().c_str(), 
-                            chunkSize);
+            click_chatter("RMCID Request [%s] Size: %d\n", srcCID.unparse().c_str(), chunk->GetSize());
             }
-            delRoute(srcCID);
-            _contentTable.erase(srcCID);
-            free(cPtr);
+            cm->replacement->remove(chunk);
+            removeLocalContent(cm, chunk);
             if(CACHE_DEBUG){
-            click_chatter("Cache Size %d/%d\n", cm->curSize, cm->maxSize);
+            click_chatter("Cache Size %d/%d\n", (int)cm->replacement->bytes(), cm->maxSize);
             }
         }
     }
@@ -598,21 +675,46 @@ void XIAContentModule::cache_management()
         delete chunk;
     }
     _oldPartial.clear();
-    _oldPartial=_partialTable;
     /* Never delete chunk in the _partialTable here
        because the chunks are still used in the _oldPartialTable
-       This have created a bug before.  */
-    _partialTable.clear();
+       This have created a bug before.
+       Partial chunks cached for the router are aged by MakeSpace instead. */
+    it=_partialTable.begin();
+    while(it!=_partialTable.end()) {
+        if(it->second->policy()==&_partialPolicy) {
+            it++;
+            continue;
+        }
+        _oldPartial[it->first]=it->second;
+        it=_partialTable.erase(it);
+    }
 #ifdef CLIENTCACHE
     cit=_contentTable.begin();
     while(cit!=_contentTable.end()) {
-        int contentType=content[cit->first];
+        chunk=cit->second;
+        if(chunk->policy()==&_routerPolicy) {
+            cit++;
+            continue;
+        }
+        int contentType=content.get(cit->first);
         if( contentType == 0 ) {
-            HashTable<XID, CChunk*>::iterator pit=cit;
-            _oldPartial[pit->first]=pit->second;
-            delRoute(pit->first);
-            content.erase(pit->first);
-            _contentTable.erase(pit);
+            if(XIACachePolicy *policy=chunk->policy()) {
+                // drop it from the context that cached it
+                HashTable<int, cacheMeta*>::iterator mit;
+                for(mit=_cacheMetaTable.begin(); mit!=_cacheMetaTable.end(); mit++) {
+                    if(mit->second->replacement==policy) {
+                        free(mit->second->contentMetaTable->get(cit->first));
+                        mit->second->contentMetaTable->erase(cit->first);
+                    }
+                }
+                policy->remove(chunk);
+            }
+            _oldPartial[cit->first]=chunk;
+            if(!demote(chunk))
+                delRoute(cit->first);
+            content.erase(cit->first);
+            cit=_contentTable.erase(cit);
+            continue;
         }else if(contentType != ContentHeader::OP_LOCAL_PUTCID){
             content[cit->first]=0;
         }
@@ -650,173 +752,315 @@ void XIAContentModule::cache_incoming(Packet *p, const XID& srcCID, const XID& d
 	}
 }
 
-int
-XIAContentModule::MakeSpace(int chunkSize)
+/* a chunk that doesn't hash to its CID is never cached or served */
+void
+XIAContentModule::rejectChunk(CChunk *chunk)
 {
-    while( usedSize + chunkSize > MAXSIZE) {
-        HashTable<XID,int>::iterator i;
-        for(i=partial.begin(); i!=partial.end(); i++)
-            if(i->second==0)
-                break;
+    click_chatter("%s does not match its content, not caching it", chunk->id().unparse().c_str());
+    _rejected++;
+    delete chunk;
+}
+
+/*
+ * keeps a chunk evicted from memory in the disk store. its route stays, so
+ * requests for it still reach the cache
+ */
+bool
+XIAContentModule::demote(CChunk *chunk)
+{
+    if(!_disk.is_open() || chunk->hashState()==XIA_CID_HASH_INVALID)
+        return false;
 
+    Vector<XID> dropped;
+    bool stored=_disk.put(chunk->id(), chunk->GetPayload(), chunk->GetSize(), dropped);
 
-        if(i!=partial.end()) {
-            HashTable<XID,CChunk*>::iterator iter = _partialTable.find(i->first);
-            usedSize-=iter->second->GetSize();
+    // chunks pushed off the end of the disk can't be served any more
+    for(int i=0; i<dropped.size(); i++) {
+        if(!_contentTable.get(dropped[i]) && _promoting.find(dropped[i])==_promoting.end())
+            delRoute(dropped[i], false);
+    }
+    return stored;
+}
 
-            CChunk *t=iter->second;
+/* starts reading a chunk back from disk, p is answered once it is in */
+bool
+XIAContentModule::promote(Packet *p, const XID &srcHID, const XID &cid)
+{
+    if(!_disk.contains(cid))
+        return false;
 
-            _partialTable.erase(iter);
-            partial.erase(i);
+    HashTable<XID, Vector<Waiting> >::iterator it=_promoting.find(cid);
+    if(it==_promoting.end()) {
+        if(!_disk.read(cid))
+            return false;
+        it=_promoting.find_insert(cid);
+    }
 
-            delete t;
-            continue;
+    Waiting w;
+    w.p=p;
+    w.srcHID=srcHID;
+    it->second.push_back(w);
+    return true;
+}
+
+void
+XIAContentModule::promoted()
+{
+    XID cid;
+    char *data;
+    unsigned length;
+
+    while(_disk.next_read(cid, data, length)) {
+        Vector<Waiting> waiting;
+        HashTable<XID, Vector<Waiting> >::iterator it=_promoting.find(cid);
+        if(it!=_promoting.end()) {
+            waiting.swap(it->second);
+            _promoting.erase(it);
         }
 
-        for(i=content.begin(); i!=content.end(); i++) {
-            if(i->second==0)
-                break;
+        CChunk *chunk=_contentTable.get(cid);
+        if(data && !chunk) {
+            _clock++;
+            MakeSpace(XIASlabAllocator::block_size(length));
+            chunk=new CChunk(cid, length, &_slab);
+            if(chunk->valid()) {
+                chunk->fill((const unsigned char *)data, 0, length);
+                _contentTable[cid]=chunk;
+                _routerPolicy.insert(chunk, chunk->id(), chunk->footprint(), _clock);
+                _promotions++;
+            } else {
+                delete chunk;
+                chunk=NULL;
+            }
+        }
+        delete[] data;
+
+        if(!chunk) {
+            if(!_disk.contains(cid)) {
+                // it was bad on disk
+                click_chatter("%s could not be read back from disk", cid.unparse().c_str());
+                delRoute(cid);
+            } else
+                click_chatter("no room to bring %s back from disk", cid.unparse().c_str());
+
+            // answering them would only park them for another read, the
+            // requesters ask again
+            for(int i=0; i<waiting.size(); i++)
+                waiting[i].p->kill();
+            continue;
         }
 
-        if(i!=content.end()) {
-            HashTable<XID,CChunk*>::iterator iter=_contentTable.find(i->first);
-            usedSize-=iter->second->GetSize();
-            // modify the routin table	     //delete
-            delRoute(iter->first);
-            CChunk *t=iter->second;
-            _contentTable.erase(iter);
-            content.erase(i);
-            delete t;
+        for(int i=0; i<waiting.size(); i++)
+            process_request(waiting[i].p, waiting[i].srcHID, cid);
+    }
+}
+
+int
+XIAContentModule::MakeSpace(int chunkSize)
+{
+    while(usedSize() + chunkSize > MAXSIZE) {
+        CChunk *chunk=static_cast<CChunk *>(_partialPolicy.oldest());
+
+        if(chunk!=NULL && _clock - chunk->stamp() >= (unsigned)REFRESH) {
+            // nothing has arrived for this chunk in a while, give up on it
+            _partialPolicy.remove(chunk);
+            _partialTable.erase(chunk->id());
+            delete chunk;
             continue;
         }
 
-        HashTable<XID,CChunk*>::iterator iter=_partialTable.begin();
-        if(iter!=_partialTable.end()) {
-            usedSize-=iter->second->GetSize();
-            CChunk *t=iter->second;
-            _partialTable.erase(iter);
-            partial.erase(i);
-            delete t;
+        if((chunk=static_cast<CChunk *>(_routerPolicy.victim()))!=NULL) {
+            // modify the routing table, unless the chunk can still be
+            // served from disk
+            if(!demote(chunk))
+                delRoute(chunk->id());
+            _contentTable.erase(chunk->id());
+            delete chunk;
             continue;
         }
 
-        iter=_contentTable.begin();
-        usedSize-=iter->second->GetSize();
-        //modify routing table	   //delete
+        if((chunk=static_cast<CChunk *>(_partialPolicy.victim()))!=NULL) {
+            _partialTable.erase(chunk->id());
+            delete chunk;
+            continue;
+        }
 
-        delRoute(iter->first);
-        CChunk *t=iter->second;
-        _contentTable.erase(iter);
-        content.erase(iter->first);
-        delete t;
+        // the chunk is bigger than the whole cache
+        break;
     }
     return 0;
 }
 
-CPart::CPart(unsigned int off, unsigned int len)
+CChunk::CChunk(XID _xid, int chunkSize, XIASlabAllocator *_slab): slab(_slab), deleted(false)
 {
-    offset=off;
-    length=len;
-}
-
-CChunk::CChunk(XID _xid, int chunkSize): deleted(false)
-{
-    size=chunkSize;
+    // the size comes off the wire, the caller checks valid() before use
+    if(chunkSize > 0 && chunkSize <= MAX_CHUNKSIZE) {
+        size=chunkSize;
+        payload=(char *)slab->allocate(size);
+    } else {
+        size=0;
+        payload=NULL;
+    }
     complete=false;
-    payload=new char[size];
     xid=_xid;
+    stride=0;
+    nparts=0;
+    nreceived=0;
+    received=NULL;
+    tailOffset=-1;
+    sha=NULL;
+    hashed=0;
+    hash_state=XIA_CID_HASH_UNCHECKED;
 }
 
 CChunk::~CChunk()
 {
-    /* TODO: Memory leak prevention -- CPartList has to be deallocated */
-    delete payload;
+    resetParts();
+    EVP_MD_CTX_free(sha);
+    slab->deallocate(payload, size);
+}
+
+void CChunk::startHash()
+{
+    if(sha || complete)
+        return;
+    if(!(sha=EVP_MD_CTX_new())) {
+        // a chunk that can't be checked can't be trusted either
+        hash_state=XIA_CID_HASH_INVALID;
+        return;
+    }
+    restartHash();
 }
 
-void CChunk::Merge(CPartList::iterator it)
+void CChunk::restartHash()
 {
-    //std::cout<<"enter Merge: offset is "<< it->offset <<std::endl;
-    CPartList::iterator post_it;
-    post_it=it;
-    post_it++;
-
-    while(1) {
-        if(post_it==parts.end()) break;
-        if(post_it->v.offset > it->v.offset+it->v.length) {
+    if(sha) {
+        EVP_DigestInit_ex(sha, EVP_sha1(), NULL);
+        hashed=0;
+    }
+}
+
+/* feeds sha the fragments that now continue the hashed prefix */
+void CChunk::hashAhead()
+{
+    while(sha && stride && hashed < size) {
+        unsigned int i=hashed / stride;
+        if(!(received[i >> 6] & ((uint64_t)1 << (i & 63))))
             break;
-        } else {
-            unsigned int l=it->v.offset+it->v.length;
-            unsigned int _l=post_it->v.offset+post_it->v.length;
-            if(l>_l) {
-                CPartListNode *n = post_it.get();
-                parts.erase(post_it);
-                delete n;
-            } else {
-                it->v.length= _l - it->v.offset;
-                CPartListNode *n = post_it.get();
-                parts.erase(post_it);
-                delete n;
-            }
-            post_it=it;
-            post_it++;
-        }
+
+        unsigned int l=(size - hashed < stride) ? size - hashed : stride;
+        EVP_DigestUpdate(sha, payload + hashed, l);
+        hashed += l;
     }
 }
 
+void CChunk::finishHash()
+{
+    if(!sha)
+        return;
+
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    EVP_DigestUpdate(sha, payload + hashed, size - hashed);
+    EVP_DigestFinal_ex(sha, digest, NULL);
+    EVP_MD_CTX_free(sha);
+    sha=NULL;
+
+    hash_state=memcmp(digest, xid.xid().id, SHA_DIGEST_LENGTH) ? XIA_CID_HASH_INVALID : XIA_CID_HASH_VALID;
+}
+
+int CChunk::setStride(unsigned int _stride)
+{
+    unsigned int n=(size + _stride - 1) / _stride;
+    size_t bytes=((n + 63) / 64) * sizeof(uint64_t);
+
+    if(!(received=(uint64_t *)slab->allocate(bytes)))
+        return -1;
+    memset(received, 0, bytes);
+    stride=_stride;
+    nparts=n;
+    nreceived=0;
+
+    // the last fragment may have come in first
+    if(tailOffset >= 0 && (unsigned)tailOffset == (nparts - 1) * stride)
+        markPart(nparts - 1);
+    tailOffset=-1;
+    return 0;
+}
+
+void CChunk::resetParts()
+{
+    if(received)
+        slab->deallocate(received, ((nparts + 63) / 64) * sizeof(uint64_t));
+    received=NULL;
+    stride=0;
+    nparts=0;
+    nreceived=0;
+}
+
+/* returns false if the fragment had already been received */
+bool CChunk::markPart(unsigned int i)
+{
+    uint64_t &w=received[i >> 6];
+    uint64_t bit=(uint64_t)1 << (i & 63);
+
+    if(w & bit)
+        return false;
+    w |= bit;
+    nreceived++;
+    return true;
+}
+
 int
 CChunk::fill(const unsigned char *_payload, unsigned int offset, unsigned int length)
 {
-    //  std::cout<<"enter fill, payload is "<<_payload<<std::endl;
-
-    CPartList::iterator it, post_it;
-    CPart p(offset, length);
-    char *off = payload + offset ;
-
-    for( it=parts.begin(); it!=parts.end(); it++ ) {
-        if(it->v.offset > offset)break;
-    }
-    if(it==parts.end()) {  //end
-        if(it==parts.begin()) { //empty
-            //std::cout<<"push back"<<std::endl;
-            memcpy(off, _payload, length);
-            parts.push_back(new CPartListNode(p));
-        } else {            //not empty
-            it--;
-            if( it->v.offset + it->v.length < offset + length) {
-                memcpy(off, _payload, length);
-                //std::cout<<"off is "<<off<<std::endl;
-                //std::cout<<"push back"<<std::endl;
-                parts.push_back(new CPartListNode(p));
-                Merge(it);
-            }
-        }
-    } else { //not end
-        if(it==parts.begin()) { //begin
-            memcpy(off, _payload, length);
-            //std::cout<<"push front"<<std::endl;
-            parts.push_front(new CPartListNode(p));
-            it=parts.begin();
-            Merge(it);
-        } else {	//not begin
-            it--;
-            if(offset <= it->v.offset + it->v.length ) { //overlap with previous interval
-                if( offset+length <= it->v.offset + it->v.length ) { //cover
-                } else { //not cover
-                    memcpy(off, _payload, length);
-                    it->v.length = (offset+length) - it->v.offset;
-                    Merge(it);
-                }
-            } else { // not overlap with previous interval
-                memcpy(off,_payload, length);
-                //std::cout<<"insert"<<std::endl;
-                parts.insert(post_it, new CPartListNode(p));
-                post_it=it;
-                post_it++;
-                Merge(post_it);
-            }
+    if(complete)
+        return 0;
+    if(length==0 || offset>=size || length>size-offset)
+        return -1;
+
+    if(offset==0 && length==size) {
+        memcpy(payload, _payload, length);
+        resetParts();
+        restartHash();
+        complete=true;
+        finishHash();
+        return 0;
+    }
+
+    bool last=(offset + length == size);
+
+    // every fragment but the last starts on a multiple of its own length
+    if(!last && offset % length)
+        return -1;
+
+    if(stride && (offset % stride || length > stride || (!last && length != stride))) {
+        // cut differently than the fragments so far, most likely another
+        // sender with a different header size. start over on its layout,
+        // keeping the last fragment if it is in since it ends the same way
+        unsigned int tail=nparts - 1;
+        int tailAt=(received[tail >> 6] & ((uint64_t)1 << (tail & 63))) ? (int)(tail * stride) : -1;
+
+        resetParts();
+        restartHash();
+        tailOffset=tailAt;
+    }
+
+    if(stride==0) {
+        if(last) {
+            // the stride can't be told from the last fragment, hold on to
+            // its offset until a full sized one arrives
+            memcpy(payload + offset, _payload, length);
+            tailOffset=offset;
+            return 0;
         }
+        if(setStride(length) < 0)
+            return -1;
+    }
+
+    if(markPart(offset / stride)) {
+        memcpy(payload + offset, _payload, length);
+        hashAhead();
     }
-    //  std::cout<<"leave fill: list size is "<<parts.size()<<std::endl;
     return 0;
 }
 
@@ -826,11 +1070,10 @@ CChunk::full()
 {
     if(complete==true) return true;
 
-    CPartList::iterator it;
-    it= parts.begin();
-
-    if( it->v.offset==0 && it->v.length==size) {
+    if(stride && nreceived==nparts) {
+        resetParts();
         complete=true;
+        finishHash();
         return true;
     }
     return false;
@@ -838,4 +1081,6 @@ CChunk::full()
 
 CLICK_ENDDECLS
 //ELEMENT_REQUIRES(userlevel)
+ELEMENT_REQUIRES(XIACachePolicy XIASlabAllocator XIADiskStore)
 ELEMENT_PROVIDES(XIAContentModule)
+ELEMENT_LIBS(-lcrypto)
@@ -7,41 +7,30 @@
 #include <clicknet/xia.h>
 #include <click/hashtable.hh>
 #include <click/xiapath.hh>
+#include <click/vector.hh>
 #include <map>
+#include <openssl/sha.h>
+#include <openssl/evp.h>
 
 #include "xiaxidroutetable.hh"
 #include "xiatransport.hh"
+#include "xiacachepolicy.hh"
+#include "xiaslaballocator.hh"
+#include "xiadiskstore.hh"
 
 #define CACHESIZE 1024*1024*1024    //only for router cache (endhost cahe is virtually unlimited, but is periodically refreshed)
 #define CLIENTCACHE
 #define PACKETSIZE 1024		
-
-#define POLICY_FIFO 1
+#define MAX_CHUNKSIZE (1024*1024)   // biggest chunk the cache will reassemble, well above XIA_MAXCHUNK
 
 
 CLICK_DECLS
 class XIAContentModule;
 class XIATransport;
 
-class CPart{
-    public: 
-	CPart(unsigned int,unsigned int);
-	~CPart(){}
-	unsigned int offset;
-	unsigned int length;
-};
-
-struct CPartListNode {
-	CPart v;
- 	List_member<CPartListNode> link;
-	CPartListNode(CPart p) : v(p) {}
-};
-
-typedef List<CPartListNode, &CPartListNode::link> CPartList;
-
-class CChunk{
+class CChunk : public CacheEntry {
     public:
-	CChunk(XID, int);
+	CChunk(XID, int, XIASlabAllocator *);
 	~CChunk();
 	int fill(const unsigned char* , unsigned int, unsigned int);
 	bool full();
@@ -53,16 +42,43 @@ class CChunk{
 	{
 	    return payload;
 	}
-	XID id() { return xid; };
+	const XID &id() const { return xid; };
+	// false if the size was out of range or the payload couldn't be allocated
+	bool valid() const { return payload != NULL; }
+	// bytes the payload takes out of the slab
+	unsigned int footprint() const { return XIASlabAllocator::block_size(size); }
+
+	// hash the payload as it fills in, see XIA_CID_HASH_ANNO for the result
+	void startHash();
+	uint8_t hashState() const { return hash_state; }
     private:
+	XIASlabAllocator *slab;
 	XID xid;
 	bool complete;
 	unsigned int size;
 	char* payload;
-	CPartList parts; 
 	bool deleted;
 
-	void Merge(CPartList::iterator);
+	// reassembly state. every fragment but the last carries stride bytes,
+	// which is only known once one of them arrives
+	unsigned int stride;
+	unsigned int nparts;
+	unsigned int nreceived;
+	uint64_t *received;			// one bit per stride sized fragment
+	int tailOffset;				// last fragment seen before the stride, or -1
+
+	// SHA-1 of the payload, fed each fragment as soon as everything before
+	// it is in so only what arrived out of order is left when it completes
+	EVP_MD_CTX *sha;			// NULL unless hashing
+	unsigned int hashed;		// length of the prefix fed to sha
+	uint8_t hash_state;
+
+	int setStride(unsigned int);
+	void resetParts();
+	bool markPart(unsigned int);
+	void restartHash();
+	void hashAhead();
+	void finishHash();
 };
 
 /* Client local cache*/
@@ -73,9 +89,9 @@ struct contentMeta{
 };
 
 struct cacheMeta{
-    int curSize;
     int maxSize;
     int policy;
+    XIACachePolicy *replacement;	// orders the context's chunks for eviction
     HashTable <XID, struct contentMeta*> *contentMetaTable;
 };
 
@@ -90,6 +106,9 @@ class XIAContentModule {
     void cache_incoming(Packet *p, const XID &, const XID &, int port);
     void process_request(Packet *p, const XID &, const XID &);
 
+    // brings chunks the disk store has finished reading back into memory
+    void promoted();
+
 	int malicious; // Respond to CID requests with bad data if set to 1
 
     protected:
@@ -102,6 +121,8 @@ class XIAContentModule {
     XIAPath _local_addr;
     XIAXIDRouteTable *_routeTable;  //XIAXIDRouteTable 
     bool _cache_content_from_network;
+    bool _verify;					// check chunks against their CID before caching them
+    unsigned _rejected;				// chunks that didn't match their CID
     HashTable<XID,CChunk*> _partialTable;
     HashTable<XID, CChunk*>_contentTable;
     HashTable<XID, CChunk*>_oldPartial; /* only used in client. When refresh timer is
@@ -110,33 +131,66 @@ class XIAContentModule {
 
     HashTable<int, cacheMeta*> _cacheMetaTable;
     
-    unsigned int usedSize;
     static const unsigned int MAXSIZE=CACHESIZE;
-    static unsigned int PKTSIZE;    
-    //lru    
+
+    // largest packet sent when serving a chunk. the response's first hop is
+    // looked up in the route tables, and ports with a known MTU use that
+    unsigned int _pktsize;
+    Vector<unsigned int> _port_mtu;		// by line card, 0 if unknown
+    Vector<XIAXIDRouteTable *> _egressTables;	// the router's tables, by any type
+    unsigned int packetSize(Packet *request) const;
+    int egressPort(const XIAPath &dst) const;
     static const int REFRESH=1000000;
     int _timer;
-    HashTable<XID, int> partial;
     HashTable<XID, int> content;   
+
+    // router cache replacement. partial chunks are kept in arrival order and
+    // the ones that have been idle for REFRESH packets are evicted first
+    XIACachePolicy _routerPolicy;
+    XIACachePolicy _partialPolicy;
+    unsigned _clock;				// # of content packets seen by the router cache
+
+    // chunk payloads and fragment lists are carved out of here. the policies
+    // are charged the slab block size, so usedSize is what the cache holds
+    XIASlabAllocator _slab;
+
+    unsigned int usedSize() const { return _routerPolicy.bytes() + _partialPolicy.bytes(); }
+
+    // chunks evicted from memory are kept here if it is open, and requests
+    // for them wait in _promoting while they are read back in
+    struct Waiting {
+	Packet *p;
+	XID srcHID;
+    };
+    XIADiskStore _disk;
+    HashTable<XID, Vector<Waiting> > _promoting;
+    unsigned _promotions;
+
+    bool demote(CChunk *chunk);
+    bool promote(Packet *p, const XID &srcHID, const XID &cid);
+
+    static uint8_t *extValue(unsigned char *ext, uint8_t key);
     Packet *makeChunkResponse(CChunk * chunk, Packet *p_in);
     Packet *makeChunkPush(CChunk * chunk, Packet *p_in);
     int MakeSpace(int);    
+    void rejectChunk(CChunk *chunk);
 
     //Cache Policy
     void applyLocalCachePolicy(int);
-    const XID* findOldestContent(int);
-    bool isExpiredContent(struct contentMeta* cm);
+    void removeLocalContent(struct cacheMeta *cm, CChunk *chunk);
 
     //modify routing table
-    void addRoute(const XID &cid) {
+    void addRoute(const XID &cid, bool verbose = true) {
 	String cmd=cid.unparse() + " " + String(DESTINED_FOR_LOCALHOST);
-	click_chatter("Add route %s", cid.unparse().c_str());
+	if (verbose)
+	    click_chatter("Add route %s", cid.unparse().c_str());
 	HandlerCall::call_write(_routeTable, "add", cmd);
     } 
 
-    void delRoute(const XID &cid) {
+    void delRoute(const XID &cid, bool verbose = true) {
 	String cmd= cid.unparse();
-	click_chatter("Del route %s", cid.unparse().c_str());
+	if (verbose)
+	    click_chatter("Del route %s", cid.unparse().c_str());
 	HandlerCall::call_write(_routeTable, "remove", cmd);
     }    
 };
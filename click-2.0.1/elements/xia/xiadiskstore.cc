@@ -0,0 +1,538 @@
+#include <click/config.h>
+#include "xiadiskstore.hh"
+#include <click/straccum.hh>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <algorithm>
+#include <openssl/sha.h>
+CLICK_DECLS
+
+XIADiskStore::XIADiskStore()
+	: _limit(0), _segment_size(0), _bytes(0), _next_id(0),
+	  _writes(0), _reads(0), _failed(0), _dropped(0),
+	  _nreaders(0), _writing(false), _backlog(0), _stop(false)
+{
+	_notify[0] = _notify[1] = -1;
+	pthread_mutex_init(&_lock, NULL);
+	pthread_cond_init(&_cond, NULL);
+	pthread_cond_init(&_write_cond, NULL);
+}
+
+XIADiskStore::~XIADiskStore()
+{
+	close();
+	pthread_cond_destroy(&_write_cond);
+	pthread_cond_destroy(&_cond);
+	pthread_mutex_destroy(&_lock);
+}
+
+String
+XIADiskStore::segment_path(unsigned id) const
+{
+	char name[32];
+
+	sprintf(name, "/%08u.chunks", id);
+	return _dir + name;
+}
+
+XIADiskStore::Segment *
+XIADiskStore::open_segment(unsigned id, ErrorHandler *errh)
+{
+	String path = segment_path(id);
+	int fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+
+	if (fd < 0) {
+		if (errh)
+			errh->error("%s: %s", path.c_str(), strerror(errno));
+		else
+			click_chatter("%s: %s", path.c_str(), strerror(errno));
+		return 0;
+	}
+
+	Segment *s = new Segment;
+	s->id = id;
+	s->fd = fd;
+	s->size = 0;
+	s->pending = 0;
+	s->dropped = false;
+	return s;
+}
+
+/*
+** Indexes the records in a segment left by an earlier run. Anything after the
+** last whole record was cut short and is trimmed, the payloads are checked
+** when they are read back.
+*/
+void
+XIADiskStore::scan_segment(Segment *s)
+{
+	struct stat st;
+	uint64_t off = 0;
+
+	if (fstat(s->fd, &st) < 0)
+		st.st_size = 0;
+
+	while (off + sizeof(Record) <= (uint64_t)st.st_size) {
+		Record r;
+
+		if (pread(s->fd, &r, sizeof(r), off) != (ssize_t)sizeof(r)
+			|| r.magic != MAGIC
+			|| r.length > st.st_size - off - sizeof(r))
+			break;
+
+		XID cid(r.xid);
+		Location loc = { s, off, r.length };
+		_index.set(cid, loc);
+		s->cids.push_back(cid);
+		off += sizeof(r) + r.length;
+	}
+
+	if (off < (uint64_t)st.st_size && ftruncate(s->fd, off) < 0)
+		click_chatter("%s: can't trim: %s", segment_path(s->id).c_str(), strerror(errno));
+	s->size = off;
+	_bytes += off;
+}
+
+int
+XIADiskStore::open(const String &dir, uint64_t limit, ErrorHandler *errh)
+{
+	if (is_open())
+		close();
+
+	if (limit == 0)
+		return errh->error("disk store for %s has no room", dir.c_str());
+	if (mkdir(dir.c_str(), 0755) < 0 && errno != EEXIST)
+		return errh->error("%s: %s", dir.c_str(), strerror(errno));
+
+	DIR *d = opendir(dir.c_str());
+	if (!d)
+		return errh->error("%s: %s", dir.c_str(), strerror(errno));
+
+	_dir = dir;
+	_limit = limit;
+	_segment_size = limit / SEGMENTS > MIN_SEGMENT ? limit / SEGMENTS : (uint64_t)MIN_SEGMENT;
+	_next_id = 0;
+
+	Vector<unsigned> ids;
+	while (struct dirent *e = readdir(d)) {
+		unsigned id;
+		int n = 0;
+
+		if (sscanf(e->d_name, "%u.chunks%n", &id, &n) == 1 && e->d_name[n] == '\0')
+			ids.push_back(id);
+	}
+	closedir(d);
+	std::sort(ids.begin(), ids.end());
+
+	for (int i = 0; i < ids.size(); i++) {
+		Segment *s = open_segment(ids[i], errh);
+		if (!s) {
+			close();
+			return -1;
+		}
+		scan_segment(s);
+		_segments.push_back(s);
+		_next_id = ids[i] + 1;
+	}
+
+	// the limit may have come down since the last run
+	Vector<XID> dropped;
+	while (_bytes > _limit && _segments.size() > 0)
+		drop_oldest(dropped);
+
+	if (pipe(_notify) < 0) {
+		_notify[0] = _notify[1] = -1;
+		close();
+		return errh->error("disk store: %s", strerror(errno));
+	}
+	fcntl(_notify[0], F_SETFL, O_NONBLOCK);
+	fcntl(_notify[1], F_SETFL, O_NONBLOCK);
+
+	_stop = false;
+	for (_nreaders = 0; _nreaders < READERS; _nreaders++)
+		if (pthread_create(&_readers[_nreaders], NULL, reader, this) != 0)
+			break;
+	if (_nreaders == 0) {
+		close();
+		return errh->error("disk store: can't start a reader");
+	}
+	if (pthread_create(&_writer, NULL, writer, this) != 0) {
+		close();
+		return errh->error("disk store: can't start the writer");
+	}
+	_writing = true;
+	return 0;
+}
+
+void
+XIADiskStore::close()
+{
+	pthread_mutex_lock(&_lock);
+	_stop = true;
+	pthread_cond_broadcast(&_cond);
+	pthread_cond_signal(&_write_cond);
+	pthread_mutex_unlock(&_lock);
+	for (int i = 0; i < _nreaders; i++)
+		pthread_join(_readers[i], NULL);
+	_nreaders = 0;
+
+	// the writer empties its queue first, so the chunks are there next time
+	if (_writing) {
+		pthread_join(_writer, NULL);
+		_writing = false;
+	}
+	reap_writes();
+
+	// reads that never finished or were never picked up
+	while (_requests.size() || _results.size()) {
+		DEQueue<Read> &q = _requests.size() ? _requests : _results;
+		Read &r = q.front();
+
+		delete[] r.data;
+		done(r.loc.seg);
+		q.pop_front();
+	}
+
+	while (_segments.size()) {
+		release(_segments.front());
+		_segments.pop_front();
+	}
+	_index.clear();
+	_bytes = 0;
+
+	for (int i = 0; i < 2; i++)
+		if (_notify[i] >= 0) {
+			::close(_notify[i]);
+			_notify[i] = -1;
+		}
+}
+
+void
+XIADiskStore::release(Segment *s)
+{
+	::close(s->fd);
+	delete s;
+}
+
+/* a read or write of s is over, s goes once the last one is if it was dropped */
+void
+XIADiskStore::done(Segment *s)
+{
+	if (--s->pending == 0 && s->dropped)
+		release(s);
+}
+
+/* deletes the oldest segment, its chunks that weren't stored again since are gone */
+void
+XIADiskStore::drop_oldest(Vector<XID> &dropped)
+{
+	Segment *s = _segments.front();
+	_segments.pop_front();
+
+	for (int i = 0; i < s->cids.size(); i++) {
+		HashTable<XID, Location>::iterator it = _index.find(s->cids[i]);
+		if (it != _index.end() && it->second.seg == s) {
+			_index.erase(it);
+			dropped.push_back(s->cids[i]);
+			_dropped++;
+		}
+	}
+
+	_bytes -= s->size;
+	unlink(segment_path(s->id).c_str());
+	s->dropped = true;
+	s->cids.clear();
+	if (s->pending == 0)
+		release(s);
+}
+
+bool
+XIADiskStore::put(const XID &cid, const char *data, unsigned length, Vector<XID> &dropped)
+{
+	uint64_t recsize = sizeof(Record) + length;
+
+	if (!is_open() || recsize > _limit)
+		return false;
+	if (contains(cid))
+		return true;
+
+	pthread_mutex_lock(&_lock);
+	bool behind = _backlog && _backlog + recsize > MAX_BACKLOG;
+	pthread_mutex_unlock(&_lock);
+	if (behind)
+		return false;
+
+	Segment *s = _segments.size() ? _segments.back() : 0;
+	if (!s || (s->size && s->size + recsize > _segment_size)) {
+		if (!(s = open_segment(_next_id++, 0)))
+			return false;
+		_segments.push_back(s);
+	}
+
+	// the caller's copy may be gone before the writer gets to it
+	Write w;
+	w.cid = cid;
+	w.loc.seg = s;
+	w.loc.offset = s->size;
+	w.loc.length = length;
+	w.record = new char[recsize];
+	w.error = 0;
+
+	Record *r = reinterpret_cast<Record *>(w.record);
+	r->magic = MAGIC;
+	r->length = length;
+	r->xid = cid.xid();
+	memcpy(w.record + sizeof(Record), data, length);
+	s->pending++;
+
+	pthread_mutex_lock(&_lock);
+	_queued.push_back(w);
+	_backlog += recsize;
+	pthread_cond_signal(&_write_cond);
+	pthread_mutex_unlock(&_lock);
+
+	_index.set(cid, w.loc);
+	s->cids.push_back(cid);
+	s->size += recsize;
+	_bytes += recsize;
+	_writes++;
+
+	// never drop the segment just written to
+	while (_bytes > _limit && _segments.size() > 1)
+		drop_oldest(dropped);
+	return true;
+}
+
+bool
+XIADiskStore::read(const XID &cid)
+{
+	HashTable<XID, Location>::iterator it = _index.find(cid);
+
+	if (it == _index.end() || !is_open())
+		return false;
+
+	Read r;
+	r.cid = cid;
+	r.loc = it->second;
+	r.data = 0;
+	r.loc.seg->pending++;
+
+	pthread_mutex_lock(&_lock);
+	if (queued_copy(r)) {
+		_results.push_back(r);
+		notify();
+	} else {
+		_requests.push_back(r);
+		pthread_cond_signal(&_cond);
+	}
+	pthread_mutex_unlock(&_lock);
+	return true;
+}
+
+/* called with _lock held. r is taken from its record if that isn't written yet */
+bool
+XIADiskStore::queued_copy(Read &r)
+{
+	for (int i = 0; i < _queued.size(); i++) {
+		const Write &w = _queued[i];
+
+		if (w.loc.seg == r.loc.seg && w.loc.offset == r.loc.offset) {
+			r.data = new char[r.loc.length ? r.loc.length : 1];
+			memcpy(r.data, w.record + sizeof(Record), r.loc.length);
+			return true;
+		}
+	}
+	return false;
+}
+
+/* a full pipe already has the content module's attention */
+void
+XIADiskStore::notify()
+{
+	if (write(_notify[1], "", 1) < 0) {
+		// nothing more to do
+	}
+}
+
+void *
+XIADiskStore::reader(void *arg)
+{
+	XIADiskStore *ds = static_cast<XIADiskStore *>(arg);
+
+	pthread_mutex_lock(&ds->_lock);
+	while (!ds->_stop) {
+		if (ds->_requests.size() == 0) {
+			pthread_cond_wait(&ds->_cond, &ds->_lock);
+			continue;
+		}
+
+		Read r = ds->_requests.front();
+		ds->_requests.pop_front();
+		pthread_mutex_unlock(&ds->_lock);
+
+		ds->read_record(r);
+
+		pthread_mutex_lock(&ds->_lock);
+		ds->_results.push_back(r);
+		ds->notify();
+	}
+	pthread_mutex_unlock(&ds->_lock);
+	return 0;
+}
+
+/* runs on a reader thread, only touches r and the segment's fd */
+void
+XIADiskStore::read_record(Read &r)
+{
+	Record hdr;
+	unsigned char digest[SHA_DIGEST_LENGTH];
+	char *data = new char[r.loc.length ? r.loc.length : 1];
+	int fd = r.loc.seg->fd;
+
+	if (pread(fd, &hdr, sizeof(hdr), r.loc.offset) == (ssize_t)sizeof(hdr)
+		&& hdr.magic == MAGIC
+		&& hdr.length == r.loc.length
+		&& XID(hdr.xid) == r.cid
+		&& pread(fd, data, r.loc.length, r.loc.offset + sizeof(hdr)) == (ssize_t)r.loc.length) {
+
+		SHA1((const unsigned char *)data, r.loc.length, digest);
+		if (memcmp(digest, r.cid.xid().id, SHA_DIGEST_LENGTH) == 0) {
+			r.data = data;
+			return;
+		}
+	}
+	delete[] data;
+}
+
+void *
+XIADiskStore::writer(void *arg)
+{
+	XIADiskStore *ds = static_cast<XIADiskStore *>(arg);
+
+	pthread_mutex_lock(&ds->_lock);
+	while (!ds->_stop || ds->_queued.size()) {
+		if (ds->_queued.size() == 0) {
+			pthread_cond_wait(&ds->_write_cond, &ds->_lock);
+			continue;
+		}
+
+		// it stays queued while it's written, so reads can still find it
+		Write w = ds->_queued.front();
+		ssize_t size = sizeof(Record) + w.loc.length;
+		pthread_mutex_unlock(&ds->_lock);
+
+		ssize_t n = pwrite(w.loc.seg->fd, w.record, size, w.loc.offset);
+		if (n != size)
+			w.error = n < 0 ? errno : EIO;
+
+		pthread_mutex_lock(&ds->_lock);
+		ds->_queued.pop_front();
+		ds->_backlog -= size;
+		delete[] w.record;
+		w.record = 0;
+		ds->_written.push_back(w);
+		ds->notify();
+	}
+	pthread_mutex_unlock(&ds->_lock);
+	return 0;
+}
+
+/*
+** Accounts for the records the writer has finished. One that couldn't be
+** written leaves a hole, which is trimmed along with the rest of its segment
+** the next time the store is opened, so it is taken out of the index now.
+*/
+void
+XIADiskStore::reap_writes()
+{
+	pthread_mutex_lock(&_lock);
+	while (_written.size()) {
+		Write w = _written.front();
+		_written.pop_front();
+		pthread_mutex_unlock(&_lock);
+
+		if (w.error) {
+			click_chatter("%s: write failed: %s", segment_path(w.loc.seg->id).c_str(), strerror(w.error));
+			HashTable<XID, Location>::iterator it = _index.find(w.cid);
+			if (it != _index.end() && it->second.seg == w.loc.seg && it->second.offset == w.loc.offset)
+				_index.erase(it);
+			_failed++;
+		}
+		done(w.loc.seg);
+
+		pthread_mutex_lock(&_lock);
+	}
+	pthread_mutex_unlock(&_lock);
+}
+
+bool
+XIADiskStore::next_read(XID &cid, char *&data, unsigned &length)
+{
+	char buf[64];
+
+	// empty the pipe before looking, a read finishing after this writes to
+	// it again
+	while (::read(_notify[0], buf, sizeof(buf)) > 0)
+		;
+	reap_writes();
+
+	pthread_mutex_lock(&_lock);
+	if (_results.size() == 0) {
+		pthread_mutex_unlock(&_lock);
+		return false;
+	}
+	Read r = _results.front();
+	_results.pop_front();
+	pthread_mutex_unlock(&_lock);
+
+	Segment *s = r.loc.seg;
+	if (r.data)
+		_reads++;
+	else {
+		// bad or missing on disk, don't try it again
+		HashTable<XID, Location>::iterator it = _index.find(r.cid);
+		if (it != _index.end() && it->second.seg == s && it->second.offset == r.loc.offset)
+			_index.erase(it);
+		_failed++;
+	}
+
+	done(s);
+
+	cid = r.cid;
+	data = r.data;
+	length = r.loc.length;
+	return true;
+}
+
+void
+XIADiskStore::cids(Vector<XID> &v) const
+{
+	for (HashTable<XID, Location>::const_iterator it = _index.begin(); it != _index.end(); ++it)
+		v.push_back(it->first);
+}
+
+String
+XIADiskStore::stats() const
+{
+	StringAccum sa;
+
+	sa << "dir " << _dir << '\n'
+	   << "chunks " << _index.size() << '\n'
+	   << "bytes " << _bytes << '\n'
+	   << "limit " << _limit << '\n'
+	   << "segments " << _segments.size() << '\n'
+	   << "writes " << _writes << '\n'
+	   << "reads " << _reads << '\n'
+	   << "failed " << _failed << '\n'
+	   << "dropped " << _dropped << '\n';
+	return sa.take_string();
+}
+
+CLICK_ENDDECLS
+ELEMENT_REQUIRES(userlevel)
+ELEMENT_PROVIDES(XIADiskStore)
+ELEMENT_LIBS(-lcrypto -lpthread)
@@ -0,0 +1,160 @@
+#ifndef CLICK_XIADISKSTORE_HH
+#define CLICK_XIADISKSTORE_HH
+#include <click/config.h>
+#include <click/string.hh>
+#include <click/vector.hh>
+#include <click/dequeue.hh>
+#include <click/hashtable.hh>
+#include <click/xid.hh>
+#include <click/error.hh>
+#include <pthread.h>
+CLICK_DECLS
+
+/*
+** Append-only chunk store on local disk, the second tier of the content cache
+**
+** Chunks are appended to segment files in a directory, each record a small
+** header naming the CID followed by the payload, and are found through an
+** in-memory index by CID. Once the store grows past its limit the oldest
+** segment is deleted whole, so space is reclaimed without ever rewriting a
+** file. The index is rebuilt by scanning the segments when the store is
+** opened, so the chunks survive a restart, and a record cut short by a
+** crash is trimmed off.
+**
+** The index is updated as soon as a chunk is put, but the record itself is
+** copied and handed to a writer thread, so the caller never waits on the
+** disk. A chunk read before its record is written is served from the copy.
+** Reads are handed to a pair of reader threads, which also check the data
+** against its CID, and are picked up with next_read() once notify_fd() turns
+** readable. Finished writes are accounted for there too.
+**
+** Apart from the reader and writer threads the store belongs to a single
+** content module.
+*/
+class XIADiskStore {
+  public:
+	enum {
+		SEGMENTS = 16,					// the limit is split about this many ways
+		MIN_SEGMENT = 4 << 20,
+		READERS = 2,
+		MAX_BACKLOG = 64 << 20			// bytes waiting for the writer
+	};
+
+	XIADiskStore();
+	~XIADiskStore();
+
+	int open(const String &dir, uint64_t limit, ErrorHandler *errh);
+	void close();
+	bool is_open() const				{ return _notify[0] >= 0; }
+
+	bool contains(const XID &cid) const	{ return _index.find(cid) != _index.end(); }
+
+	// appends a chunk unless it is already stored, false if it can't be or the
+	// writer is too far behind. CIDs whose only copy went with segments
+	// deleted to make room are added to dropped
+	bool put(const XID &cid, const char *data, unsigned length, Vector<XID> &dropped);
+
+	// starts reading a chunk, false if it isn't stored
+	bool read(const XID &cid);
+
+	// readable while reads or writes are waiting to be picked up
+	int notify_fd() const				{ return _notify[0]; }
+
+	// a finished read. data is NULL if the chunk was lost or corrupt, in which
+	// case it is gone from the index too. the caller frees data with delete[]
+	bool next_read(XID &cid, char *&data, unsigned &length);
+
+	// CIDs stored, to route them when the store is opened
+	void cids(Vector<XID> &v) const;
+
+	uint64_t bytes() const				{ return _bytes; }
+	uint64_t limit() const				{ return _limit; }
+	unsigned count() const				{ return _index.size(); }
+	String dir() const					{ return _dir; }
+	String stats() const;
+
+  private:
+	enum { MAGIC = 0x58434b31 };		// "XCK1"
+
+	struct Record {
+		uint32_t magic;
+		uint32_t length;				// payload bytes that follow
+		struct click_xia_xid xid;
+	};
+
+	struct Segment {
+		unsigned id;
+		int fd;
+		uint64_t size;
+		Vector<XID> cids;				// records in the segment, in order
+		int pending;					// reads and writes in flight, the fd stays open until 0
+		bool dropped;
+	};
+
+	struct Location {
+		Segment *seg;
+		uint64_t offset;				// of the record header
+		unsigned length;
+	};
+
+	struct Read {
+		XID cid;
+		Location loc;
+		char *data;
+	};
+
+	struct Write {
+		XID cid;
+		Location loc;
+		char *record;					// header and payload, NULL once written
+		int error;						// errno if it couldn't be written
+	};
+
+	String _dir;
+	uint64_t _limit;
+	uint64_t _segment_size;
+	uint64_t _bytes;
+	unsigned _next_id;
+
+	DEQueue<Segment *> _segments;		// oldest first, the last one takes writes
+	HashTable<XID, Location> _index;
+
+	// stats
+	uint64_t _writes;
+	uint64_t _reads;
+	uint64_t _failed;
+	uint64_t _dropped;
+
+	// reader and writer threads. the queues are guarded by _lock
+	pthread_t _readers[READERS];
+	int _nreaders;
+	pthread_t _writer;
+	bool _writing;
+	pthread_mutex_t _lock;
+	pthread_cond_t _cond;
+	pthread_cond_t _write_cond;
+	DEQueue<Read> _requests;
+	DEQueue<Read> _results;
+	DEQueue<Write> _queued;				// the writer works on the front one
+	DEQueue<Write> _written;
+	uint64_t _backlog;					// record bytes in _queued
+	bool _stop;
+	int _notify[2];						// written once per finished read or write
+
+	String segment_path(unsigned id) const;
+	Segment *open_segment(unsigned id, ErrorHandler *errh);
+	void scan_segment(Segment *s);
+	void drop_oldest(Vector<XID> &dropped);
+	void release(Segment *s);
+	void done(Segment *s);
+	void reap_writes();
+	void notify();
+
+	static void *reader(void *arg);
+	void read_record(Read &r);
+	static void *writer(void *arg);
+	bool queued_copy(Read &r);
+};
+
+CLICK_ENDDECLS
+#endif
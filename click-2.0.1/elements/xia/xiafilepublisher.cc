@@ -0,0 +1,320 @@
+#include <click/config.h>
+#include "xiafilepublisher.hh"
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <openssl/sha.h>
+CLICK_DECLS
+
+XIAFilePublisher::XIAFilePublisher()
+	: _nthreads(0), _task(0), _stop(false)
+{
+	pthread_mutex_init(&_lock, NULL);
+	pthread_cond_init(&_cond, NULL);
+}
+
+XIAFilePublisher::~XIAFilePublisher()
+{
+	stop();
+	pthread_cond_destroy(&_cond);
+	pthread_mutex_destroy(&_lock);
+}
+
+bool
+XIAFilePublisher::start(Task *task)
+{
+	if (_nthreads > 0)
+		return true;
+
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	int want = cpus < 1 ? 1 : (cpus > MAX_THREADS ? (int)MAX_THREADS : (int)cpus);
+
+	_task = task;
+	_stop = false;
+	for (_nthreads = 0; _nthreads < want; _nthreads++)
+		if (pthread_create(&_threads[_nthreads], NULL, publisher, this) != 0)
+			break;
+	return _nthreads > 0;
+}
+
+void
+XIAFilePublisher::stop()
+{
+	pthread_mutex_lock(&_lock);
+	_stop = true;
+	pthread_cond_broadcast(&_cond);
+	pthread_mutex_unlock(&_lock);
+	for (int i = 0; i < _nthreads; i++)
+		pthread_join(_threads[i], NULL);
+	_nthreads = 0;
+
+	// batches that never finished or were never picked up
+	while (_jobs.size()) {
+		Job *j = _jobs.front();
+		_jobs.pop_front();
+		j->pending -= j->batch->chunks.size() - j->next;
+		j->next = j->batch->chunks.size();
+		if (j->pending == 0)
+			finish(j);
+	}
+	while (Batch *b = next_batch()) {
+		for (int i = 0; i < b->chunks.size(); i++)
+			if (b->chunks[i])
+				b->chunks[i]->kill();
+		delete b;
+	}
+}
+
+void
+XIAFilePublisher::submit(Batch *b)
+{
+	Job *j = new Job;
+
+	j->batch = b;
+	j->fd = -1;
+	j->next = 0;
+	j->pending = b->chunks.size();
+	j->bad = b->chunks.size();
+	j->opening = false;
+	b->error = 0;
+
+	pthread_mutex_lock(&_lock);
+	if (j->pending == 0)
+		finish(j);
+	else {
+		_jobs.push_back(j);
+		pthread_cond_broadcast(&_cond);
+	}
+	pthread_mutex_unlock(&_lock);
+}
+
+XIAFilePublisher::Batch *
+XIAFilePublisher::next_batch()
+{
+	Batch *b = 0;
+
+	pthread_mutex_lock(&_lock);
+	if (_results.size()) {
+		b = _results.front();
+		_results.pop_front();
+	}
+	pthread_mutex_unlock(&_lock);
+	return b;
+}
+
+void *
+XIAFilePublisher::publisher(void *arg)
+{
+	static_cast<XIAFilePublisher *>(arg)->run();
+	return 0;
+}
+
+/*
+** Runs on each publisher thread. The first thread to find a batch opens its
+** file, then every thread takes chunks from it until they are all handed out.
+*/
+void
+XIAFilePublisher::run()
+{
+	pthread_mutex_lock(&_lock);
+	while (!_stop) {
+		if (_jobs.size() == 0) {
+			pthread_cond_wait(&_cond, &_lock);
+			continue;
+		}
+
+		Job *j = _jobs.front();
+		int n = j->batch->chunks.size();
+
+		if (j->opening) {
+			pthread_cond_wait(&_cond, &_lock);
+			continue;
+		}
+
+		if (j->fd < 0) {
+			j->opening = true;
+			pthread_mutex_unlock(&_lock);
+			int fd = open_file(j->batch);
+			int err = errno;
+			pthread_mutex_lock(&_lock);
+			j->opening = false;
+			pthread_cond_broadcast(&_cond);
+
+			if (fd < 0) {
+				_jobs.pop_front();
+				j->batch->error = err;
+				j->pending -= n;
+				j->next = n;
+				finish(j);
+			} else
+				j->fd = fd;
+			continue;
+		}
+
+		int i = j->next++;
+		if (j->next == n)
+			_jobs.pop_front();
+
+		WritablePacket *p = 0;
+		if (i < j->bad) {
+			pthread_mutex_unlock(&_lock);
+			p = read_chunk(j->fd, j->batch->msg.x_putfile(), i);
+			pthread_mutex_lock(&_lock);
+			if (!p && i < j->bad)
+				j->bad = i;
+		}
+		j->batch->chunks[i] = p;
+
+		if (--j->pending == 0)
+			finish(j);
+	}
+	pthread_mutex_unlock(&_lock);
+}
+
+/* called with _lock held once every chunk of j has been read or skipped */
+void
+XIAFilePublisher::finish(Job *j)
+{
+	if (j->fd >= 0)
+		close(j->fd);
+	_results.push_back(j->batch);
+	delete j;
+	if (_task)
+		_task->reschedule();
+}
+
+/*
+** The inode of the UDP socket bound to port, 0 if there isn't one. API
+** sockets talk to click over IPv4.
+*/
+static unsigned long
+socket_inode(unsigned short port)
+{
+	FILE *f = fopen("/proc/net/udp", "r");
+	char line[256];
+	unsigned long inode = 0;
+
+	if (!f)
+		return 0;
+
+	// skip the header
+	if (fgets(line, sizeof(line), f)) {
+		while (fgets(line, sizeof(line), f)) {
+			unsigned lport;
+			unsigned long ino;
+
+			if (sscanf(line, "%*d: %*x:%x %*x:%*x %*x %*x:%*x %*x:%*x %*x %*d %*d %lu",
+					&lport, &ino) == 2 && lport == port) {
+				inode = ino;
+				break;
+			}
+		}
+	}
+	fclose(f);
+	return inode;
+}
+
+/* pid's descriptor fd is the socket bound to port */
+static bool
+holds_socket(unsigned pid, int fd, unsigned short port)
+{
+	char path[64], link[64], want[64];
+	unsigned long inode = socket_inode(port);
+	ssize_t n;
+
+	sprintf(path, "/proc/%u/fd/%d", pid, fd);
+	if (!inode || (n = readlink(path, link, sizeof(link) - 1)) < 0)
+		return false;
+	link[n] = '\0';
+	sprintf(want, "socket:[%lu]", inode);
+	return strcmp(link, want) == 0;
+}
+
+/* pid's descriptor fd is open for reading on the file st describes */
+static bool
+holds_file(unsigned pid, int fd, const struct stat &st)
+{
+	char path[64], line[64];
+	struct stat held;
+	unsigned flags;
+	bool found = false;
+	FILE *f;
+
+	sprintf(path, "/proc/%u/fd/%d", pid, fd);
+	if (stat(path, &held) < 0 || held.st_dev != st.st_dev || held.st_ino != st.st_ino)
+		return false;
+
+	sprintf(path, "/proc/%u/fdinfo/%d", pid, fd);
+	if (!(f = fopen(path, "r")))
+		return false;
+	while (!found && fgets(line, sizeof(line), f))
+		found = sscanf(line, "flags: %o", &flags) == 1;
+	fclose(f);
+	return found && (flags & O_ACCMODE) != O_WRONLY;
+}
+
+/*
+** Opens the file the batch is published from. It's checked after it is
+** opened, so a descriptor swapped in meanwhile fails the check instead of
+** being read.
+*/
+int
+XIAFilePublisher::open_file(const Batch *b)
+{
+	const xia::X_Putfile_Msg &m = b->msg.x_putfile();
+	char path[64];
+	struct stat st;
+	int fd;
+
+	sprintf(path, "/proc/%u/fd/%d", m.pid(), m.fd());
+	if ((fd = open(path, O_RDONLY)) < 0)
+		return -1;
+
+	if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)
+			|| !holds_socket(m.pid(), m.sock(), b->port)
+			|| !holds_file(m.pid(), m.fd(), st)) {
+		close(fd);
+		errno = EACCES;
+		return -1;
+	}
+	return fd;
+}
+
+/*
+** Reads chunk i of the batch into a packet, NULL if it can't be read in full
+** or doesn't match its CID. Reading with pread means a file that shrinks
+** under us ends the batch rather than faulting.
+*/
+WritablePacket *
+XIAFilePublisher::read_chunk(int fd, const xia::X_Putfile_Msg &m, int i)
+{
+	unsigned length = m.length(i);
+	unsigned char digest[SHA_DIGEST_LENGTH];
+	char hex[SHA_DIGEST_LENGTH * 2 + 1];
+	WritablePacket *p = WritablePacket::make(256, (const void *)NULL, length, 0);
+
+	if (!p)
+		return 0;
+	if (pread(fd, p->data(), length, m.offset(i)) != (ssize_t)length) {
+		p->kill();
+		return 0;
+	}
+
+	SHA1(p->data(), length, digest);
+	for (int k = 0; k < SHA_DIGEST_LENGTH; k++)
+		sprintf(&hex[k * 2], "%02x", digest[k]);
+	if (m.cid(i).compare(0, std::string::npos, hex, SHA_DIGEST_LENGTH * 2) != 0) {
+		p->kill();
+		return 0;
+	}
+	return p;
+}
+
+CLICK_ENDDECLS
+ELEMENT_REQUIRES(userlevel)
+ELEMENT_PROVIDES(XIAFilePublisher)
+ELEMENT_LIBS(-lcrypto -lpthread)
@@ -0,0 +1,79 @@
+#ifndef CLICK_XIAFILEPUBLISHER_HH
+#define CLICK_XIAFILEPUBLISHER_HH
+#include <click/config.h>
+#include <click/string.hh>
+#include <click/vector.hh>
+#include <click/dequeue.hh>
+#include <click/packet.hh>
+#include <click/task.hh>
+#include <pthread.h>
+#include "../../userlevel/xia.pb.h"
+CLICK_DECLS
+
+/*
+** Reads and checks the chunks of files published with XputFile, off the
+** Click thread
+**
+** A batch names a file the publishing process has open, and the CID, offset
+** and length of each chunk to publish from it. The file is opened through
+** /proc, but only after checking that the process holds both the API socket
+** the request came in on and the file, open for reading, so click can't be
+** made to read a file the process couldn't read itself. The chunks are read
+** straight from the file into their packets and hashed by a pool of threads,
+** each taking the next chunk of the oldest batch. A finished batch is picked
+** up with next_batch() once the owner's task runs.
+**
+** Apart from the publisher threads, it belongs to a single XTRANSPORT.
+*/
+class XIAFilePublisher {
+  public:
+	enum { MAX_THREADS = 8 };
+
+	struct Batch {
+		unsigned short port;			// API port the request came in on
+		xia::XSocketMsg msg;			// the request, answered when done
+		Vector<WritablePacket *> chunks;	// in order, NULL if it didn't check out
+		int error;						// errno if the file couldn't be opened
+	};
+
+	XIAFilePublisher();
+	~XIAFilePublisher();
+
+	// starts the threads the first time, false if none could be started
+	bool start(Task *task);
+	void stop();
+
+	// takes b, which is handed back by next_batch() once its chunks are read
+	void submit(Batch *b);
+	Batch *next_batch();
+
+  private:
+	struct Job {
+		Batch *batch;
+		int fd;
+		int next;						// next chunk to hand out
+		int pending;					// chunks not read yet
+		int bad;						// first chunk that didn't check out
+		bool opening;
+	};
+
+	pthread_t _threads[MAX_THREADS];
+	int _nthreads;
+	Task *_task;
+
+	// jobs and results are guarded by _lock
+	pthread_mutex_t _lock;
+	pthread_cond_t _cond;
+	DEQueue<Job *> _jobs;
+	DEQueue<Batch *> _results;
+	bool _stop;
+
+	static void *publisher(void *arg);
+	void run();
+	void finish(Job *j);
+	static int open_file(const Batch *b);
+	static WritablePacket *read_chunk(int fd, const xia::X_Putfile_Msg &m, int i);
+};
+
+CLICK_ENDDECLS
+#endif
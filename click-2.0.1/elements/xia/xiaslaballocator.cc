@@ -0,0 +1,214 @@
+#include <click/config.h>
+#include "xiaslaballocator.hh"
+#include <click/straccum.hh>
+#include <stdlib.h>
+CLICK_DECLS
+
+XIASlabAllocator::XIASlabAllocator()
+	: _large(0), _large_bytes(0)
+{
+	for (int i = 0; i < NCLASSES; i++) {
+		_classes[i].empty = 0;
+		_classes[i].slabs = 0;
+		_classes[i].blocks = 0;
+		_classes[i].requested = 0;
+	}
+}
+
+XIASlabAllocator::~XIASlabAllocator()
+{
+	// blocks still out are freed along with their slabs
+	for (int i = 0; i < NCLASSES; i++) {
+		SizeClass &c = _classes[i];
+
+		while (Slab *s = c.partial.front()) {
+			c.partial.erase(s);
+			release_slab(s);
+		}
+		while (Slab *s = c.full.front()) {
+			c.full.erase(s);
+			release_slab(s);
+		}
+		if (c.empty)
+			release_slab(c.empty);
+	}
+}
+
+int
+XIASlabAllocator::size_class(size_t size)
+{
+	if (size > MAX_BLOCK)
+		return -1;
+
+	int cls = 0;
+	while (((size_t)MIN_BLOCK << cls) < size)
+		cls++;
+	return cls;
+}
+
+size_t
+XIASlabAllocator::block_size(size_t size)
+{
+	int cls = size_class(size);
+
+	return cls < 0 ? size : (size_t)MIN_BLOCK << cls;
+}
+
+XIASlabAllocator::Slab *
+XIASlabAllocator::new_slab(int cls)
+{
+	void *mem;
+
+	if (posix_memalign(&mem, SLAB_SIZE, SLAB_SIZE) != 0)
+		return 0;
+
+	size_t bsize = (size_t)MIN_BLOCK << cls;
+	size_t header = (sizeof(Slab) + MIN_BLOCK - 1) & ~(size_t)(MIN_BLOCK - 1);
+
+	Slab *s = new(mem) Slab;
+	s->cls = cls;
+	s->inuse = 0;
+	s->nblocks = (SLAB_SIZE - header) / bsize;
+	s->free_list = 0;
+	s->fresh = reinterpret_cast<char *>(mem) + header;
+	s->end = s->fresh + s->nblocks * bsize;
+
+	_classes[cls].slabs++;
+	return s;
+}
+
+void
+XIASlabAllocator::release_slab(Slab *s)
+{
+	_classes[s->cls].slabs--;
+	s->~Slab();
+	free(s);
+}
+
+void *
+XIASlabAllocator::allocate(size_t size)
+{
+	int cls = size_class(size);
+
+	if (cls < 0) {
+		void *p = malloc(size);
+		if (p) {
+			_large++;
+			_large_bytes += size;
+		}
+		return p;
+	}
+
+	SizeClass &c = _classes[cls];
+	Slab *s = c.partial.front();
+
+	if (!s) {
+		if ((s = c.empty))
+			c.empty = 0;
+		else if (!(s = new_slab(cls)))
+			return 0;
+		c.partial.push_back(s);
+	}
+
+	void *p;
+	if (s->free_list) {
+		p = s->free_list;
+		s->free_list = *reinterpret_cast<void **>(p);
+	} else {
+		p = s->fresh;
+		s->fresh += (size_t)MIN_BLOCK << cls;
+	}
+
+	if (++s->inuse == s->nblocks) {
+		c.partial.erase(s);
+		c.full.push_back(s);
+	}
+
+	c.blocks++;
+	c.requested += size;
+	return p;
+}
+
+void
+XIASlabAllocator::deallocate(void *p, size_t size)
+{
+	if (!p)
+		return;
+
+	int cls = size_class(size);
+
+	if (cls < 0) {
+		free(p);
+		_large--;
+		_large_bytes -= size;
+		return;
+	}
+
+	SizeClass &c = _classes[cls];
+	Slab *s = slab_of(p);
+	assert(s->cls == cls);
+
+	if (s->inuse-- == s->nblocks) {
+		c.full.erase(s);
+		c.partial.push_back(s);
+	}
+
+	*reinterpret_cast<void **>(p) = s->free_list;
+	s->free_list = p;
+	c.blocks--;
+	c.requested -= size;
+
+	if (s->inuse == 0) {
+		c.partial.erase(s);
+		if (!c.empty) {
+			// start the spare over so it is carved front to back again
+			s->free_list = 0;
+			s->fresh = s->end - s->nblocks * ((size_t)MIN_BLOCK << cls);
+			c.empty = s;
+		} else
+			release_slab(s);
+	}
+}
+
+uint64_t
+XIASlabAllocator::allocated() const
+{
+	uint64_t bytes = _large_bytes;
+
+	for (int i = 0; i < NCLASSES; i++)
+		bytes += (uint64_t)_classes[i].blocks << (MIN_SHIFT + i);
+	return bytes;
+}
+
+uint64_t
+XIASlabAllocator::reserved() const
+{
+	uint64_t bytes = _large_bytes;
+
+	for (int i = 0; i < NCLASSES; i++)
+		bytes += (uint64_t)_classes[i].slabs * SLAB_SIZE;
+	return bytes;
+}
+
+String
+XIASlabAllocator::stats() const
+{
+	StringAccum sa;
+
+	for (int i = 0; i < NCLASSES; i++) {
+		const SizeClass &c = _classes[i];
+
+		if (c.slabs == 0)
+			continue;
+		sa << "size " << (MIN_BLOCK << i) << " blocks " << c.blocks
+		   << " slabs " << c.slabs << " requested " << c.requested
+		   << " reserved " << (uint64_t)c.slabs * SLAB_SIZE << "\n";
+	}
+	if (_large)
+		sa << "large blocks " << _large << " requested " << _large_bytes << "\n";
+	sa << "total allocated " << allocated() << " reserved " << reserved() << "\n";
+	return sa.take_string();
+}
+
+CLICK_ENDDECLS
+ELEMENT_PROVIDES(XIASlabAllocator)
@@ -0,0 +1,90 @@
+#ifndef CLICK_XIASLABALLOCATOR_HH
+#define CLICK_XIASLABALLOCATOR_HH
+#include <click/config.h>
+#include <click/list.hh>
+#include <click/string.hh>
+CLICK_DECLS
+
+/*
+** Size-classed slab allocator for the content cache
+**
+** Requests are rounded up to a power of two between MIN_BLOCK and MAX_BLOCK
+** and carved out of SLAB_SIZE arenas that only hold blocks of that size.
+** Slabs are aligned on their own size so a block finds its slab header by
+** masking its address, and each size class keeps one empty slab around so
+** a cache running at capacity does not hand memory back to the system on
+** every eviction. Anything bigger than MAX_BLOCK goes straight to malloc.
+**
+** The slab header takes the first block of every slab, so a slab holds
+** SLAB_SIZE / MAX_BLOCK - 1 blocks of the largest class (31, about 3% lost)
+** and the smaller classes lose proportionally less.
+**
+** The allocator is not thread safe, it belongs to a single content module.
+*/
+class XIASlabAllocator {
+  public:
+	enum {
+		SLAB_SHIFT = 20,
+		SLAB_SIZE = 1 << SLAB_SHIFT,
+		MIN_SHIFT = 6,
+		MAX_SHIFT = 15,
+		MIN_BLOCK = 1 << MIN_SHIFT,
+		MAX_BLOCK = 1 << MAX_SHIFT,
+		NCLASSES = MAX_SHIFT - MIN_SHIFT + 1
+	};
+
+	XIASlabAllocator();
+	~XIASlabAllocator();
+
+	void *allocate(size_t size);
+	void deallocate(void *p, size_t size);
+
+	// bytes actually set aside for a request of size bytes
+	static size_t block_size(size_t size);
+
+	// bytes in blocks handed out, counted at their rounded up block size
+	// rather than the size asked for (see stats() for that)
+	uint64_t allocated() const;
+	// bytes held from the system, including slab headers and spare slabs
+	uint64_t reserved() const;
+
+	// one line per size class in use
+	String stats() const;
+
+  private:
+	struct Slab {
+		List_member<Slab> link;
+		int cls;
+		unsigned inuse;
+		unsigned nblocks;
+		void *free_list;			// blocks that were freed
+		char *fresh;				// blocks never handed out start here
+		char *end;
+	};
+
+	typedef List<Slab, &Slab::link> SlabList;
+
+	struct SizeClass {
+		SlabList partial;			// slabs with free blocks
+		SlabList full;
+		Slab *empty;				// spare slab kept for the next allocation
+		unsigned slabs;
+		unsigned blocks;
+		uint64_t requested;
+	};
+
+	SizeClass _classes[NCLASSES];
+	unsigned _large;
+	uint64_t _large_bytes;
+
+	static int size_class(size_t size);
+	static Slab *slab_of(void *p) {
+		return reinterpret_cast<Slab *>(reinterpret_cast<uintptr_t>(p) & ~(uintptr_t)(SLAB_SIZE - 1));
+	}
+
+	Slab *new_slab(int cls);
+	void release_slab(Slab *s);
+};
+
+CLICK_ENDDECLS
+#endif
@@ -0,0 +1,551 @@
+/*
+ * xiatransportdispatch.{cc,hh} -- spreads XTRANSPORT work across shards
+ *
+ * Copyright 2012 Carnegie Mellon University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "../../userlevel/xia.pb.h"
+#include <click/config.h>
+#include "xiatransportdispatch.hh"
+#include "xtransport.hh"
+#include <click/confparse.hh>
+#include <click/error.hh>
+#include <click/handlercall.hh>
+#include <click/integers.hh>
+#include <click/packet_anno.hh>
+#include <clicknet/xia.h>
+CLICK_DECLS
+
+XIATransportDispatch::XIATransportDispatch()
+	: _nshards(0), _xid_owner(new OwnerTable), _reclaim_timer(this), _task(this)
+{
+	memset(_port_owner, NO_SHARD, sizeof(_port_owner));
+}
+
+XIATransportDispatch::~XIATransportDispatch()
+{
+	for (Vector<RetiredTable>::iterator it = _retired.begin(); it != _retired.end(); ++it)
+		delete it->table;
+	delete _xid_owner;
+}
+
+int
+XIATransportDispatch::configure(Vector<String> &conf, ErrorHandler *errh)
+{
+	if (cp_va_kparse(conf, this, errh,
+					 "SHARDS", cpkP + cpkM, cpInteger, &_nshards,
+					 cpEnd) < 0)
+		return -1;
+
+	if (_nshards < 1 || _nshards > MAX_SHARDS)
+		return errh->error("SHARDS must be between 1 and %d", MAX_SHARDS);
+
+	_shards.resize(_nshards, 0);
+	return 0;
+}
+
+int
+XIATransportDispatch::initialize(ErrorHandler *errh)
+{
+	if (noutputs() != ninputs() * _nshards)
+		return errh->error("need %d outputs for %d shards", ninputs() * _nshards, _nshards);
+
+	for (int i = 0; i < _nshards; i++)
+		if (!_shards[i])
+			return errh->error("no XTRANSPORT configured as shard %d", i);
+
+	_task.initialize(this, false);
+	_reclaim_timer.initialize(this);
+	return 0;
+}
+
+int
+XIATransportDispatch::attach(int shard, XTRANSPORT *xt, ErrorHandler *errh)
+{
+	if (shard < 0 || shard >= _nshards)
+		return errh->error("SHARD must be between 0 and %d", _nshards - 1);
+	if (_shards[shard])
+		return errh->error("shard %d is already taken by %s", shard, _shards[shard]->declaration().c_str());
+
+	_shards[shard] = xt;
+	return 0;
+}
+
+
+
+/*************************************************************
+** STEERING
+*************************************************************/
+int
+XIATransportDispatch::port_owner(unsigned short port) const
+{
+	int shard = __atomic_load_n(&_port_owner[port], __ATOMIC_ACQUIRE);
+
+	// ports we haven't seen yet (temporary control sockets) are spread by number
+	return shard == NO_SHARD ? port % _nshards : shard;
+}
+
+void
+XIATransportDispatch::claim_port(unsigned short port, int shard)
+{
+	__atomic_store_n(&_port_owner[port], (uint8_t)shard, __ATOMIC_RELEASE);
+}
+
+int
+XIATransportDispatch::xid_owner(Packet *p)
+{
+	const click_xia *xiah = p->xia_header();
+
+	if (!xiah || xiah->dnode == 0)
+		return 0;
+
+	XID intent(xiah->node[xiah->dnode - 1].xid);
+
+	// unclaimed XIDs map to shard 0
+	const OwnerTable *owners = __atomic_load_n(&_xid_owner, __ATOMIC_ACQUIRE);
+	return owners->get(intent);
+}
+
+inline void
+XIATransportDispatch::forward(int port, int shard, Packet *p)
+{
+	output(port * _nshards + shard).push(p);
+}
+
+void
+XIATransportDispatch::broadcast(int port, int primary, Packet *p)
+{
+	for (int i = 0; i < _nshards; i++) {
+		if (i == primary)
+			continue;
+
+		if (Packet *q = p->clone()) {
+			if (port == API_PORT)
+				SET_XTRANSPORT_MIRROR_ANNO(q, 1);
+			forward(port, i, q);
+		}
+	}
+
+	forward(port, primary, p);
+}
+
+void
+XIATransportDispatch::push(int port, Packet *p)
+{
+	switch (port) {
+		case API_PORT:
+			dispatch_api(p);
+			break;
+
+		case NETWORK_PORT:
+			// every shard may have sockets listening for xcmp
+			if (p->xia_header() && p->xia_header()->nxt == CLICK_XIA_NXT_XCMP)
+				broadcast(port, 0, p);
+			else
+				forward(port, xid_owner(p), p);
+			break;
+
+		case CACHE_PORT:
+			forward(port, xid_owner(p), p);
+			break;
+
+		default:
+			broadcast(port, 0, p);
+			break;
+	}
+}
+
+/*
+** The call type is always the first field of a serialized XSocketMsg, so most
+** requests can be steered without parsing the whole message.
+*/
+static int
+peek_call_type(const unsigned char *data, int len)
+{
+	if (len < 2 || data[0] != 0x08)
+		return -1;
+
+	int type = 0;
+	for (int i = 1, shift = 0; i < len && shift < 32; i++, shift += 7) {
+		type |= (data[i] & 0x7f) << shift;
+		if (!(data[i] & 0x80))
+			return type;
+	}
+	return -1;
+}
+
+void
+XIATransportDispatch::dispatch_api(Packet *p)
+{
+	unsigned short sport = SRC_PORT_ANNO(p);
+	int type = peek_call_type(p->data(), p->length());
+	xia::XSocketMsg xsm;
+
+	switch (type) {
+		case xia::XSOCKET:
+			claim_port(sport, sport % _nshards);
+			forward(API_PORT, sport % _nshards, p);
+			break;
+
+		case xia::XCHANGEAD:
+		case xia::XUPDATENAMESERVERDAG:
+		case xia::XFORK:
+			broadcast(API_PORT, port_owner(sport), p);
+			break;
+
+		case xia::XACCEPT:
+			// the new socket lives in the same shard as the listener
+			xsm.ParseFromArray(p->data(), p->length());
+			claim_port(xsm.x_accept().new_port(), port_owner(sport));
+			forward(API_PORT, port_owner(sport), p);
+			break;
+
+		case xia::XCLOSE:
+			// Xclose is sent over a temporary control socket
+			xsm.ParseFromArray(p->data(), p->length());
+			forward(API_PORT, port_owner(xsm.x_close().port()), p);
+			break;
+
+		case xia::XPOLL:
+			xsm.ParseFromArray(p->data(), p->length());
+			dispatch_poll(p, sport, xsm);
+			break;
+
+		case xia::XRING:
+			xsm.ParseFromArray(p->data(), p->length());
+			dispatch_ring(p, sport, xsm);
+			break;
+
+		default:
+			forward(API_PORT, port_owner(sport), p);
+			break;
+	}
+}
+
+void
+XIATransportDispatch::dispatch_poll(Packet *p, unsigned short sport, xia::XSocketMsg &xsm)
+{
+	const xia::X_Poll_Msg &poll = xsm.x_poll();
+	uint32_t shards = 0;
+
+	if (poll.type() == xia::X_Poll_Msg::CANCEL) {
+		_poll_lock.acquire();
+		HashTable<unsigned short, uint32_t>::iterator it = _split_polls.find(sport);
+		if (it != _split_polls.end()) {
+			shards = it->second;
+			_split_polls.erase(it);
+		}
+		_poll_lock.release();
+
+		p->kill();
+		send_cancel(sport, shards);
+		return;
+	}
+
+	for (int i = 0; i < poll.pfds_size(); i++) {
+		if (poll.pfds(i).port() > 0)
+			shards |= 1 << port_owner(poll.pfds(i).port());
+	}
+
+	if (shards == 0)
+		shards = 1 << port_owner(sport);
+
+	// remember who is holding the poll so it can be cancelled later
+	_poll_lock.acquire();
+	_split_polls.set(sport, shards);
+	_poll_lock.release();
+
+	if ((shards & (shards - 1)) == 0) {
+		// all of the sockets live in one shard, no need to split the request
+		forward(API_PORT, ffs_lsb(shards) - 1, p);
+		return;
+	}
+
+	for (int shard = 0; shard < _nshards; shard++) {
+		if (!(shards & (1 << shard)))
+			continue;
+
+		xia::XSocketMsg sub;
+		sub.set_type(xia::XPOLL);
+		sub.set_sequence(xsm.sequence());
+		xia::X_Poll_Msg *sub_poll = sub.mutable_x_poll();
+		sub_poll->set_type(xia::X_Poll_Msg::DOPOLL);
+
+		for (int i = 0; i < poll.pfds_size(); i++) {
+			const xia::X_Poll_Msg::PollFD &pfd = poll.pfds(i);
+
+			if (pfd.port() > 0 && port_owner(pfd.port()) == shard)
+				*sub_poll->add_pfds() = pfd;
+		}
+		sub_poll->set_nfds(sub_poll->pfds_size());
+
+		std::string buf;
+		sub.SerializeToString(&buf);
+		WritablePacket *q = Packet::make(256, buf.c_str(), buf.size(), 0);
+		if (!q)
+			continue;
+
+		q->copy_annotations(p);
+		forward(API_PORT, shard, q);
+	}
+
+	p->kill();
+}
+
+void
+XIATransportDispatch::dispatch_ring(Packet *p, unsigned short sport, xia::XSocketMsg &xsm)
+{
+	const xia::X_Ring_Msg &ring = xsm.x_ring();
+	uint32_t shards = 0;
+
+	if (ring.cancel()) {
+		// the ring may have ops waiting in any shard
+		broadcast(API_PORT, port_owner(sport), p);
+		return;
+	}
+
+	for (int i = 0; i < ring.ops_size(); i++) {
+		const xia::XSocketMsg &op = ring.ops(i);
+		int shard = port_owner(op.port());
+
+		// sockets created by an accept live with their listener
+		if (op.type() == xia::XACCEPT)
+			claim_port(op.x_accept().new_port(), shard);
+		shards |= 1 << shard;
+	}
+
+	if (shards == 0 || (shards & (shards - 1)) == 0) {
+		forward(API_PORT, shards ? ffs_lsb(shards) - 1 : port_owner(sport), p);
+		return;
+	}
+
+	// each shard completes its own ops, the ring collects the answers
+	for (int shard = 0; shard < _nshards; shard++) {
+		if (!(shards & (1 << shard)))
+			continue;
+
+		xia::XSocketMsg sub;
+		sub.set_type(xia::XRING);
+		sub.set_sequence(xsm.sequence());
+		xia::X_Ring_Msg *sub_ring = sub.mutable_x_ring();
+
+		for (int i = 0; i < ring.ops_size(); i++) {
+			if (port_owner(ring.ops(i).port()) == shard)
+				*sub_ring->add_ops() = ring.ops(i);
+		}
+
+		std::string buf;
+		sub.SerializeToString(&buf);
+		WritablePacket *q = Packet::make(256, buf.c_str(), buf.size(), 0);
+		if (!q)
+			continue;
+
+		q->copy_annotations(p);
+		forward(API_PORT, shard, q);
+	}
+
+	p->kill();
+}
+
+void
+XIATransportDispatch::poll_answered(unsigned short pollport, int shard)
+{
+	uint32_t shards = 0;
+
+	_poll_lock.acquire();
+	HashTable<unsigned short, uint32_t>::iterator it = _split_polls.find(pollport);
+	if (it != _split_polls.end()) {
+		shards = it->second & ~(1 << shard);
+		_split_polls.erase(it);
+	}
+	_poll_lock.release();
+
+	// the API only reads the first answer, so withdraw the poll from everyone else
+	send_cancel(pollport, shards);
+}
+
+void
+XIATransportDispatch::send_cancel(unsigned short pollport, uint32_t shards)
+{
+	if (shards == 0)
+		return;
+
+	xia::XSocketMsg xsm;
+	xsm.set_type(xia::XPOLL);
+	xsm.set_sequence(0);
+	xia::X_Poll_Msg *poll = xsm.mutable_x_poll();
+	poll->set_type(xia::X_Poll_Msg::CANCEL);
+	poll->set_nfds(0);
+
+	std::string buf;
+	xsm.SerializeToString(&buf);
+
+	for (int shard = 0; shard < _nshards; shard++) {
+		if (!(shards & (1 << shard)))
+			continue;
+
+		WritablePacket *p = Packet::make(256, buf.c_str(), buf.size(), 0);
+		if (!p)
+			continue;
+
+		SET_SRC_PORT_ANNO(p, pollport);
+		forward(API_PORT, shard, p);
+	}
+}
+
+
+
+/*************************************************************
+** ROUTE TABLE UPDATES
+*************************************************************/
+void
+XIATransportDispatch::add_route(int shard, Element *table, const XID &xid, const String &cmd)
+{
+	RouteOp op;
+	op.table = table;
+	op.handler = "add";
+	op.cmd = cmd;
+	op.xid = xid;
+	op.shard = shard;
+
+	_route_lock.acquire();
+	_route_ops.push_back(op);
+	_route_lock.release();
+
+	_task.reschedule();
+}
+
+void
+XIATransportDispatch::remove_route(int shard, Element *table, const XID &xid)
+{
+	RouteOp op;
+	op.table = table;
+	op.handler = "remove";
+	op.cmd = xid.unparse();
+	op.xid = xid;
+	op.shard = shard;
+
+	_route_lock.acquire();
+	_route_ops.push_back(op);
+	_route_lock.release();
+
+	_task.reschedule();
+}
+
+bool
+XIATransportDispatch::run_task(Task *)
+{
+	Vector<RouteOp> ops;
+
+	_route_lock.acquire();
+	ops.swap(_route_ops);
+	_route_lock.release();
+
+	if (ops.empty())
+		return false;
+
+	// claims are applied to a copy of the owner table, which replaces the
+	// current one before any of the new routes can deliver packets
+	OwnerTable *owners = new OwnerTable(*_xid_owner);
+	for (Vector<RouteOp>::iterator it = ops.begin(); it != ops.end(); ++it) {
+		if (it->handler == "add")
+			owners->set(it->xid, it->shard);
+		else {
+			OwnerTable::iterator o = owners->find(it->xid);
+			if (o != owners->end() && o->second == it->shard)
+				owners->erase(o);
+		}
+	}
+
+	RetiredTable old;
+	old.table = _xid_owner;
+	old.expires = Timestamp::now() + Timestamp::make_msec(RETIRE_GRACE_MSEC);
+	__atomic_store_n(&_xid_owner, owners, __ATOMIC_RELEASE);
+
+	// readers may still be looking at the old table
+	_retired.push_back(old);
+	if (!_reclaim_timer.scheduled())
+		_reclaim_timer.schedule_at(old.expires);
+
+	// the route table isn't thread safe, so all updates are applied from here
+	for (Vector<RouteOp>::iterator it = ops.begin(); it != ops.end(); ++it)
+		HandlerCall::call_write(it->table, it->handler, it->cmd);
+
+	return true;
+}
+
+void
+XIATransportDispatch::run_timer(Timer *)
+{
+	// tables are retired in order, so the expired ones are at the front
+	Timestamp now = Timestamp::now();
+	int n = 0;
+
+	while (n < _retired.size() && _retired[n].expires <= now)
+		delete _retired[n++].table;
+	_retired.erase(_retired.begin(), _retired.begin() + n);
+
+	if (!_retired.empty())
+		_reclaim_timer.schedule_at(_retired[0].expires);
+}
+
+
+
+/*************************************************************
+** HANDLER FUNCTIONS
+*************************************************************/
+String
+XIATransportDispatch::read_netstat(Element *e, void *)
+{
+	XIATransportDispatch *d = static_cast<XIATransportDispatch *>(e);
+	String table;
+
+	for (int i = 0; i < d->_nshards; i++)
+		table += HandlerCall::call_read(d->_shards[i], "netstat");
+
+	return table;
+}
+
+int
+XIATransportDispatch::write_shards(const String &conf, Element *e, void *thunk, ErrorHandler *errh)
+{
+	XIATransportDispatch *d = static_cast<XIATransportDispatch *>(e);
+	const char *handler = static_cast<const char *>(thunk);
+	int rc = 0;
+
+	for (int i = 0; i < d->_nshards; i++) {
+		int n = HandlerCall::call_write(d->_shards[i], handler, conf, errh);
+		if (n < 0)
+			return n;
+		rc += n;
+	}
+
+	return rc;
+}
+
+void
+XIATransportDispatch::add_handlers()
+{
+	add_read_handler("netstat", read_netstat, 0);
+	add_write_handler("purge", write_shards, (void *)"purge");
+	add_write_handler("flush", write_shards, (void *)"flush");
+	add_write_handler("local_addr", write_shards, (void *)"local_addr");
+}
+
+CLICK_ENDDECLS
+EXPORT_ELEMENT(XIATransportDispatch)
+ELEMENT_REQUIRES(userlevel XTRANSPORT)
+ELEMENT_LIBS(-lprotobuf)
+ELEMENT_MT_SAFE(XIATransportDispatch)
@@ -0,0 +1,164 @@
+#ifndef CLICK_XIATRANSPORTDISPATCH_HH
+#define CLICK_XIATRANSPORTDISPATCH_HH
+
+#include <click/element.hh>
+#include <click/task.hh>
+#include <click/timer.hh>
+#include <click/sync.hh>
+#include <click/xid.hh>
+#include <click/hashtable.hh>
+#include <click/packet_anno.hh>
+#include "../../userlevel/xia.pb.h"
+
+CLICK_DECLS
+
+/*
+=c
+
+XIATransportDispatch(SHARDS)
+
+=s xia
+
+spreads XTRANSPORT work across several XTRANSPORT shards
+
+=d
+
+XIATransportDispatch splits the sockets of a host between SHARDS XTRANSPORT
+elements so that transport work can run on more than one Click thread. It has
+the same five inputs as XTRANSPORT (API, bad, network, cache and xhcp) and
+5*SHARDS outputs. A packet arriving on input K that belongs to shard S is
+emitted on output K*SHARDS+S, which should be connected to input K of shard S.
+
+API requests are steered by the API port of the socket they act on. New
+sockets are spread across the shards by port number, and sockets created by
+Xaccept stay with the shard that owns the listening socket. Requests that
+change host wide state (Xchangead, Xupdatenameserverdag and Xfork) are
+delivered to every shard, but only the owning shard replies. Xpoll requests
+that cover sockets in several shards are split, and the remaining shards are
+cancelled as soon as one of them answers. Xring batches are split the same
+way, and each shard posts completions for its own ops. Cancelling a ring
+goes to every shard.
+
+Network and cache packets are steered by the intent XID of their destination
+DAG. Each shard claims the XIDs it binds through the dispatcher, which also
+serializes the matching route table updates onto its own thread. The table of
+claimed XIDs is read without locking: the dispatcher replaces it whole once
+per batch of updates, and frees old tables after a grace period. Packets for
+unclaimed XIDs go to shard 0; XCMP and xhcp packets go to every shard.
+Since an XID can only be claimed by one shard, SO_REUSEPORT is refused on
+sharded sockets.
+
+Each shard must be configured with SHARD and DISPATCH arguments naming its
+index and this element, and should be pinned to its own thread with
+StaticThreadSched. The XIAShardedTransport compound element in
+xia_router_lib.click wires everything together. None of the shipped
+configurations use it; it is opt-in, replacing the XTRANSPORT in
+XIARoutingCore.
+
+=h netstat read-only
+
+Socket table of every shard, in the same format as XTRANSPORT's netstat
+handler.
+
+=h purge write-only
+
+Purges all stream sockets in every shard.
+
+=h flush write-only
+
+Purges stream sockets in the TIME_WAIT state in every shard.
+
+=h local_addr write-only
+
+Passes a new local address to every shard.
+
+=a XTRANSPORT, StaticThreadSched
+*/
+
+class XTRANSPORT;
+
+class XIATransportDispatch : public Element { public:
+
+	XIATransportDispatch();
+	~XIATransportDispatch();
+
+	const char *class_name() const	{ return "XIATransportDispatch"; }
+	const char *port_count() const	{ return "5/-"; }
+	const char *processing() const	{ return PUSH; }
+
+	int configure_phase() const		{ return CONFIGURE_PHASE_FIRST; }
+	int configure(Vector<String> &, ErrorHandler *);
+	int initialize(ErrorHandler *);
+	void add_handlers();
+
+	void push(int port, Packet *);
+	bool run_task(Task *);
+	void run_timer(Timer *);
+
+	// called by the shards
+	int attach(int shard, XTRANSPORT *xt, ErrorHandler *errh);
+	void claim_port(unsigned short port, int shard);
+	void add_route(int shard, Element *table, const XID &xid, const String &cmd);
+	void remove_route(int shard, Element *table, const XID &xid);
+	void poll_answered(unsigned short pollport, int shard);
+
+private:
+	enum { NO_SHARD = 0xFF, MAX_SHARDS = 32 };
+	enum { RETIRE_GRACE_MSEC = 1000 };
+
+	struct RouteOp {
+		Element *table;
+		String handler;
+		String cmd;
+		XID xid;
+		int shard;
+	};
+
+	typedef HashTable<XID, int> OwnerTable;
+
+	struct RetiredTable {
+		OwnerTable *table;
+		Timestamp expires;
+	};
+
+	int _nshards;
+	Vector<XTRANSPORT *> _shards;
+
+	// owning shard of each API port, NO_SHARD if not yet assigned
+	uint8_t _port_owner[65536];
+
+	// owning shard of each bound XID, read by any thread without a lock
+	// and replaced whole by the dispatcher's task
+	OwnerTable *_xid_owner;
+	Vector<RetiredTable> _retired;
+	Timer _reclaim_timer;
+
+	// xpoll requests that were split across shards, indexed by control port
+	Spinlock _poll_lock;
+	HashTable<unsigned short, uint32_t> _split_polls;
+
+	// route table changes queued by the shards
+	Spinlock _route_lock;
+	Vector<RouteOp> _route_ops;
+	Task _task;
+
+	int port_owner(unsigned short port) const;
+	int xid_owner(Packet *p);
+
+	void dispatch_api(Packet *p);
+	void dispatch_poll(Packet *p, unsigned short sport, xia::XSocketMsg &xsm);
+	void dispatch_ring(Packet *p, unsigned short sport, xia::XSocketMsg &xsm);
+	void send_cancel(unsigned short pollport, uint32_t shards);
+	void forward(int port, int shard, Packet *p);
+	void broadcast(int port, int primary, Packet *p);
+
+	static String read_netstat(Element *e, void *thunk);
+	static int write_shards(const String &conf, Element *e, void *thunk, ErrorHandler *errh);
+};
+
+// set on API requests that are copies of a request owned by another shard
+#define XTRANSPORT_MIRROR_ANNO(p)			PAINT_ANNO(p)
+#define SET_XTRANSPORT_MIRROR_ANNO(p, v)	SET_PAINT_ANNO(p, v)
+
+CLICK_ENDDECLS
+#endif
@@ -15,7 +15,7 @@
 #endif
 CLICK_DECLS
 
-XIAXIDRouteTable::XIAXIDRouteTable(): _drops(0)
+XIAXIDRouteTable::XIAXIDRouteTable(): _drops(0), _xid_type(htonl(CLICK_XIA_XID_TYPE_UNDEF))
 {
 }
 
@@ -49,8 +49,22 @@ XIAXIDRouteTable::configure(Vector<String> &conf, ErrorHandler *errh)
         
     String broadcast_xid(BHID);  // broadcast HID
     _bcast_xid.parse(broadcast_xid);    
-    
-	return 0;
+
+    // the tables are named after their XID type, which is what default
+    // route changes are reported as
+    String n = name().substring(name().find_right('/') + 1);
+    if (n.starts_with("rt_"))
+	cp_xid_type(n.substring(3), &_xid_type);
+
+    return 0;
+}
+
+int
+XIAXIDRouteTable::lookup_port(const XID &xid) const
+{
+	XIARouteData *xrd = _rts.get(xid);
+
+	return xrd ? xrd->port : _rtdata.port;
 }
 
 int
@@ -73,6 +87,7 @@ XIAXIDRouteTable::add_handlers()
 	add_write_handler("add4", set_handler4, 0);
 	add_write_handler("set4", set_handler4, (void*)1);
 	add_write_handler("remove", remove_handler, 0);
+	add_write_handler("bulk", bulk_handler, 0, Handler::RAW);
 	add_write_handler("load", load_routes_handler, 0);
 	add_write_handler("generate", generate_routes_handler, 0);
 	add_data_handlers("drops", Handler::OP_READ, &_drops);
@@ -202,6 +217,7 @@ XIAXIDRouteTable::set_handler4(const String &conf, Element *e, void *thunk, Erro
 		table->_rtdata.port= port;
 		table->_rtdata.flags = flags;
 		table->_rtdata.nexthop = nexthop;
+		table->notify(add_mode ? CLICK_XIA_ROUTE_ADD : CLICK_XIA_ROUTE_SET, NULL, &table->_rtdata);
 	} else {
 		 XID xid;
 		if (!cp_xid(xid_str, &xid, e)) {
@@ -219,6 +235,7 @@ XIAXIDRouteTable::set_handler4(const String &conf, Element *e, void *thunk, Erro
 		xrd->flags = flags;
 		xrd->nexthop = nexthop;
 		table->_rts[xid] = xrd;
+		table->notify(add_mode ? CLICK_XIA_ROUTE_ADD : CLICK_XIA_ROUTE_SET, &xid, xrd);
 	}
 
 	return 0;
@@ -242,6 +259,7 @@ XIAXIDRouteTable::remove_handler(const String &xid_str, Element *e, void *, Erro
 			delete table->_rtdata.nexthop;
 			table->_rtdata.nexthop = NULL;
 		}
+		table->notify(CLICK_XIA_ROUTE_REMOVE, NULL, NULL);
 
 	} else {
 		XID xid;
@@ -258,10 +276,153 @@ XIAXIDRouteTable::remove_handler(const String &xid_str, Element *e, void *, Erro
 
 		table->_rts.erase(it);
 		delete xrd;
+		table->notify(CLICK_XIA_ROUTE_REMOVE, &xid, NULL);
+	}
+	return 0;
+}
+
+/*
+** The records may sit at any offset in the handler string, so each one is
+** copied out before it is looked at.
+*/
+int
+XIAXIDRouteTable::bulk_handler(const String &conf, Element *e, void *, ErrorHandler *errh)
+{
+	XIAXIDRouteTable* table = static_cast<XIAXIDRouteTable*>(e);
+	click_xia_route_batch hdr;
+	click_xia_route_update u;
+
+	if ((size_t)conf.length() < sizeof(hdr))
+		return errh->error("route batch too short");
+	memcpy(&hdr, conf.data(), sizeof(hdr));
+
+	uint32_t count = ntohl(hdr.count);
+	if (ntohl(hdr.magic) != CLICK_XIA_ROUTE_BATCH_MAGIC)
+		return errh->error("not a route batch");
+	if ((conf.length() - sizeof(hdr)) / sizeof(u) != count
+			|| (conf.length() - sizeof(hdr)) % sizeof(u) != 0)
+		return errh->error("route batch of %u routes is %d bytes", count, conf.length());
+
+	const char *rec = conf.data() + sizeof(hdr);
+
+	// check the whole batch against the table as the records before each
+	// one would leave it, so a bad record leaves the table untouched
+	HashTable<XID, bool> present;
+	bool has_default = table->_rtdata.port != -1;
+
+	for (uint32_t i = 0; i < count; i++) {
+		memcpy(&u, rec + i * sizeof(u), sizeof(u));
+		int op = u.op & ~CLICK_XIA_ROUTE_DEFAULT;
+
+		if (op != CLICK_XIA_ROUTE_ADD && op != CLICK_XIA_ROUTE_SET && op != CLICK_XIA_ROUTE_REMOVE)
+			return errh->error("route %u: invalid operation %d", i, u.op);
+
+		if (u.op & CLICK_XIA_ROUTE_DEFAULT) {
+			if (op == CLICK_XIA_ROUTE_ADD && has_default)
+				return errh->error("route %u: duplicate default route", i);
+			has_default = (op != CLICK_XIA_ROUTE_REMOVE);
+			continue;
+		}
+
+		XID xid(u.xid);
+		bool exists;
+		HashTable<XID, bool>::iterator it = present.find(xid);
+
+		if (it != present.end())
+			exists = it->second;
+		else
+			exists = table->_rts.find(xid) != table->_rts.end();
+
+		if (op == CLICK_XIA_ROUTE_ADD && exists)
+			return errh->error("route %u: duplicate XID: %s", i, xid.unparse().c_str());
+		if (op == CLICK_XIA_ROUTE_REMOVE && !exists)
+			return errh->error("route %u: nonexistent XID: %s", i, xid.unparse().c_str());
+		present.set(xid, op != CLICK_XIA_ROUTE_REMOVE);
+	}
+
+	for (uint32_t i = 0; i < count; i++) {
+		memcpy(&u, rec + i * sizeof(u), sizeof(u));
+		table->apply_update(u);
 	}
 	return 0;
 }
 
+void
+XIAXIDRouteTable::apply_update(const click_xia_route_update &u)
+{
+	int op = u.op & ~CLICK_XIA_ROUTE_DEFAULT;
+	XIARouteData *xrd;
+	XID xid(u.xid);
+
+	if (u.op & CLICK_XIA_ROUTE_DEFAULT)
+		xrd = &_rtdata;
+	else {
+		HashTable<XID, XIARouteData*>::iterator it = _rts.find(xid);
+
+		if (op == CLICK_XIA_ROUTE_REMOVE) {
+			xrd = it.value();
+			_rts.erase(it);
+			delete xrd->nexthop;
+			delete xrd;
+			notify(op, &xid, NULL);
+			return;
+		}
+
+		if (it != _rts.end())
+			xrd = it.value();
+		else {
+			xrd = new XIARouteData();
+			xrd->nexthop = NULL;
+			_rts[xid] = xrd;
+		}
+	}
+
+	delete xrd->nexthop;
+	xrd->nexthop = NULL;
+
+	if (op == CLICK_XIA_ROUTE_REMOVE) {
+		xrd->port = -1;
+		xrd->flags = 0;
+	} else {
+		xrd->port = (int32_t)ntohl(u.port);
+		xrd->flags = ntohl(u.flags);
+		if (u.nexthop.type != htonl(CLICK_XIA_XID_TYPE_UNDEF))
+			xrd->nexthop = new XID(u.nexthop);
+	}
+	notify(op, xrd == &_rtdata ? NULL : &xid, op == CLICK_XIA_ROUTE_REMOVE ? NULL : xrd);
+}
+
+/*
+** Tell the listeners about a change, xid is NULL for the default route and
+** xrd is NULL if the route is gone.
+*/
+void
+XIAXIDRouteTable::notify(int op, const XID *xid, const XIARouteData *xrd)
+{
+	click_xia_route_update u;
+
+	if (_listeners.empty())
+		return;
+
+	memset(&u, 0, sizeof(u));
+	u.op = op;
+	if (xid)
+		u.xid = xid->xid();
+	else {
+		u.op |= CLICK_XIA_ROUTE_DEFAULT;
+		u.xid.type = _xid_type;
+	}
+	u.port = htonl(xrd ? xrd->port : -1);
+	if (xrd) {
+		u.flags = htonl(xrd->flags);
+		if (xrd->nexthop)
+			u.nexthop = xrd->nexthop->xid();
+	}
+
+	for (int i = 0; i < _listeners.size(); i++)
+		_listeners[i]->route_changed(u);
+}
+
 int
 XIAXIDRouteTable::load_routes_handler(const String &conf, Element *e, void *, ErrorHandler *errh)
 {
@@ -422,6 +583,10 @@ XIAXIDRouteTable::generate_routes_handler(const String &conf, Element *e, void *
 	}
 
 	click_chatter("generated %d entries", count);
+
+	// far too many to report one at a time
+	for (int i = 0; i < table->_listeners.size(); i++)
+		table->_listeners[i]->routes_lost();
 	return 0;
 }
 
@@ -502,6 +667,7 @@ XIAXIDRouteTable::process_xcmp_redirect(Packet *p)
    HashTable<XID, XIARouteData*>::const_iterator it = _rts.find(*dest);
    if (it != _rts.end()) {
    	(*it).second->nexthop = newroute;
+	notify(CLICK_XIA_ROUTE_REDIRECT, dest, (*it).second);
    } else {
        // Make a new entry for this XID
        XIARouteData *xrd1 = new XIARouteData();
@@ -514,6 +680,7 @@ XIAXIDRouteTable::process_xcmp_redirect(Packet *p)
        xrd1->port = port;
        xrd1->nexthop = newroute;
        _rts[*dest] = xrd1;
+       notify(CLICK_XIA_ROUTE_REDIRECT, dest, xrd1);
    }
    
    return -1;
@@ -559,6 +726,7 @@ XIAXIDRouteTable::lookup_route(int in_ether_port, Packet *p)
 				if ((*it).second->port != in_ether_port) {
 				  // update the entry
 				  (*it).second->port = in_ether_port;
+				  notify(CLICK_XIA_ROUTE_NEIGHBOR, &source_hid, (*it).second);
 				}	
 			  }
     		else
@@ -568,6 +736,7 @@ XIAXIDRouteTable::lookup_route(int in_ether_port, Packet *p)
 				xrd1->port = in_ether_port;
 				xrd1->nexthop = new XID(source_hid);
 				_rts[source_hid] = xrd1;
+				notify(CLICK_XIA_ROUTE_NEIGHBOR, &source_hid, xrd1);
 			  }
     		return DESTINED_FOR_LOCALHOST;
     	}    	
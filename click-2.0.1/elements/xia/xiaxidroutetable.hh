@@ -25,6 +25,26 @@ It outputs AD0 packets to port 0, HID2 packets to port 1, and other packets to p
 If the packet has already arrived at the destination node, the packet will be destroyed,
 so use the XIACheckDest element before using this element.
 
+=h bulk write-only
+
+Applies a batch of route changes in binary form, a click_xia_route_batch
+header followed by click_xia_route_update records (see <clicknet/xia.h>),
+each adding, setting or removing one route. Every record is checked before
+any is applied, so either the whole batch takes effect or none of it does.
+Meant for routing daemons loading many routes, which would otherwise write
+them to set4 one at a time.
+
+=n
+
+Every change to the table, including neighbors learned from broadcasts and
+next hops changed by XCMP redirects, is passed to the XIARouteListeners that
+have registered with it. XTRANSPORT registers with the tables next to its
+ROUTETABLENAME and forwards the changes to sockets that set
+XOPT_ROUTE_EVENTS, so daemons don't have to reread the whole table. Routes
+made by the generate handler are reported as lost rather than one by one.
+The table's XID type, used for default route changes, is taken from an
+element name of the form rt_TYPE.
+
 =a StaticIPLookup, IPRouteTable
 */
 
@@ -39,6 +59,14 @@ so use the XIACheckDest element before using this element.
 
 enum { PRINCIPAL_TYPE_ENABLED };
 
+// told about each change made to an XIAXIDRouteTable, from whichever thread
+// made it
+class XIARouteListener { public:
+    virtual ~XIARouteListener() { }
+    virtual void route_changed(const click_xia_route_update &u) = 0;
+    virtual void routes_lost() = 0;	// too many changes to report
+};
+
 typedef struct {
 	int	port;
 	unsigned flags;
@@ -62,6 +90,13 @@ class XIAXIDRouteTable : public Element { public:
 	int set_enabled(int e);
 	int get_enabled();
 
+	void add_listener(XIARouteListener *l)	{ _listeners.push_back(l); }
+
+	// port a packet for xid leaves on, the default route's if xid has none
+	int lookup_port(const XID &xid) const;
+	// type of the XIDs in the table, network order, UNDEF if unknown
+	uint32_t xid_type() const		{ return _xid_type; }
+
 protected:
     int lookup_route(int in_ether_port, Packet *);
     int process_xcmp_redirect(Packet *);
@@ -69,6 +104,7 @@ protected:
     static int set_handler(const String &conf, Element *e, void *thunk, ErrorHandler *errh);
     static int set_handler4(const String &conf, Element *e, void *thunk, ErrorHandler *errh);
     static int remove_handler(const String &conf, Element *e, void *, ErrorHandler *errh);
+    static int bulk_handler(const String &conf, Element *e, void *, ErrorHandler *errh);
     static int load_routes_handler(const String &conf, Element *e, void *, ErrorHandler *errh);
     static int generate_routes_handler(const String &conf, Element *e, void *, ErrorHandler *errh);
 	static String read_handler(Element *e, void *thunk);
@@ -76,6 +112,9 @@ protected:
 
     static String list_routes_handler(Element *e, void *thunk);
 
+    void apply_update(const click_xia_route_update &u);
+    void notify(int op, const XID *xid, const XIARouteData *xrd);
+
 private:
 	HashTable<XID, XIARouteData*> _rts;
 	XIARouteData _rtdata;
@@ -86,6 +125,9 @@ private:
     XIAPath _local_addr;
     XID _local_hid;
     XID _bcast_xid;
+    uint32_t _xid_type;		// network order, UNDEF if the name doesn't say
+
+    Vector<XIARouteListener *> _listeners;
 };
 
 CLICK_ENDDECLS
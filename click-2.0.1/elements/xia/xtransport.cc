@@ -14,6 +14,8 @@
 #include "xlog.hh"
 
 #include <click/xiasecurity.hh>  // xs_getSHA1Hash()
+#include <sys/stat.h>
+#include <fcntl.h>
 
 /*
 ** FIXME:
@@ -30,7 +32,7 @@
 
 CLICK_DECLS
 
-XTRANSPORT::XTRANSPORT() : _timer(this)
+XTRANSPORT::XTRANSPORT() : _timer(this), _dispatch(0), _shard(0), _task(this), _mirror_port(-1), _ring_port(-1), _ring_batch(0), _events_lost(false), _event_subscribers(0)
 {
 	GOOGLE_PROTOBUF_VERIFY_VERSION;
 	cp_xid_type("SID", &_sid_type);	// FIXME: why isn't this a constant?
@@ -43,7 +45,9 @@ int XTRANSPORT::configure(Vector<String> &conf, ErrorHandler *errh)
 	XIAPath local_addr;
 	XID local_4id;
 	Element* routing_table_elem;
+	Element* dispatch_elem = 0;
 	bool is_dual_stack_router;
+	int shard = 0;
 	_is_dual_stack_router = false;
 
 	if (cp_va_kparse(conf, this, errh,
@@ -51,9 +55,21 @@ int XTRANSPORT::configure(Vector<String> &conf, ErrorHandler *errh)
 					 "LOCAL_4ID", cpkP + cpkM, cpXID, &local_4id,
 					 "ROUTETABLENAME", cpkP + cpkM, cpElement, &routing_table_elem,
 					 "IS_DUAL_STACK_ROUTER", 0, cpBool, &is_dual_stack_router,
+					 "SHARD", 0, cpInteger, &shard,
+					 "DISPATCH", 0, cpElement, &dispatch_elem,
 					 cpEnd) < 0)
 		return -1;
 
+	if (dispatch_elem) {
+		_dispatch = static_cast<XIATransportDispatch *>(dispatch_elem->cast("XIATransportDispatch"));
+		if (!_dispatch)
+			return errh->error("DISPATCH must be an XIATransportDispatch element");
+
+		_shard = shard;
+		if (_dispatch->attach(_shard, this, errh) < 0)
+			return -1;
+	}
+
 	_local_addr = local_addr;
 	_local_hid = local_addr.xid(local_addr.destination_node());
 	_local_4id = local_4id;
@@ -79,12 +95,14 @@ XTRANSPORT::~XTRANSPORT()
 	// click is shutting down, so we can get away with being lazy here
 	//Clear all hashtable entries
 	XIDtoSock.clear();
+	XIDtoSockGroup.clear();
 	portToSock.clear();
 	XIDtoPushPort.clear();
 	XIDpairToSock.clear();
 	XIDpairToConnectPending.clear();
 
 	xcmp_listeners.clear();
+	route_listeners.clear();
 	notify_listeners.clear();
 }
 
@@ -95,12 +113,129 @@ int XTRANSPORT::initialize(ErrorHandler *)
 	// XLog installed the syslog error handler, use it!
 	_errh = (SyslogErrorHandler*)ErrorHandler::default_handler();
 	_timer.initialize(this);
+	_task.initialize(this, false);
+
+	// listen to every route table beside the SID table we were given
+	if (_routeTable) {
+		String dir = _routeTable->name().substring(0, _routeTable->name().find_right('/') + 1);
+
+		for (int i = 0; i < router()->nelements(); i++) {
+			Element *e = router()->element(i);
+
+			if (e->name().length() > dir.length() && e->name().starts_with(dir)
+					&& e->name().find_left('/', dir.length()) < 0 && e->cast("XIAXIDRouteTable"))
+				static_cast<XIAXIDRouteTable *>(e)->add_listener(this);
+		}
+	}
 	return 0;
 }
 
 
 
 void XTRANSPORT::push(int port, Packet *p_input)
+{
+	if (!_dispatch) {
+		ProcessPacket(port, p_input);
+		return;
+	}
+
+	// a shard only touches its sockets from its own thread, so queue the
+	// packet and let run_task pick it up
+	_inbox_lock.acquire();
+	if (_inbox.size() >= SHARD_INBOX_SIZE) {
+		_inbox_lock.release();
+		WARN("shard %d inbox is full, dropping packet from port %d\n", _shard, port);
+		p_input->kill();
+		return;
+	}
+	_inbox.push_back(p_input);
+	_inbox_port.push_back(port);
+	_inbox_lock.release();
+
+	_task.reschedule();
+}
+
+
+
+bool XTRANSPORT::run_task(Task *)
+{
+	Vector<Packet *> inbox;
+	Vector<int> ports;
+
+	_inbox_lock.acquire();
+	inbox.swap(_inbox);
+	ports.swap(_inbox_port);
+	_inbox_lock.release();
+
+	Vector<click_xia_route_update> events;
+	bool lost;
+
+	_events_lock.acquire();
+	events.swap(_events);
+	lost = _events_lost;
+	_events_lost = false;
+	_events_lock.release();
+
+	bool published = false;
+
+	_lock.acquire();
+	for (int i = 0; i < inbox.size(); i++) {
+		ProcessPacket(ports[i], inbox[i]);
+	}
+	if (!events.empty() || lost)
+		ProcessRouteEvents(events, lost);
+	while (XIAFilePublisher::Batch *b = _publisher.next_batch()) {
+		PublishFileBatch(b);
+		published = true;
+	}
+	_lock.release();
+
+	return !inbox.empty() || !events.empty() || published;
+}
+
+
+
+/*
+** The route tables call these from whatever thread changed them, so the
+** change is queued for run_task. Nothing is kept unless a socket wants it.
+*/
+void XTRANSPORT::route_changed(const click_xia_route_update &u)
+{
+	bool wanted;
+
+	_events_lock.acquire();
+	wanted = _event_subscribers > 0;
+	if (wanted) {
+		if (_events.size() < ROUTE_EVENT_QUEUE)
+			_events.push_back(u);
+		else
+			_events_lost = true;
+	}
+	_events_lock.release();
+
+	if (wanted)
+		_task.reschedule();
+}
+
+
+
+void XTRANSPORT::routes_lost()
+{
+	bool wanted;
+
+	_events_lock.acquire();
+	wanted = _event_subscribers > 0;
+	if (wanted)
+		_events_lost = true;
+	_events_lock.release();
+
+	if (wanted)
+		_task.reschedule();
+}
+
+
+
+void XTRANSPORT::ProcessPacket(int port, Packet *p_input)
 {
 	WritablePacket *p_in = p_input->uniqueify();
 
@@ -153,9 +288,11 @@ int XTRANSPORT::write_param(const String &conf, Element *e, void *vparam, ErrorH
 						 "LOCAL_ADDR", cpkP + cpkM, cpXIAPath, &local_addr,
 						 cpEnd) < 0)
 			return -1;
+		f->_lock.acquire();
 		f->_local_addr = local_addr;
 		click_chatter("Moved to %s", local_addr.unparse().c_str());
 		f->_local_hid = local_addr.xid(local_addr.destination_node());
+		f->_lock.release();
 
 	}
 	break;
@@ -176,6 +313,7 @@ int XTRANSPORT::purge(const String &conf, Element *e, void *thunk, ErrorHandler
 	// If purge is true, kill all stream sockets
 	// else kill those in TIME_WAIT state
 
+	xt->_lock.acquire();
 	for (HashTable<unsigned short, sock*>::iterator it = xt->portToSock.begin(); it != xt->portToSock.end(); ++it) {
 		unsigned short _sport = it->first;
 		sock *sk = it->second;
@@ -188,6 +326,7 @@ int XTRANSPORT::purge(const String &conf, Element *e, void *thunk, ErrorHandler
 			}
 		}
 	}
+	xt->_lock.release();
 	return count;
 }
 
@@ -199,6 +338,7 @@ String XTRANSPORT::Netstat(Element *e, void *)
 	char line[512];
 	XTRANSPORT* xt = static_cast<XTRANSPORT*>(e);
 
+	xt->_lock.acquire();
 	for (HashTable<unsigned short, sock*>::iterator it = xt->portToSock.begin(); it != xt->portToSock.end(); ++it) {
 		unsigned short _sport = it->first;
 		sock *sk = it->second;
@@ -216,9 +356,15 @@ String XTRANSPORT::Netstat(Element *e, void *)
 			xid = source_xid.unparse().c_str();
 		}
 
-		sprintf(line, "%d,%s,%s,%s,%d\n", _sport, type, state, xid, sk->refcount);
+		// bytes held for the socket's chunk requests and fetch
+		unsigned long mem = sk->chunk_mem;
+		if (sk->fetch)
+			mem += sk->fetch->buffered_bytes();
+
+		sprintf(line, "%d,%s,%s,%s,%d,%lu\n", _sport, type, state, xid, sk->refcount, mem);
 		table += line;
 	}
+	xt->_lock.release();
 
 	return table;
 }
@@ -305,7 +451,7 @@ void XTRANSPORT::ChangeState(sock *sk, SocketState state)
 
 
 
-void XTRANSPORT::copy_common(sock *sk, XIAHeader &xiahdr, XIAHeaderEncap &xiah)
+bool XTRANSPORT::update_src_path(sock *sk)
 {
 	//Recalculate source path
 	XID	source_xid = sk->src_path.xid(sk->src_path.destination_node());
@@ -318,7 +464,16 @@ void XTRANSPORT::copy_common(sock *sk, XIAHeader &xiahdr, XIAHeaderEncap &xiah)
 		//Moved!
 		// 1. Update 'sk->src_path'
 		sk->src_path.parse_re(str_local_addr);
+		return true;
 	}
+	return false;
+}
+
+
+
+void XTRANSPORT::copy_common(sock *sk, XIAHeader &xiahdr, XIAHeaderEncap &xiah)
+{
+	update_src_path(sk);
 
 	xiah.set_nxt(xiahdr.nxt());
 	xiah.set_last(xiahdr.last());
@@ -351,6 +506,36 @@ WritablePacket *XTRANSPORT::copy_packet(Packet *p, sock *sk)
 
 
 
+/*
+** Build a stream DATA packet around payload. The payload is copied once, into
+** a packet with room in front for the headers and the link layer, so nothing
+** downstream has to reallocate it.
+*/
+WritablePacket *XTRANSPORT::data_packet(sock *sk, uint32_t seqnum, const std::string &payload)
+{
+	XIAHeaderEncap xiah;
+	xiah.set_nxt(CLICK_XIA_NXT_TRN);
+	xiah.set_last(LAST_NODE_DEFAULT);
+	xiah.set_hlim(sk->hlim);
+	xiah.set_dst_path(sk->dst_path);
+	xiah.set_src_path(sk->src_path);
+
+	TransportHeaderEncap *thdr = TransportHeaderEncap::MakeDATAHeader(seqnum, sk->ack_num, 0, calc_recv_window(sk)); // #seq, #ack, length, recv_wind
+
+	size_t headroom = xiah.hdr_size() + thdr->hlen() + Packet::default_headroom;
+	WritablePacket *p = WritablePacket::make(headroom, (const void*)payload.data(), payload.size(), 0);
+
+	p = thdr->encap(p);
+	thdr->update();
+	xiah.set_plen(payload.size() + thdr->hlen()); // XIA payload = transport header + transport-layer data
+	p = xiah.encap(p, false);
+
+	delete thdr;
+	return p;
+}
+
+
+
 WritablePacket *XTRANSPORT::copy_cid_req_packet(Packet *p, sock *sk)
 {
 	XIAHeader xiahdr(p);
@@ -391,6 +576,64 @@ WritablePacket *XTRANSPORT::copy_cid_response_packet(Packet *p, sock *sk)
 
 
 
+XTRANSPORT::ChunkRequest *XTRANSPORT::chunk_request(sock *sk, const XID &cid)
+{
+	ChunkRequest *&cr = sk->chunk_requests[cid];
+
+	if (!cr) {
+		cr = new ChunkRequest(cid);
+		sk->chunk_mem += sizeof(ChunkRequest);
+	}
+	return cr;
+}
+
+
+
+// replaces the packet held in slot, keeping the socket's memory count
+void XTRANSPORT::chunk_packet(sock *sk, WritablePacket *&slot, WritablePacket *p)
+{
+	if (slot) {
+		sk->chunk_mem -= slot->buffer_length();
+		slot->kill();
+	}
+	if (p)
+		sk->chunk_mem += p->buffer_length();
+	slot = p;
+}
+
+
+
+// (re)starts the request's timer, or stops it
+void XTRANSPORT::chunk_timer(sock *sk, ChunkRequest *cr, bool on)
+{
+	if (cr->timer_on)
+		sk->chunk_timers.erase(cr);
+
+	cr->timer_on = on;
+	if (on) {
+		cr->expiry = Timestamp::now() + Timestamp::make_msec(ACK_DELAY);
+		sk->chunk_timers.push_back(cr);
+	}
+}
+
+
+
+void XTRANSPORT::free_chunk_requests(sock *sk)
+{
+	for (HashTable<XID, ChunkRequest*>::iterator it = sk->chunk_requests.begin(); it != sk->chunk_requests.end(); ++it) {
+		ChunkRequest *cr = it->second;
+
+		chunk_timer(sk, cr, false);
+		chunk_packet(sk, cr->req_pkt, NULL);
+		chunk_packet(sk, cr->response, NULL);
+		delete cr;
+	}
+	sk->chunk_requests.clear();
+	sk->chunk_mem = 0;
+}
+
+
+
 bool XTRANSPORT::TeardownSocket(sock *sk)
 {
 	XID src_xid;
@@ -412,6 +655,7 @@ bool XTRANSPORT::TeardownSocket(sock *sk)
 	}
 
 	xcmp_listeners.remove(sk->port);
+	SetRouteEvents(sk, 0);
 
 	if (sk->sock_type == SOCK_STREAM) {
 		if (have_src && have_dst) {
@@ -428,7 +672,7 @@ bool XTRANSPORT::TeardownSocket(sock *sk)
 		//queue<xia::XSocketMsg*> pendingAccepts;
 		for (int i = 0; i < sk->send_buffer_size; i++) {
 			if (sk->send_buffer[i] != NULL) {
-				sk->send_buffer[i]->kill();
+				delete sk->send_buffer[i];
 				sk->send_buffer[i] = NULL;
 			}
 		}
@@ -437,7 +681,8 @@ bool XTRANSPORT::TeardownSocket(sock *sk)
 	if (!sk->isAcceptedSocket) {
 		// we only do this if the socket wasn't generateed due to an accept
 
-		if (have_src) {
+		// the route stays while other sockets share the XID
+		if (have_src && !leave_sock_group(sk, src_xid)) {
 			DBG("deleting route for %d %s\n", sk->port, src_xid.unparse().c_str());
 			delRoute(src_xid);
 			XIDtoSock.erase(src_xid);
@@ -445,13 +690,10 @@ bool XTRANSPORT::TeardownSocket(sock *sk)
 	}
 
 	if (sk->sock_type == SOCK_CHUNK) {
-		// FIXME: delete this stuff of chunk sockets will leak!
-		//HashTable<XID, WritablePacket*> XIDtoCIDreqPkt;
-		//HashTable<XID, Timestamp> XIDtoExpiryTime;
-		//HashTable<XID, bool> XIDtoTimerOn;
-		//HashTable<XID, int> XIDtoStatus;	// Content-chunk request status... 1: waiting to be read, 0: waiting for chunk response, -1: failed
-		//HashTable<XID, bool> XIDtoReadReq;	// Indicates whether ReadCID() is called for a specific CID
-		//HashTable<XID, WritablePacket*> XIDtoCIDresponsePkt;
+		delete sk->fetch;
+		sk->fetch = NULL;
+
+		free_chunk_requests(sk);
 	}
 
 	portToSock.erase(sk->port);
@@ -518,13 +760,18 @@ bool XTRANSPORT::RetransmitSYN(sock *sk, unsigned short _sport, Timestamp &now)
 		sk->so_error = ETIMEDOUT;
 
 		// Notify API that the connection failed
-		if (!sk->isBlocking) {
+		if ((!sk->isBlocking && !sk->ring_cancelled) || sk->ring_port) {
 			xia::XSocketMsg xsm;
 
 			xsm.set_type(xia::XCONNECT);
 			xsm.set_sequence(0);
 			xia::X_Connect_Msg *connect_msg = xsm.mutable_x_connect();
 			connect_msg->set_status(xia::X_Connect_Msg::XFAILED);
+			if (sk->ring_port) {
+				xsm.set_sequence(sk->ring_sequence);
+				xsm.set_ring_port(sk->ring_port);
+				sk->ring_port = 0;
+			}
 			ReturnResult(_sport, &xsm, -1, ETIMEDOUT);
 		}
 
@@ -632,10 +879,11 @@ bool XTRANSPORT::RetransmitDATA(sock *sk, unsigned short _sport, Timestamp &now)
 		DBG("Socket %d  DATA RETRANSMIT (%s) send_base=%d next_seq=%d \n\n",
 			_sport, (_local_addr.unparse()).c_str(), sk->send_base, sk->next_send_seqnum);
 
-		// retransmit data
+		// retransmit data, from wherever we are now
+		update_src_path(sk);
 		for (unsigned int i = sk->send_base; i < sk->next_send_seqnum; i++) {
 			if (sk->send_buffer[i % sk->send_buffer_size] != NULL) {
-				WritablePacket *copy = copy_packet(sk->send_buffer[i % sk->send_buffer_size], sk);
+				WritablePacket *copy = data_packet(sk, i, *sk->send_buffer[i % sk->send_buffer_size]);
 				output(NETWORK_PORT).push(copy);
 				retransmit_sent = true;
 			}
@@ -665,32 +913,26 @@ bool XTRANSPORT::RetransmitDATA(sock *sk, unsigned short _sport, Timestamp &now)
 
 bool XTRANSPORT::RetransmitCIDRequest(sock *sk, unsigned short _sport, Timestamp &now, Timestamp &earliest_pending_expiry)
 {
-	for (HashTable<XID, bool>::iterator it = sk->XIDtoTimerOn.begin(); it != sk->XIDtoTimerOn.end(); ++it ) {
-		XID requested_cid = it->first;
-		bool timer_on = it->second;
-
-		HashTable<XID, Timestamp>::iterator it2;
-		it2 = sk->XIDtoExpiryTime.find(requested_cid);
-		Timestamp cid_req_expiry = it2->second;
-
-		if (timer_on == true && cid_req_expiry <= now) {
-			DBG("Socket %d  Chunk RETRANSMIT (%s)", sk->port);
-
-			//retransmit cid-request
-			HashTable<XID, WritablePacket*>::iterator it3;
-			it3 = sk->XIDtoCIDreqPkt.find(requested_cid);
-			WritablePacket *copy = copy_cid_req_packet(it3->second, sk);
-			output(NETWORK_PORT).push(copy);
-
-			cid_req_expiry  = Timestamp::now() + Timestamp::make_msec(ACK_DELAY);
-			sk->XIDtoExpiryTime.set(requested_cid, cid_req_expiry);
-			sk->XIDtoTimerOn.set(requested_cid, true);
+	// the list is in expiry order, so stop at the first request that isn't due
+	while (ChunkRequest *cr = sk->chunk_timers.front()) {
+		if (cr->expiry > now) {
+			if (cr->expiry < earliest_pending_expiry || earliest_pending_expiry == now) {
+				earliest_pending_expiry = cr->expiry;
+			}
+			break;
 		}
 
-		if (timer_on == true && cid_req_expiry > now && ( cid_req_expiry < earliest_pending_expiry || earliest_pending_expiry == now ) ) {
-			earliest_pending_expiry = cid_req_expiry;
-		}
+		DBG("Socket %d  Chunk RETRANSMIT (%s)", _sport, cr->cid.unparse().c_str());
+
+		//retransmit cid-request
+		WritablePacket *copy = copy_cid_req_packet(cr->req_pkt, sk);
+		output(NETWORK_PORT).push(copy);
+
+		// moves it to the back of the list
+		chunk_timer(sk, cr, true);
 	}
+
+	return false;
 }
 
 
@@ -699,6 +941,8 @@ void XTRANSPORT::run_timer(Timer *timer)
 {
 	assert(timer == &_timer);
 
+	_lock.acquire();
+
 	Timestamp now = Timestamp::now();
 	Timestamp earliest_pending_expiry = now;
 
@@ -746,6 +990,10 @@ void XTRANSPORT::run_timer(Timer *timer)
 			// FIXME: why is this here instead of with the other retransmits?
 			// check for CID request cases
 			RetransmitCIDRequest(sk, _sport, now, earliest_pending_expiry);
+
+			if (sk->fetch) {
+				RetransmitFetch(sk, now, earliest_pending_expiry);
+			}
 		}
 	}
 
@@ -767,6 +1015,8 @@ void XTRANSPORT::run_timer(Timer *timer)
 	if (earliest_pending_expiry > now) {
 		_timer.reschedule_at(earliest_pending_expiry);
 	}
+
+	_lock.release();
 }
 
 
@@ -853,14 +1103,96 @@ void XTRANSPORT::add_packet_to_recv_buf(WritablePacket *p, sock *sk)
 	sk->recv_buffer[index] = p_cpy;
 }
 
+/**
+* @brief Returns the number of bytes that can be handed to the app right now.
+*
+* For STREAM sockets this is the in-order data between recv_base and
+* next_recv_seqnum, less any data already consumed from a partially read
+* packet. For DGRAM and RAW sockets it is non-zero if a datagram is waiting.
+*
+* @param sk
+*
+* @return the number of readable bytes
+*/
+uint32_t XTRANSPORT::recv_bytes_available(sock *sk)
+{
+	uint32_t bytes = 0;
+
+	if (sk->sock_type == SOCK_STREAM) {
+		for (uint32_t i = sk->recv_base; i < sk->next_recv_seqnum; i++) {
+			WritablePacket *p = sk->recv_buffer[i % sk->recv_buffer_size];
+			if (!p) {
+				break;
+			}
+
+			XIAHeader xiah(p->xia_header());
+			TransportHeader thdr(p);
+			bytes += xiah.plen() - thdr.hlen() - XIA_TAIL_ANNO(p);
+		}
+
+	} else if (sk->sock_type == SOCK_DGRAM || sk->sock_type == SOCK_RAW) {
+		WritablePacket *p = sk->recv_buffer[sk->dgram_buffer_start];
+
+		if (sk->recv_buffer_count > 0 && p) {
+			XIAHeader xiah(p->xia_header());
+			bytes = xiah.plen();
+		}
+	}
+
+	return bytes;
+}
+
+/**
+* @brief Returns the number of bytes a blocking recv must wait for.
+*
+* STREAM receives are held until SO_RCVLOWAT bytes are buffered, or until
+* the full request is available if MSG_WAITALL was specified. The low water
+* mark never exceeds the number of bytes the app asked for. Datagram sockets
+* are readable as soon as any packet arrives.
+*
+* @param sk
+* @param xia_socket_msg The Xrecv or Xrecvfrom message from the API
+*
+* @return the low water mark for this request
+*/
+uint32_t XTRANSPORT::recv_low_water(sock *sk, xia::XSocketMsg *xia_socket_msg)
+{
+	if (sk->sock_type != SOCK_STREAM) {
+		return 1;
+	}
+
+	const xia::X_Recv_Msg &x_recv_msg = xia_socket_msg->x_recv();
+	uint32_t requested = x_recv_msg.bytes_requested();
+	uint32_t lowat = sk->so_rcvlowat;
+
+	if (x_recv_msg.flags() & MSG_WAITALL) {
+		lowat = requested;
+	}
+
+	if (lowat > requested) {
+		lowat = requested;
+	}
+	return (lowat > 0 ? lowat : 1);
+}
+
 /**
 * @brief check to see if the app is waiting for this data; if so, return it now
 *
+* The parked request is only completed once enough data is buffered to
+* satisfy the socket's low water mark, or once the peer has closed the
+* connection, in which case whatever is left (possibly 0 bytes) is returned.
+*
 * @param sk
 */
 void XTRANSPORT::check_for_and_handle_pending_recv(sock *sk)
 {
 	if (sk->recv_pending) {
+		if (sk->sock_type == SOCK_STREAM && sk->state == CONNECTED &&
+				recv_bytes_available(sk) < recv_low_water(sk, sk->pending_recv_msg)) {
+			// not enough data yet, keep waiting
+			return;
+		}
+
 		int bytes_returned = read_from_recv_buf(sk->pending_recv_msg, sk);
 		ReturnResult(sk->port, sk->pending_recv_msg, bytes_returned);
 
@@ -944,9 +1276,30 @@ void XTRANSPORT::resize_buffer(WritablePacket* buf[], int max, int type, uint32_
 
 
 
+/*
+** The send buffer only holds payloads, but every unacked sequence # has its
+** own slot, so the slot each one moves to follows from send_base.
+*/
 void XTRANSPORT::resize_send_buffer(sock *sk, uint32_t new_size)
 {
-	resize_buffer(sk->send_buffer, MAX_SEND_WIN_SIZE, sk->sock_type, sk->send_buffer_size, new_size, &(sk->dgram_buffer_start), &(sk->dgram_buffer_end));
+	std::string *temp[MAX_SEND_WIN_SIZE];
+	memset(temp, 0, sizeof(temp));
+
+	if (new_size < sk->next_send_seqnum - sk->send_base)
+		WARN("new buffer size is smaller than old size. Some data may be discarded.\n");
+
+	for (uint32_t i = sk->send_base; i < sk->next_send_seqnum; i++) {
+		std::string *&from = sk->send_buffer[i % sk->send_buffer_size];
+		if (!from)
+			continue;
+
+		std::string *&to = temp[i % new_size];
+		delete to;
+		to = from;
+		from = NULL;
+	}
+
+	memcpy(sk->send_buffer, temp, sizeof(temp));
 	sk->send_buffer_size = new_size;
 }
 
@@ -1056,14 +1409,17 @@ int XTRANSPORT::read_from_recv_buf(xia::XSocketMsg *xia_socket_msg, sock *sk)
 			// raw wants transport header too
 			// packet wants it all
 			XIAHeader xiah(p->xia_header());
-			TransportHeader thdr(p);
 			int data_size;
 			String payload;
 
 			switch (sk->sock_type) {
 				case SOCK_DGRAM:
+				{
+					// raw packets may not have a transport header
+					TransportHeader thdr(p);
 					data_size = xiah.plen() - thdr.hlen();
 					payload = String((const char*)thdr.payload(), data_size);
+				}
 					break;
 
 				case SOCK_RAW:
@@ -1162,6 +1518,85 @@ void XTRANSPORT::ProcessNetworkPacket(WritablePacket *p_in)
 }
 
 
+/*************************************************************
+** SO_REUSEPORT GROUPS
+*************************************************************/
+/*
+** Adds sk to the DGRAM sockets sharing xid if the socket already bound to it
+** allows that too. Returns false if sk should take over the XID instead.
+*/
+bool XTRANSPORT::join_sock_group(sock *sk, const XID &xid)
+{
+	sock *bound = XIDtoSock.get(xid);
+
+	if (!bound || bound == sk || !sk->so_reuseport || !bound->so_reuseport
+			|| sk->sock_type != SOCK_DGRAM || bound->sock_type != SOCK_DGRAM)
+		return false;
+
+	SockGroup &g = XIDtoSockGroup[xid];
+	if (g.socks.size() == 0) {
+		g.socks.push_back(bound);
+		g.next = 0;
+	}
+	for (int i = 0; i < g.socks.size(); i++)
+		if (g.socks[i] == sk)
+			return true;
+	g.socks.push_back(sk);
+	return true;
+}
+
+/*
+** Takes sk out of the sockets sharing xid. Returns true if others are still
+** bound to it.
+*/
+bool XTRANSPORT::leave_sock_group(sock *sk, const XID &xid)
+{
+	HashTable<XID, SockGroup>::iterator it = XIDtoSockGroup.find(xid);
+
+	if (it == XIDtoSockGroup.end())
+		return false;
+
+	Vector<sock*> &socks = it->second.socks;
+	int i;
+	for (i = 0; i < socks.size() && socks[i] != sk; i++)
+		;
+	if (i == socks.size())
+		return false;
+
+	socks.erase(socks.begin() + i);
+	if (XIDtoSock.get(xid) == sk)
+		XIDtoSock.set(xid, socks[0]);
+	if (socks.size() == 1)
+		XIDtoSockGroup.erase(it);
+	return true;
+}
+
+/*
+** Picks which of the sockets sharing xid gets the next datagram: the one with
+** the fewest waiting, starting after the last one picked so idle sockets take
+** turns.
+*/
+XTRANSPORT::sock *XTRANSPORT::pick_group_receiver(sock *sk, const XID &xid)
+{
+	HashTable<XID, SockGroup>::iterator it = XIDtoSockGroup.find(xid);
+
+	if (it == XIDtoSockGroup.end())
+		return sk;
+
+	SockGroup &g = it->second;
+	int n = g.socks.size();
+	int pick = g.next % n;
+
+	for (int i = 1; i < n; i++) {
+		int j = (g.next + i) % n;
+		if (g.socks[j]->recv_buffer_count < g.socks[pick]->recv_buffer_count)
+			pick = j;
+	}
+	g.next = pick + 1;
+	return g.socks[pick];
+}
+
+
 /*************************************************************
 ** DATAGRAM PACKET HANDLER
 *************************************************************/
@@ -1177,6 +1612,8 @@ void XTRANSPORT::ProcessDatagramPacket(WritablePacket *p_in)
 		WARN("ProcessDatagramPacket: sk == NULL\n");
 		return;
 	}
+	if (sk->so_reuseport)
+		sk = pick_group_receiver(sk, _destination_xid);
 	unsigned short _dport = sk->port;
 
 	// buffer packet if this is a DGRAM socket and we have room
@@ -1699,31 +2136,145 @@ void XTRANSPORT::ProcessXcmpPacket(WritablePacket *p_in)
 
 
 
-void XTRANSPORT::MigrateFailure(sock *sk)
+/*
+** Hand route table changes to the sockets that asked for them. Each gets the
+** records it wants in messages of up to ROUTE_EVENT_BATCH, built like an XIA
+** packet from us to us so the raw socket recv path can return them. A socket
+** whose recv buffer is full misses the message and is told so in the next.
+*/
+void XTRANSPORT::ProcessRouteEvents(const Vector<click_xia_route_update> &events, bool lost)
 {
-	if (sk->polling) {
-		// tell API we are in trouble
-		ProcessPollEvent(sk->port, POLLHUP);
-	}
+	list<int>::iterator i;
 
-	if (sk->isBlocking && sk->recv_pending) {
-		// The api is blocking on a recv, return an error
-		ReturnResult(sk->port, sk->pending_recv_msg, -1, ESTALE);
+	for (i = route_listeners.begin(); i != route_listeners.end(); i++) {
+		sock *sk = portToSock.get(*i);
+		Vector<click_xia_route_update> wanted;
 
-		sk->recv_pending = false;
-		delete sk->pending_recv_msg;
-		sk->pending_recv_msg = NULL;
+		if (!sk)
+			continue;
+
+		for (int j = 0; j < events.size(); j++) {
+			unsigned kind;
+
+			switch (events[j].op & ~CLICK_XIA_ROUTE_DEFAULT) {
+				case CLICK_XIA_ROUTE_NEIGHBOR:
+					kind = CLICK_XIA_ROUTE_EVENT_NEIGHBORS;
+					break;
+				case CLICK_XIA_ROUTE_REDIRECT:
+					kind = CLICK_XIA_ROUTE_EVENT_REDIRECTS;
+					break;
+				default:
+					kind = CLICK_XIA_ROUTE_EVENT_ROUTES;
+					break;
+			}
+			if (sk->route_events & kind)
+				wanted.push_back(events[j]);
+		}
+
+		if (lost)
+			sk->route_events_lost = true;
+
+		int next = 0;
+		while (next < wanted.size() || sk->route_events_lost) {
+			int count = wanted.size() - next;
+			click_xia_route_events hdr;
+			String payload;
+
+			if (count > ROUTE_EVENT_BATCH)
+				count = ROUTE_EVENT_BATCH;
+
+			hdr.magic = htonl(CLICK_XIA_ROUTE_EVENTS_MAGIC);
+			hdr.seq = htonl(sk->route_event_seq);
+			hdr.count = htons(count);
+			hdr.flags = htons(sk->route_events_lost ? CLICK_XIA_ROUTE_EVENTS_LOST : 0);
+			payload = String((const char *)&hdr, sizeof(hdr));
+			if (count)
+				payload.append((const char *)&wanted[next], count * sizeof(click_xia_route_update));
+			next += count;
+
+			XIAHeaderEncap xiah;
+			xiah.set_nxt(CLICK_XIA_NXT_NO);
+			xiah.set_last(LAST_NODE_DEFAULT);
+			xiah.set_hlim(HLIM_DEFAULT);
+			xiah.set_dst_path(_local_addr);
+			xiah.set_src_path(_local_addr);
+			xiah.set_plen(payload.length());
+
+			WritablePacket *p = WritablePacket::make(256, payload.data(), payload.length(), 0);
+			p = xiah.encap(p, false);
+
+			if (!should_buffer_received_packet(p, sk)) {
+				// the rest wouldn't fit either
+				sk->route_events_lost = true;
+				p->kill();
+				break;
+			}
+
+			add_packet_to_recv_buf(p, sk);
+			p->kill();
+			sk->route_event_seq++;
+			sk->route_events_lost = false;
+
+			if (sk->polling) {
+				// tell API we are readable
+				ProcessPollEvent(sk->port, POLLIN);
+			}
+			check_for_and_handle_pending_recv(sk);
+		}
 	}
 }
 
 
 
-void XTRANSPORT::ProcessSynPacket(WritablePacket *p_in)
+/*
+** Start or stop sending a socket route table changes, events is a mask of
+** CLICK_XIA_ROUTE_EVENT_* bits.
+*/
+void XTRANSPORT::SetRouteEvents(sock *sk, unsigned events)
 {
-	XIAHeader xiah(p_in->xia_header());
+	bool was = sk->route_events != 0;
 
-	XIAPath dst_path = xiah.dst_path();
-	XIAPath src_path = xiah.src_path();
+	sk->route_events = events & CLICK_XIA_ROUTE_EVENT_ALL;
+	if (was == (sk->route_events != 0))
+		return;
+
+	if (sk->route_events)
+		route_listeners.push_back(sk->port);
+	else
+		route_listeners.remove(sk->port);
+
+	_events_lock.acquire();
+	_event_subscribers += sk->route_events ? 1 : -1;
+	_events_lock.release();
+}
+
+
+
+void XTRANSPORT::MigrateFailure(sock *sk)
+{
+	if (sk->polling) {
+		// tell API we are in trouble
+		ProcessPollEvent(sk->port, POLLHUP);
+	}
+
+	if (sk->isBlocking && sk->recv_pending) {
+		// The api is blocking on a recv, return an error
+		ReturnResult(sk->port, sk->pending_recv_msg, -1, ESTALE);
+
+		sk->recv_pending = false;
+		delete sk->pending_recv_msg;
+		sk->pending_recv_msg = NULL;
+	}
+}
+
+
+
+void XTRANSPORT::ProcessSynPacket(WritablePacket *p_in)
+{
+	XIAHeader xiah(p_in->xia_header());
+
+	XIAPath dst_path = xiah.dst_path();
+	XIAPath src_path = xiah.src_path();
 
 	XID _destination_xid(xiah.hdr()->node[xiah.last()].xid);
 	XID	_source_xid = src_path.xid(src_path.destination_node());
@@ -1852,7 +2403,7 @@ void XTRANSPORT::ProcessSynPacket(WritablePacket *p_in)
 		new_sk->pkt = copy_packet(p, new_sk);
 		new_sk->refcount = 1;
 
-		memset(new_sk->send_buffer, 0, new_sk->send_buffer_size * sizeof(WritablePacket*));
+		memset(new_sk->send_buffer, 0, new_sk->send_buffer_size * sizeof(std::string*));
 		memset(new_sk->recv_buffer, 0, new_sk->recv_buffer_size * sizeof(WritablePacket*));
 
 		ScheduleTimer(new_sk, ACK_DELAY);
@@ -2037,7 +2588,7 @@ void XTRANSPORT::ProcessSynAckPacket(WritablePacket *p_in)
 			ProcessPollEvent(_dport, POLLIN | POLLOUT);
 		}
 
-		if (sk->isBlocking) {
+		if ((sk->isBlocking && !sk->ring_cancelled) || sk->ring_port) {
 			// complete the connection started by the API
 			xia::XSocketMsg xsm;
 			xsm.set_type(xia::XCONNECT);
@@ -2045,6 +2596,11 @@ void XTRANSPORT::ProcessSynAckPacket(WritablePacket *p_in)
 			xia::X_Connect_Msg *connect_msg = xsm.mutable_x_connect();
 			connect_msg->set_ddag(src_path.unparse().c_str());
 			connect_msg->set_status(xia::X_Connect_Msg::XCONNECTED);
+			if (sk->ring_port) {
+				xsm.set_sequence(sk->ring_sequence);
+				xsm.set_ring_port(sk->ring_port);
+				sk->ring_port = 0;
+			}
 			ReturnResult(_dport, &xsm);
 		}
 	}
@@ -2086,7 +2642,7 @@ void XTRANSPORT::ProcessStreamDataPacket(WritablePacket*p_in)
 				sk->next_recv_seqnum = next_missing_seqnum(sk);
 				// TODO: update recv window
 
-				if (sk->polling) {
+				if (sk->polling && recv_bytes_available(sk) >= sk->so_rcvlowat) {
 					// tell API we are readable
 					ProcessPollEvent(sk->port, POLLIN);
 				}
@@ -2163,7 +2719,12 @@ void XTRANSPORT::ProcessAckPacket(WritablePacket *p_in)
 			xia::XSocketMsg *acceptXSM = sk->pendingAccepts.front();
 			// FIXME: can I just use pop in the line above?
 			sk->pendingAccepts.pop();
-			ReturnResult(sk->port, acceptXSM);
+			if (acceptXSM->type() == xia::XACCEPT) {
+				// queued by a ring, finish the accept now
+				Xaccept(sk->port, acceptXSM);
+			} else {
+				ReturnResult(sk->port, acceptXSM);
+			}
 			delete acceptXSM;
 		}
 
@@ -2202,7 +2763,7 @@ void XTRANSPORT::ProcessAckPacket(WritablePacket *p_in)
 		for (int i = sk->send_base; i < remote_next_seqnum_expected; i++) {
 			int idx = i % sk->send_buffer_size;
 			if (sk->send_buffer[idx]) {
-				sk->send_buffer[idx]->kill();
+				delete sk->send_buffer[idx];
 				sk->send_buffer[idx] = NULL;
 			}
 			resetTimer = true;
@@ -2290,14 +2851,8 @@ void XTRANSPORT::ProcessFinPacket(WritablePacket *p_in)
 
 	// tell API peer requested close
 	if (sk->isBlocking) {
-		if (sk->recv_pending) {
-			// The api is blocking on a recv, return 0 bytes available
-			ReturnResult(sk->port, sk->pending_recv_msg, 0, 0);
-
-			sk->recv_pending = false;
-			delete sk->pending_recv_msg;
-			sk->pending_recv_msg = NULL;
-		}
+		// The api is blocking on a recv, return whatever is left (possibly 0 bytes)
+		check_for_and_handle_pending_recv(sk);
 	}
 	if (sk->polling) {
 		ProcessPollEvent(sk->port, POLLIN|POLLHUP);
@@ -2309,7 +2864,28 @@ void XTRANSPORT::ProcessFinPacket(WritablePacket *p_in)
 /*************************************************************
 ** CHUNK PACKET HANDLERS
 *************************************************************/
-// for response pkt, verify it, clear the reqPkt entry in the socket, send it to upper layer if read_cid_req is true, or if store it in XIDtoCIDresponsePkt
+/*
+** The cache hashes chunks as they are reassembled and marks the result on the
+** packet, so the payload only needs hashing here if it came some other way.
+*/
+bool XTRANSPORT::cid_hash_matches(Packet *p, XIAHeader &xiah, const XID &cid)
+{
+	switch (XIA_CID_HASH_ANNO(p)) {
+		case XIA_CID_HASH_VALID:
+			return true;
+		case XIA_CID_HASH_INVALID:
+			return false;
+	}
+
+	unsigned char digest[SHA_DIGEST_LENGTH];
+	xs_getSHA1Hash((const unsigned char *)xiah.payload(), xiah.plen(), digest, SHA_DIGEST_LENGTH);
+
+	return memcmp(digest, cid.xid().id, SHA_DIGEST_LENGTH) == 0;
+}
+
+
+
+// for response pkt, verify it, clear the request's reqPkt and timer, keep the response with the request, and send it to upper layer if read_cid_req is true
 void XTRANSPORT::ProcessCachePacket(WritablePacket *p_in)
 {
 	DBG("Got packet from cache");
@@ -2325,19 +2901,8 @@ void XTRANSPORT::ProcessCachePacket(WritablePacket *p_in)
 
 	if (ch.opcode()==ContentHeader::OP_PUSH) {
 		// compute the hash and verify it matches the CID
-		unsigned char digest[SHA_DIGEST_LENGTH];
-		xs_getSHA1Hash((const unsigned char *)xiah.payload(), xiah.plen(), \
-        digest, SHA_DIGEST_LENGTH);
-
-		String hash = "CID:";        
-		char hexBuf[3];        
-		for(int i = 0; i < SHA_DIGEST_LENGTH; i++) {
-			sprintf(hexBuf, "%02x", digest[i]);
-			hash.append(const_cast<char *>(hexBuf), 2);
-		}
-
 		// int status = READY_TO_READ;
-		if (hash != source_cid.unparse()) {
+		if (!cid_hash_matches(p_in, xiah, source_cid)) {
 			WARN("CID with invalid hash received: %s\n", source_cid.unparse().c_str());
 			// status = INVALID_HASH;
 		}
@@ -2387,116 +2952,69 @@ void XTRANSPORT::ProcessCachePacket(WritablePacket *p_in)
 	xid_pair.set_dst(source_cid);
 
 	sock *sk = XIDpairToSock.get(xid_pair);
-	unsigned short _dport = sk->port;
+	unsigned short _dport = sk ? sk->port : 0;
 
 	INFO("CachePacket, dest: %s, src_cid %s OPCode: %d \n", destination_sid.unparse().c_str(), source_cid.unparse().c_str(), ch.opcode());
 
-	if (_dport) {
+	if (_dport && sk->fetch && sk->fetch->wants(source_cid)) {
+		int status = READY_TO_READ;
+		if (!cid_hash_matches(p_in, xiah, source_cid)) {
+			WARN("CID with invalid hash received: %s\n", source_cid.unparse().c_str());
+			status = INVALID_HASH;
+		}
+
+		// keep the mapping if XrequestChunk is also waiting on this chunk
+		ChunkRequest *cr = sk->chunk_requests.get(source_cid);
+		if (!cr || !cr->timer_on)
+			XIDpairToSock.erase(xid_pair);
+		sk->fetch->received(source_cid, p_in, status, Timestamp::now());
+		SendFetchRequests(sk);
+		DeliverFetchedChunks(sk);
+
+	} else if (_dport) {
 		//TODO: Refine the way we change DAG in case of migration. Use some control bits. Add verification
 		//sock sk=portToSock.get(_dport);
 		//sk.dst_path=xiah.src_path();
 		//portToSock.set(_dport,sk);
 		//ENDTODO
 
-		// Reset timer or just Remove the corresponding entry in the hash tables (Done below)
-		HashTable<XID, WritablePacket*>::iterator it1;
-		it1 = sk->XIDtoCIDreqPkt.find(source_cid);
-
-		if(it1 != sk->XIDtoCIDreqPkt.end() ) {
-			// Remove the entry
-			sk->XIDtoCIDreqPkt.erase(it1);
-		}
-
-		HashTable<XID, Timestamp>::iterator it2;
-		it2 = sk->XIDtoExpiryTime.find(source_cid);
-
-		if(it2 != sk->XIDtoExpiryTime.end()) {
-			// Remove the entry
-			sk->XIDtoExpiryTime.erase(it2);
-		}
-
-		HashTable<XID, bool>::iterator it3;
-		it3 = sk->XIDtoTimerOn.find(source_cid);
-
-		if(it3 != sk->XIDtoTimerOn.end()) {
-			// Remove the entry
-			sk->XIDtoTimerOn.erase(it3);
-		}
+		// the request has been answered
+		ChunkRequest *cr = chunk_request(sk, source_cid);
+		chunk_timer(sk, cr, false);
+		chunk_packet(sk, cr->req_pkt, NULL);
 
 		// compute the hash and verify it matches the CID
-		unsigned char digest[SHA_DIGEST_LENGTH];
-        xs_getSHA1Hash((const unsigned char *)xiah.payload(), xiah.plen(), \
-            digest, SHA_DIGEST_LENGTH);
-    
-        String hash = "CID:";
-		char hexBuf[3];
-		for(int i = 0; i < SHA_DIGEST_LENGTH; i++) {
-			sprintf(hexBuf, "%02x", digest[i]);
-			hash.append(const_cast<char *>(hexBuf), 2);
-		}
-
-		int status = READY_TO_READ;
-		if (hash != source_cid.unparse()) {
+		cr->status = READY_TO_READ;
+		if (!cid_hash_matches(p_in, xiah, source_cid)) {
 			WARN("CID with invalid hash received: %s\n", source_cid.unparse().c_str());
-			status = INVALID_HASH;
+			cr->status = INVALID_HASH;
 		}
 
-		// Update the status of CID request
-		sk->XIDtoStatus.set(source_cid, status);
+		// Store the packet until XreadChunk is done with it
+		chunk_packet(sk, cr->response, copy_cid_response_packet(p_in, sk));
 
 		// Check if the ReadCID() was called for this CID
-		HashTable<XID, bool>::iterator it4;
-		it4 = sk->XIDtoReadReq.find(source_cid);
-
-		if(it4 != sk->XIDtoReadReq.end()) {
-			// There is an entry
-			bool read_cid_req = it4->second;
-
-			if (read_cid_req == true) {
-				// Send pkt up
-				sk->XIDtoReadReq.erase(it4);
-
-				portToSock.set(_dport, sk);
-				if(_dport != sk->port) {
-					ERROR("ERROR _dport %d, sk->port %d", _dport, sk->port);
-				}
-
-				//Unparse dag info
-				String src_path = xiah.src_path().unparse();
-
-				xia::XSocketMsg xia_socket_msg;
-				xia_socket_msg.set_type(xia::XREADCHUNK);
-				xia::X_Readchunk_Msg *x_readchunk_msg = xia_socket_msg.mutable_x_readchunk();
-				x_readchunk_msg->set_dag(src_path.c_str());
-				x_readchunk_msg->set_payload((const char*)xiah.payload(), xiah.plen());
+		if (cr->read_req) {
+			// Send pkt up
+			cr->read_req = false;
 
-				std::string p_buf;
-				xia_socket_msg.SerializeToString(&p_buf);
-
-				WritablePacket *p2 = WritablePacket::make(256, p_buf.c_str(), p_buf.size(), 0);
+			//Unparse dag info
+			String src_path = xiah.src_path().unparse();
 
-				DBG("Sent packet to socket: sport %d dport %d \n", _dport, _dport);
+			xia::XSocketMsg xia_socket_msg;
+			xia_socket_msg.set_type(xia::XREADCHUNK);
+			xia::X_Readchunk_Msg *x_readchunk_msg = xia_socket_msg.mutable_x_readchunk();
+			x_readchunk_msg->set_dag(src_path.c_str());
+			x_readchunk_msg->set_payload((const char*)xiah.payload(), xiah.plen());
 
-				output(API_PORT).push(UDPIPPrep(p2, _dport));
+			std::string p_buf;
+			xia_socket_msg.SerializeToString(&p_buf);
 
-			} else {
-				// Store the packet into temp buffer (until ReadCID() is called for this CID)
-				WritablePacket *copy_response_pkt = copy_cid_response_packet(p_in, sk);
-				sk->XIDtoCIDresponsePkt.set(source_cid, copy_response_pkt);
+			WritablePacket *p2 = WritablePacket::make(256, p_buf.c_str(), p_buf.size(), 0);
 
-				portToSock.set(_dport, sk);
-				if(_dport != sk->port) {
-					ERROR("ERROR _dport %d, sk->port %d", _dport, sk->port);
-				}
-			}
+			DBG("Sent packet to socket: sport %d dport %d \n", _dport, _dport);
 
-		} else {
-			WritablePacket *copy_response_pkt = copy_cid_response_packet(p_in, sk);
-			sk->XIDtoCIDresponsePkt.set(source_cid, copy_response_pkt);
-			portToSock.set(_dport, sk);
-			if(_dport != sk->port) {
-				ERROR("ERROR _dport %d, sk->port %d", _dport, sk->port);
-			}
+			output(API_PORT).push(UDPIPPrep(p2, _dport));
 		}
 	}
 	else
@@ -2517,12 +3035,13 @@ void XTRANSPORT::ProcessAPIPacket(WritablePacket *p_in)
 
 	// DBG("Push: Got packet from API sport:%d",ntohs(_sport));
 
-	std::string p_buf;
-	p_buf.assign((const char*)p_in->data(), (const char*)p_in->end_data());
-
 	//protobuf message parsing
 	xia::XSocketMsg xia_socket_msg;
-	xia_socket_msg.ParseFromString(p_buf);
+	xia_socket_msg.ParseFromArray(p_in->data(), p_in->length());
+
+	// another shard owns this request and will send the reply
+	_mirror_port = XTRANSPORT_MIRROR_ANNO(p_in) ? _sport : -1;
+
 	switch(xia_socket_msg.type()) {
 	case xia::XSOCKET:
 		Xsocket(_sport, &xia_socket_msg);
@@ -2581,6 +3100,9 @@ void XTRANSPORT::ProcessAPIPacket(WritablePacket *p_in)
 	case xia::XREQUESTCHUNK:
 		XrequestChunk(_sport, &xia_socket_msg, p_in);
 		break;
+	case xia::XFETCHCHUNKS:
+		XfetchChunks(_sport, &xia_socket_msg);
+		break;
 	case xia::XGETCHUNKSTATUS:
 		XgetChunkStatus(_sport, &xia_socket_msg);
 		break;
@@ -2593,6 +3115,9 @@ void XTRANSPORT::ProcessAPIPacket(WritablePacket *p_in)
 	case xia::XPUTCHUNK:
 		XputChunk(_sport, &xia_socket_msg);
 		break;
+	case xia::XPUTFILE:
+		XputFile(_sport, &xia_socket_msg);
+		break;
 	case xia::XGETPEERNAME:
 		Xgetpeername(_sport, &xia_socket_msg);
 		break;
@@ -2620,11 +3145,15 @@ void XTRANSPORT::ProcessAPIPacket(WritablePacket *p_in)
 	case xia::XNOTIFY:
 		Xnotify(_sport, &xia_socket_msg);
 		break;		
+	case xia::XRING:
+		Xring(_sport, &xia_socket_msg, p_in);
+		break;
 	default:
 		ERROR("ERROR: Unknown API request\n");
 		break;
 	}
 
+	_mirror_port = -1;
 	p_in->kill();
 }
 
@@ -2632,10 +3161,19 @@ void XTRANSPORT::ProcessAPIPacket(WritablePacket *p_in)
 
 void XTRANSPORT::ReturnResult(int sport, xia::XSocketMsg *xia_socket_msg, int rc, int err)
 {
+	if (sport == _mirror_port)
+		return;
+
 	xia::X_Result_Msg *x_result = xia_socket_msg->mutable_x_result();
 	x_result->set_return_code(rc);
 	x_result->set_err_code(err);
 
+	if (xia_socket_msg->has_ring_port()) {
+		// the request was submitted through a ring, complete it there
+		ReturnRingResult(xia_socket_msg);
+		return;
+	}
+
 	std::string p_buf;
 	xia_socket_msg->SerializeToString(&p_buf);
 	WritablePacket *reply = WritablePacket::make(256, p_buf.c_str(), p_buf.size(), 0);
@@ -2644,6 +3182,51 @@ void XTRANSPORT::ReturnResult(int sport, xia::XSocketMsg *xia_socket_msg, int rc
 
 
 
+/*
+** Post a completion to the ring that submitted the request. Completions
+** produced while the ring's own request is being handled are batched into a
+** single reply, later ones are sent to the ring as they happen.
+*/
+void XTRANSPORT::ReturnRingResult(xia::XSocketMsg *xia_socket_msg)
+{
+	int ring_port = xia_socket_msg->ring_port();
+
+	if (_ring_batch && ring_port == _ring_port) {
+		if (_ring_batch->ByteSizeLong() + xia_socket_msg->ByteSizeLong() > RING_BATCH_MAX)
+			FlushRingBatch();
+
+		_ring_batch->mutable_x_ring()->add_ops()->CopyFrom(*xia_socket_msg);
+		return;
+	}
+
+	xia::XSocketMsg xsm;
+	xsm.set_type(xia::XRING);
+	xsm.set_sequence(0);
+	xsm.mutable_x_ring()->add_ops()->CopyFrom(*xia_socket_msg);
+
+	std::string p_buf;
+	xsm.SerializeToString(&p_buf);
+	WritablePacket *reply = WritablePacket::make(256, p_buf.c_str(), p_buf.size(), 0);
+	output(API_PORT).push(UDPIPPrep(reply, ring_port));
+}
+
+
+
+void XTRANSPORT::FlushRingBatch()
+{
+	if (_ring_batch->x_ring().ops_size() == 0)
+		return;
+
+	std::string p_buf;
+	_ring_batch->SerializeToString(&p_buf);
+	WritablePacket *reply = WritablePacket::make(256, p_buf.c_str(), p_buf.size(), 0);
+	output(API_PORT).push(UDPIPPrep(reply, _ring_port));
+
+	_ring_batch->mutable_x_ring()->clear_ops();
+}
+
+
+
 /*
 ** Handler for the Xsocket API call
 */
@@ -2660,7 +3243,7 @@ void XTRANSPORT::Xsocket(unsigned short _sport, xia::XSocketMsg *xia_socket_msg)
 	sk->state = INACTIVE;
 	sk->refcount = 1;
 
-	memset(sk->send_buffer, 0, sk->send_buffer_size * sizeof(WritablePacket*));
+	memset(sk->send_buffer, 0, sk->send_buffer_size * sizeof(std::string*));
 	memset(sk->recv_buffer, 0, sk->recv_buffer_size * sizeof(WritablePacket*));
 
 	// Map the source port to sock
@@ -2677,6 +3260,7 @@ void XTRANSPORT::Xsetsockopt(unsigned short _sport, xia::XSocketMsg *xia_socket_
 {
 	xia::X_Setsockopt_Msg *x_sso_msg = xia_socket_msg->mutable_x_setsockopt();
 	sock *sk = portToSock.get(_sport);
+	int rc = 0, ec = 0;
 
 	switch (x_sso_msg->opt_type()) {
 		case XOPT_HLIM:
@@ -2702,6 +3286,11 @@ void XTRANSPORT::Xsetsockopt(unsigned short _sport, xia::XSocketMsg *xia_socket_
 			sk->isBlocking = x_sso_msg->int_opt();
 			break;
 
+		case XOPT_ROUTE_EVENTS:
+			if (sk->sock_type == SOCK_RAW)
+				SetRouteEvents(sk, x_sso_msg->int_opt());
+			break;
+
 		case SO_DEBUG:
 			sk->so_debug = x_sso_msg->int_opt();
 			break;
@@ -2710,12 +3299,33 @@ void XTRANSPORT::Xsetsockopt(unsigned short _sport, xia::XSocketMsg *xia_socket_
 			sk->so_error = x_sso_msg->int_opt();
 			break;
 
+		case SO_RCVLOWAT:
+		{
+			int lowat = x_sso_msg->int_opt();
+			sk->so_rcvlowat = (lowat > 0 ? lowat : 1);
+
+			// a lower mark may satisfy a recv that is already waiting
+			check_for_and_handle_pending_recv(sk);
+		}
+		break;
+
+		case SO_REUSEPORT:
+			// the sockets sharing an XID would be spread across the shards,
+			//  each claiming it and adding its route
+			if (_dispatch && x_sso_msg->int_opt()) {
+				rc = -1;
+				ec = ENOPROTOOPT;
+			} else {
+				sk->so_reuseport = x_sso_msg->int_opt();
+			}
+			break;
+
 		default:
 			// unsupported option
 			break;
 	}
 
-	ReturnResult(_sport, xia_socket_msg);
+	ReturnResult(_sport, xia_socket_msg, rc, ec);
 }
 
 /*
@@ -2736,6 +3346,10 @@ void XTRANSPORT::Xgetsockopt(unsigned short _sport, xia::XSocketMsg *xia_socket_
 			x_sso_msg->set_int_opt(sk->nxt_xport);
 			break;
 
+		case XOPT_ROUTE_EVENTS:
+			x_sso_msg->set_int_opt(sk->route_events);
+			break;
+
 		case SO_ACCEPTCONN:
 			x_sso_msg->set_int_opt(sk->state == LISTEN);
 			break;
@@ -2754,6 +3368,14 @@ void XTRANSPORT::Xgetsockopt(unsigned short _sport, xia::XSocketMsg *xia_socket_
 			x_sso_msg->set_int_opt(sk->so_error);
 			break;
 
+		case SO_RCVLOWAT:
+			x_sso_msg->set_int_opt(sk->so_rcvlowat);
+			break;
+
+		case SO_REUSEPORT:
+			x_sso_msg->set_int_opt(sk->so_reuseport);
+			break;
+
 		default:
 			// unsupported option
 			break;
@@ -2791,8 +3413,11 @@ void XTRANSPORT::Xbind(unsigned short _sport, xia::XSocketMsg *xia_socket_msg)
 		//TODO: Add a check to see if XID is already being used
 
 		// Map the source XID to source port (for now, for either type of tranports)
-		XIDtoSock.set(source_xid, sk);
-		addRoute(source_xid);
+		// unless the socket is joining others already bound to it
+		if (!join_sock_group(sk, source_xid)) {
+			XIDtoSock.set(source_xid, sk);
+			addRoute(source_xid);
+		}
 		portToSock.set(_sport, sk);
 		if(_sport != sk->port) {
 			ERROR("ERROR _sport %d, sk->port %d", _sport, sk->port);
@@ -2858,6 +3483,137 @@ void XTRANSPORT::Xnotify(unsigned short _sport, xia::XSocketMsg *xia_socket_msg)
 
 
 
+/*
+** Handler for a batch of requests submitted through Xring_submit
+**
+** Each op carries the API port of the socket it acts on and is handed to the
+** normal handler for its type. Results are tagged with the ring's port so
+** ReturnResult posts them to the ring instead of the socket. Anything that
+** completes right away is sent back in a single reply; connects, accepts and
+** receives that have to wait are parked on their socket the same way blocking
+** calls are, and complete on the ring when they are satisfied.
+*/
+void XTRANSPORT::Xring(unsigned short _sport, xia::XSocketMsg *xia_socket_msg, WritablePacket *p_in)
+{
+	if (xia_socket_msg->x_ring().cancel()) {
+		CancelRing(_sport);
+		ReturnResult(_sport, xia_socket_msg);
+		return;
+	}
+
+	xia::XSocketMsg batch;
+	batch.set_type(xia::XRING);
+	batch.set_sequence(xia_socket_msg->sequence());
+
+	_ring_port = _sport;
+	_ring_batch = &batch;
+
+	xia::X_Ring_Msg *x_ring_msg = xia_socket_msg->mutable_x_ring();
+
+	for (int i = 0; i < x_ring_msg->ops_size(); i++) {
+		xia::XSocketMsg *op = x_ring_msg->mutable_ops(i);
+		unsigned short port = op->port();
+		sock *sk = portToSock.get(port);
+
+		op->set_ring_port(_sport);
+
+		if (!sk) {
+			ReturnResult(port, op, -1, EBADF);
+			continue;
+		}
+
+		switch (op->type()) {
+		case xia::XCONNECT:
+			if (sk->state != INACTIVE)
+				ReturnResult(port, op, -1, EALREADY);
+			else
+				Xconnect(port, op);
+			break;
+
+		case xia::XACCEPT:
+			if (sk->state != LISTEN) {
+				ReturnResult(port, op, -1, EINVAL);
+
+			} else if (!sk->pending_connection_buf.empty()) {
+				Xaccept(port, op);
+
+			} else {
+				// finished when the next connection is established
+				xia::XSocketMsg *xsm_cpy = new xia::XSocketMsg();
+				xsm_cpy->CopyFrom(*op);
+				sk->pendingAccepts.push(xsm_cpy);
+			}
+			break;
+
+		case xia::XSEND:
+			Xsend(port, op, p_in);
+			break;
+
+		case xia::XRECV:
+		case xia::XRECVFROM:
+			if (sk->recv_pending) {
+				// only one receive can be waiting on a socket
+				ReturnResult(port, op, -1, EBUSY);
+			} else if (op->type() == xia::XRECV) {
+				Xrecv(port, op);
+			} else {
+				Xrecvfrom(port, op);
+			}
+			break;
+
+		case xia::XREQUESTCHUNK:
+			XrequestChunk(port, op, p_in);
+			break;
+
+		default:
+			ReturnResult(port, op, -1, EOPNOTSUPP);
+			break;
+		}
+	}
+
+	FlushRingBatch();
+	_ring_batch = 0;
+	_ring_port = -1;
+}
+
+
+
+/*
+** Drop everything a destroyed ring left parked on its sockets, so nothing
+** completes to its port later and the sockets take new receives and accepts.
+** A connect keeps going; the API sees how it went through XOPT_ERROR, the
+** same as a non-blocking connect.
+*/
+void XTRANSPORT::CancelRing(unsigned short ring_port)
+{
+	for (HashTable<unsigned short, sock*>::iterator it = portToSock.begin(); it != portToSock.end(); ++it) {
+		sock *sk = it->second;
+
+		if (sk->recv_pending && sk->pending_recv_msg && sk->pending_recv_msg->ring_port() == ring_port) {
+			sk->recv_pending = false;
+			delete sk->pending_recv_msg;
+			sk->pending_recv_msg = NULL;
+		}
+
+		if (sk->ring_port == ring_port) {
+			sk->ring_port = 0;
+			sk->ring_cancelled = true;
+		}
+
+		for (size_t n = sk->pendingAccepts.size(); n > 0; n--) {
+			xia::XSocketMsg *xsm = sk->pendingAccepts.front();
+			sk->pendingAccepts.pop();
+
+			if (xsm->ring_port() == ring_port)
+				delete xsm;
+			else
+				sk->pendingAccepts.push(xsm);
+		}
+	}
+}
+
+
+
 // FIXME: This way of doing things is a bit hacky.
 void XTRANSPORT::XbindPush(unsigned short _sport, xia::XSocketMsg *xia_socket_msg)
 {
@@ -3034,7 +3790,14 @@ void XTRANSPORT::Xconnect(unsigned short _sport, xia::XSocketMsg *xia_socket_msg
 	// the other end responded and the connection has been CONNECTED.
 	x_connect_msg->set_status(xia::X_Connect_Msg::XCONNECTING);
 	sk->so_error = EINPROGRESS;
-	ReturnResult(_sport, xia_socket_msg, -1, EINPROGRESS);
+	sk->ring_cancelled = false;
+	if (xia_socket_msg->has_ring_port()) {
+		// a ring only wants to hear about the outcome of the handshake
+		sk->ring_port = xia_socket_msg->ring_port();
+		sk->ring_sequence = xia_socket_msg->sequence();
+	} else {
+		ReturnResult(_sport, xia_socket_msg, -1, EINPROGRESS);
+	}
 
 	// Prepare SYN packet
 	const char *payload = "SYN";
@@ -3331,6 +4094,8 @@ void XTRANSPORT::ProcessPollEvent(unsigned short _sport, unsigned int flags_out)
 
 		// do I need to set other flags in the return struct?
 		ReturnResult(pollport, &xsm, 1, 0);
+		if (_dispatch)
+			_dispatch->poll_answered(pollport, _shard);
 
 		// found the socket, decrement the polling count for all the sockets in the poll instance
 		for (HashTable<unsigned short, unsigned int>::iterator pit = pe.events.begin(); pit != pe.events.end(); pit++) {
@@ -3451,7 +4216,7 @@ void XTRANSPORT::Xpoll(unsigned short _sport, xia::XSocketMsg *xia_socket_msg)
 				// is there any read data?
 				if (flags & POLLIN) {
 					if (sk->sock_type == SOCK_STREAM) {
-						if (sk->recv_base < sk->next_recv_seqnum) {
+						if (sk->recv_base < sk->next_recv_seqnum && recv_bytes_available(sk) >= sk->so_rcvlowat) {
 							flags_out |= POLLIN;
 						} else if (sk->state == CLOSE_WAIT) {
 							// other end closed, app needs to know!
@@ -3500,6 +4265,8 @@ void XTRANSPORT::Xpoll(unsigned short _sport, xia::XSocketMsg *xia_socket_msg)
 			poll_out->set_type(xia::X_Poll_Msg::RESULT);
 
 			ReturnResult(_sport, &msg_out, actionable, 0);
+			if (_dispatch)
+				_dispatch->poll_answered(_sport, _shard);
 
 		} else {
 			// we can't return a result yet
@@ -3779,13 +4546,11 @@ void XTRANSPORT::Xsend(unsigned short _sport, xia::XSocketMsg *xia_socket_msg, W
 
 	xia::X_Send_Msg *x_send_msg = xia_socket_msg->mutable_x_send();
 	int pktPayloadSize = x_send_msg->payload().size();
-
-	char payload[65536];
-	memcpy(payload, x_send_msg->payload().c_str(), pktPayloadSize);
+	const char *payload = x_send_msg->payload().data();
 
 	//Find DAG info for that stream
 	if(rc == 0 && sk->sock_type == SOCK_RAW) {
-		struct click_xia *xiah = reinterpret_cast<struct click_xia *>(payload);
+		const struct click_xia *xiah = reinterpret_cast<const struct click_xia *>(payload);
 		DBG("xiah->ver = %d", xiah->ver);
 		DBG("xiah->nxt = %d", xiah->nxt);
 		DBG("xiah->plen = %d", xiah->plen);
@@ -3831,11 +4596,11 @@ void XTRANSPORT::Xsend(unsigned short _sport, xia::XSocketMsg *xia_socket_msg, W
 		XIAPath dst_path = xiaheader.dst_path();
 		INFO("Sending RAW packet to:%s:", dst_path.unparse().c_str());
 		size_t headerlen = xiaheader.hdr_size();
-		char *pktcontents = &payload[headerlen];
+		const char *pktcontents = &payload[headerlen];
 		int pktcontentslen = pktPayloadSize - headerlen;
 		INFO("Packet size without XIP header:%d", pktcontentslen);
 
-		WritablePacket *p = WritablePacket::make(p_in->headroom() + 1, (const void*)pktcontents, pktcontentslen, p_in->tailroom());
+		WritablePacket *p = WritablePacket::make(headerlen + Packet::default_headroom, (const void*)pktcontents, pktcontentslen, 0);
 		p = xiahencap.encap(p, false);
 
 		output(NETWORK_PORT).push(p);
@@ -3889,35 +4654,15 @@ void XTRANSPORT::Xsend(unsigned short _sport, xia::XSocketMsg *xia_socket_msg, W
 		}
 
 		DBG("(%d) sent packet to %s, from %s\n", _sport, sk->dst_path.unparse_re().c_str(), sk->src_path.unparse_re().c_str());
-		//Add XIA headers
-		XIAHeaderEncap xiah;
-		xiah.set_nxt(CLICK_XIA_NXT_TRN);
-		xiah.set_last(LAST_NODE_DEFAULT);
-		xiah.set_hlim(sk->hlim);
-		xiah.set_dst_path(sk->dst_path);
-		xiah.set_src_path(sk->src_path);
-		xiah.set_plen(pktPayloadSize);
-
-		WritablePacket *just_payload_part = WritablePacket::make(p_in->headroom() + 1, (const void*)x_send_msg->payload().c_str(), pktPayloadSize, p_in->tailroom());
-
-		WritablePacket *p = NULL;
-
-		//Add XIA Transport headers
-		TransportHeaderEncap *thdr = TransportHeaderEncap::MakeDATAHeader(sk->next_send_seqnum, sk->ack_num, 0, calc_recv_window(sk) ); // #seq, #ack, length, recv_wind
-		p = thdr->encap(just_payload_part);
-
-		thdr->update();
-		xiah.set_plen(pktPayloadSize + thdr->hlen()); // XIA payload = transport header + transport-layer data
+		WritablePacket *p = data_packet(sk, sk->next_send_seqnum, x_send_msg->payload());
 
-		p = xiah.encap(p, false);
-
-		delete thdr;
-
-		// Store the packet into buffer
-		WritablePacket *tmp = sk->send_buffer[sk->seq_num % sk->send_buffer_size];
-		sk->send_buffer[sk->seq_num % sk->send_buffer_size] = copy_packet(p, sk);
-		if (tmp)
-			tmp->kill();
+		// Keep the payload for retransmission. It's taken from the request
+		// rather than shared with p, so p goes out as the only reference to
+		// its data and the elements downstream can write it in place.
+		std::string *kept = new std::string;
+		kept->swap(*x_send_msg->mutable_payload());
+		delete sk->send_buffer[sk->seq_num % sk->send_buffer_size];
+		sk->send_buffer[sk->seq_num % sk->send_buffer_size] = kept;
 
 		sk->seq_num++;
 		sk->next_send_seqnum++;
@@ -4052,38 +4797,42 @@ void XTRANSPORT::Xrecv(unsigned short _sport, xia::XSocketMsg *xia_socket_msg)
 {
 	sock *sk = portToSock.get(_sport);
 
+	if (!sk || (sk->state != CONNECTED && sk->state != CLOSE_WAIT)) {
+		// don't leave the app hanging on a socket that can't receive
+		ReturnResult(_sport, xia_socket_msg, -1, ENOTCONN);
+		return;
+	}
+
 	if(sk->port != _sport) {
 		ERROR("ERROR sk->port %d _sport %d", sk->port, _sport);
 		// FIXME: do something with the error
 	}
 
-	if (sk && (sk->state == CONNECTED || sk->state == CLOSE_WAIT)) {
-		read_from_recv_buf(xia_socket_msg, sk);
-
-		if (xia_socket_msg->x_recv().bytes_returned() > 0) {
-			// Return response to API
-			ReturnResult(_sport, xia_socket_msg, xia_socket_msg->x_recv().bytes_returned());
+	uint32_t available = recv_bytes_available(sk);
 
-		} else if (sk->state == CLOSE_WAIT) {
-			// other end has closed, tell app there's nothing to read
-			// what if other end is doing retransmits??
-			ReturnResult(_sport, xia_socket_msg, 0);
+	if (sk->state == CLOSE_WAIT || available >= recv_low_water(sk, xia_socket_msg) ||
+			(available > 0 && !xia_socket_msg->blocking())) {
+		// Return response to API, once the other end has closed this may be 0 bytes
+		// which tells the app there's nothing left to read
+		// what if other end is doing retransmits??
+		int bytes_returned = read_from_recv_buf(xia_socket_msg, sk);
+		ReturnResult(_sport, xia_socket_msg, bytes_returned);
 
-		}else if (!xia_socket_msg->blocking()) {
+	} else if (!xia_socket_msg->blocking()) {
 
-			// we're not blocking and there's no data, so let API know immediately
-			sk->recv_pending = false;
-			ReturnResult(_sport, xia_socket_msg, -1, EWOULDBLOCK);
+		// we're not blocking and there's no data, so let API know immediately
+		sk->recv_pending = false;
+		ReturnResult(_sport, xia_socket_msg, -1, EWOULDBLOCK);
 
-		} else {
-			// rather than returning a response, wait until we get data
-			sk->recv_pending = true; // when we get data next, send straight to app
+	} else {
+		// rather than returning a response, wait until we get enough data
+		// to satisfy the low water mark
+		sk->recv_pending = true; // when we get data next, send straight to app
 
-			// xia_socket_msg is saved on the stack; allocate a copy on the heap
-			xia::XSocketMsg *xsm_cpy = new xia::XSocketMsg();
-			xsm_cpy->CopyFrom(*xia_socket_msg);
-			sk->pending_recv_msg = xsm_cpy;
-		}
+		// xia_socket_msg is saved on the stack; allocate a copy on the heap
+		xia::XSocketMsg *xsm_cpy = new xia::XSocketMsg();
+		xsm_cpy->CopyFrom(*xia_socket_msg);
+		sk->pending_recv_msg = xsm_cpy;
 	}
 }
 
@@ -4123,12 +4872,113 @@ void XTRANSPORT::Xrecvfrom(unsigned short _sport, xia::XSocketMsg *xia_socket_ms
 
 
 
-void XTRANSPORT::XrequestChunk(unsigned short _sport, xia::XSocketMsg *xia_socket_msg, WritablePacket *p_in)
+/*
+** Chunk sockets get their source DAG the first time they request something,
+** and it is refreshed each time in case the host has moved.
+*/
+XTRANSPORT::sock *XTRANSPORT::chunk_sock(unsigned short _sport)
+{
+	sock *sk = portToSock.get(_sport);
+
+	if(!sk) {
+		//No local SID bound yet, so bind one
+		sk = new sock();
+	}
+
+	if (sk->initialized == false) {
+		sk->initialized = true;
+		sk->full_src_dag = true;
+		sk->port = _sport;
+		String str_local_addr = _local_addr.unparse_re();
+
+		char xid_string[50];
+		random_xid("SID", xid_string);
+		str_local_addr = str_local_addr + " " + xid_string; //Make source DAG _local_addr:SID
+
+		sk->src_path.parse_re(str_local_addr);
+
+		XID	source_xid = sk->src_path.xid(sk->src_path.destination_node());
+
+		XIDtoSock.set(source_xid, sk);
+		addRoute(source_xid);
+
+	}
+
+	// Case of initial binding to only SID
+	if(sk->full_src_dag == false) {
+		sk->full_src_dag = true;
+		String str_local_addr = _local_addr.unparse_re();
+		XID front_xid = sk->src_path.xid(sk->src_path.destination_node());
+		String xid_string = front_xid.unparse();
+		str_local_addr = str_local_addr + " " + xid_string; //Make source DAG _local_addr:SID
+		sk->src_path.parse_re(str_local_addr);
+	}
+
+	if(sk->src_path.unparse_re().length() != 0) {
+		//Recalculate source path
+		XID	source_xid = sk->src_path.xid(sk->src_path.destination_node());
+		String str_local_addr = _local_addr.unparse_re() + " " + source_xid.unparse(); //Make source DAG _local_addr:SID
+		sk->src_path.parse(str_local_addr);
+	}
+
+	portToSock.set(_sport, sk);
+	if(_sport != sk->port) {
+		ERROR("ERROR _sport %d, sk->port %d", _sport, sk->port);
+	}
+
+	return sk;
+}
+
+
+
+/*
+** Builds a CID request from the socket to dst_path, and makes sure the
+** response finds its way back to the socket.
+*/
+WritablePacket *XTRANSPORT::cid_request_packet(sock *sk, const XIAPath &dst_path, const String &payload)
+{
+	//Add XIA headers
+	XIAHeaderEncap xiah;
+	xiah.set_nxt(CLICK_XIA_NXT_CID);
+	xiah.set_last(LAST_NODE_DEFAULT);
+	xiah.set_hlim(sk->hlim);
+	xiah.set_dst_path(dst_path);
+	xiah.set_src_path(sk->src_path);
+	xiah.set_plen(payload.length());
+
+	WritablePacket *just_payload_part = WritablePacket::make(256, payload.data(), payload.length(), 20);
+
+	WritablePacket *p = NULL;
+
+	//Add Content header
+	ContentHeaderEncap *chdr = ContentHeaderEncap::MakeRequestHeader();
+	p = chdr->encap(just_payload_part);
+	p = xiah.encap(p, true);
+	delete chdr;
+
+	XID	source_sid = sk->src_path.xid(sk->src_path.destination_node());
+	XID	destination_cid = dst_path.xid(dst_path.destination_node());
+
+	XIDpair xid_pair;
+	xid_pair.set_src(source_sid);
+	xid_pair.set_dst(destination_cid);
+
+	// Map the src & dst XID pair to source port
+	XIDpairToSock.set(xid_pair, sk);
+
+	return p;
+}
+
+
+
+void XTRANSPORT::XrequestChunk(unsigned short _sport, xia::XSocketMsg *xia_socket_msg, WritablePacket *)
 {
 	xia::X_Requestchunk_Msg *x_requestchunk_msg = xia_socket_msg->mutable_x_requestchunk();
 
 	String pktPayload(x_requestchunk_msg->payload().c_str(), x_requestchunk_msg->payload().size());
-	int pktPayloadSize = pktPayload.length();
+
+	//Find DAG info for this DGRAM
+	sock *sk = chunk_sock(_sport);
 
 	// send CID-Requests
 
@@ -4137,112 +4987,177 @@ void XTRANSPORT::XrequestChunk(unsigned short _sport, xia::XSocketMsg *xia_socke
 		XIAPath dst_path;
 		dst_path.parse(dest);
 
-		//Find DAG info for this DGRAM
-		sock *sk = portToSock.get(_sport);
+		//_errh->debug("sent packet to %s, from %s\n", dest.c_str(), sk->src_path.unparse_re().c_str());
 
-		if(!sk) {
-			//No local SID bound yet, so bind one
-			sk = new sock();
-		}
+		WritablePacket *p = cid_request_packet(sk, dst_path, pktPayload);
+		XID	destination_cid = dst_path.xid(dst_path.destination_node());
 
-		if (sk->initialized == false) {
-			sk->initialized = true;
-			sk->full_src_dag = true;
-			sk->port = _sport;
-			String str_local_addr = _local_addr.unparse_re();
+		ChunkRequest *cr = chunk_request(sk, destination_cid);
 
-			char xid_string[50];
-			random_xid("SID", xid_string);
-			str_local_addr = str_local_addr + " " + xid_string; //Make source DAG _local_addr:SID
+		// Store the packet into buffer, any earlier copy of the chunk is stale
+		chunk_packet(sk, cr->req_pkt, copy_cid_req_packet(p, sk));
+		chunk_packet(sk, cr->response, NULL);
 
-			sk->src_path.parse_re(str_local_addr);
+		cr->status = WAITING_FOR_CHUNK;
+		cr->read_req = false;
 
-			XID	source_xid = sk->src_path.xid(sk->src_path.destination_node());
+		// Set timer
+		chunk_timer(sk, cr, true);
 
-			XIDtoSock.set(source_xid, sk);
-			addRoute(source_xid);
+		if (! _timer.scheduled() || _timer.expiry() >= cr->expiry )
+			_timer.reschedule_at(cr->expiry);
 
-		}
+		output(NETWORK_PORT).push(p);
+	}
 
-		// Case of initial binding to only SID
-		if(sk->full_src_dag == false) {
-			sk->full_src_dag = true;
-			String str_local_addr = _local_addr.unparse_re();
-			XID front_xid = sk->src_path.xid(sk->src_path.destination_node());
-			String xid_string = front_xid.unparse();
-			str_local_addr = str_local_addr + " " + xid_string; //Make source DAG _local_addr:SID
-			sk->src_path.parse_re(str_local_addr);
-		}
+	ReturnResult(_sport, xia_socket_msg); // TODO: Error codes?
+}
+
+
+
+/*
+** Starts a fetch of the listed chunks, or adds them to the one in progress.
+** Only the message that starts the fetch is answered; the API sends the rest
+** of a long manifest, and the credit for further chunks, without waiting.
+** DAGs that can't be parsed are delivered in their turn as failed. A cancel
+** drops the fetch without a reply.
+*/
+void XTRANSPORT::XfetchChunks(unsigned short _sport, xia::XSocketMsg *xia_socket_msg)
+{
+	xia::X_Fetchchunks_Msg *x_fetchchunks_msg = xia_socket_msg->mutable_x_fetchchunks();
+	int ndags = x_fetchchunks_msg->dag_size();
+	bool reply = false;
 
-		if(sk->src_path.unparse_re().length() != 0) {
-			//Recalculate source path
-			XID	source_xid = sk->src_path.xid(sk->src_path.destination_node());
-			String str_local_addr = _local_addr.unparse_re() + " " + source_xid.unparse(); //Make source DAG _local_addr:SID
-			sk->src_path.parse(str_local_addr);
+	sock *sk = portToSock.get(_sport);
+	if (!sk || sk->sock_type != SOCK_CHUNK) {
+		if (ndags)
+			ReturnResult(_sport, xia_socket_msg, -1, ENOTSOCK);
+		return;
+	}
+
+	if (x_fetchchunks_msg->cancel()) {
+		// the API couldn't send the whole list, chunks already requested
+		// are dropped as they come in
+		if (sk->fetch && sk->fetch->sequence() == (int)xia_socket_msg->sequence()) {
+			delete sk->fetch;
+			sk->fetch = NULL;
 		}
+		return;
+	}
 
-		portToSock.set(_sport, sk);
-		if(_sport != sk->port) {
-			ERROR("ERROR _sport %d, sk->port %d", _sport, sk->port);
+	if (!sk->fetch) {
+		if (ndags == 0)
+			return;
+		sk->fetch = new XIAChunkFetch(xia_socket_msg->sequence());
+		reply = true;
+	}
+	if (ndags)
+		chunk_sock(_sport);
+
+	for (int i = 0; i < ndags; i++) {
+		XIAPath dst_path;
+
+		if (dst_path.parse(x_fetchchunks_msg->dag(i).c_str()) && dst_path.destination_node() >= 0)
+			sk->fetch->add(dst_path);
+		else {
+			WARN("Socket %d: can't fetch invalid DAG %s\n", _sport, x_fetchchunks_msg->dag(i).c_str());
+			sk->fetch->add_failed(REQUEST_FAILED);
 		}
+	}
+	if (ndags)
+		sk->fetch->set_more(x_fetchchunks_msg->more());
+	sk->fetch->add_credit(x_fetchchunks_msg->credit());
 
-		sk = portToSock.get(_sport);
+	// answer before any chunk goes up so the reply is the first thing the API sees
+	if (reply) {
+		x_fetchchunks_msg->clear_dag();
+		ReturnResult(_sport, xia_socket_msg);
+	}
 
-		//_errh->debug("sent packet to %s, from %s\n", dest.c_str(), sk->src_path.unparse_re().c_str());
+	SendFetchRequests(sk);
+	DeliverFetchedChunks(sk);
+}
 
-		//Add XIA headers
-		XIAHeaderEncap xiah;
-		xiah.set_nxt(CLICK_XIA_NXT_CID);
-		xiah.set_last(LAST_NODE_DEFAULT);
-		xiah.set_hlim(sk->hlim);
-		xiah.set_dst_path(dst_path);
-		xiah.set_src_path(sk->src_path);
-		xiah.set_plen(pktPayloadSize);
 
-		WritablePacket *just_payload_part = WritablePacket::make(p_in->headroom() + 1, (const void*)x_requestchunk_msg->payload().c_str(), pktPayloadSize, p_in->tailroom());
 
-		WritablePacket *p = NULL;
+void XTRANSPORT::SendFetchRequests(sock *sk)
+{
+	XIAChunkFetch *fetch = sk->fetch;
+	Timestamp now = Timestamp::now();
+	String payload;
+	int i;
 
-		//Add Content header
-		ContentHeaderEncap *chdr = ContentHeaderEncap::MakeRequestHeader();
-		p = chdr->encap(just_payload_part);
-		p = xiah.encap(p, true);
-		delete chdr;
+	while ((i = fetch->next_request(now)) >= 0)
+		output(NETWORK_PORT).push(cid_request_packet(sk, fetch->dag(i), payload));
 
-		XID	source_sid = sk->src_path.xid(sk->src_path.destination_node());
-		XID	destination_cid = dst_path.xid(dst_path.destination_node());
+	Timestamp expiry;
+	if (fetch->next_expiry(expiry) && (!_timer.scheduled() || _timer.expiry() > expiry))
+		_timer.reschedule_at(expiry);
+}
 
-		XIDpair xid_pair;
-		xid_pair.set_src(source_sid);
-		xid_pair.set_dst(destination_cid);
 
-		// Map the src & dst XID pair to source port
-		XIDpairToSock.set(xid_pair, sk);
 
-		// Store the packet into buffer
-		WritablePacket *copy_req_pkt = copy_cid_req_packet(p, sk);
-		sk->XIDtoCIDreqPkt.set(destination_cid, copy_req_pkt);
+/*
+** Hands the application the chunks that are in, in manifest order, as far as
+** its credit goes, and drops the fetch once everything has been delivered.
+*/
+void XTRANSPORT::DeliverFetchedChunks(sock *sk)
+{
+	XIAChunkFetch *fetch = sk->fetch;
+	int i;
+
+	while ((i = fetch->next_delivery()) >= 0) {
+		xia::XSocketMsg xia_socket_msg;
+		xia_socket_msg.set_type(xia::XFETCHCHUNKS);
+		xia_socket_msg.set_sequence(fetch->sequence());
 
-		// Set the status of CID request
-		sk->XIDtoStatus.set(destination_cid, WAITING_FOR_CHUNK);
+		xia::X_Fetchchunks_Msg *msg = xia_socket_msg.mutable_x_fetchchunks();
+		msg->set_index(i);
+		msg->set_status(fetch->status(i));
+		msg->set_cid(fetch->cid(i).unparse().c_str());
 
-		// Set the status of ReadCID reqeust
-		sk->XIDtoReadReq.set(destination_cid, false);
+		if (Packet *p = fetch->response(i)) {
+			XIAHeader xiah(p->xia_header());
+			msg->set_payload((const char *)xiah.payload(), xiah.plen());
+		}
 
-		// Set timer
-		Timestamp cid_req_expiry  = Timestamp::now() + Timestamp::make_msec(ACK_DELAY);
-		sk->XIDtoExpiryTime.set(destination_cid, cid_req_expiry);
-		sk->XIDtoTimerOn.set(destination_cid, true);
+		std::string p_buf;
+		xia_socket_msg.SerializeToString(&p_buf);
+		WritablePacket *p2 = WritablePacket::make(256, p_buf.c_str(), p_buf.size(), 0);
+		output(API_PORT).push(UDPIPPrep(p2, sk->port));
 
-		if (! _timer.scheduled() || _timer.expiry() >= cid_req_expiry )
-			_timer.reschedule_at(cid_req_expiry);
+		fetch->delivered(i);
+	}
 
-		portToSock.set(_sport, sk);
+	if (fetch->done()) {
+		delete fetch;
+		sk->fetch = NULL;
+	}
+}
 
-		output(NETWORK_PORT).push(p);
+
+
+void XTRANSPORT::RetransmitFetch(sock *sk, Timestamp &now, Timestamp &earliest_pending_expiry)
+{
+	XIAChunkFetch *fetch = sk->fetch;
+	Vector<int> resend;
+	String payload;
+
+	fetch->expire(now, resend, REQUEST_FAILED);
+	for (int k = 0; k < resend.size(); k++) {
+		DBG("Socket %d fetch RETRANSMIT (%s)", sk->port, fetch->cid(resend[k]).unparse().c_str());
+		output(NETWORK_PORT).push(cid_request_packet(sk, fetch->dag(resend[k]), payload));
 	}
 
-	ReturnResult(_sport, xia_socket_msg); // TODO: Error codes?
+	// chunks that were given up on may have unblocked the window or delivery
+	SendFetchRequests(sk);
+	DeliverFetchedChunks(sk);
+
+	Timestamp expiry;
+	if (sk->fetch && sk->fetch->next_expiry(expiry)
+		&& (expiry < earliest_pending_expiry || earliest_pending_expiry == now)) {
+		earliest_pending_expiry = expiry;
+	}
 }
 
 
@@ -4254,40 +5169,32 @@ void XTRANSPORT::XgetChunkStatus(unsigned short _sport, xia::XSocketMsg *xia_soc
 	int numCids = x_getchunkstatus_msg->dag_size();
 	String pktPayload(x_getchunkstatus_msg->payload().c_str(), x_getchunkstatus_msg->payload().size());
 
+	//Find DAG info for this DGRAM
+	sock *sk = portToSock.get(_sport);
+
 	// send CID-Requests
 	for (int i = 0; i < numCids; i++) {
 		String dest = x_getchunkstatus_msg->dag(i).c_str();
 		XIAPath dst_path;
 		dst_path.parse(dest);
 
-		//Find DAG info for this DGRAM
-		sock *sk = portToSock.get(_sport);
-
 		XID	destination_cid = dst_path.xid(dst_path.destination_node());
 
 		// Check the status of CID request
-		HashTable<XID, int>::iterator it;
-		it = sk->XIDtoStatus.find(destination_cid);
-
-		if(it != sk->XIDtoStatus.end()) {
-			// There is an entry
-			int status = it->second;
+		ChunkRequest *cr = sk ? sk->chunk_requests.get(destination_cid) : NULL;
+		int status = cr ? cr->status : 0;
 
-			if(status == WAITING_FOR_CHUNK) {
-				x_getchunkstatus_msg->add_status("WAITING");
+		if(status == WAITING_FOR_CHUNK) {
+			x_getchunkstatus_msg->add_status("WAITING");
 
-			} else if(status == READY_TO_READ) {
-				x_getchunkstatus_msg->add_status("READY");
+		} else if(status == READY_TO_READ) {
+			x_getchunkstatus_msg->add_status("READY");
 
-			} else if(status == INVALID_HASH) {
-				x_getchunkstatus_msg->add_status("INVALID_HASH");
-
-			} else if(status == REQUEST_FAILED) {
-				x_getchunkstatus_msg->add_status("FAILED");
-			}
+		} else if(status == INVALID_HASH) {
+			x_getchunkstatus_msg->add_status("INVALID_HASH");
 
 		} else {
-			// Status query for the CID that was not requested...
+			// failed, or a status query for a CID that was not requested...
 			x_getchunkstatus_msg->add_status("FAILED");
 		}
 	}
@@ -4307,62 +5214,38 @@ void XTRANSPORT::XreadChunk(unsigned short _sport, xia::XSocketMsg *xia_socket_m
 	xia::X_Readchunk_Msg *x_readchunk_msg = xia_socket_msg->mutable_x_readchunk();
 
 	String dest = x_readchunk_msg->dag().c_str();
-	WritablePacket *copy;
 	XIAPath dst_path;
 	dst_path.parse(dest);
 
 	//Find DAG info for this DGRAM
 	sock *sk = portToSock.get(_sport);
+	if (!sk) {
+		ReturnResult(_sport, xia_socket_msg, -1, ENOTSOCK);
+		return;
+	}
 
 	XID	destination_cid = dst_path.xid(dst_path.destination_node());
 
 	// Update the status of ReadCID reqeust
-	sk->XIDtoReadReq.set(destination_cid, true);
-	portToSock.set(_sport, sk);
+	ChunkRequest *cr = chunk_request(sk, destination_cid);
+	cr->read_req = true;
 
 	// Check the status of CID request
-	HashTable<XID, int>::iterator it;
-	it = sk->XIDtoStatus.find(destination_cid);
-
-	if(it != sk->XIDtoStatus.end()) {
-		// There is an entry
-		int status = it->second;
-
-		if (status != READY_TO_READ  &&
-			status != INVALID_HASH) {
-			// Do nothing
-
-		} else {
-			// Send the buffered pkt to upper layer
-
-			sk->XIDtoReadReq.set(destination_cid, false);
-			portToSock.set(_sport, sk);
-
-			HashTable<XID, WritablePacket*>::iterator it2;
-			it2 = sk->XIDtoCIDresponsePkt.find(destination_cid);
-			copy = copy_cid_response_packet(it2->second, sk);
+	if (cr->status == READY_TO_READ || cr->status == INVALID_HASH) {
+		// Send the buffered pkt to upper layer
+		cr->read_req = false;
 
-			XIAHeader xiah(copy->xia_header());
+		XIAHeader xiah(cr->response->xia_header());
 
-			//Unparse dag info
-			String src_path = xiah.src_path().unparse();
-
-			xia::X_Readchunk_Msg *x_readchunk_msg = xia_socket_msg->mutable_x_readchunk();
-			x_readchunk_msg->set_dag(src_path.c_str());
-			x_readchunk_msg->set_payload((const char *)xiah.payload(), xiah.plen());
+		//Unparse dag info
+		String src_path = xiah.src_path().unparse();
 
-			DBG(">>send chunk to API after read %d\n", _sport);
+		x_readchunk_msg->set_dag(src_path.c_str());
+		x_readchunk_msg->set_payload((const char *)xiah.payload(), xiah.plen());
 
-			/*
-			 * Taking out these lines fixes the problem with getting the same CID
-			 * multiple times for subsequent chunks
-			 * FIXME: but does it cause us to leak?
-			it2->second->kill();
-			sk->XIDtoCIDresponsePkt.erase(it2);
-			*/
+		DBG(">>send chunk to API after read %d\n", _sport);
 
-			portToSock.set(_sport, sk);
-		}
+		// the response stays with the request so the chunk can be read again
 	}
 
 	ReturnResult(_sport, xia_socket_msg); // TODO: Error codes?
@@ -4422,24 +5305,143 @@ void XTRANSPORT::XputChunk(unsigned short _sport, xia::XSocketMsg *xia_socket_ms
 	int32_t cachePolicy = x_putchunk_msg->cachepolicy();
 
 	String pktPayload(x_putchunk_msg->payload().c_str(), x_putchunk_msg->payload().size());
-	String src;
+	String src = hex_digest((const unsigned char *)pktPayload.c_str(), pktPayload.length());
+
+	DBG("ctxID=%d, length=%d, ttl=%d cid=%s\n", contextID, x_putchunk_msg->payload().size(), ttl, src.c_str());
 
-	/* Computes SHA1 Hash if user does not supply it */
-    unsigned char digest[SHA_DIGEST_LENGTH];
-    xs_getSHA1Hash((const unsigned char *)pktPayload.c_str(), \
-        pktPayload.length(), digest, SHA_DIGEST_LENGTH);
-    
-    char hexBuf[3];
-	for(int i = 0; i < SHA_DIGEST_LENGTH; i++) {
-		sprintf(hexBuf, "%02x", digest[i]);
-		src.append(const_cast<char *>(hexBuf), 2);
+	PutLocalChunk(src, pktPayload.c_str(), pktPayload.length(), contextID, ttl, cacheSize, cachePolicy);
+
+	// (for Ack purpose) Reply with a packet with the destination port=source port
+	x_putchunk_msg->set_cid(src.c_str());
+	ReturnResult(_sport, xia_socket_msg, 0, 0);
+}
+
+/*
+** Publishes a batch of chunks straight from a file the API process has open.
+** Reading and hashing the chunks is left to the publisher threads, see
+** XIAFilePublisher; the batch is answered by PublishFileBatch once they're
+** done. Only the leading chunks with a usable length are taken.
+*/
+void XTRANSPORT::XputFile(unsigned short _sport, xia::XSocketMsg *xia_socket_msg)
+{
+	xia::X_Putfile_Msg *x_putfile_msg = xia_socket_msg->mutable_x_putfile();
+	int n = x_putfile_msg->cid_size();
+
+	if (x_putfile_msg->offset_size() != n || x_putfile_msg->length_size() != n) {
+		x_putfile_msg->set_status(-1);
+		ReturnResult(_sport, xia_socket_msg, -1, EINVAL);
+		return;
 	}
 
-	DBG("ctxID=%d, length=%d, ttl=%d cid=%s\n", contextID, x_putchunk_msg->payload().size(), ttl, src.c_str());
+	if (!_publisher.start(&_task)) {
+		// let the API fall back to XputChunk
+		ERROR("unable to start the file publisher threads");
+		x_putfile_msg->set_status(-1);
+		ReturnResult(_sport, xia_socket_msg, -1, EAGAIN);
+		return;
+	}
+
+	int usable = 0;
+	while (usable < n && x_putfile_msg->length(usable) > 0
+			&& x_putfile_msg->length(usable) <= MAX_CHUNKSIZE)
+		usable++;
+
+	XIAFilePublisher::Batch *b = new XIAFilePublisher::Batch;
+	b->port = _sport;
+	b->msg.Swap(xia_socket_msg);
+	b->chunks.resize(usable, 0);
+	_publisher.submit(b);
+}
+
+/*
+** Called from run_task with each batch the publisher threads are done with.
+** The chunks are published in order, up to the first one that couldn't be
+** read or doesn't match the CID the API gave it.
+*/
+void XTRANSPORT::PublishFileBatch(XIAFilePublisher::Batch *b)
+{
+	xia::X_Putfile_Msg *x_putfile_msg = b->msg.mutable_x_putfile();
+
+	int32_t contextID = x_putfile_msg->contextid();
+	int32_t ttl = x_putfile_msg->ttl();
+	int32_t cacheSize = x_putfile_msg->cachesize();
+	int32_t cachePolicy = x_putfile_msg->cachepolicy();
+
+	if (b->error) {
+		// let the API fall back to XputChunk
+		ERROR("Socket %d: unable to open file %d of process %u for publishing",
+			b->port, x_putfile_msg->fd(), x_putfile_msg->pid());
+		x_putfile_msg->set_status(-1);
+		ReturnResult(b->port, &b->msg, -1, b->error);
+		delete b;
+		return;
+	}
+
+	int published = 0;
+	for (int i = 0; i < b->chunks.size(); i++) {
+		WritablePacket *p = b->chunks[i];
+
+		if (!p || published < i) {
+			if (p)
+				p->kill();
+			else if (published == i)
+				WARN("Socket %d: chunk %d doesn't match its CID\n", b->port, i);
+			continue;
+		}
+
+		PutLocalChunk(String(x_putfile_msg->cid(i).c_str()), p, contextID, ttl, cacheSize, cachePolicy);
+		published++;
+	}
+
+	DBG("published %d of %d chunks\n", published, x_putfile_msg->cid_size());
+
+	// the descriptors aren't needed in the reply
+	x_putfile_msg->clear_cid();
+	x_putfile_msg->clear_offset();
+	x_putfile_msg->clear_length();
+	x_putfile_msg->set_status(published);
+	ReturnResult(b->port, &b->msg, 0, 0);
+	delete b;
+}
+
+/*
+** Lower case hex SHA-1 of data, the form CIDs are given in by the API.
+*/
+String XTRANSPORT::hex_digest(const unsigned char *data, unsigned length)
+{
+	unsigned char digest[SHA_DIGEST_LENGTH];
+	char hex[SHA_DIGEST_LENGTH * 2 + 1];
+
+	xs_getSHA1Hash(data, length, digest, SHA_DIGEST_LENGTH);
+	for (int i = 0; i < SHA_DIGEST_LENGTH; i++)
+		sprintf(&hex[i * 2], "%02x", digest[i]);
+	return String(hex, SHA_DIGEST_LENGTH * 2);
+}
+
+/*
+** Hands a chunk published by a local application to the cache. cid is the
+** hex hash of the data, which is copied once into the packet.
+*/
+void XTRANSPORT::PutLocalChunk(const String &cid, const char *data, unsigned length,
+	int32_t contextID, int32_t ttl, int32_t cacheSize, int32_t cachePolicy)
+{
+	WritablePacket *p = WritablePacket::make(256, (const void*)data, length, 0);
+
+	if (p)
+		PutLocalChunk(cid, p, contextID, ttl, cacheSize, cachePolicy);
+}
+
+/*
+** As above, for a chunk that is already in a packet of its own.
+*/
+void XTRANSPORT::PutLocalChunk(const String &cid, WritablePacket *just_payload_part,
+	int32_t contextID, int32_t ttl, int32_t cacheSize, int32_t cachePolicy)
+{
+	unsigned length = just_payload_part->length();
 
 	//append local address before CID
 	String str_local_addr = _local_addr.unparse_re();
-	str_local_addr = "RE " + str_local_addr + " CID:" + src;
+	str_local_addr = "RE " + str_local_addr + " CID:" + cid;
 	XIAPath src_path;
 	src_path.parse(str_local_addr);
 
@@ -4468,11 +5470,9 @@ void XTRANSPORT::XputChunk(unsigned short _sport, xia::XSocketMsg *xia_socket_ms
 
 	//Might need to remove more if another header is required (eg some control/DAG info)
 
-	WritablePacket *just_payload_part = WritablePacket::make(256, (const void*)pktPayload.c_str(), pktPayload.length(), 0);
-
 	WritablePacket *p = NULL;
-	int chunkSize = pktPayload.length();
-	ContentHeaderEncap  contenth(0, 0, pktPayload.length(), chunkSize, ContentHeader::OP_LOCAL_PUTCID,
+	int chunkSize = length;
+	ContentHeaderEncap  contenth(0, 0, length, chunkSize, ContentHeader::OP_LOCAL_PUTCID,
 								 contextID, ttl, cacheSize, cachePolicy);
 	p = contenth.encap(just_payload_part);
 	p = xiah.encap(p, true);
@@ -4480,10 +5480,6 @@ void XTRANSPORT::XputChunk(unsigned short _sport, xia::XSocketMsg *xia_socket_ms
 	DBG("sent packet to cache");
 
 	output(CACHE_PORT).push(p);
-
-	// (for Ack purpose) Reply with a packet with the destination port=source port
-	x_putchunk_msg->set_cid(src.c_str());
-	ReturnResult(_sport, xia_socket_msg, 0, 0);
 }
 
 
@@ -4622,6 +5618,6 @@ void XTRANSPORT::XpushChunkto(unsigned short _sport, xia::XSocketMsg *xia_socket
 CLICK_ENDDECLS
 
 EXPORT_ELEMENT(XTRANSPORT)
-ELEMENT_REQUIRES(userlevel)
+ELEMENT_REQUIRES(userlevel XIAChunkFetch XIAFilePublisher)
 ELEMENT_MT_SAFE(XTRANSPORT)
 ELEMENT_LIBS(-lcrypto -lssl -lprotobuf)
@@ -6,6 +6,7 @@
 #include <click/xid.hh>
 #include <click/xiaheader.hh>
 #include <click/hashtable.hh>
+#include <click/list.hh>
 #include "xiaxidroutetable.hh"
 #include <click/handlercall.hh>
 #include <click/xiapath.hh>
@@ -17,6 +18,11 @@
 #include <click/xiatransportheader.hh>
 #include <click/error.hh>
 #include <click/error-syslog.hh>
+#include <click/task.hh>
+#include <click/sync.hh>
+#include "xiatransportdispatch.hh"
+#include "xiachunkfetch.hh"
+#include "xiafilepublisher.hh"
 
 
 #if CLICK_USERLEVEL
@@ -38,6 +44,7 @@ using namespace std;
 #define XOPT_NEXT_PROTO 0x07002
 #define XOPT_BLOCK	    0x07003
 #define XOPT_ERROR_PEEK 0x07004
+#define XOPT_ROUTE_EVENTS 0x07005
 
 // various constants
 #define ACK_DELAY			300
@@ -70,6 +77,17 @@ using namespace std;
 #define CACHE_PORT   3
 #define XHCP_PORT	 4
 
+// max # of packets waiting to be handled by a transport shard
+#define SHARD_INBOX_SIZE 4096
+
+// largest batch of ring completions sent to the API in a single message
+#define RING_BATCH_MAX	60000
+
+// route changes waiting to go to subscribed sockets, and the most sent in
+// one message
+#define ROUTE_EVENT_QUEUE	4096
+#define ROUTE_EVENT_BATCH	128
+
 enum SocketState {INACTIVE = 0, LISTEN, SYN_RCVD, SYN_SENT, CONNECTED, FIN_WAIT1, FIN_WAIT2, TIME_WAIT, CLOSING, CLOSE_WAIT, LAST_ACK, CLOSED};
 
 CLICK_DECLS
@@ -81,7 +99,7 @@ typedef struct {
 } PollEvent;
 
 
-class XTRANSPORT : public Element {
+class XTRANSPORT : public Element, public XIARouteListener {
 public:
 	XTRANSPORT();
 	~XTRANSPORT();
@@ -94,6 +112,7 @@ public:
 	void push(int port, Packet *);
 	int initialize(ErrorHandler *);
 	void run_timer(Timer *timer);
+	bool run_task(Task *);
 
 	XID local_hid()	  { return _local_hid; };
 	XIAPath local_addr() { return _local_addr; };
@@ -102,12 +121,39 @@ public:
 
 	static int write_param(const String &, Element *, void *vparam, ErrorHandler *);
 
+	// called by the route tables, possibly from other threads
+	void route_changed(const click_xia_route_update &u);
+	void routes_lost();
+
 
 private:
 	SyslogErrorHandler *_errh;
 
 	Timer _timer;
 
+	// set when this element is one of several shards behind an XIATransportDispatch
+	XIATransportDispatch *_dispatch;
+	int _shard;
+	Task _task;
+	Spinlock _lock;				// held while the shard is working
+	Spinlock _inbox_lock;
+	Vector<Packet *> _inbox;	// packets pushed to the shard from other threads
+	Vector<int> _inbox_port;
+	int _mirror_port;			// API port that must not see replies to the current request
+
+	// completions for the ring request being processed are collected here
+	int _ring_port;
+	xia::XSocketMsg *_ring_batch;
+
+	// reads and checks XputFile batches, finished ones are published by run_task
+	XIAFilePublisher _publisher;
+
+	// route table changes queued for run_task to hand to the subscribers
+	Spinlock _events_lock;
+	Vector<click_xia_route_update> _events;
+	bool _events_lost;
+	int _event_subscribers;		// sockets with XOPT_ROUTE_EVENTS set
+
 	uint32_t _cid_type, _sid_type;
 	XID _local_hid;
 	XIAPath _local_addr;
@@ -119,6 +165,31 @@ private:
 	Packet* UDPIPPrep(Packet *, int);
 
 
+	/* =========================
+	 * Chunk request states
+	 * ========================= */
+	/*
+	** One record per CID a chunk socket has requested or asked to read.
+	** While the request is outstanding the record is also on the socket's
+	** timer list, which stays in expiry order as every request waits
+	** ACK_DELAY before it is resent.
+	*/
+	struct ChunkRequest {
+		ChunkRequest(const XID &c) : cid(c), req_pkt(NULL), response(NULL),
+			status(0), read_req(false), timer_on(false) {}
+
+		XID cid;
+		WritablePacket *req_pkt;	// request to resend until the chunk arrives
+		WritablePacket *response;	// the chunk, kept for XreadChunk
+		int status;					// WAITING_FOR_CHUNK, READY_TO_READ, INVALID_HASH, 0 if not requested
+		bool read_req;				// XreadChunk is waiting for the chunk
+		bool timer_on;				// on the socket's timer list
+		Timestamp expiry;			// when the request is resent
+		List_member<ChunkRequest> timer_link;
+	};
+
+	typedef List<ChunkRequest, &ChunkRequest::timer_link> ChunkTimerList;
+
 	/* =========================
 	 * Socket states
 	 * ========================= */
@@ -131,6 +202,8 @@ private:
 			initialized = false;
 			so_error = 0;
 			so_debug = false;
+			so_rcvlowat = 1;
+			so_reuseport = false;
 			interface_id = -1;
 			polling = false;
 			recv_pending = false;
@@ -164,6 +237,14 @@ private:
 			num_migrate_tries = 0;
 			migrate_pkt = NULL;
 			recv_pending = false;
+			ring_port = 0;
+			ring_sequence = 0;
+			ring_cancelled = false;
+			chunk_mem = 0;
+			fetch = NULL;
+			route_events = 0;
+			route_events_lost = false;
+			route_event_seq = 0;
 		}
 
 	/* =========================
@@ -176,6 +257,8 @@ private:
 		bool initialized;			// FIXME: used by dgram and chunks. can we replace it?
 		int so_error;				// used by non-blocking connect, accessed via getsockopt(SO_ERROR)
 		int so_debug;				// set/read via SO_DEBUG. could be used for tracing in the future
+		uint32_t so_rcvlowat;		// min # of bytes a blocking stream recv waits for, set via SO_RCVLOWAT
+		bool so_reuseport;			// DGRAM socket may share its bound XID, set via SO_REUSEPORT
 		int interface_id;			// port of the interface the packets arrive on
 		unsigned polling;			// # of outstanding poll/select requests on this socket
 		bool recv_pending;			// true if API is waiting to receive data
@@ -191,6 +274,10 @@ private:
 
 		unsigned short nxt_xport;
 
+		unsigned route_events;		// kinds of route change wanted, set via XOPT_ROUTE_EVENTS
+		bool route_events_lost;		// changes were dropped since the last message
+		uint32_t route_event_seq;
+
 		/* =========================
 		 * "TCP" state
 		 * ========================= */
@@ -206,13 +293,16 @@ private:
 		// connect/accept
 		queue<sock*> pending_connection_buf;	// list of outstanding connections waiting to be accepted
 		queue<xia::XSocketMsg*> pendingAccepts;	// stores accept messages from API when there are no pending connections
+		unsigned short ring_port;	// ring waiting for the outcome of a connect, 0 if none
+		int ring_sequence;			// sequence # of that connect request
+		bool ring_cancelled;		// the ring went away, nobody is waiting for the connect
 
 		// send buffer
 		uint32_t send_buffer_size;
 		uint32_t send_base;				// the sequence # of the oldest unacked packet
 		uint32_t next_send_seqnum;		// the smallest unused sequence # (i.e., the sequence # of the next packet to be sent)
 		uint32_t remote_recv_window;	// num additional *packets* the receiver has room to buffer
-		WritablePacket *send_buffer[MAX_SEND_WIN_SIZE]; // packets we've sent but have not gotten an ACK for
+		std::string *send_buffer[MAX_SEND_WIN_SIZE]; // payloads of packets we've sent but have not gotten an ACK for
 
 		/* =========================
 		 * shared tcp/udp receive buffers
@@ -237,12 +327,10 @@ private:
 		/* =========================
 		 * Chunk States
 		* ========================= */
-		HashTable<XID, WritablePacket*> XIDtoCIDreqPkt;
-		HashTable<XID, Timestamp> XIDtoExpiryTime;
-		HashTable<XID, bool> XIDtoTimerOn;
-		HashTable<XID, int> XIDtoStatus;	// Content-chunk request status... 1: waiting to be read, 0: waiting for chunk response, -1: failed
-		HashTable<XID, bool> XIDtoReadReq;	// Indicates whether ReadCID() is called for a specific CID
-		HashTable<XID, WritablePacket*> XIDtoCIDresponsePkt;
+		HashTable<XID, ChunkRequest*> chunk_requests;
+		ChunkTimerList chunk_timers;	// requests waiting for a response, soonest expiry first
+		size_t chunk_mem;				// bytes held by chunk_requests and their packets
+		XIAChunkFetch *fetch;		// windowed fetch started by XfetchChunks, NULL if none
 	} ;
 
 protected:
@@ -251,6 +339,9 @@ protected:
 	// list of ports wanting xcmp notifications
 	list<int> xcmp_listeners;
 
+	// list of ports wanting route table changes
+	list<int> route_listeners;
+
 	// list of ports waiting for a notification
 	list <int> notify_listeners;
 
@@ -262,6 +353,14 @@ protected:
 
 	// incoming connection to socket mapping
 	HashTable<XID, sock*> XIDtoSock;
+
+	// DGRAM sockets bound to the same XID with SO_REUSEPORT, XIDtoSock holds
+	// one of them
+	struct SockGroup {
+		Vector<sock*> socks;
+		int next;					// where the search for the next receiver starts
+	};
+	HashTable<XID, SockGroup> XIDtoSockGroup;
 	HashTable<XIDpair , sock*> XIDpairToSock;
 
 	// find sock structure based on API port #
@@ -276,17 +375,35 @@ protected:
 	 * Xtransport Methods
 	* ========================= */
 	void ReturnResult(int sport, xia::XSocketMsg *xia_socket_msg, int rc = 0, int err = 0);
+	void ReturnRingResult(xia::XSocketMsg *xia_socket_msg);
+	void FlushRingBatch();
 
+	bool update_src_path(struct sock *sk);
 	void copy_common(struct sock *sk, XIAHeader &xiahdr, XIAHeaderEncap &xiah);
 	WritablePacket* copy_packet(Packet *, struct sock *);
+	WritablePacket* data_packet(struct sock *, uint32_t seqnum, const std::string &payload);
 	WritablePacket* copy_cid_req_packet(Packet *, struct sock *);
 	WritablePacket* copy_cid_response_packet(Packet *, struct sock *);
+	WritablePacket* cid_request_packet(struct sock *sk, const XIAPath &dst_path, const String &payload);
+	bool cid_hash_matches(Packet *p, XIAHeader &xiah, const XID &cid);
+	sock *chunk_sock(unsigned short _sport);
+	ChunkRequest *chunk_request(sock *sk, const XID &cid);
+	void chunk_packet(sock *sk, WritablePacket *&slot, WritablePacket *p);
+	void chunk_timer(sock *sk, ChunkRequest *cr, bool on);
+	void free_chunk_requests(sock *sk);
+	void PutLocalChunk(const String &cid, const char *data, unsigned length,
+		int32_t contextID, int32_t ttl, int32_t cacheSize, int32_t cachePolicy);
+	void PutLocalChunk(const String &cid, WritablePacket *data,
+		int32_t contextID, int32_t ttl, int32_t cacheSize, int32_t cachePolicy);
 
 	char *random_xid(const char *type, char *buf);
+	static String hex_digest(const unsigned char *data, unsigned length);
 
 	uint32_t calc_recv_window(sock *sk);
 	bool should_buffer_received_packet(WritablePacket *p, sock *sk);
 	void add_packet_to_recv_buf(WritablePacket *p, sock *sk);
+	uint32_t recv_bytes_available(sock *sk);
+	uint32_t recv_low_water(sock *sk, xia::XSocketMsg *xia_socket_msg);
 	void check_for_and_handle_pending_recv(sock *sk);
 	int read_from_recv_buf(xia::XSocketMsg *xia_socket_msg, sock *sk);
 	uint32_t next_missing_seqnum(sock *sk);
@@ -296,9 +413,12 @@ protected:
 
 	bool usingRendezvousDAG(XIAPath bound_dag, XIAPath pkt_dag);
 
+	void ProcessPacket(int port, Packet *p_input);
 	void ProcessAPIPacket(WritablePacket *p_in);
 	void ProcessNetworkPacket(WritablePacket *p_in);
 	void ProcessCachePacket(WritablePacket *p_in);
+	void SendFetchRequests(sock *sk);
+	void DeliverFetchedChunks(sock *sk);
 	void ProcessXhcpPacket(WritablePacket *p_in);
 
 	void CreatePollEvent(unsigned short _sport, xia::X_Poll_Msg *msg);
@@ -328,17 +448,27 @@ protected:
 	void Xrecv(unsigned short _sport, xia::XSocketMsg *xia_socket_msg);
 	void Xrecvfrom(unsigned short _sport, xia::XSocketMsg *xia_socket_msg);
 	void XrequestChunk(unsigned short _sport, xia::XSocketMsg *xia_socket_msg, WritablePacket *p_in);
+	void XfetchChunks(unsigned short _sport, xia::XSocketMsg *xia_socket_msg);
 	void XgetChunkStatus(unsigned short _sport, xia::XSocketMsg *xia_socket_msg);
 	void XreadChunk(unsigned short _sport, xia::XSocketMsg *xia_socket_msg);
 	void XremoveChunk(unsigned short _sport, xia::XSocketMsg *xia_socket_msg);
 	void XpushChunkto(unsigned short _sport, xia::XSocketMsg *xia_socket_msg, WritablePacket *p_in);
 	void XbindPush(unsigned short _sport, xia::XSocketMsg *xia_socket_msg);
 	void XputChunk(unsigned short _sport, xia::XSocketMsg *xia_socket_msg);
+	void XputFile(unsigned short _sport, xia::XSocketMsg *xia_socket_msg);
+	void PublishFileBatch(XIAFilePublisher::Batch *b);
 	void Xpoll(unsigned short _sport, xia::XSocketMsg *xia_socket_msg);
 	void Xupdaterv(unsigned short _sport, xia::XSocketMsg *xia_socket_msg);
 	void Xfork(unsigned short _sport, xia::XSocketMsg *xia_socket_msg);
 	void Xreplay(unsigned short _sport, xia::XSocketMsg *xia_socket_msg);
 	void Xnotify(unsigned short _sport, xia::XSocketMsg *xia_socket_msg);
+	void Xring(unsigned short _sport, xia::XSocketMsg *xia_socket_msg, WritablePacket *p_in);
+	void CancelRing(unsigned short ring_port);
+
+	// SO_REUSEPORT groups
+	bool join_sock_group(sock *sk, const XID &xid);
+	bool leave_sock_group(sock *sk, const XID &xid);
+	sock *pick_group_receiver(sock *sk, const XID &xid);
 
 	// protocol handlers
 	void ProcessDatagramPacket(WritablePacket *p_in);
@@ -351,6 +481,8 @@ protected:
 	// TCP state handlers
 	void ProcessAckPacket(WritablePacket *p_in);
 	void ProcessXcmpPacket(WritablePacket*p_in);
+	void ProcessRouteEvents(const Vector<click_xia_route_update> &events, bool lost);
+	void SetRouteEvents(sock *sk, unsigned events);
 	void ProcessMigratePacket(WritablePacket *p_in);
 	void ProcessMigrateAck(WritablePacket *p_in);
 	void ProcessSynPacket(WritablePacket *p_in);
@@ -361,6 +493,7 @@ protected:
 
 	// timer retransmit handlers
 	bool RetransmitCIDRequest(sock *sk, unsigned short _sport, Timestamp &now, Timestamp &erlist_pending_expiry);
+	void RetransmitFetch(sock *sk, Timestamp &now, Timestamp &earliest_pending_expiry);
 	bool RetransmitDATA(sock *sk, unsigned short _sport, Timestamp &now);
 	bool RetransmitFIN(sock *sk, unsigned short _sport, Timestamp &now);
 	bool RetransmitFINACK(sock *sk, unsigned short _sport, Timestamp &now);
@@ -381,14 +514,21 @@ protected:
 	static int purge(const String &conf, Element *e, void *thunk, ErrorHandler *errh);
 
 	// modify routing table
+	// shards hand the change to the dispatcher so the route table is only touched from one thread
 	void addRoute(const XID &sid) {
 		String cmd = sid.unparse() + " " + String(DESTINED_FOR_LOCALHOST);
-		HandlerCall::call_write(_routeTable, "add", cmd);
+		if (_dispatch)
+			_dispatch->add_route(_shard, _routeTable, sid, cmd);
+		else
+			HandlerCall::call_write(_routeTable, "add", cmd);
 	}
 
 	void delRoute(const XID &sid) {
 		String cmd = sid.unparse();
-		HandlerCall::call_write(_routeTable, "remove", cmd);
+		if (_dispatch)
+			_dispatch->remove_route(_shard, _routeTable, sid);
+		else
+			HandlerCall::call_write(_routeTable, "remove", cmd);
 	}
 };
 
@@ -151,12 +151,21 @@
 #define SET_DST_PORT_ANNO(p, v)        ((p)->set_anno_u16(DST_PORT_ANNO_OFFSET, (v)))
 
 #if HAVE_XIA
-// bytes 56-63
+// byte 56
 #define XIA_NEXT_PATH_ANNO_OFFSET      56
-#define XIA_NEXT_PATH_ANNO_SIZE        8
+#define XIA_NEXT_PATH_ANNO_SIZE        1
 #  define XIA_NEXT_PATH_ANNO(p)	((p)->anno_u8(XIA_NEXT_PATH_ANNO_OFFSET))
 #  define SET_XIA_NEXT_PATH_ANNO(p, v) ((p)->set_anno_u8(XIA_NEXT_PATH_ANNO_OFFSET, (v)))
 
+// byte 57: whether a reassembled chunk matched its CID, as hashed by the cache
+#define XIA_CID_HASH_ANNO_OFFSET	57
+#define XIA_CID_HASH_ANNO_SIZE		1
+#define XIA_CID_HASH_ANNO(p)		((p)->anno_u8(XIA_CID_HASH_ANNO_OFFSET))
+#define SET_XIA_CID_HASH_ANNO(p, v)	((p)->set_anno_u8(XIA_CID_HASH_ANNO_OFFSET, (v)))
+#define XIA_CID_HASH_UNCHECKED		0
+#define XIA_CID_HASH_VALID			1
+#define XIA_CID_HASH_INVALID		2
+
 // bytes 64-87
 #define XIA_NEXT_HOP_NEIGHBOR_ANNO_OFFSET      64
 #define XIA_NEXT_HOP_NEIGHBOR_ANNO_SIZE        24
@@ -126,5 +126,55 @@ struct click_xia_xcmp {
 #define	  XCMP_TIMXCEED_TRANSIT		0	/*   ttl==0 in transit	     */
 #define	  XCMP_TIMXCEED_REASSEMBLY	1	/*   ttl==0 in reassembly    */
 
+// Route changes written in one go to an XIAXIDRouteTable's bulk handler: a
+// click_xia_route_batch header followed by count click_xia_route_update
+// records. Multi-byte fields are in network byte order.
+#define CLICK_XIA_ROUTE_BATCH_MAGIC 0x58525431  /* "XRT1" */
+
+#define CLICK_XIA_ROUTE_ADD         1   /* fails if the XID has a route */
+#define CLICK_XIA_ROUTE_SET         2
+#define CLICK_XIA_ROUTE_REMOVE      3   /* fails if the XID has no route */
+#define CLICK_XIA_ROUTE_DEFAULT     0x80    /* or'd into op: the default route, xid is ignored */
+
+struct click_xia_route_batch {
+    uint32_t magic;
+    uint32_t count;
+};
+
+struct click_xia_route_update {
+    uint8_t op;
+    uint8_t pad[3];
+    int32_t port;
+    uint32_t flags;
+    struct click_xia_xid xid;
+    struct click_xia_xid nexthop;       /* type UNDEF if there is none */
+};
+
+// Route table changes sent to raw sockets that set XOPT_ROUTE_EVENTS: a
+// click_xia_route_events header followed by count click_xia_route_update
+// records. Besides the ops above, a record may report a neighbor heard from
+// on a broadcast or an XCMP redirect. Default route records carry an XID of
+// the table's type with a zero id. If the LOST flag is set, changes were
+// dropped before this message and the tables should be read again.
+#define CLICK_XIA_ROUTE_EVENTS_MAGIC 0x58524531 /* "XRE1" */
+
+#define CLICK_XIA_ROUTE_NEIGHBOR    4   /* xid is a neighbor's HID, port is where it was heard */
+#define CLICK_XIA_ROUTE_REDIRECT    5   /* nexthop for xid was changed by a redirect */
+
+#define CLICK_XIA_ROUTE_EVENTS_LOST 0x0001
+
+// XOPT_ROUTE_EVENTS value, the kinds of change a socket wants to hear about
+#define CLICK_XIA_ROUTE_EVENT_ROUTES    0x01    /* add, set and remove */
+#define CLICK_XIA_ROUTE_EVENT_NEIGHBORS 0x02
+#define CLICK_XIA_ROUTE_EVENT_REDIRECTS 0x04
+#define CLICK_XIA_ROUTE_EVENT_ALL       0x07
+
+struct click_xia_route_events {
+    uint32_t magic;
+    uint32_t seq;                       /* counts the messages sent to the socket */
+    uint16_t count;
+    uint16_t flags;
+};
+
 #define BHID "HID:FFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFF"
 #endif
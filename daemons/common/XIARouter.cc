@@ -6,10 +6,26 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <ctype.h>
 #include <sstream>
+#include <map>
+
+#include <fcntl.h>
 
 using namespace std;
 #include "XIARouter.hh"
+#include "Xsocket.h"
+
+static const struct {
+	const char *name;
+	uint32_t type;
+} xidTypes[] = {
+	{ "AD",  CLICK_XIA_XID_TYPE_AD },
+	{ "HID", CLICK_XIA_XID_TYPE_HID },
+	{ "CID", CLICK_XIA_XID_TYPE_CID },
+	{ "SID", CLICK_XIA_XID_TYPE_SID },
+	{ "IP",  CLICK_XIA_XID_TYPE_IP },
+};
 
 int XIARouter::connect(std::string clickHost, unsigned short controlPort)
 {
@@ -35,6 +51,10 @@ void XIARouter::close()
 	if (_connected)
 		_cserr = _cs.close();
 	_connected = false;
+
+	if (_evsock >= 0)
+		Xclose(_evsock);
+	_evsock = -1;
 }
 
 int XIARouter::version(std::string &ver)
@@ -207,6 +227,200 @@ int XIARouter::delRoute(const std::string &xid)
 	return updateRoute("remove", xid, 0, next, 0);
 }
 
+// converts "TYPE:hex" to its binary form, the type is left 0 for "TYPE:-"
+bool XIARouter::packXID(const std::string &s, struct click_xia_xid &xid)
+{
+	size_t n = s.find(":");
+
+	memset(&xid, 0, sizeof(xid));
+	if (n == string::npos)
+		return false;
+	if (s.compare(n + 1, string::npos, "-") == 0)
+		return true;
+	if (s.length() - n - 1 != 2 * CLICK_XIA_XID_ID_LEN)
+		return false;
+
+	for (unsigned i = 0; i < sizeof(xidTypes) / sizeof(xidTypes[0]); i++)
+		if (s.compare(0, n, xidTypes[i].name) == 0)
+			xid.type = htonl(xidTypes[i].type);
+	if (xid.type == 0)
+		return false;
+
+	for (int i = 0; i < CLICK_XIA_XID_ID_LEN; i++) {
+		char hex[3] = { s[n + 1 + 2 * i], s[n + 2 + 2 * i], 0 };
+
+		if (!isxdigit(hex[0]) || !isxdigit(hex[1]))
+			return false;
+		xid.id[i] = strtoul(hex, NULL, 16);
+	}
+	return true;
+}
+
+int XIARouter::applyBatch(const std::vector<XIARouteUpdate> &updates)
+{
+	map<string, string> tables;
+	size_t n;
+
+	if (!connected())
+		return XR_NOT_CONNECTED;
+
+	if (getRouter().length() == 0)
+		return  XR_ROUTER_NOT_SET;
+
+	// sort the records by the table they go to, checking everything before
+	// click is told anything
+	vector<XIARouteUpdate>::const_iterator it;
+	for (it = updates.begin(); it != updates.end(); it++) {
+		struct click_xia_route_update u;
+
+		if ((n = it->xid.find(":")) == string::npos || n == 0)
+			return XR_INVALID_XID;
+		if (it->op != XR_ROUTE_ADD && it->op != XR_ROUTE_SET && it->op != XR_ROUTE_REMOVE)
+			return XR_INVALID_XID;
+
+		memset(&u, 0, sizeof(u));
+		if (!packXID(it->xid, u.xid))
+			return XR_INVALID_XID;
+		if (it->nextHop.length() > 0 && (!packXID(it->nextHop, u.nexthop) || u.nexthop.type == 0))
+			return XR_INVALID_XID;
+
+		u.op = it->op;
+		if (u.xid.type == 0)
+			u.op |= CLICK_XIA_ROUTE_DEFAULT;
+		u.port = htonl(it->port);
+		u.flags = htonl(it->flags);
+
+		string &buf = tables[it->xid.substr(0, n)];
+		if (buf.empty()) {
+			struct click_xia_route_batch hdr;
+			hdr.magic = htonl(CLICK_XIA_ROUTE_BATCH_MAGIC);
+			hdr.count = 0;
+			buf.append((const char *)&hdr, sizeof(hdr));
+		}
+		buf.append((const char *)&u, sizeof(u));
+	}
+
+	map<string, string>::iterator t;
+	for (t = tables.begin(); t != tables.end(); t++) {
+		string &buf = t->second;
+		struct click_xia_route_batch hdr;
+
+		memcpy(&hdr, buf.data(), sizeof(hdr));
+		hdr.count = htonl((buf.size() - sizeof(hdr)) / sizeof(struct click_xia_route_update));
+		buf.replace(0, sizeof(hdr), (const char *)&hdr, sizeof(hdr));
+
+		std::string table = _router + "/xrc/n/proc/rt_" + t->first;
+		if ((_cserr = _cs.write(table, "bulk", buf.data(), buf.size())) != 0)
+			return XR_CLICK_ERROR;
+	}
+
+	return XR_OK;
+}
+
+// the reverse of packXID, in lowercase like the route lists click returns
+std::string XIARouter::unpackXID(const struct click_xia_xid &xid, bool dflt)
+{
+	string s;
+	char hex[16];
+
+	for (unsigned i = 0; i < sizeof(xidTypes) / sizeof(xidTypes[0]); i++)
+		if (ntohl(xid.type) == xidTypes[i].type)
+			s = xidTypes[i].name;
+	if (s.empty()) {
+		sprintf(hex, "%u", ntohl(xid.type));
+		s = hex;
+	}
+
+	s += ":";
+	if (dflt)
+		return s + "-";
+
+	for (int i = 0; i < CLICK_XIA_XID_ID_LEN; i++) {
+		sprintf(hex, "%02x", xid.id[i]);
+		s += hex;
+	}
+	return s;
+}
+
+int XIARouter::subscribe(unsigned events)
+{
+	if (_evsock >= 0)
+		Xclose(_evsock);
+
+	if ((_evsock = Xsocket(AF_XIA, SOCK_RAW, 0)) < 0)
+		return XR_SOCKET_ERROR;
+
+	int mask = events;
+	if (Xsetsockopt(_evsock, XOPT_ROUTE_EVENTS, &mask, sizeof(mask)) < 0
+			|| Xfcntl(_evsock, F_SETFL, O_NONBLOCK) < 0) {
+		int err = errno;
+		Xclose(_evsock);
+		_evsock = -1;
+		errno = err;
+		return XR_SOCKET_ERROR;
+	}
+
+	_evseq = 0;
+	return _evsock;
+}
+
+/*
+** Each message is the XIA header click wraps it in, a click_xia_route_events
+** header, and the records. The messages are numbered from 0, so a gap means
+** one went missing.
+*/
+int XIARouter::readEvents(std::vector<XIARouteUpdate> &events, bool &lost)
+{
+	char buf[XIA_MAXBUF];
+	int n, count = 0;
+
+	lost = false;
+	if (_evsock < 0)
+		return XR_SOCKET_ERROR;
+
+	while ((n = Xrecvfrom(_evsock, buf, sizeof(buf), 0, NULL, NULL)) >= 0) {
+		struct click_xia xh;
+		struct click_xia_route_events eh;
+
+		if ((size_t)n < sizeof(xh))
+			continue;
+		memcpy(&xh, buf, sizeof(xh));
+
+		size_t off = sizeof(xh) + (xh.dnode + xh.snode) * sizeof(struct click_xia_xid_node);
+		if ((size_t)n < off + sizeof(eh))
+			continue;
+		memcpy(&eh, buf + off, sizeof(eh));
+		off += sizeof(eh);
+
+		if (ntohl(eh.magic) != CLICK_XIA_ROUTE_EVENTS_MAGIC)
+			continue;
+		if (ntohl(eh.seq) != _evseq || (ntohs(eh.flags) & CLICK_XIA_ROUTE_EVENTS_LOST))
+			lost = true;
+		_evseq = ntohl(eh.seq) + 1;
+
+		for (unsigned i = 0; i < ntohs(eh.count) && off + sizeof(struct click_xia_route_update) <= (size_t)n; i++) {
+			struct click_xia_route_update u;
+			XIARouteUpdate e;
+
+			memcpy(&u, buf + off, sizeof(u));
+			off += sizeof(u);
+
+			e.op = u.op & ~CLICK_XIA_ROUTE_DEFAULT;
+			e.xid = unpackXID(u.xid, u.op & CLICK_XIA_ROUTE_DEFAULT);
+			if (u.nexthop.type != htonl(CLICK_XIA_XID_TYPE_UNDEF))
+				e.nextHop = unpackXID(u.nexthop, false);
+			e.port = (int32_t)ntohl(u.port);
+			e.flags = ntohl(u.flags);
+			events.push_back(e);
+			count++;
+		}
+	}
+
+	if (errno != EWOULDBLOCK && errno != EAGAIN)
+		return XR_SOCKET_ERROR;
+	return count;
+}
+
 const char *XIARouter::cserror()
 {
 	switch(_cserr) {
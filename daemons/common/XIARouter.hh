@@ -17,12 +17,14 @@
 
 #include <string>
 #include <vector>
+#include <stdint.h>
 
 // FIXME: stupid hack because csclient.hh requires it, need to modify that code
 // to prefix string and vector woth std::
 using namespace std;
 
 #include "csclient.hh"
+#include "clicknetxia.h"
 
 // questions:
 //  where do we want to specify the device (router0, etc?) at init time, or in each call?
@@ -38,6 +40,7 @@ using namespace std;
 #define XR_ROUTER_NOT_SET		-7
 #define XR_BAD_HOSTNAME			-8
 #define XR_INVALID_XID			-9
+#define XR_SOCKET_ERROR			-10	// errno says why
 
 #define TOTAL_SPECIAL_CASES 8
 #define DESTINED_FOR_DISCARD -1
@@ -55,10 +58,33 @@ typedef struct {
 	unsigned long  flags;
 } XIARouteEntry;
 
+// route operations for applyBatch()
+#define XR_ROUTE_ADD			1
+#define XR_ROUTE_SET			2
+#define XR_ROUTE_REMOVE			3
+
+// also reported by readEvents()
+#define XR_ROUTE_NEIGHBOR		4	// a neighbor HID was heard from on port
+#define XR_ROUTE_REDIRECT		5	// an XCMP redirect changed the next hop to xid
+
+// the kinds of change subscribe() asks for
+#define XR_EVENTS_ROUTES		CLICK_XIA_ROUTE_EVENT_ROUTES	// add, set and remove
+#define XR_EVENTS_NEIGHBORS		CLICK_XIA_ROUTE_EVENT_NEIGHBORS
+#define XR_EVENTS_REDIRECTS		CLICK_XIA_ROUTE_EVENT_REDIRECTS
+#define XR_EVENTS_ALL			CLICK_XIA_ROUTE_EVENT_ALL
+
+typedef struct {
+	int op;
+	std::string xid;
+	std::string nextHop;	// may be empty
+	int port;
+	unsigned long flags;
+} XIARouteUpdate;
+
 class XIARouter {
 public:
 	XIARouter(const char *_rtr = "router0") { _connected = false; 
-		_cserr = ControlSocketClient::no_err; _router = _rtr; };
+		_cserr = ControlSocketClient::no_err; _router = _rtr; _evsock = -1; _evseq = 0; };
 	~XIARouter() { if (connected()) close(); };
 
 	// connect to click
@@ -88,14 +114,36 @@ public:
 	int setRoute(const std::string &xid, int port, const std::string &next, unsigned long flags);
 	int delRoute(const std::string &xid);
 
+	// applies a list of route changes with one write to click per XID type.
+	// click checks all of the changes to a table before making any, so a
+	// failed batch leaves that table as it was. XIDs must be hex, of the
+	// AD, HID, CID, SID or IP types. returns 0 success, < 0 on error
+	int applyBatch(const std::vector<XIARouteUpdate> &updates);
+
+	// opens a socket that click sends the changes to the route tables of the
+	// host set by set_conf() over, events is a mask of XR_EVENTS_*. The socket
+	// doesn't block and can be given to Xpoll. returns the socket, < 0 on error
+	int subscribe(unsigned events = XR_EVENTS_ALL);
+	int eventSocket() { return _evsock; };
+
+	// appends the changes that have arrived since the last call to events.
+	// Default routes are reported as "TYPE:-". lost is set if any were
+	// dropped, getRoutes() then has the current tables.
+	// returns the number of changes read, < 0 on error
+	int readEvents(std::vector<XIARouteUpdate> &events, bool &lost);
+
 	const char *cserror();
 private:
 	bool _connected;
 	std::string _router;
 	ControlSocketClient _cs;
 	ControlSocketClient::err_t _cserr;
+	int _evsock;
+	uint32_t _evseq;	// seq of the next event message
 
 	int updateRoute(std::string cmd, const std::string &xid, int port, const std::string &next, unsigned long flags);
 	string itoa(signed);
+	static bool packXID(const std::string &s, struct click_xia_xid &xid);
+	static std::string unpackXID(const struct click_xia_xid &xid, bool dflt);
 };
 
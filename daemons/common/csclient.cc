@@ -264,11 +264,14 @@ ControlSocketClient::write(string el, string handler, const char *buf, int bufsz
   if ((size_t) res != cmd.size())
     return sys_err;
 
-  res = ::write(_fd, buf, bufsz);
-  if (res < 0)
-    return sys_err;
-  if (res != bufsz)
-    return sys_err;
+  // large writes (such as route batches) may go out in pieces
+  for (int sent = 0; sent < bufsz; sent += res) {
+    res = ::write(_fd, buf + sent, bufsz - sent);
+    if (res < 0 && errno == EINTR)
+      res = 0;
+    else if (res <= 0)
+      return sys_err;
+  }
 
   string cmd_resp;
   string line;
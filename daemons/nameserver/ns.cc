@@ -11,27 +11,65 @@
 #include <stddef.h>
 #include <errno.h>
 #include <libgen.h>
-#include <map>
+#include <limits.h>
+#include <set>
+#include <algorithm>
+#include <vector>
+#include <sstream>
+#include <tr1/unordered_map>
 using namespace std;
 
 #include "Xsocket.h"
 #include "xns.h"
 #include "dagaddr.hpp"
+#include "nsstore.hh"
 
 #define DEFAULT_NAME "host0"
 #define APPNAME "xnameservice"
 
-map<std::string, std::string> name_to_dag_db_table; // map name to dag
+#define NS_SHARDS	64	// independently locked parts of the database
+#define NS_WORKERS	4	// default # of threads answering requests
+#define MAX_WORKERS	64
+#define STORE_DIR	"/etc"	// under XIADIR, where the names are saved
+
+typedef std::tr1::unordered_map<std::string, NameRecord> NameMap;
+typedef std::tr1::unordered_map<std::string, std::set<std::string> > DagMap;
+
+// names are sharded by name, the reverse index by dag. A name's lock is
+//  taken before a dag's, and only one dag lock is held at a time.
+typedef struct {
+	pthread_rwlock_t lock;
+	bool restoring;		// its saved names are still only in the store
+	NameMap names;
+	pthread_rwlock_t dag_lock;
+	DagMap dags;		// dag -> the names registered with it
+} Shard;
+
+Shard name_to_dag_db_table[NS_SHARDS];
+
+// registrations wait here for their shard to be restored
+pthread_mutex_t restore_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t restored = PTHREAD_COND_INITIALIZER;
+
+// the reverse index is built after the saved names are restored, until then
+//  reverse lookups search the names
+volatile int dags_ready = 0;
 
 char *hostname = NULL;
 char *ident = NULL;
+char *store_dir = NULL;
+int workers = NS_WORKERS;
+unsigned ttl = NS_DEFAULT_TTL;
 
 void help(const char *name)
 {
-	printf("\nusage: %s [-l level] [-v] [-c config] [-h hostname]\n", name);
+	printf("\nusage: %s [-l level] [-v] [-t threads] [-T ttl] [-d dir] [-h hostname]\n", name);
 	printf("where:\n");
 	printf(" -l level    : syslog logging level 0 = LOG_EMERG ... 7 = LOG_DEBUG (default=3:LOG_ERR)\n");
 	printf(" -v          : log to the console as well as syslog\n");
+	printf(" -t threads  : # of threads answering requests (default=%d)\n", NS_WORKERS);
+	printf(" -T ttl      : seconds clients may cache answers (default=%d)\n", NS_DEFAULT_TTL);
+	printf(" -d dir      : directory the names are saved in (default=$XIADIR%s)\n", STORE_DIR);
 	printf(" -h hostname : click device name (default=host0)\n");
 	printf("\n");
 	exit(0);
@@ -45,14 +83,23 @@ void config(int argc, char** argv)
 
 	opterr = 0;
 
-	while ((c = getopt(argc, argv, "h:l:v")) != -1) {
+	while ((c = getopt(argc, argv, "d:h:l:t:T:v")) != -1) {
 		switch (c) {
+			case 'd':
+				store_dir = strdup(optarg);
+				break;
 			case 'h':
 				hostname = strdup(optarg);
 				break;
 			case 'l':
 				level = MIN(atoi(optarg), LOG_DEBUG);
 				break;
+			case 't':
+				workers = MAX(1, MIN(atoi(optarg), MAX_WORKERS));
+				break;
+			case 'T':
+				ttl = MAX(1, atoi(optarg));
+				break;
 			case 'v':
 				verbose = LOG_PERROR;
 				break;
@@ -98,229 +145,600 @@ int check_pair(Graph &g, int ad, int hid)
 	return found;
 }
 
-// Called when a name registration is recieved with the migrate flag set.
-// This will happen when the xhcp client registers a name for its AD:HID
-//  and will happen whenever the host finds itself in a new AD.
-// If an older host entry is found for this HID, replace the entry, and
-//  find any other names that use the old AD and update them to use the new one
-//  instead.
-void migrate(const char *name, const char *dag)
+// pieces of s between delims, as the DAG parser splits them
+static std::vector<std::string> split_dag(const std::string &s, char delim)
 {
-	map<std::string, std::string>::iterator it;
+	std::vector<std::string> pieces;
+	std::stringstream ss(s);
+	std::string piece;
 
-	it = name_to_dag_db_table.find(name);
-	if (it != name_to_dag_db_table.end()) {
+	while (std::getline(ss, piece, delim))
+		pieces.push_back(piece);
+	return pieces;
+}
 
-		// name is already registered, we may need to migrate it
+// one of the built in XID types, or one listed in etc/xids
+static bool known_type(const std::string &type)
+{
+	if (type == Node::XID_TYPE_AD_STRING || type == Node::XID_TYPE_HID_STRING
+			|| type == Node::XID_TYPE_CID_STRING || type == Node::XID_TYPE_SID_STRING
+			|| type == Node::XID_TYPE_IP_STRING)
+		return true;
+
+	for (Node::XidMap::const_iterator it = Node::xids.begin(); it != Node::xids.end(); ++it)
+		if (it->second == type)
+			return true;
+	return false;
+}
 
-		string dag_str = it->second;
+// "TYPE:" followed by 40 hex digits
+static bool valid_node(const std::string &node)
+{
+	size_t colon = node.find(':');
+
+	if (colon == std::string::npos || node.length() - colon - 1 != 2 * Node::ID_LEN
+			|| !known_type(node.substr(0, colon)))
+		return false;
+	for (size_t i = colon + 1; i < node.length(); i++)
+		if (!isxdigit(node[i]))
+			return false;
+	return true;
+}
 
-		Graph new_dag(dag);
-		Graph old_dag(dag_str);
-		Node *new_ad = NULL;
-		Node *new_hid = NULL;
-		Node *old_ad = NULL;
+// edges[i] are the nodes node i points to, node 0 is where the DAG starts.
+// The rest have to fit in a sockaddr_x, be reachable from the start without
+//  going round in circles, and lead to a single sink.
+static bool valid_graph(const std::vector<std::vector<size_t> > &edges, size_t &sink)
+{
+	size_t n = edges.size();
+	std::vector<int> state(n, 0);	// 1 while its paths are walked, 2 after
+	std::vector<std::pair<size_t, size_t> > stack;
+	size_t sinks = 0;
+
+	if (n < 2 || n - 1 > NODES_MAX)
+		return false;
+
+	for (size_t i = 0; i < n; i++) {
+		if (edges[i].size() > EDGES_MAX)
+			return false;
+		if (edges[i].empty()) {
+			sink = i;
+			sinks++;
+		}
+	}
+	if (sinks != 1)
+		return false;
+
+	stack.push_back(std::make_pair(0, 0));
+	state[0] = 1;
+	while (!stack.empty()) {
+		size_t node = stack.back().first;
+		size_t &next = stack.back().second;
+
+		if (next == edges[node].size()) {
+			state[node] = 2;
+			stack.pop_back();
+			continue;
+		}
 
-		int ad_index = -1;
-		int hid_index = -1;
+		size_t to = edges[node][next++];
+		if (state[to] == 1)
+			return false;
+		if (state[to] == 0) {
+			state[to] = 1;
+			stack.push_back(std::make_pair(to, 0));
+		}
+	}
 
-		// find AD & HID in the new DAG
-		for (int i = 0; i < new_dag.num_nodes(); i++) {
-			Node n = new_dag.get_node(i);
+	for (size_t i = 0; i < n; i++)
+		if (state[i] != 2)
+			return false;
+	return true;
+}
 
-			if (n.type() == Node::XID_TYPE_AD) {
-				ad_index = i;
-				new_ad = new Node(n);
+// "DAG e... - TYPE:ID e... - ... - TYPE:ID", where edges are indexes of the
+//  nodes after the first line and the sink comes last
+static bool valid_dag_format(std::string dag)
+{
+	dag.erase(std::remove(dag.begin(), dag.end(), '\n'), dag.end());
+	std::vector<std::string> lines = split_dag(dag, '-');
+	std::vector<std::vector<size_t> > edges(lines.size());
+	size_t sink;
+
+	for (size_t i = 0; i < lines.size(); i++) {
+		size_t begin = lines[i].find_first_not_of(" \t");
+		size_t end = lines[i].find_last_not_of(" \t");
+		if (begin == std::string::npos)
+			return false;
+
+		std::vector<std::string> elems = split_dag(lines[i].substr(begin, end - begin + 1), ' ');
+		if (i == 0 ? elems[0] != "DAG" : !valid_node(elems[0]))
+			return false;
+
+		for (size_t j = 1; j < elems.size(); j++) {
+			const std::string &e = elems[j];
+
+			if (e.empty() || e.length() > 2 || e.find_first_not_of("0123456789") != std::string::npos
+					|| (size_t)atoi(e.c_str()) + 1 >= lines.size())
+				return false;
+			edges[i].push_back(atoi(e.c_str()) + 1);
+		}
+	}
+	return valid_graph(edges, sink) && sink == lines.size() - 1;
+}
 
-			} else if (n.type() == Node::XID_TYPE_HID) {
-				hid_index = i;
-				new_hid = new Node(n);
+// "RE TYPE:ID ( TYPE:ID ... ) TYPE:ID ...", where a fallback path in
+//  brackets rejoins the intent at the node after it
+static bool valid_re_format(const std::string &re)
+{
+	std::vector<std::string> components = split_dag(re, ' ');
+	std::vector<std::vector<size_t> > edges(1);
+	size_t intent = 0, first_fallback = 0, last_fallback = 0, sink;
+	bool in_fallback = false, after_fallback = false;
+
+	if (components.empty() || components[0] != "RE")
+		return false;
+
+	for (size_t i = 1; i < components.size(); i++) {
+		if (components[i] == "(") {
+			if (in_fallback || after_fallback)
+				return false;
+			in_fallback = true;
+			first_fallback = 0;
+		} else if (components[i] == ")") {
+			if (!in_fallback || first_fallback == 0)
+				return false;
+			in_fallback = false;
+			after_fallback = true;
+		} else {
+			if (!valid_node(components[i]))
+				return false;
+			size_t node = edges.size();
+			edges.push_back(std::vector<size_t>());
+
+			if (in_fallback) {
+				if (first_fallback == 0)
+					first_fallback = node;
+				else
+					edges[last_fallback].push_back(node);
+				last_fallback = node;
+			} else {
+				edges[intent].push_back(node);
+				if (after_fallback) {
+					edges[intent].push_back(first_fallback);
+					edges[last_fallback].push_back(node);
+					after_fallback = false;
+				}
+				intent = node;
 			}
 		}
+	}
+	return !in_fallback && valid_graph(edges, sink);
+}
 
-		if (check_pair(new_dag, ad_index, hid_index)) {
+// Graph takes any string, and may throw or read past the nodes it has on a
+//  malformed one, so requests are checked before their DAGs are parsed
+bool valid_dag(const char *dag)
+{
+	std::string s(dag);
+
+	// the formats are told apart the same way Graph does
+	if (s.find("DAG") != std::string::npos)
+		return valid_dag_format(s);
+	if (s.find("RE") != std::string::npos)
+		return valid_re_format(s);
+	return false;
+}
 
-			// we found the new AD/HID and AD has an out edge to HID
+// parse the DAG once, so migration checks don't have to later
+void make_record(const char *dag, NameRecord &r)
+{
+	Graph g(dag);
+	int ad_index = -1;
+	int hid_index = -1;
+
+	// this assumes the DAG only has a single AD and HID in it
+	// and will only reliably work for and dag like AD->HID or IP->(AD->HID)
+	for (int i = 0; i < g.num_nodes(); i++) {
+		Node n = g.get_node(i);
+
+		if (n.type() == Node::XID_TYPE_AD) {
+			ad_index = i;
+			r.ad = n.to_string();
+
+		} else if (n.type() == Node::XID_TYPE_HID) {
+			hid_index = i;
+			r.hid = n.to_string();
+		}
+	}
 
-			ad_index = -1;
-			hid_index = -1;
+	r.dag = dag;
+	r.host = check_pair(g, ad_index, hid_index);
+}
 
-			// this assumes the old DAG only has a single AD and HID in it
-			// and will only reliably work for and dag like AD->HID or IP->(AD->HID)
-			for (int i = 0; i < old_dag.num_nodes(); i++) {
+// FNV-1a, the store sorts the saved names into shards with it
+int shard_index(const char *key)
+{
+	uint32_t h = 2166136261u;
 
-				Node n = old_dag.get_node(i);
-				if (n.type() == Node::XID_TYPE_AD) {
-					ad_index = i;
-					old_ad = new Node(n);
-				}
-				else if (n.type() == Node::XID_TYPE_HID && new_hid->equal_to(n)) {
-					// we found an HID that matches the one in the new dag
-					hid_index = i;
-				}
-			}
+	for (; *key; key++)
+		h = (h ^ (unsigned char)*key) * 16777619u;
+	return h % NS_SHARDS;
+}
 
-			if (check_pair(old_dag, ad_index, hid_index)) {
+Shard &shard(const char *key)
+{
+	return name_to_dag_db_table[shard_index(key)];
+}
 
-				// HIDs match, time to update dags in our database
+Shard &shard(const std::string &key)
+{
+	return shard(key.c_str());
+}
 
-				// this dag has migrated, put new record in table
-				syslog(LOG_INFO, "migrated host record %s to %s:%s", name,
-						new_ad->type_string().c_str(), new_ad->id_string().c_str());
-				name_to_dag_db_table[name] = dag;
+// caller holds the write lock of name's shard
+// returns false if name already had this dag
+bool set_record(Shard &s, const char *name, const NameRecord &r)
+{
+	NameMap::iterator it = s.names.find(name);
+
+	if (it != s.names.end()) {
+		if (it->second.dag == r.dag)
+			return false;
+
+		Shard &old = shard(it->second.dag);
+		pthread_rwlock_wrlock(&old.dag_lock);
+		DagMap::iterator d = old.dags.find(it->second.dag);
+		if (d != old.dags.end()) {
+			d->second.erase(name);
+			if (d->second.empty())
+				old.dags.erase(d);
+		}
+		pthread_rwlock_unlock(&old.dag_lock);
 
-				// now walk the list of registered dags and update those that should migrate
-				/*
-				for (it = name_to_dag_db_table.begin(); it != name_to_dag_db_table.end(); it++) {
-					string ds = it->second;
-					string nm = it->first;
-					Graph g(ds);
+		it->second = r;
+	} else {
+		s.names[name] = r;
+	}
 
-					ad_index = -1;
-					hid_index = -1;
+	Shard &ds = shard(r.dag);
+	pthread_rwlock_wrlock(&ds.dag_lock);
+	ds.dags[r.dag].insert(name);
+	pthread_rwlock_unlock(&ds.dag_lock);
+	return true;
+}
 
-					for (int i = 0; i < g.num_nodes(); i++) {
-						if (old_ad->equal_to(g.get_node(i)))
-							ad_index = i;
-						else if (new_hid->equal_to(g.get_node(i)))
-							hid_index = i;
-					}
+// Called when a name registration is recieved with the migrate flag set.
+// This will happen when the xhcp client registers a name for its AD:HID
+//  and will happen whenever the host finds itself in a new AD.
+// If an older host entry is found for this HID, replace the entry.
+// Returns true if the record was added or replaced.
+bool migrate(Shard &s, const char *name, const NameRecord &r)
+{
+	NameMap::iterator it = s.names.find(name);
 
-					if (check_pair(g, ad_index, hid_index)) {
+	if (it == s.names.end()) {
+		syslog(LOG_DEBUG, "%s is new, no migration needed", name);
+		syslog(LOG_INFO, "registered %s", name);
+		return true;
+	}
 
-						// update the AD node
-						syslog(LOG_INFO, "migrated name record %s to %s:%s", nm.c_str(),
-							new_ad->type_string().c_str(), new_ad->id_string().c_str());
-						g.replace_node_at(ad_index, *new_ad);
-						name_to_dag_db_table[nm] = g.dag_string();
-					}
-				}
-				*/
-			}
-		}
+	// name is already registered, we may need to migrate it
+	// only if the new dag is a host record and the HIDs match
+	const NameRecord &old = it->second;
+	if (r.host && old.host && r.hid == old.hid) {
+		syslog(LOG_INFO, "migrated host record %s to %s", name, r.ad.c_str());
+		return true;
+	}
+	return false;
+}
 
-		if (new_ad)  delete new_ad;
-		if (new_hid) delete new_hid;
-		if (old_ad)  delete old_ad;
+// called by any of the workers, the parse happens before taking the lock
+// returns false if dag is malformed
+bool register_name(const char *name, const char *dag, bool migrating)
+{
+	NameRecord r;
 
+	if (!valid_dag(dag)) {
+		syslog(LOG_WARNING, "not registering %s, malformed DAG: %s", name, dag);
+		return false;
+	}
+	make_record(dag, r);
+
+	// a name restored after this would undo it
+	Shard &s = shard(name);
+	pthread_mutex_lock(&restore_lock);
+	while (s.restoring)
+		pthread_cond_wait(&restored, &restore_lock);
+	pthread_mutex_unlock(&restore_lock);
+
+	pthread_rwlock_wrlock(&s.lock);
+	if (migrating) {
+		// this should be a host record, if no matching name is in the
+		//  database, just add the record
+		// if the name already exists, check that the HIDs match, and
+		//  if so replace the entry
+		if (migrate(s, name, r) && set_record(s, name, r))
+			store_append(name, r);
 	} else {
-		syslog(LOG_DEBUG, "%s is new, no migration needed", name);
-		syslog(LOG_INFO, "registered %s", name);
-		name_to_dag_db_table[name] = dag;
+		// just add the new name record
+		syslog(LOG_INFO, "new entry: %s = %s", name, dag);
+		if (set_record(s, name, r))
+			store_append(name, r);
 	}
+	pthread_rwlock_unlock(&s.lock);
+	return true;
 }
 
+// make room for the saved names before they are restored, the tables are
+//  only rebuilt if they would have to grow
+void reserve_names(size_t count)
+{
+	for (int i = 0; i < NS_SHARDS; i++) {
+		NameMap &names = name_to_dag_db_table[i].names;
+		size_t want = names.size() + count / NS_SHARDS;
 
-int main(int argc, char *argv[]) {
-	sockaddr_x ddag;
-	int rtype = NS_TYPE_RESPONSE_ERROR;
+		if (want > names.bucket_count() * names.max_load_factor())
+			names.rehash(want);
+	}
+}
 
-	char pkt_out[NS_MAX_PACKET_SIZE];
-	char pkt_in[NS_MAX_PACKET_SIZE];
-	string response_str;
+// called by the threads restoring the saved names while requests are
+//  answered, the reverse index is built once they are all back
+void restore_name(const char *name, NameRecord &r)
+{
+	// one copy of the name for the lookup and the insert
+	std::string key(name);
+	Shard &s = shard(name);
+
+	pthread_rwlock_wrlock(&s.lock);
+	NameRecord &rec = s.names[key];
+	rec.dag.swap(r.dag);
+	rec.host = r.host;
+	rec.ad.swap(r.ad);
+	rec.hid.swap(r.hid);
+	pthread_rwlock_unlock(&s.lock);
+}
 
-	config(argc, argv);
-	syslog(LOG_NOTICE, "%s started on %s", APPNAME, hostname);
+// called once every saved name in the shard is restored
+void shard_restored(int i)
+{
+	Shard &s = name_to_dag_db_table[i];
+
+	pthread_rwlock_wrlock(&s.lock);
+	pthread_mutex_lock(&restore_lock);
+	s.restoring = false;
+	pthread_cond_broadcast(&restored);
+	pthread_mutex_unlock(&restore_lock);
+	pthread_rwlock_unlock(&s.lock);
+}
 
-	// Xsocket init
-	int sock = Xsocket(AF_XIA, SOCK_DGRAM, 0);
-	if (sock < 0) {
-   		syslog(LOG_ALERT, "Unable to create a socket");
-   		exit(-1);
-	}
+// index the restored names by dag while requests are being answered, a
+//  name registered meanwhile is indexed by set_record and again here, which
+//  is harmless as long as it's done with the name's shard locked
+void index_dags()
+{
+	for (int i = 0; i < NS_SHARDS; i++) {
+		Shard &s = name_to_dag_db_table[i];
 
-	struct addrinfo *ai;
-	if (Xgetaddrinfo(NULL, SID_NS, NULL, &ai) != 0) {
-   		syslog(LOG_ALERT, "unable to get local address");
-		exit(-1);
+		pthread_rwlock_rdlock(&s.lock);
+		for (NameMap::const_iterator it = s.names.begin(); it != s.names.end(); ++it) {
+			Shard &ds = shard(it->second.dag);
+
+			pthread_rwlock_wrlock(&ds.dag_lock);
+			ds.dags[it->second.dag].insert(it->first);
+			pthread_rwlock_unlock(&ds.dag_lock);
+		}
+		pthread_rwlock_unlock(&s.lock);
 	}
 
-	sockaddr_x *sa = (sockaddr_x*)ai->ai_addr;
+	__sync_synchronize();
+	dags_ready = 1;
+	syslog(LOG_INFO, "reverse lookups are indexed");
+}
 
-	if (Xbind(sock, (struct sockaddr*)sa, sizeof(sockaddr_x)) < 0) {
-   		Graph g(sa);
-   		syslog(LOG_ALERT, "unable to bind to local DAG : %s", g.dag_string().c_str());
-   		exit(-1);
-	}
+// restores the saved names while requests are being answered
+void restore_names()
+{
+	int cpus = MAX(1, sysconf(_SC_NPROCESSORS_ONLN));
 
-	// main looping
-	while(1) {
-		memset(pkt_in, 0, sizeof(pkt_in));
-		socklen_t ddaglen = sizeof(ddag);
-		int rc = Xrecvfrom(sock, pkt_in, NS_MAX_PACKET_SIZE, 0, (struct sockaddr*)&ddag, &ddaglen);
-		if (rc < 0) {
-			syslog(LOG_WARNING, "error receiving data (%s)", strerror(errno));
+	store_restore(cpus, reserve_names, restore_name, shard_restored);
+	syslog(LOG_INFO, "saved names are restored");
+}
+
+// restores and indexes the saved names, then flushes them to disk every
+//  second, and writes a new snapshot once the log is big enough. Only one
+//  shard at a time is held, and only for reading, so queries are never
+//  kept waiting.
+void *saver(void *)
+{
+	restore_names();
+	index_dags();
+
+	while (1) {
+		sleep(1);
+		store_sync();
+
+		if (!store_should_compact() || !store_begin_snapshot())
 			continue;
+
+		for (int i = 0; i < NS_SHARDS; i++) {
+			Shard &s = name_to_dag_db_table[i];
+
+			pthread_rwlock_rdlock(&s.lock);
+			for (NameMap::const_iterator it = s.names.begin(); it != s.names.end(); ++it)
+				store_snapshot_add(it->first.c_str(), it->second);
+			pthread_rwlock_unlock(&s.lock);
 		}
+		store_end_snapshot();
+	}
+	return NULL;
+}
 
-   		ns_pkt req_pkt;
-   		get_ns_packet(pkt_in, rc, &req_pkt);
+bool lookup_name(const char *name, std::string &dag)
+{
+	bool found = false;
+	int i = shard_index(name);
+	Shard &s = name_to_dag_db_table[i];
 
-    	switch (req_pkt.type) {
-		case NS_TYPE_REGISTER:
-			// insert a new entry
+	pthread_rwlock_rdlock(&s.lock);
+	if (s.restoring) {
+		found = store_find(i, name, dag);
+	} else {
+		NameMap::const_iterator it = s.names.find(name);
+		if (it != s.names.end()) {
+			dag = it->second.dag;
+			found = true;
+		}
+	}
+	pthread_rwlock_unlock(&s.lock);
+	return found;
+}
 
-			if (req_pkt.flags & NS_FLAGS_MIGRATE) {
-				// this should be a host record, if no matching name is in the
-				//  database, just add the record
-				// if the name already exists, check that the HIDs match, and
-				//  if so replace the entry, and update the AD in any name records that
-				//  contain the same HID
-				migrate(req_pkt.name, req_pkt.dag);
-			} else {
-				// just add the new name record
-				syslog(LOG_INFO, "new entry: %s = %s", req_pkt.name, req_pkt.dag);
-				name_to_dag_db_table[req_pkt.name] = req_pkt.dag;
-			}
-			rtype = NS_TYPE_RESPONSE_REGISTER;
-			break;
+// the same answer the index gives, the last matching name in order
+bool search_dag(const char *dag, std::string &name)
+{
+	bool found = false;
 
-		case NS_TYPE_QUERY:
-		{
-			map<std::string, std::string>::iterator it;
-			it = name_to_dag_db_table.find(req_pkt.name);
+	for (int i = 0; i < NS_SHARDS; i++) {
+		Shard &s = name_to_dag_db_table[i];
 
-			if(it != name_to_dag_db_table.end()) {
-				response_str = it->second;
-				rtype = NS_TYPE_RESPONSE_QUERY;
-				syslog(LOG_DEBUG, "Successful name lookup for %s", req_pkt.name);
-			} else {
-				rtype = NS_TYPE_RESPONSE_ERROR;
-				syslog(LOG_DEBUG, "DAG for %s not found", req_pkt.name);
-			}
-			break;
-		}
+		pthread_rwlock_rdlock(&s.lock);
+		if (s.restoring) {
+			std::string saved;
 
-		case NS_TYPE_RQUERY:
-		{
-			map<std::string, std::string>::iterator it;
-			// Walk the table and look for a matching DAG
-			for(it=name_to_dag_db_table.begin(); it!=name_to_dag_db_table.end(); it++) {
-				if(strcmp(it->second.c_str(), req_pkt.dag) != 0) {
-					continue;
+			if (store_find_dag(i, dag, saved) && (!found || saved > name)) {
+				name = saved;
+				found = true;
+			}
+		} else {
+			for (NameMap::const_iterator it = s.names.begin(); it != s.names.end(); ++it) {
+				if (it->second.dag == dag && (!found || it->first > name)) {
+					name = it->first;
+					found = true;
 				}
-				response_str = it->first;
-				rtype = NS_TYPE_RESPONSE_RQUERY;
-				syslog(LOG_DEBUG, "Successful DAG lookup for %s", req_pkt.dag);
 			}
-			break;
 		}
+		pthread_rwlock_unlock(&s.lock);
+	}
+	return found;
+}
 
-		default:
-			syslog(LOG_WARNING, "unrecognized request: %d", req_pkt.type);
+bool lookup_dag(const char *dag, std::string &name)
+{
+	bool found = false;
+	Shard &s = shard(dag);
+
+	if (!dags_ready)
+		return search_dag(dag, name);
+	__sync_synchronize();
+
+	pthread_rwlock_rdlock(&s.dag_lock);
+	DagMap::const_iterator it = s.dags.find(dag);
+	if (it != s.dags.end()) {
+		// same answer as a walk of the names in order would give
+		name = *it->second.rbegin();
+		found = true;
+	}
+	pthread_rwlock_unlock(&s.dag_lock);
+	return found;
+}
+
+// fill pkt_out with the response to req, returns its length
+int process_request(ns_pkt &req, char *pkt_out, int size)
+{
+	ns_pkt response_pkt;
+	std::string response_str;
+	std::string dags[NS_MAX_BATCH];
+	int rtype;
+
+	response_pkt.name = response_pkt.dag = NULL;
+	response_pkt.count = 0;
+	response_pkt.ttl = 0;
+
+	switch (req.type) {
+	case NS_TYPE_REGISTER:
+		// insert a new entry
+		if (register_name(req.name, req.dag, req.flags & NS_FLAGS_MIGRATE))
+			rtype = NS_TYPE_RESPONSE_REGISTER;
+		else
 			rtype = NS_TYPE_RESPONSE_ERROR;
-			break;
+		break;
+
+	case NS_TYPE_QUERY:
+		if (lookup_name(req.name, response_str)) {
+			response_pkt.dag = response_str.c_str();
+			response_pkt.ttl = ttl;
+			rtype = NS_TYPE_RESPONSE_QUERY;
+			syslog(LOG_DEBUG, "Successful name lookup for %s", req.name);
+		} else {
+			// the name may be registered soon, don't let clients wait long
+			response_pkt.ttl = MIN(ttl, NS_NEGATIVE_TTL);
+			rtype = NS_TYPE_RESPONSE_ERROR;
+			syslog(LOG_DEBUG, "DAG for %s not found", req.name);
+		}
+		break;
+
+	case NS_TYPE_RQUERY:
+		if (lookup_dag(req.dag, response_str)) {
+			response_pkt.name = response_str.c_str();
+			rtype = NS_TYPE_RESPONSE_RQUERY;
+			syslog(LOG_DEBUG, "Successful DAG lookup for %s", req.dag);
+		} else {
+			rtype = NS_TYPE_RESPONSE_ERROR;
+			syslog(LOG_DEBUG, "name for %s not found", req.dag);
 		}
+		break;
+
+	case NS_TYPE_MQUERY:
+		// names that aren't found get an empty dag, if all of the answers
+		//  don't fit, the client asks again for the rest
+		for (int i = 0; i < req.count; i++) {
+			lookup_name(req.names[i], dags[i]);
+			response_pkt.dags[i] = dags[i].c_str();
+		}
+		response_pkt.count = req.count;
+		response_pkt.ttl = ttl;
+		rtype = NS_TYPE_RESPONSE_MQUERY;
+		syslog(LOG_DEBUG, "batched lookup of %d names", req.count);
+		break;
+
+	default:
+		syslog(LOG_WARNING, "unrecognized request: %d", req.type);
+		rtype = NS_TYPE_RESPONSE_ERROR;
+		break;
+	}
 
-		//Construct a response packet
-		ns_pkt response_pkt;
+	//Construct a response packet
+	response_pkt.type = rtype;
+	response_pkt.flags = 0;
+	// pack it up to go on the wire
+	return make_ns_packet(&response_pkt, pkt_out, size);
+}
+
+// each worker answers the requests click hands to its own socket
+void *worker(void *arg)
+{
+	int sock = (int)(intptr_t)arg;
+	sockaddr_x ddag;
+	char pkt_out[NS_MAX_PACKET_SIZE];
+	char pkt_in[NS_MAX_PACKET_SIZE + 2];
 
-		response_pkt.type = rtype;
-		response_pkt.flags = 0;
-		response_pkt.name = (rtype == NS_TYPE_RESPONSE_RQUERY) ? response_str.c_str(): NULL;
-		response_pkt.dag = (rtype == NS_TYPE_RESPONSE_QUERY) ? response_str.c_str() : NULL;
-		// pack it up to go on the wire
-		int len = make_ns_packet(&response_pkt, pkt_out, sizeof(pkt_out));
+	while(1) {
+		socklen_t ddaglen = sizeof(ddag);
+		int rc = Xrecvfrom(sock, pkt_in, NS_MAX_PACKET_SIZE, 0, (struct sockaddr*)&ddag, &ddaglen);
+		if (rc < 0) {
+			syslog(LOG_WARNING, "error receiving data (%s)", strerror(errno));
+			continue;
+		}
+		// terminate the name and dag of a short request instead of clearing
+		//  the whole buffer
+		pkt_in[rc] = pkt_in[rc + 1] = 0;
+
+		ns_pkt req_pkt;
+		get_ns_packet(pkt_in, rc, &req_pkt);
+
+		int len = process_request(req_pkt, pkt_out, sizeof(pkt_out));
 
 		//Send the response packet back to the query node
 		rc = Xsendto(sock, pkt_out, len, 0, (struct sockaddr*)&ddag, sizeof(ddag));
@@ -329,5 +747,89 @@ int main(int argc, char *argv[]) {
 		else
 			syslog(LOG_WARNING, "unable to send response (%d)", errno);
 	}
+	return NULL;
+}
+
+int main(int argc, char *argv[]) {
+	int socks[MAX_WORKERS];
+
+	config(argc, argv);
+	syslog(LOG_NOTICE, "%s started on %s", APPNAME, hostname);
+
+	for (int i = 0; i < NS_SHARDS; i++) {
+		pthread_rwlock_init(&name_to_dag_db_table[i].lock, NULL);
+		pthread_rwlock_init(&name_to_dag_db_table[i].dag_lock, NULL);
+		name_to_dag_db_table[i].restoring = true;
+	}
+
+	// bring back the names from before the last restart, they are answered
+	//  from the saved files until the saver has restored them
+	char root[PATH_MAX];
+	std::string dir = store_dir ? store_dir : std::string(XrootDir(root, sizeof(root))) + STORE_DIR;
+	std::string prefix = std::string(hostname) + ".names";
+	int cpus = MAX(1, sysconf(_SC_NPROCESSORS_ONLN));
+
+	pthread_t t;
+	int count = store_open(dir.c_str(), prefix.c_str(), cpus, NS_SHARDS, shard_index);
+	syslog(LOG_NOTICE, "found %d saved records in %s", MAX(count, 0), dir.c_str());
+	if (pthread_create(&t, NULL, saver, NULL) != 0) {
+		syslog(LOG_WARNING, "unable to start saving names");
+		restore_names();
+		index_dags();
+	}
+
+	struct addrinfo *ai;
+	if (Xgetaddrinfo(NULL, SID_NS, NULL, &ai) != 0) {
+   		syslog(LOG_ALERT, "unable to get local address");
+		exit(-1);
+	}
+
+	sockaddr_x *sa = (sockaddr_x*)ai->ai_addr;
+
+	// every worker gets its own socket bound to the nameserver SID, click
+	//  spreads the requests across them
+	for (int i = 0; i < workers; i++) {
+		int reuse = 1;
+		socklen_t len = sizeof(reuse);
+
+		// Xsocket init
+		socks[i] = Xsocket(AF_XIA, SOCK_DGRAM, 0);
+		if (socks[i] < 0) {
+	   		syslog(LOG_ALERT, "Unable to create a socket");
+	   		exit(-1);
+		}
+
+		// an older click takes the option but doesn't share the SID, and a
+		//  sharded one refuses it
+		if (workers > 1
+				&& (Xsetsockopt(socks[i], SO_REUSEPORT, &reuse, sizeof(reuse)) < 0
+				|| Xgetsockopt(socks[i], SO_REUSEPORT, &reuse, &len) < 0 || !reuse)) {
+			syslog(LOG_WARNING, "unable to share the nameserver SID, using 1 thread");
+			workers = 1;
+			if (i > 0) {
+				Xclose(socks[i]);
+				break;
+			}
+		}
+
+		if (Xbind(socks[i], (struct sockaddr*)sa, sizeof(sockaddr_x)) < 0) {
+	   		Graph g(sa);
+	   		syslog(LOG_ALERT, "unable to bind to local DAG : %s", g.dag_string().c_str());
+	   		exit(-1);
+		}
+	}
+	Xfreeaddrinfo(ai);
+
+	for (int i = 1; i < workers; i++) {
+		pthread_t t;
+
+		if (pthread_create(&t, NULL, worker, (void *)(intptr_t)socks[i]) != 0) {
+			syslog(LOG_WARNING, "unable to start worker %d", i);
+			Xclose(socks[i]);
+		}
+	}
+	syslog(LOG_INFO, "answering requests with %d threads", workers);
+
+	worker((void *)(intptr_t)socks[0]);
 	return 0;
 }
@@ -0,0 +1,584 @@
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <syslog.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "nsstore.hh"
+
+using namespace std;
+
+#define STORE_MAGIC		0x584e5331	// "XNS1"
+#define STORE_VERSION	1
+#define HEADER_SIZE		8
+#define RECORD_HEADER	8
+#define MAX_THREADS		64
+
+#define RECORD_HOST		0x01
+
+#define COMPACT_MIN		(4 * 1024 * 1024)	// don't bother with smaller logs
+#define SNAPSHOT_CHUNK	(1024 * 1024)		// snapshot bytes buffered per write
+
+static pthread_mutex_t log_lock = PTHREAD_MUTEX_INITIALIZER;
+static int log_fd = -1;
+static off_t log_size;
+static off_t snapshot_size;
+static bool old_log;			// a log is waiting to be covered by a snapshot
+static bool log_failed;
+
+static string dir_path;
+static string db_path;
+static string log_path;
+static string old_path;
+static string tmp_path;
+
+// only touched by the thread taking the snapshot
+static int snap_fd = -1;
+static string snap_buf;
+static off_t snap_size;
+static bool snap_failed;
+
+// FNV style, but taken a word at a time, enough to spot a torn write
+static uint32_t checksum(const char *p, size_t len)
+{
+	uint64_t h = 14695981039346656037ULL ^ len;
+	uint64_t w;
+
+	for (; len >= sizeof(w); p += sizeof(w), len -= sizeof(w)) {
+		memcpy(&w, p, sizeof(w));
+		h = (h ^ w) * 1099511628211ULL;
+		h ^= h >> 29;
+	}
+	w = 0;
+	memcpy(&w, p, len);
+	h = (h ^ w) * 1099511628211ULL;
+	return h ^ (h >> 32);
+}
+
+static uint32_t get32(const char *p)
+{
+	uint32_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static void putHeader(string &buf)
+{
+	uint32_t h[2] = { STORE_MAGIC, STORE_VERSION };
+
+	buf.append((const char *)h, sizeof(h));
+}
+
+static void encode(string &buf, const char *name, const NameRecord &r)
+{
+	size_t start = buf.size();
+	size_t nlen = strlen(name) + 1;
+	uint32_t len = 1 + nlen + r.dag.size() + r.ad.size() + r.hid.size() + 3;
+
+	buf.append(RECORD_HEADER, '\0');
+	buf.push_back(r.host ? RECORD_HOST : 0);
+	buf.append(name, nlen);
+	buf.append(r.dag.c_str(), r.dag.size() + 1);
+	buf.append(r.ad.c_str(), r.ad.size() + 1);
+	buf.append(r.hid.c_str(), r.hid.size() + 1);
+
+	uint32_t sum = checksum(buf.data() + start + RECORD_HEADER, len);
+	memcpy(&buf[start], &len, sizeof(len));
+	memcpy(&buf[start + 4], &sum, sizeof(sum));
+}
+
+// a record is its flags followed by exactly 4 strings
+static bool valid(const char *rec)
+{
+	uint32_t len = get32(rec);
+	const char *p = rec + RECORD_HEADER;
+
+	if (checksum(p, len) != get32(rec + 4) || p[len - 1] != '\0')
+		return false;
+
+	int strings = 0;
+	for (const char *s = p + 1; s < p + len; s += strlen(s) + 1)
+		strings++;
+	return strings == 4;
+}
+
+static unsigned nameHash(const char *name)
+{
+	return checksum(name, strlen(name));
+}
+
+static bool writeAll(int fd, const char *p, size_t len)
+{
+	while (len > 0) {
+		ssize_t rc = write(fd, p, len);
+
+		if (rc < 0) {
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+		p += rc;
+		len -= rc;
+	}
+	return true;
+}
+
+/*
+** The saved files are mapped and checked by store_open(), each split across
+** the threads, which find where the good records end and sort them by
+** partition, keeping them in file order. store_restore() then restores a
+** partition at a time, each by one thread, so a name's changes are applied
+** in order. Until then the mapped records are searched instead.
+*/
+typedef struct {
+	size_t offset;
+	uint32_t hash;		// of the name, to skip most records when searching
+} Saved;
+
+typedef vector<Saved> Partition;
+
+typedef struct {
+	char *map;
+	size_t size;
+	vector<Partition> parts;
+} SavedFile;
+
+static vector<SavedFile> saved;
+static size_t saved_count;
+static int partitions = 1;
+static StorePartition partition_of;
+
+typedef struct {
+	pthread_t thread;
+	const char *map;
+	const vector<size_t> *offsets;
+	size_t first;		// records checked by this thread
+	size_t last;
+	size_t bad;			// first bad record found, or the # of records
+	vector<Partition> parts;
+} Checker;
+
+typedef struct {
+	pthread_t thread;
+	int index;
+	int threads;
+	StoreRestore restore;
+	StoreReady ready;
+} Restorer;
+
+static void *check(void *arg)
+{
+	Checker *c = (Checker *)arg;
+
+	c->parts.resize(partitions);
+	c->bad = c->offsets->size();
+	for (size_t i = c->first; i < c->last; i++) {
+		const char *rec = c->map + (*c->offsets)[i];
+
+		if (!valid(rec)) {
+			c->bad = i;
+			break;
+		}
+
+		const char *name = rec + RECORD_HEADER + 1;
+		Saved sv = { (*c->offsets)[i], nameHash(name) };
+		c->parts[partition_of(name) % partitions].push_back(sv);
+	}
+	return NULL;
+}
+
+static const char *nameOf(const SavedFile &f, const Saved &sv)
+{
+	return f.map + sv.offset + RECORD_HEADER + 1;
+}
+
+static const char *dagOf(const char *name)
+{
+	return name + strlen(name) + 1;
+}
+
+static void *apply(void *arg)
+{
+	Restorer *r = (Restorer *)arg;
+	NameRecord rec;
+
+	for (int p = r->index; p < partitions; p += r->threads) {
+		for (size_t f = 0; f < saved.size(); f++) {
+			const Partition &part = saved[f].parts[p];
+
+			for (size_t i = 0; i < part.size(); i++) {
+				const char *name = nameOf(saved[f], part[i]);
+				const char *s = dagOf(name);
+
+				rec.host = (name[-1] & RECORD_HOST) != 0;
+				rec.dag.assign(s);
+				s += rec.dag.size() + 1;
+				rec.ad.assign(s);
+				s += rec.ad.size() + 1;
+				rec.hid.assign(s);
+				r->restore(name, rec);
+			}
+		}
+		r->ready(p);
+	}
+	return NULL;
+}
+
+template <typename T>
+static void run(T *r, int threads, void *(*fn)(void *))
+{
+	for (int i = 1; i < threads; i++)
+		if (pthread_create(&r[i].thread, NULL, fn, &r[i]) != 0)
+			fn(&r[i]);
+	fn(&r[0]);
+	for (int i = 1; i < threads; i++)
+		if (r[i].thread)
+			pthread_join(r[i].thread, NULL);
+}
+
+// maps path and sorts its good records into saved, returns their #, and
+//  sets good to the end of the last one, or 0 if the file is missing or
+//  isn't ours
+static int load(const string &path, int threads, off_t &good, bool &exists)
+{
+	struct stat st;
+	int fd;
+
+	good = 0;
+	exists = false;
+	if ((fd = open(path.c_str(), O_RDONLY)) < 0)
+		return 0;
+	exists = true;
+
+	if (fstat(fd, &st) < 0 || st.st_size < HEADER_SIZE) {
+		close(fd);
+		return 0;
+	}
+
+	char *map = (char *)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		syslog(LOG_ERR, "unable to map %s (%s)", path.c_str(), strerror(errno));
+		return 0;
+	}
+
+	if (get32(map) != STORE_MAGIC || get32(map + 4) != STORE_VERSION) {
+		munmap(map, st.st_size);
+
+		// keep it for someone to look at rather than write over it
+		string bad = path + ".bad";
+		syslog(LOG_ERR, "%s is not a name database, moved to %s", path.c_str(), bad.c_str());
+		rename(path.c_str(), bad.c_str());
+		exists = false;
+		return 0;
+	}
+
+	vector<size_t> offsets;
+	size_t off = HEADER_SIZE;
+	while (off + RECORD_HEADER <= (size_t)st.st_size) {
+		uint32_t len = get32(map + off);
+
+		if (len < 5 || len > st.st_size - off - RECORD_HEADER)
+			break;
+		offsets.push_back(off);
+		off += RECORD_HEADER + len;
+	}
+
+	size_t n = offsets.size();
+	if (threads > MAX_THREADS)
+		threads = MAX_THREADS;
+	if ((size_t)threads > n / 1024 + 1)
+		threads = n / 1024 + 1;
+
+	vector<Checker> c(threads);
+	for (int i = 0; i < threads; i++) {
+		c[i].map = map;
+		c[i].offsets = &offsets;
+		c[i].first = n * i / threads;
+		c[i].last = n * (i + 1) / threads;
+	}
+	run(&c[0], threads, check);
+
+	size_t bad = n;
+	for (int i = 0; i < threads; i++)
+		if (c[i].bad < bad)
+			bad = c[i].bad;
+
+	good = bad < n ? offsets[bad] : off;
+	if (good != st.st_size)
+		syslog(LOG_WARNING, "%s is damaged after %d records, ignoring the last %ld bytes",
+			path.c_str(), (int)bad, (long)(st.st_size - good));
+
+	if (bad == 0) {
+		munmap(map, st.st_size);
+		return 0;
+	}
+
+	// a thread that started past the first bad record has nothing to keep,
+	//  the one it's in stopped there
+	saved.push_back(SavedFile());
+	SavedFile &f = saved.back();
+	f.map = map;
+	f.size = st.st_size;
+	f.parts.resize(partitions);
+	for (int p = 0; p < partitions; p++) {
+		for (int i = 0; i < threads && c[i].first < bad; i++) {
+			if (threads == 1)
+				f.parts[p].swap(c[i].parts[p]);
+			else
+				f.parts[p].insert(f.parts[p].end(), c[i].parts[p].begin(), c[i].parts[p].end());
+		}
+	}
+	saved_count += bad;
+	return bad;
+}
+
+static void syncDir()
+{
+	int fd = open(dir_path.c_str(), O_RDONLY);
+
+	if (fd >= 0) {
+		fsync(fd);
+		close(fd);
+	}
+}
+
+// opens a new log, or the existing one truncated to its good records
+static int openLog(off_t good)
+{
+	int fd = open(log_path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+
+	if (fd < 0)
+		return -1;
+
+	if (good < HEADER_SIZE) {
+		string h;
+
+		putHeader(h);
+		if (ftruncate(fd, 0) < 0 || !writeAll(fd, h.data(), h.size())) {
+			close(fd);
+			return -1;
+		}
+		good = HEADER_SIZE;
+	} else if (ftruncate(fd, good) < 0) {
+		close(fd);
+		return -1;
+	}
+	log_size = good;
+	return fd;
+}
+
+int store_open(const char *dir, const char *prefix, int threads, int parts, StorePartition partition)
+{
+	struct stat st;
+	off_t good;
+	bool exists;
+	int count = 0;
+
+	dir_path = dir;
+	db_path = dir_path + "/" + prefix + ".db";
+	log_path = dir_path + "/" + prefix + ".log";
+	old_path = log_path + ".old";
+	tmp_path = db_path + ".tmp";
+
+	partitions = max(parts, 1);
+	partition_of = partition;
+
+	count += load(db_path, threads, good, exists);
+	snapshot_size = exists && stat(db_path.c_str(), &st) == 0 ? st.st_size : 0;
+
+	count += load(old_path, threads, good, old_log);
+	count += load(log_path, threads, good, exists);
+
+	// the log is only cut back to its good records, which stay mapped
+	if ((log_fd = openLog(good)) < 0) {
+		syslog(LOG_ERR, "unable to open %s (%s), names will not be saved", log_path.c_str(), strerror(errno));
+		return -1;
+	}
+	return count;
+}
+
+void store_restore(int threads, StoreReserve reserve, StoreRestore restore, StoreReady ready)
+{
+	threads = max(1, min(threads, min(partitions, MAX_THREADS)));
+	if ((size_t)threads > saved_count / 1024 + 1)
+		threads = saved_count / 1024 + 1;
+
+	Restorer r[MAX_THREADS];
+	memset(r, 0, sizeof(r));
+	for (int i = 0; i < threads; i++) {
+		r[i].index = i;
+		r[i].threads = threads;
+		r[i].restore = restore;
+		r[i].ready = ready;
+	}
+	reserve(saved_count);
+	run(r, threads, apply);
+
+	for (size_t f = 0; f < saved.size(); f++)
+		munmap(saved[f].map, saved[f].size);
+	saved.clear();
+	saved_count = 0;
+}
+
+bool store_find(int partition, const char *name, string &dag)
+{
+	uint32_t hash = nameHash(name);
+	const char *found = NULL;
+
+	// the last record of name is the one that counts
+	for (size_t f = 0; f < saved.size(); f++) {
+		const Partition &part = saved[f].parts[partition];
+
+		for (size_t i = 0; i < part.size(); i++) {
+			const char *n = nameOf(saved[f], part[i]);
+
+			if (part[i].hash == hash && strcmp(n, name) == 0)
+				found = n;
+		}
+	}
+	if (found)
+		dag = dagOf(found);
+	return found != NULL;
+}
+
+bool store_find_dag(int partition, const char *dag, string &name)
+{
+	bool found = false;
+	string latest;
+
+	for (size_t f = 0; f < saved.size(); f++) {
+		const Partition &part = saved[f].parts[partition];
+
+		for (size_t i = 0; i < part.size(); i++) {
+			const char *n = nameOf(saved[f], part[i]);
+
+			if (strcmp(dagOf(n), dag) != 0 || (found && name >= n))
+				continue;
+
+			// and it wasn't changed after this record
+			if (store_find(partition, n, latest) && latest == dag) {
+				name = n;
+				found = true;
+			}
+		}
+	}
+	return found;
+}
+
+void store_append(const char *name, const NameRecord &r)
+{
+	string buf;
+
+	if (log_fd < 0)
+		return;
+	encode(buf, name, r);
+
+	pthread_mutex_lock(&log_lock);
+	if (writeAll(log_fd, buf.data(), buf.size())) {
+		log_size += buf.size();
+		log_failed = false;
+	} else if (!log_failed) {
+		syslog(LOG_ERR, "unable to save %s (%s)", name, strerror(errno));
+		log_failed = true;
+	}
+	pthread_mutex_unlock(&log_lock);
+}
+
+// sync and the snapshot functions are only called from one thread, which is
+//  the only one that replaces log_fd
+void store_sync()
+{
+	if (log_fd >= 0)
+		fdatasync(log_fd);
+}
+
+bool store_should_compact()
+{
+	if (log_fd < 0)
+		return false;
+	return old_log || (log_size >= COMPACT_MIN && log_size >= snapshot_size);
+}
+
+bool store_begin_snapshot()
+{
+	string h;
+
+	if ((snap_fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+		syslog(LOG_ERR, "unable to create %s (%s)", tmp_path.c_str(), strerror(errno));
+		return false;
+	}
+
+	// if an old log is still around, the snapshot has to cover it first,
+	//  the current log keeps being written until the next one
+	if (!old_log) {
+		pthread_mutex_lock(&log_lock);
+		int fd = -1;
+		if (rename(log_path.c_str(), old_path.c_str()) == 0) {
+			old_log = true;
+			fd = openLog(0);
+		}
+		if (fd < 0) {
+			pthread_mutex_unlock(&log_lock);
+			syslog(LOG_ERR, "unable to start a new log (%s)", strerror(errno));
+			close(snap_fd);
+			unlink(tmp_path.c_str());
+			return false;
+		}
+		int old = log_fd;
+		log_fd = fd;
+		pthread_mutex_unlock(&log_lock);
+		close(old);
+	}
+
+	putHeader(h);
+	snap_buf = h;
+	snap_size = 0;
+	snap_failed = false;
+	return true;
+}
+
+void store_snapshot_add(const char *name, const NameRecord &r)
+{
+	encode(snap_buf, name, r);
+
+	if (snap_buf.size() >= SNAPSHOT_CHUNK) {
+		if (!snap_failed && !writeAll(snap_fd, snap_buf.data(), snap_buf.size()))
+			snap_failed = true;
+		snap_size += snap_buf.size();
+		snap_buf.clear();
+	}
+}
+
+void store_end_snapshot()
+{
+	if (!snap_failed && !writeAll(snap_fd, snap_buf.data(), snap_buf.size()))
+		snap_failed = true;
+	snap_size += snap_buf.size();
+	snap_buf.clear();
+
+	if (!snap_failed && fsync(snap_fd) < 0)
+		snap_failed = true;
+	close(snap_fd);
+	snap_fd = -1;
+
+	if (snap_failed || rename(tmp_path.c_str(), db_path.c_str()) < 0) {
+		syslog(LOG_ERR, "unable to save a snapshot of the names (%s)", strerror(errno));
+		unlink(tmp_path.c_str());
+		return;
+	}
+
+	// the old log isn't needed once the new snapshot is sure to be found
+	syncDir();
+	unlink(old_path.c_str());
+	old_log = false;
+	snapshot_size = snap_size;
+	syslog(LOG_INFO, "saved a snapshot of the names, %ld bytes", (long)snap_size);
+}
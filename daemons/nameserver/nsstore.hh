@@ -0,0 +1,83 @@
+#ifndef NSSTORE_HH
+#define NSSTORE_HH
+#include <string>
+
+/*
+** On disk copy of the name database
+**
+** Every change to a name is appended to a log before it is answered, and
+** the database is periodically written out as a snapshot so the log stays
+** short. At startup the snapshot and then the log are mapped and checked,
+** which is all that is done before queries are answered. The names are
+** then restored a partition at a time, and a partition's names are looked
+** up in the mapped files until it is.
+**
+** Both files start with a magic number and version, followed by records of
+**
+**	length (4), checksum (4), flags (1), name, dag, AD, HID
+**
+** where the strings are NUL terminated, length counts the bytes after the
+** checksum, and the checksum covers the same bytes. Replay stops at the
+** first record that doesn't check out, which is where a crash cut the log
+** short, and the log is truncated there before anything is appended.
+**
+** A snapshot is taken by moving the log aside, starting a new one, and
+** writing the database to a temporary file that replaces the old snapshot
+** once it is on disk. The old log is kept until then, so a crash at any
+** point leaves snapshot + old log + log describing the whole database.
+*/
+
+// a name record, the DAG is parsed once when it is registered
+typedef struct {
+	std::string dag;	// as returned to queries
+	bool host;			// true if an AD in the DAG has an edge to its HID
+	std::string ad;		// that AD and HID as "TYPE:id"
+	std::string hid;
+} NameRecord;
+
+// called before the names are restored with the # of records saved
+typedef void (*StoreReserve)(size_t records);
+
+// called by the restore threads, a partition is always restored by the same
+//  one. The strings in r may be taken.
+typedef void (*StoreRestore)(const char *name, NameRecord &r);
+
+// which of the partitions name is in
+typedef int (*StorePartition)(const char *name);
+
+// called by the restore threads once every saved name in partition is
+//  restored, after which it isn't searched for in the files again
+typedef void (*StoreReady)(int partition);
+
+// maps and checks the files in dir using up to threads threads, sorting the
+//  records into parts partitions, then opens the log for appending. Returns
+//  the # of records saved, or -1 if the log can't be opened, in which case
+//  nothing is saved but the names can still be restored.
+int store_open(const char *dir, const char *prefix, int threads, int parts, StorePartition partition);
+
+// restores the saved names using up to threads threads, then unmaps the files
+void store_restore(int threads, StoreReserve reserve, StoreRestore restore, StoreReady ready);
+
+// the saved dag of name, or the last name in order saved with dag, searched
+//  for in a partition that isn't ready yet. The caller keeps it from being
+//  made ready until it's done, which is what keeps the files mapped.
+bool store_find(int partition, const char *name, std::string &dag);
+bool store_find_dag(int partition, const char *dag, std::string &name);
+
+// the caller holds the lock of name's shard, so changes to a name are
+//  logged in the order they are made
+void store_append(const char *name, const NameRecord &r);
+
+// flush the log to disk
+void store_sync();
+
+// true if the log has grown enough to be worth a new snapshot
+bool store_should_compact();
+
+// a snapshot is begun, fed every record, and ended. The records may be
+//  changed while the snapshot is written, those changes are in the new log.
+bool store_begin_snapshot();
+void store_snapshot_add(const char *name, const NameRecord &r);
+void store_end_snapshot();
+
+#endif
@@ -0,0 +1,184 @@
+/*
+** Checks that the nameserver only registers DAGs it can parse: the ones the
+** API builds are taken in either format, malformed ones are answered with an
+** error instead of being handed to Graph, and anything accepted out of a
+** batch of mutated DAGs parses into what it says.
+**
+** dag_test [iterations] [seed]
+*/
+#define main ns_main
+#include "../ns.cc"
+#undef main
+
+#define ITERATIONS 20000
+
+#define AD "AD:1000000000000000000000000000000000000001"
+#define HID "HID:0000000000000000000000000000000000000002"
+#define SID "SID:0f00000000000000000000000000000000000003"
+#define IP "IP:4500000000010000fafa00000000000080020304"
+
+static void check(const char *name, bool passed)
+{
+	printf("%s: %s\n", name, passed ? "PASS" : "FAIL");
+	if (!passed)
+		exit(-1);
+}
+
+// sends a registration through process_request, returns the response type
+static int do_register(const char *name, const char *dag)
+{
+	char pkt_out[NS_MAX_PACKET_SIZE];
+	ns_pkt req, resp;
+
+	req.type = NS_TYPE_REGISTER;
+	req.flags = 0;
+	req.name = name;
+	req.dag = dag;
+	int len = process_request(req, pkt_out, sizeof(pkt_out));
+	get_ns_packet(pkt_out, len, &resp);
+	return resp.type;
+}
+
+static std::string mutate(const std::string &dag)
+{
+	static const char chars[] = "DAGRE -\n()0123456789:afxADHIS";
+	std::string m(dag);
+
+	for (int i = 0, n = 1 + rand() % 3; i < n && !m.empty(); i++) {
+		size_t at = rand() % m.size();
+
+		switch (rand() % 3) {
+			case 0:
+				m[at] = chars[rand() % (sizeof(chars) - 1)];
+				break;
+			case 1:
+				m.erase(at, 1 + rand() % 3);
+				break;
+			default:
+				m.insert(at, 1, chars[rand() % (sizeof(chars) - 1)]);
+				break;
+		}
+	}
+	return m;
+}
+
+int main(int argc, char **argv)
+{
+	int iterations = argc > 1 ? atoi(argv[1]) : ITERATIONS;
+	std::string response;
+
+	srand(argc > 2 ? atoi(argv[2]) : 7);
+	openlog("dag_test", LOG_PERROR, LOG_LOCAL4);
+	setlogmask(LOG_UPTO(LOG_ERR));
+	for (int i = 0; i < NS_SHARDS; i++) {
+		pthread_rwlock_init(&name_to_dag_db_table[i].lock, NULL);
+		pthread_rwlock_init(&name_to_dag_db_table[i].dag_lock, NULL);
+	}
+
+	// DAGs as the API writes them
+	Node src;
+	Graph host = src * Node(AD) * Node(HID);
+	Graph service = src * Node(AD) * Node(HID) * Node(SID);
+	Graph fallback = src * (Graph(Node(AD)) * Node(HID) + Node(IP)) * Node(SID);
+	std::vector<std::string> good;
+	good.push_back(host.dag_string());
+	good.push_back(service.dag_string());
+	good.push_back(fallback.dag_string());
+	good.push_back("RE " AD " " HID);
+	good.push_back("RE ( " AD " " HID " ) " SID);
+	good.push_back(Graph("RE ( " AD " " HID " ) " SID).dag_string());
+	good.push_back("RE " AD " ( " IP " ) " HID " " SID);
+
+	bool ok = true;
+	for (size_t i = 0; i < good.size(); i++) {
+		if (!valid_dag(good[i].c_str())) {
+			printf("rejected %s\n", good[i].c_str());
+			ok = false;
+		}
+	}
+	check("DAG Test 1", ok);
+
+	std::vector<std::string> bad;
+	bad.push_back("");
+	bad.push_back("www.example.com");
+	bad.push_back("DAG");
+	bad.push_back("DAG 0 -");
+	bad.push_back("DAG 5 - " AD);
+	bad.push_back("DAG 99999999999 - " AD);
+	bad.push_back("DAG x - " AD);
+	bad.push_back("DAG -1 - " AD);
+	bad.push_back("DAG 0 - " AD " 1 -- " HID);
+	bad.push_back("DAG 0 - " AD "  1 - " HID);
+	bad.push_back("DAG 0 - AD 1 - " HID);
+	bad.push_back("DAG 0 - AD:10000000000000000000000000000000000000 1 - " HID);
+	bad.push_back("DAG 0 - AD:100000000000000000000000000000000000000g 1 - " HID);
+	bad.push_back("DAG 0 - :1000000000000000000000000000000000000001 1 - " HID);
+	bad.push_back("DAG 0 - H1D:1000000000000000000000000000000000000001 1 - " HID);
+	bad.push_back("DAG 0 - " AD " 0 - " HID);								// loop
+	bad.push_back("DAG 0 - " AD " 1 - " HID " 0 - " SID);					// cycle
+	bad.push_back("DAG 0 - " AD " 2 - " HID " 2 - " SID);					// HID unreachable
+	bad.push_back("DAG 1 - " AD " - " HID " 0");							// sink first
+	bad.push_back("DAG 0 - " AD " 1 - " HID " - " SID);						// two sinks
+	bad.push_back("DAG 0 1 2 3 4 - " AD " 5 - " AD " 5 - " AD " 5 - " AD " 5 - " AD " 5 - " HID);
+	bad.push_back("RE");
+	bad.push_back("RE  " AD);
+	bad.push_back("RE ) " AD);
+	bad.push_back("RE ( ) " AD);
+	bad.push_back("RE ( " AD);
+	bad.push_back("RE " AD " ( " HID " )");
+	bad.push_back("RE ( " AD " ( " HID " ) ) " SID);
+	bad.push_back("RE ( " AD " ) ( " HID " ) " SID);
+	bad.push_back("RE " AD " " HID "\n");
+	std::string many = "RE";
+	for (int i = 0; i <= NODES_MAX; i++)
+		many += " " AD;
+	bad.push_back(many);
+
+	ok = true;
+	for (size_t i = 0; i < bad.size(); i++) {
+		if (valid_dag(bad[i].c_str())) {
+			printf("accepted %s\n", bad[i].c_str());
+			ok = false;
+		}
+	}
+	check("DAG Test 2", ok);
+
+	// malformed registrations get an error and change nothing
+	check("DAG Test 3", do_register("www.bad.com", "DAG 5 - " AD) == NS_TYPE_RESPONSE_ERROR
+		&& !lookup_name("www.bad.com", response));
+	check("DAG Test 4", do_register("www.good.com", good[1].c_str()) == NS_TYPE_RESPONSE_REGISTER
+		&& lookup_name("www.good.com", response) && response == good[1]
+		&& do_register("www.good.com", "RE ( " AD) == NS_TYPE_RESPONSE_ERROR
+		&& lookup_name("www.good.com", response) && response == good[1]);
+
+	// a host record is still recognized as one
+	NameRecord r;
+	make_record(good[0].c_str(), r);
+	check("DAG Test 5", r.host && r.ad == AD && r.hid == HID);
+
+	// whatever is accepted parses into a DAG with as many nodes as it names
+	int accepted = 0;
+	for (int i = 0; i < iterations; i++) {
+		std::string m = mutate(good[rand() % good.size()]);
+
+		if (!valid_dag(m.c_str()))
+			continue;
+		accepted++;
+
+		Graph g(m);
+		Graph again(g.dag_string());
+		size_t nodes = 0;
+		for (size_t c = m.find(':'); c != std::string::npos; c = m.find(':', c + 1))
+			nodes++;
+		make_record(m.c_str(), r);
+		if ((size_t)g.num_nodes() != nodes || g.dag_string().find(Node::XID_TYPE_UNKNOWN_STRING) != std::string::npos || again.dag_string() != g.dag_string()) {
+			printf("accepted %s, which parses to %s\n", m.c_str(), g.dag_string().c_str());
+			check("DAG Test 6", false);
+		}
+	}
+	printf("%d mutated DAGs, %d accepted\n", iterations, accepted);
+	check("DAG Test 6", true);
+
+	printf("all tests successful\n");
+	return 0;
+}
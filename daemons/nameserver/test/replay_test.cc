@@ -0,0 +1,240 @@
+/*
+** Saves a database of names the way the nameserver does, restarts from it
+** and times how long it takes before requests can be answered. Checks that
+** names are answered from the saved files while they are being restored,
+** that a registration made meanwhile isn't undone, that every name comes
+** back, that changes logged after the snapshot win, and that a log cut
+** short by a crash is replayed up to where it was cut.
+**
+** replay_test [names]
+*/
+#define main ns_main
+#include "../ns.cc"
+#undef main
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+#define NAMES 1000000
+#define LOGGED 1000			// changes made after the snapshot
+#define TARGET_MSEC 500		// before saved names are answered
+#define SAMPLE 997			// names looked up while restoring
+
+static char dir[] = "/tmp/replay_testXXXXXX";
+
+static void check(const char *name, bool passed)
+{
+	printf("%s: %s\n", name, passed ? "PASS" : "FAIL");
+	if (!passed)
+		exit(-1);
+}
+
+static double now_ms()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static void xid(char *buf, const char *type, unsigned n, unsigned salt)
+{
+	sprintf(buf, "%s:%08x%08x%08x%08x%08x", type, n, salt, n ^ salt, n * 2654435761u, salt * 40503u);
+}
+
+// a host record, AD -> HID -> SID, the way services are registered
+static void record(unsigned n, unsigned version, std::string &name, NameRecord &r)
+{
+	char ad[64], hid[64], sid[64], buf[64];
+
+	sprintf(buf, "www.replay%u.xia", n);
+	name = buf;
+	xid(ad, "AD", version, 1);
+	xid(hid, "HID", n, 2);
+	xid(sid, "SID", n, 3);
+
+	r.dag = std::string("DAG 2 0 - \n") + ad + " 2 1 - \n" + hid + " 2 - \n" + sid;
+	r.host = true;
+	r.ad = ad;
+	r.hid = hid;
+}
+
+static void clear_names()
+{
+	for (int i = 0; i < NS_SHARDS; i++) {
+		name_to_dag_db_table[i].names.clear();
+		name_to_dag_db_table[i].dags.clear();
+	}
+}
+
+static size_t count_names()
+{
+	size_t count = 0;
+
+	for (int i = 0; i < NS_SHARDS; i++)
+		count += name_to_dag_db_table[i].names.size();
+	return count;
+}
+
+// every name has the dag it was last given
+static bool all_there(int names, int logged)
+{
+	std::string name, dag;
+	NameRecord r;
+
+	for (int i = 0; i < names; i++) {
+		record(i, i < logged ? 2 : 1, name, r);
+		if (!lookup_name(name.c_str(), dag) || dag != r.dag)
+			return false;
+	}
+	return count_names() == (size_t)names;
+}
+
+// what the nameserver does before it answers requests
+static int open_saved()
+{
+	clear_names();
+	for (int i = 0; i < NS_SHARDS; i++)
+		name_to_dag_db_table[i].restoring = true;
+	return store_open(dir, "test.names", MAX(1, sysconf(_SC_NPROCESSORS_ONLN)), NS_SHARDS, shard_index);
+}
+
+static int restart()
+{
+	int count = open_saved();
+
+	restore_names();
+	return count;
+}
+
+// some of the names have the dag they were last given
+static bool answered(int names, int logged)
+{
+	std::string name, dag;
+	NameRecord r;
+
+	for (int i = 0; i < names; i += i < logged ? 1 : SAMPLE) {
+		record(i, i < logged ? 2 : 1, name, r);
+		if (!lookup_name(name.c_str(), dag) || dag != r.dag)
+			return false;
+	}
+	return true;
+}
+
+static void *register_changed(void *arg)
+{
+	std::string name;
+	NameRecord r;
+
+	record(*(int *)arg, 3, name, r);
+	register_name(name.c_str(), r.dag.c_str(), false);
+	return NULL;
+}
+
+static void remove_dir()
+{
+	DIR *d = opendir(dir);
+	struct dirent *e;
+
+	while (d && (e = readdir(d)) != NULL) {
+		std::string path = std::string(dir) + "/" + e->d_name;
+		if (e->d_name[0] != '.')
+			unlink(path.c_str());
+	}
+	if (d)
+		closedir(d);
+	rmdir(dir);
+}
+
+int main(int argc, char **argv)
+{
+	int names = argc > 1 ? atoi(argv[1]) : NAMES;
+	std::string name;
+	NameRecord r;
+	struct stat st;
+
+	openlog("replay_test", LOG_PERROR, LOG_LOCAL4);
+	setlogmask(LOG_UPTO(LOG_ERR));
+	for (int i = 0; i < NS_SHARDS; i++) {
+		pthread_rwlock_init(&name_to_dag_db_table[i].lock, NULL);
+		pthread_rwlock_init(&name_to_dag_db_table[i].dag_lock, NULL);
+	}
+
+	if (!mkdtemp(dir)) {
+		printf("unable to make a directory to test in\n");
+		exit(-1);
+	}
+	atexit(remove_dir);
+
+	// a snapshot of names, then a few changes to the log
+	check("Replay Test 1", restart() == 0);
+	store_begin_snapshot();
+	for (int i = 0; i < names; i++) {
+		record(i, 1, name, r);
+		store_snapshot_add(name.c_str(), r);
+	}
+	store_end_snapshot();
+	for (int i = 0; i < LOGGED; i++) {
+		record(i, 2, name, r);
+		store_append(name.c_str(), r);
+	}
+	store_sync();
+
+	std::string db = std::string(dir) + "/test.names.db";
+	stat(db.c_str(), &st);
+
+	double start = now_ms();
+	int count = open_saved();
+	double elapsed = now_ms() - start;
+
+	// answered from the files, by name and by dag, before being restored
+	std::string found;
+	record(names / 2, 1, name, r);
+	bool ok = count == names + LOGGED && answered(names, LOGGED)
+		&& lookup_dag(r.dag.c_str(), found) && found == name;
+	record(LOGGED / 2, 1, name, r);
+	check("Replay Test 2", ok && !lookup_dag(r.dag.c_str(), found));
+
+	start = now_ms();
+	restore_names();
+	printf("answering %d names from a %ld MB snapshot after %.0f ms, restored after %.0f ms more\n",
+		count, (long)(st.st_size >> 20), elapsed, now_ms() - start);
+	check("Replay Test 3", all_there(names, LOGGED));
+
+	// the reverse index is built after requests are being answered
+	index_dags();
+	record(names - 1, 1, name, r);
+	check("Replay Test 4", lookup_dag(r.dag.c_str(), found) && found == name);
+
+	// a torn record at the end of the log is dropped, and appends go after
+	//  the good ones
+	std::string log = std::string(dir) + "/test.names.log";
+	stat(log.c_str(), &st);
+	if (truncate(log.c_str(), st.st_size - 7) < 0) {
+		printf("unable to truncate the log\n");
+		exit(-1);
+	}
+	count = restart();
+	record(LOGGED - 1, 1, name, r);
+	bool torn = count == names + LOGGED - 1 && lookup_name(name.c_str(), found) && found == r.dag;
+	record(LOGGED - 1, 2, name, r);
+	store_append(name.c_str(), r);
+	store_sync();
+	check("Replay Test 5", torn && restart() == names + LOGGED && all_there(names, LOGGED));
+
+	// a registration waits for its shard to be restored, and then stays
+	pthread_t t;
+	int changed = LOGGED / 3;
+	open_saved();
+	pthread_create(&t, NULL, register_changed, &changed);
+	restore_names();
+	pthread_join(t, NULL);
+	record(changed, 3, name, r);
+	check("Replay Test 6", lookup_name(name.c_str(), found) && found == r.dag);
+
+	if (names == NAMES)
+		check("Replay Test 7", elapsed < TARGET_MSEC);
+
+	printf("all tests successful\n");
+	return 0;
+}
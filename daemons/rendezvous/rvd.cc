@@ -1,7 +1,12 @@
 #include <syslog.h>
 #include <errno.h>
+#include <ctype.h>
+#include <time.h>
+#include <fcntl.h>
 #include <map>
 #include <string>
+#include <vector>
+#include <tr1/unordered_map>
 using namespace std;
 
 #include <stdint.h>
@@ -16,6 +21,42 @@ using namespace std;
 
 #define RV_MAX_DATA_PACKET_SIZE 16384
 #define RV_MAX_CONTROL_PACKET_SIZE 1024
+#define RV_BATCH 64				// most data packets relayed per wakeup
+#define RV_STATS_INTERVAL 10	// seconds between traffic reports
+#define RV_BENCH_HOSTS 10000	// registered hosts in the benchmark
+#define RV_BENCH_TIME 3			// seconds the benchmark runs
+#define RV_BENCH_PACKETS 64	// packets kept going round in the benchmark
+
+// XIDs are kept as their 20 raw bytes so the data path never formats one
+typedef struct {
+	unsigned char id[CLICK_XIA_XID_ID_LEN];
+} XIDKey;
+
+// XIDs are SHA-1 hashes, so their first bytes are already well mixed
+struct XIDHash {
+	size_t operator()(const XIDKey &k) const {
+		size_t h;
+		memcpy(&h, k.id, sizeof(h));
+		return h;
+	}
+};
+
+struct XIDEqual {
+	bool operator()(const XIDKey &a, const XIDKey &b) const {
+		return memcmp(a.id, b.id, sizeof(a.id)) == 0;
+	}
+};
+
+typedef std::tr1::unordered_map<XIDKey, XIDKey, XIDHash, XIDEqual> XIDMap;
+
+// data plane counters, logged every RV_STATS_INTERVAL seconds instead of
+//  logging each packet
+typedef struct {
+	unsigned long relayed;
+	unsigned long unknown;		// for hosts that haven't registered
+	unsigned long malformed;
+	unsigned long failed;		// couldn't be sent back out
+} RVStats;
 
 map<std::string, std::string> name_to_dag_db_table; // map name to dag
 
@@ -23,19 +64,22 @@ char *hostname = NULL;
 char *ident = NULL;
 char *datasid = NULL;
 char *controlsid = NULL;
-map<string, string> HIDtoAD;
+int benchmark_only = 0;
+XIDMap HIDtoAD;
 map<string, double> HIDtoTimestamp;
 map<string, double>::iterator HIDtoTimestampIterator;
+RVStats stats;
 
 void help(const char *name)
 {
-	printf("\nusage: %s [-l level] [-v] [-d SID -c SID][-h hostname]\n", name);
+	printf("\nusage: %s [-l level] [-v] [-b] [-d SID -c SID][-h hostname]\n", name);
 	printf("where:\n");
 	printf(" -c SID      : SID for rendezvous control plane.\n");
 	printf(" -d SID      : SID for rendezvous data plane.\n");
 	printf(" -l level    : syslog logging level 0 = LOG_EMERG ... 7 = LOG_DEBUG (default=3:LOG_ERR)\n");
 	printf(" -v          : log to the console as well as syslog\n");
 	printf(" -h hostname : click device name (default=host0)\n");
+	printf(" -b          : relay packets through click for a few seconds, report the rate and exit\n");
 	printf("\n");
 	exit(0);
 }
@@ -74,8 +118,11 @@ void config(int argc, char** argv)
 
 	opterr = 0;
 
-	while ((c = getopt(argc, argv, "h:l:d:c:v")) != -1) {
+	while ((c = getopt(argc, argv, "bh:l:d:c:v")) != -1) {
 		switch (c) {
+			case 'b':
+				benchmark_only = 1;
+				break;
 			case 'h':
 				hostname = strdup(optarg);
 				break;
@@ -178,162 +225,107 @@ int getServerSocket(char *sid, int type)
 	return sockfd;
 }
 
-void print_packet_contents(char *packet, int len)
+// fill key from "TYPE:" followed by 40 hex digits
+bool parseXID(const char *s, const char *type, XIDKey &key)
 {
-	int hex_string_len = (len*2) + 1;
-	char hex_string[hex_string_len];
-    int i;
-    for(i=0;i<len;i++) {
-        sprintf(&hex_string[2*i], "%02x", (unsigned int)packet[i]);
-    }
-    hex_string[hex_string_len-1] = '\0';
-	syslog(LOG_INFO, "Packet contents|%s|", hex_string);
-}
+	size_t n = strlen(type);
 
-void print_packet_header(click_xia *xiah)
-{
-	syslog(LOG_INFO, "======= RAW PACKET HEADER ========");
-	syslog(LOG_INFO, "ver:%d", xiah->ver);
-	syslog(LOG_INFO, "nxt:%d", xiah->nxt);
-	syslog(LOG_INFO, "plen:%d", htons(xiah->plen));
-	syslog(LOG_INFO, "hlim:%d", xiah->hlim);
-	syslog(LOG_INFO, "dnode:%d", xiah->dnode);
-	syslog(LOG_INFO, "snode:%d", xiah->snode);
-	syslog(LOG_INFO, "last:%d", xiah->last);
-	int total_nodes = xiah->dnode + xiah->snode;
-	for(int i=0;i<total_nodes;i++) {
-		uint8_t id[20];
-		char hex_string[41];
-		bzero(hex_string, 41);
-		memcpy(id, xiah->node[i].xid.id, 20);
-		for(int j=0;j<20;j++) {
-			sprintf(&hex_string[2*j], "%02x", (unsigned int)id[j]);
-		}
-		char type[10];
-		bzero(type, 10);
-		switch (htonl(xiah->node[i].xid.type)) {
-			case CLICK_XIA_XID_TYPE_AD:
-				strcpy(type, "AD");
-				break;
-			case CLICK_XIA_XID_TYPE_HID:
-				strcpy(type, "HID");
-				break;
-			case CLICK_XIA_XID_TYPE_SID:
-				strcpy(type, "SID");
-				break;
-			case CLICK_XIA_XID_TYPE_CID:
-				strcpy(type, "CID");
-				break;
-			case CLICK_XIA_XID_TYPE_IP:
-				strcpy(type, "4ID");
-				break;
-			default:
-				sprintf(type, "%d", xiah->node[i].xid.type);
-		};
-		syslog(LOG_INFO, "%s:%s", type, hex_string);
+	if (strncmp(s, type, n) != 0)
+		return false;
+	s += n;
+
+	for (int i = 0; i < CLICK_XIA_XID_ID_LEN; i++) {
+		unsigned v;
+
+		if (!isxdigit(s[2 * i]) || !isxdigit(s[2 * i + 1]) || sscanf(s + 2 * i, "%2x", &v) != 1)
+			return false;
+		key.id[i] = v;
 	}
+	return true;
 }
 
-void process_data(int datasock)
+// Point the packet at the AD its destination host last registered from.
+// Returns false if the packet should be dropped.
+bool relay(char *packet, int len)
 {
-	int packetlen;
-	char packet[RV_MAX_DATA_PACKET_SIZE];
-	sockaddr_x rdag;
-	socklen_t rdaglen = sizeof(rdag);
-	bzero(packet, RV_MAX_DATA_PACKET_SIZE);
-
-	syslog(LOG_INFO, "Reading data packet");
-	int retval = Xrecvfrom(datasock, packet, RV_MAX_DATA_PACKET_SIZE, 0, (struct sockaddr *)&rdag, &rdaglen);
-	if(retval < 0) {
-		syslog(LOG_WARNING, "WARN: No data(%s)", strerror(errno));
-		return;
-	}
-	packetlen = retval;
-	Graph g(&rdag);
-	syslog(LOG_INFO, "Packet of size:%d received from %s:", retval, g.dag_string().c_str());
-	print_packet_contents(packet, retval);
 	click_xia *xiah = reinterpret_cast<struct click_xia *>(packet);
-	print_packet_header(xiah);
-	/*
-	syslog(LOG_INFO, "======= RAW PACKET HEADER ========");
-	syslog(LOG_INFO, "ver:%d", xiah->ver);
-	syslog(LOG_INFO, "nxt:%d", xiah->nxt);
-	syslog(LOG_INFO, "plen:%d", htons(xiah->plen));
-	syslog(LOG_INFO, "hlim:%d", xiah->hlim);
-	syslog(LOG_INFO, "dnode:%d", xiah->dnode);
-	syslog(LOG_INFO, "snode:%d", xiah->snode);
-	syslog(LOG_INFO, "last:%d", xiah->last);
-	int total_nodes = xiah->dnode + xiah->snode;
-	for(int i=0;i<total_nodes;i++) {
-		uint8_t id[20];
-		char hex_string[41];
-		bzero(hex_string, 41);
-		memcpy(id, xiah->node[i].xid.id, 20);
-		for(int j=0;j<20;j++) {
-			sprintf(&hex_string[2*j], "%02x", (unsigned int)id[j]);
-		}
-		char type[10];
-		bzero(type, 10);
-		switch (htonl(xiah->node[i].xid.type)) {
-			case CLICK_XIA_XID_TYPE_AD:
-				strcpy(type, "AD");
-				break;
-			case CLICK_XIA_XID_TYPE_HID:
-				strcpy(type, "HID");
-				break;
-			case CLICK_XIA_XID_TYPE_SID:
-				strcpy(type, "SID");
-				break;
-			case CLICK_XIA_XID_TYPE_CID:
-				strcpy(type, "CID");
-				break;
-			case CLICK_XIA_XID_TYPE_IP:
-				strcpy(type, "4ID");
-				break;
-			default:
-				sprintf(type, "%d", xiah->node[i].xid.type);
-		};
-		syslog(LOG_INFO, "%s:%s", type, hex_string);
+
+	if (len < (int)sizeof(click_xia) || xiah->dnode == 0
+			|| len < (int)(sizeof(click_xia) + (xiah->dnode + xiah->snode) * sizeof(click_xia_xid_node))) {
+		stats.malformed++;
+		return false;
 	}
-	*/
 
 // make the warning go away for xiah->node[0]
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Warray-bounds"
 
 	// Starting at node at offset 0, verify it is an AD node
-	if(htonl(xiah->node[0].xid.type) != CLICK_XIA_XID_TYPE_AD) {
-		syslog(LOG_ERR, "First node in destination DAG is not an AD");
-		return;
+	click_xia_xid_node *ad = &xiah->node[0];
+	unsigned hid = ad->edge[0].idx;
+
+	if (ad->xid.type != htonl(CLICK_XIA_XID_TYPE_AD) || hid >= xiah->dnode) {
+		stats.malformed++;
+		return false;
+	}
+
+	// The AD's first edge leads to the HID
+	XIDKey key;
+	memcpy(key.id, xiah->node[hid].xid.id, sizeof(key.id));
+
+	XIDMap::const_iterator it = HIDtoAD.find(key);
+	if (it == HIDtoAD.end()) {
+		stats.unknown++;
+		return false;
 	}
-	// Walk the destination DAG to find HID
-	char hid_str[41];
-	sha1_hash_to_hex_string(xiah->node[xiah->node[0].edge[0].idx].xid.id, 20, hid_str, 41);
+
+	// Update the AD and reset the last pointer so the packet is routed
+	//  from the start of the DAG
+	memcpy(ad->xid.id, it->second.id, CLICK_XIA_XID_ID_LEN);
+	xiah->last = -1;
 
 // done disabling the warning
 #pragma GCC diagnostic pop
 
-	syslog(LOG_INFO, "DestHost = %s", hid_str);
-	Node hidNode("HID", hid_str);
-	syslog(LOG_INFO, "DestHostID = %s", hidNode.to_string().c_str());
-	std::string ad_string(HIDtoAD[hidNode.to_string()]);
-	Node adNode(ad_string);
-	//char id_hex_string[41];
-	//bzero(id_hex_string, 41);
-	//sha1_hash_to_hex_string((unsigned char *)adNode.id(), 20, id_hex_string, 41);
-	//syslog(LOG_INFO, "AD from table = %s", id_hex_string);
-	memcpy(xiah->node[0].xid.id, adNode.id(), 20);
-	xiah->last = -1;
-	syslog(LOG_INFO, "Updated AD and last pointer in header");
-	print_packet_header(xiah);
-	syslog(LOG_INFO, "Sending the packet out on the network");
-	Xsend(datasock, packet, packetlen, 0);
-	// Find the AD->HID->SID this packet was destined to
-	// Verify HID is in table and find newAD
-	// If newAD is different from the AD in XIP header, update it
-	// If not, drop the packet
-	// Reset the next pointer in the XIP header
-	// Send packet back on the network
+	stats.relayed++;
+	return true;
+}
+
+// Relay the data packets waiting on the socket, at most RV_BATCH of them so
+//  control messages aren't kept waiting. The socket is non-blocking, so
+//  this stops as soon as it is drained.
+void process_data(int datasock)
+{
+	char packet[RV_MAX_DATA_PACKET_SIZE];
+
+	for (int i = 0; i < RV_BATCH; i++) {
+		int len = Xrecvfrom(datasock, packet, RV_MAX_DATA_PACKET_SIZE, 0, NULL, NULL);
+		if (len < 0) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				syslog(LOG_WARNING, "WARN: No data(%s)", strerror(errno));
+			return;
+		}
+
+		if (relay(packet, len) && Xsend(datasock, packet, len, 0) < 0)
+			stats.failed++;
+	}
+}
+
+void report_stats(time_t elapsed)
+{
+	if (stats.relayed || stats.unknown || stats.malformed || stats.failed) {
+		syslog(LOG_INFO, "relayed %lu packets (%lu/sec), dropped %lu for unknown hosts, %lu malformed, %lu unsent",
+			stats.relayed, stats.relayed / MAX(elapsed, 1), stats.unknown, stats.malformed, stats.failed);
+	}
+	memset(&stats, 0, sizeof(stats));
+}
+
+double now()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
 }
 
 #define MAX_XID_STR_SIZE 64
@@ -402,6 +394,14 @@ void process_control_message(int controlsock)
 		return;
 	}
 
+	// Extract AD from DAG, both are kept in binary for the data plane
+	XIDKey hidKey, adKey;
+	const char *ad = strstr(dag, "AD:");
+	if (!ad || !parseXID(hid, "HID:", hidKey) || !parseXID(ad, "AD:", adKey)) {
+		syslog(LOG_ERR, "ERROR: Malformed HID or DAG in control message");
+		return;
+	}
+
 	// Verify that the timestamp is newer than seen before
 	HIDtoTimestampIterator = HIDtoTimestamp.find(hid);
 	if(HIDtoTimestampIterator == HIDtoTimestamp.end()) {
@@ -419,13 +419,8 @@ void process_control_message(int controlsock)
 		}
 	}
 
-	// Extract AD from DAG
-	int ADstringLength = strlen("AD:") + 40 + 1;
-	char ADstring[ADstringLength];
-	bzero(ADstring, ADstringLength);
-	strncpy(ADstring, strstr(dag, "AD:"), ADstringLength-1);
-	HIDtoAD[hid] = ADstring;
-	syslog(LOG_INFO, "Added %s:%s to table", hid, ADstring);
+	HIDtoAD[hidKey] = adKey;
+	syslog(LOG_INFO, "Added %s:%.43s to table", hid, ad);
 
 	// Registration message
 	// Extract HID, newAD, timestamp, Signature, Pubkey
@@ -445,34 +440,34 @@ void process_control_message(int controlsock)
 	// Heartbeat message?
 }
 
-int main(int argc, char *argv[]) {
-
-	// Parse command-line arguments
-	config(argc, argv);
-	syslog(LOG_NOTICE, "%s started on %s", APPNAME, hostname);
-
-	// Data plane socket used to rendezvous clients with services
-	int datasock = getServerSocket(datasid, SOCK_RAW);
-	int controlsock = getServerSocket(controlsid, SOCK_DGRAM);
-	if(datasock < 0 || controlsock < 0) {
-		syslog(LOG_ERR, "ERROR creating a server socket");
-		return 1;
-	}
+// Relay data packets and handle control messages until stop, or forever
+//  if stop is 0. Returns non-zero if waiting on the sockets fails.
+int serve(int datasock, int controlsock, time_t stop)
+{
+	time_t last_report = time(NULL);
 
 	// Main loop checks data and control sockets for activity
-	while(1) {
+	while(stop == 0 || time(NULL) < stop) {
 		fd_set read_fds;
 		FD_ZERO(&read_fds);
 		FD_SET(datasock, &read_fds);
 		FD_SET(controlsock, &read_fds);
 		struct timeval timeout;
-		timeout.tv_sec = 0;
-		timeout.tv_usec = 1000;
-		int retval = Xselect(controlsock+1, &read_fds, NULL, NULL, &timeout);
+		timeout.tv_sec = 1;
+		timeout.tv_usec = 0;
+		int retval = Xselect(MAX(controlsock, datasock)+1, &read_fds, NULL, NULL, &timeout);
 		if(retval == -1) {
 			syslog(LOG_ERR, "ERROR waiting for data to arrive. Exiting");
 			return 2;
 		}
+
+		// a timed run reports for itself, so its counts aren't reset
+		time_t t = time(NULL);
+		if (stop == 0 && t - last_report >= RV_STATS_INTERVAL) {
+			report_stats(t - last_report);
+			last_report = t;
+		}
+
 		if(retval == 0) {
 			// No data on control/data sockets, loop again
 			// This is the place to add any actions between loop iterations
@@ -488,5 +483,129 @@ int main(int argc, char *argv[]) {
 		}
 	}
 	return 0;
+}
+
+// Builds a stream packet with no payload from AD -> HID -> SID back to
+//  itself, in the form raw sockets send and receive. Returns its length.
+int make_packet(char *packet, const XIDKey &ad, const XIDKey &hid, const XIDKey &sid)
+{
+	const uint32_t types[] = { CLICK_XIA_XID_TYPE_AD, CLICK_XIA_XID_TYPE_HID, CLICK_XIA_XID_TYPE_SID };
+	const XIDKey *ids[] = { &ad, &hid, &sid };
+	click_xia *xiah = reinterpret_cast<struct click_xia *>(packet);
+
+	xiah->ver = 1;
+	xiah->nxt = CLICK_XIA_NXT_TRN;
+	xiah->hlim = 250;
+	xiah->dnode = 3;
+	xiah->snode = 3;
+	xiah->last = -1;
+
+	// the source copies the destination, its indexes start over at 0.
+	//  the edges out of the final node are where the path starts
+	for (int n = 0; n < 6; n++) {
+		click_xia_xid_node &node = xiah->node[n];
+		node.xid.type = htonl(types[n % 3]);
+		memcpy(node.xid.id, ids[n % 3]->id, CLICK_XIA_XID_ID_LEN);
+		for (int e = 0; e < CLICK_XIA_XID_EDGE_NUM; e++) {
+			node.edge[e].idx = CLICK_XIA_XID_EDGE_UNUSED;
+			node.edge[e].visited = 0;
+		}
+		node.edge[0].idx = (n + 1) % 3;
+	}
+
+	// a transport header saying this is a stream data packet
+	click_xia_ext *ext = reinterpret_cast<struct click_xia_ext *>(&xiah->node[6]);
+	ext->nxt = CLICK_XIA_NXT_NO;
+	ext->hlen = sizeof(click_xia_ext) + 6;
+	ext->data[0] = 2;		// TYPE = XSOCK_STREAM
+	ext->data[1] = 0;
+	ext->data[2] = 1;
+	ext->data[3] = 2;		// PKT_INFO = DATA
+	ext->data[4] = 1;
+	ext->data[5] = 3;
+	xiah->plen = htons(ext->hlen);
+
+	return sizeof(click_xia) + 6 * sizeof(click_xia_xid_node) + ext->hlen;
+}
+
+// Relay RV_BENCH_PACKETS packets round and round through click for
+//  RV_BENCH_TIME seconds and report the rate. The packets are addressed to
+//  the data socket, and this host's HID is registered from this host's AD,
+//  so each packet relayed comes straight back to be relayed again. The rate
+//  counts everything a relayed packet goes through: the main loop, the
+//  trips to and from click and click's forwarding. RV_BENCH_HOSTS random
+//  hosts are registered as well, so the lookups are in a table of some size.
+int benchmark(int datasock, int controlsock)
+{
+	struct addrinfo *ai;
+	XIDKey ad, hid, sid;
+	char packet[RV_MAX_DATA_PACKET_SIZE];
+
+	if (Xgetaddrinfo(NULL, datasid, NULL, &ai) != 0) {
+		syslog(LOG_ERR, "ERROR: unable to get the data plane address");
+		return 1;
+	}
+	std::string dag = Graph((sockaddr_x *)ai->ai_addr).dag_string();
+	Xfreeaddrinfo(ai);
+
+	const char *adstr = strstr(dag.c_str(), "AD:");
+	const char *hidstr = strstr(dag.c_str(), "HID:");
+	if (!adstr || !hidstr || !parseXID(adstr, "AD:", ad) || !parseXID(hidstr, "HID:", hid)
+			|| !parseXID(datasid, "SID:", sid)) {
+		syslog(LOG_ERR, "ERROR: unable to parse the data plane address %s", dag.c_str());
+		return 1;
+	}
+
+	srand(time(NULL));
+	for (int i = 0; i < RV_BENCH_HOSTS; i++) {
+		XIDKey h, a;
+		for (int j = 0; j < CLICK_XIA_XID_ID_LEN; j++) {
+			h.id[j] = rand();
+			a.id[j] = rand();
+		}
+		HIDtoAD[h] = a;
+	}
+	HIDtoAD[hid] = ad;
+
+	int len = make_packet(packet, ad, hid, sid);
+	for (int i = 0; i < RV_BENCH_PACKETS; i++) {
+		if (Xsend(datasock, packet, len, 0) < 0) {
+			syslog(LOG_ERR, "ERROR: unable to send benchmark packets: %s", strerror(errno));
+			return 1;
+		}
+	}
+
+	double start = now();
+	int rc = serve(datasock, controlsock, time(NULL) + RV_BENCH_TIME);
+	double elapsed = now() - start;
+
+	printf("%lu packets relayed in %.2f seconds, %.0f packets/sec, %lu unsent\n",
+		stats.relayed, elapsed, stats.relayed / elapsed, stats.failed);
+	return rc;
+}
+
+int main(int argc, char *argv[]) {
+
+	// Parse command-line arguments
+	config(argc, argv);
+	syslog(LOG_NOTICE, "%s started on %s", APPNAME, hostname);
+
+	// Data plane socket used to rendezvous clients with services
+	int datasock = getServerSocket(datasid, SOCK_RAW);
+	int controlsock = getServerSocket(controlsid, SOCK_DGRAM);
+	if(datasock < 0 || controlsock < 0) {
+		syslog(LOG_ERR, "ERROR creating a server socket");
+		return 1;
+	}
+
+	// Data packets are read until the socket is drained
+	if (Xfcntl(datasock, F_SETFL, O_NONBLOCK) < 0) {
+		syslog(LOG_ERR, "ERROR making the data plane socket non-blocking");
+		return 1;
+	}
+
+	if (benchmark_only)
+		return benchmark(datasock, controlsock);
 
+	return serve(datasock, controlsock, 0);
 }
@@ -0,0 +1,195 @@
+/*
+** Checks how the rendezvous server relays data packets: how XIDs are parsed,
+** which packets relay() rewrites and which it drops, and that the main loop
+** relays everything waiting on the data socket in batches of at most
+** RV_BATCH. The socket calls the loop makes are replaced by a queue of
+** packets, so this runs without click.
+*/
+#define main rvd_main
+#include "../rvd.cc"
+#undef main
+
+#include <deque>
+
+// node[] is a zero length array at the end of the header
+#pragma GCC diagnostic ignored "-Warray-bounds"
+
+#define DATASOCK 5
+#define CONTROLSOCK 6
+#define GOOD 150
+#define UNKNOWN 30
+#define MALFORMED 20
+#define FAIL_SEND 10	// the send after this many fails
+
+static const char *hid = "HID:00112233445566778899aabbccddeeff00112233";
+static const char *ad = "AD:ffeeddccbbaa99887766554433221100ffeeddcc";
+static const char *sid = "SID:0123456789abcdef0123456789abcdef01234567";
+
+static std::deque<std::string> waiting;
+static std::vector<std::string> sent;
+static int wakeups = 0;
+static int received = 0;
+static int most_received = 0;
+static int sends = 0;
+
+// the data socket is readable while there are packets waiting, and once
+//  they are all gone the wait fails, which ends serve()
+int Xselect(int, fd_set *readfds, fd_set *, fd_set *, struct timeval *)
+{
+	FD_ZERO(readfds);
+	if (waiting.empty())
+		return -1;
+
+	FD_SET(DATASOCK, readfds);
+	most_received = MAX(most_received, received);
+	received = 0;
+	wakeups++;
+	return 1;
+}
+
+int Xrecvfrom(int sockfd, void *rbuf, size_t len, int, struct sockaddr *, socklen_t *)
+{
+	if (sockfd != DATASOCK || waiting.empty()) {
+		errno = EAGAIN;
+		return -1;
+	}
+
+	std::string p = waiting.front();
+	waiting.pop_front();
+	received++;
+
+	len = MIN(len, p.size());
+	memcpy(rbuf, p.data(), len);
+	return len;
+}
+
+int Xsend(int, const void *buf, size_t len, int)
+{
+	if (sends++ == FAIL_SEND) {
+		errno = ENOBUFS;
+		return -1;
+	}
+	sent.push_back(std::string((const char *)buf, len));
+	return len;
+}
+
+static void check(const char *name, bool passed)
+{
+	printf("%s: %s\n", name, passed ? "PASS" : "FAIL");
+	if (!passed)
+		exit(-1);
+}
+
+static XIDKey key(const char *s, const char *type)
+{
+	XIDKey k;
+	if (!parseXID(s, type, k)) {
+		printf("unable to parse %s\n", s);
+		exit(-1);
+	}
+	return k;
+}
+
+static click_xia *header(std::string &p)
+{
+	return reinterpret_cast<click_xia *>(&p[0]);
+}
+
+int main()
+{
+	XIDKey h, a, s;
+	char packet[RV_MAX_DATA_PACKET_SIZE];
+
+	openlog("relay_test", LOG_PERROR, LOG_LOCAL4);
+	// serve() logs an error when the queue runs dry
+	setlogmask(LOG_UPTO(LOG_CRIT));
+
+	h = key(hid, "HID:");
+	a = key(ad, "AD:");
+	s = key(sid, "SID:");
+
+	check("Relay Test 1", parseXID("AD:ffeeddccbbaa99887766554433221100ffeeddcc HID:0", "AD:", a)
+		&& memcmp(a.id, "\xff\xee\xdd\xcc", 4) == 0 && a.id[19] == 0xcc);
+	check("Relay Test 2", !parseXID("HID:0011", "HID:", h)
+		&& !parseXID(hid, "AD:", h)
+		&& !parseXID("HID:00112233445566778899aabbccddeeff0011223g", "HID:", h)
+		&& !parseXID("HID: 0112233445566778899aabbccddeeff00112233", "HID:", h));
+
+	// a packet for hid from some other AD
+	h = key(hid, "HID:");
+	XIDKey old_ad = key("AD:1000000000000000000000000000000000000000", "AD:");
+	int len = make_packet(packet, old_ad, h, s);
+	std::string unregistered(packet, len);
+
+	// the packets from the benchmark hold their route and a stream header
+	click_xia *xiah = reinterpret_cast<click_xia *>(packet);
+	click_xia_ext *ext = reinterpret_cast<click_xia_ext *>(&xiah->node[6]);
+	check("Relay Test 3", xiah->dnode == 3 && xiah->snode == 3 && xiah->last == -1
+		&& xiah->node[0].edge[0].idx == 1 && xiah->node[1].edge[0].idx == 2
+		&& xiah->node[2].edge[0].idx == 0 && xiah->node[2].edge[1].idx == CLICK_XIA_XID_EDGE_UNUSED
+		&& xiah->nxt == CLICK_XIA_NXT_TRN && ntohs(xiah->plen) == ext->hlen
+		&& len == (int)((char *)ext - packet) + ext->hlen);
+
+	// dropped until the host registers
+	check("Relay Test 4", !relay(packet, len) && stats.unknown == 1 && stats.relayed == 0);
+
+	HIDtoAD[h] = a;
+	xiah->last = 2;
+	check("Relay Test 5", relay(packet, len) && stats.relayed == 1
+		&& memcmp(xiah->node[0].xid.id, a.id, CLICK_XIA_XID_ID_LEN) == 0
+		&& xiah->last == -1
+		&& memcmp(packet + sizeof(click_xia) + CLICK_XIA_XID_ID_LEN + sizeof(uint32_t),
+			unregistered.data() + sizeof(click_xia) + CLICK_XIA_XID_ID_LEN + sizeof(uint32_t),
+			len - sizeof(click_xia) - CLICK_XIA_XID_ID_LEN - sizeof(uint32_t)) == 0);
+
+	// too short for the header, too short for its nodes, a first node that
+	//  isn't an AD and an AD edge that goes nowhere are all malformed
+	memcpy(packet, unregistered.data(), len);
+	bool dropped = !relay(packet, 4) && !relay(packet, sizeof(click_xia) + 6 * sizeof(click_xia_xid_node) - 1);
+	xiah->node[0].xid.type = htonl(CLICK_XIA_XID_TYPE_HID);
+	dropped = dropped && !relay(packet, len);
+	xiah->node[0].xid.type = htonl(CLICK_XIA_XID_TYPE_AD);
+	xiah->node[0].edge[0].idx = 3;
+	dropped = dropped && !relay(packet, len);
+	check("Relay Test 6", dropped && stats.malformed == 4 && stats.relayed == 1);
+
+	// the main loop relays a mix of packets
+	memset(&stats, 0, sizeof(stats));
+	std::string malformed = unregistered;
+	header(malformed)->node[0].xid.type = htonl(CLICK_XIA_XID_TYPE_SID);
+	std::string unknown = unregistered;
+	header(unknown)->node[1].xid.id[0] ^= 1;
+	for (int i = 0; i < GOOD + UNKNOWN + MALFORMED; i++) {
+		if (i % 10 == 3 && i / 10 < MALFORMED)
+			waiting.push_back(malformed);
+		else if (i % 5 == 1 && i / 5 < UNKNOWN)
+			waiting.push_back(unknown);
+		else
+			waiting.push_back(unregistered);
+	}
+
+	check("Relay Test 7", serve(DATASOCK, CONTROLSOCK, 0) == 2 && waiting.empty());
+	check("Relay Test 8", stats.relayed == GOOD && stats.unknown == UNKNOWN
+		&& stats.malformed == MALFORMED && stats.failed == 1 && sent.size() == GOOD - 1);
+
+	bool rewritten = true;
+	for (size_t i = 0; i < sent.size(); i++) {
+		click_xia *x = header(sent[i]);
+		rewritten = rewritten && sent[i].size() == unregistered.size() && x->last == -1
+			&& memcmp(x->node[0].xid.id, a.id, CLICK_XIA_XID_ID_LEN) == 0;
+	}
+	check("Relay Test 9", rewritten);
+
+	// at most RV_BATCH packets are taken in each wakeup, and as many as
+	//  there are up to that
+	int expected = (GOOD + UNKNOWN + MALFORMED + RV_BATCH - 1) / RV_BATCH;
+	check("Relay Test 10", most_received == RV_BATCH && wakeups == expected);
+
+	// nothing is waited for once the time is up
+	waiting.push_back(unregistered);
+	wakeups = 0;
+	check("Relay Test 11", serve(DATASOCK, CONTROLSOCK, time(NULL) - 1) == 0 && wakeups == 0);
+
+	printf("all tests successful\n");
+	return 0;
+}
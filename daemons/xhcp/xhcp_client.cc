@@ -110,6 +110,27 @@ void listRoutes(std::string xidType)
 	}
 }
 
+// log the route changes click has reported since the last call. Without an
+// event socket the tables are listed when we've changed them, and they are
+// also listed if click had to drop some changes.
+void logRouteEvents(bool changed)
+{
+	vector<XIARouteUpdate> events;
+	bool lost = false;
+
+	if (xr.eventSocket() < 0 ? changed : xr.readEvents(events, lost) < 0 || lost) {
+		listRoutes("AD");
+		listRoutes("HID");
+		return;
+	}
+
+	for (size_t i = 0; i < events.size(); i++) {
+		XIARouteUpdate &e = events[i];
+		syslog(LOG_INFO, "%s %s: %d : %s : %lu\n", e.op == XR_ROUTE_REMOVE ? "removed" : "set",
+			e.xid.c_str(), e.port, e.nextHop.c_str(), e.flags);
+	}
+}
+
 int main(int argc, char *argv[]) {
 	int rc;
 	sockaddr_x sdag;
@@ -149,6 +170,10 @@ int main(int argc, char *argv[]) {
 		syslog(LOG_ERR, "unable to connect to click! (%d)\n", rc);
 		return -1;
 	}
+
+	// the routes set below are logged as click reports them
+	if (xr.subscribe(XR_EVENTS_ROUTES) < 0)
+		syslog(LOG_WARNING, "unable to subscribe to route events: %s", strerror(errno));
 	
 	// Xsocket init
 	int sockfd = Xsocket(AF_XIA, SOCK_DGRAM, 0);
@@ -306,10 +331,9 @@ int main(int argc, char *argv[]) {
 			myNS_DAG = nsDAG;
 		}				
 		
-		if (changed) {
-			listRoutes("AD");
-			listRoutes("HID");
-		}
+		// click reports changes once it has made them, so these are mostly
+		// from the last beacon
+		logRouteEvents(changed);
 
 		beacon_reception_count++;
 		if ((beacon_reception_count % beacon_response_freq) == 0) {
@@ -0,0 +1,122 @@
+/*
+** Times encoding and decoding LSAs in the binary format, and decoding the
+** same LSAs in the text format older routers send.
+**
+** msg_bench [neighbors]
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "../xroutemsg.hh"
+
+using namespace std;
+
+#define BENCH_SECONDS 1.0
+
+static double now()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static string randomXID(const char *type)
+{
+	static const char hex[] = "0123456789abcdef";
+	string xid(type);
+
+	for (int i = 0; i < 40; i++)
+		xid.push_back(hex[rand() % 16]);
+	return xid;
+}
+
+// the "^" separated form: type, dual router, AD, HID, seq, count, the
+//  neighbor ADs and HIDs, then their costs
+static string textLSA(const LSAMsg &lsa)
+{
+	char buf[32];
+	string msg = "1^";
+
+	msg += lsa.dual_router ? "1^" : "0^";
+	msg += lsa.AD + "^" + lsa.HID + "^";
+	snprintf(buf, sizeof(buf), "%u^%u^", lsa.seq, (unsigned)lsa.neighbors.size());
+	msg += buf;
+	for (size_t i = 0; i < lsa.neighbors.size(); i++)
+		msg += lsa.neighbors[i].AD + "^" + lsa.neighbors[i].HID + "^";
+	for (size_t i = 0; i < lsa.neighbors.size(); i++) {
+		snprintf(buf, sizeof(buf), "%d^", lsa.neighbors[i].cost);
+		msg += buf;
+	}
+	return msg;
+}
+
+// runs f for about BENCH_SECONDS, returns microseconds per call
+template <typename F>
+static double timeit(F f)
+{
+	unsigned long n = 0;
+	double start = now(), elapsed;
+
+	do {
+		for (int i = 0; i < 1000; i++)
+			f();
+		n += 1000;
+	} while ((elapsed = now() - start) < BENCH_SECONDS);
+	return elapsed * 1e6 / n;
+}
+
+static LSAMsg lsa;
+static vector<string> fragments;
+static string text;
+
+static void encode()
+{
+	encodeLSA(lsa, fragments);
+}
+
+static void decode()
+{
+	LSAMsg got;
+
+	for (size_t f = 0; f < fragments.size(); f++)
+		decodeLSA(fragments[f].data(), fragments[f].size(), got);
+}
+
+static void decodeText()
+{
+	LSAMsg got;
+
+	decodeLSA(text.data(), text.size(), got);
+}
+
+int main(int argc, char **argv)
+{
+	int neighbors = argc > 1 ? atoi(argv[1]) : 20;
+
+	lsa.dual_router = false;
+	lsa.AD = randomXID("AD:");
+	lsa.HID = randomXID("HID:");
+	lsa.seq = 1;
+	lsa.age = 0;
+	for (int i = 0; i < neighbors; i++) {
+		LSANeighbor n;
+		n.AD = randomXID("AD:");
+		n.HID = randomXID("HID:");
+		n.cost = 1;
+		lsa.neighbors.push_back(n);
+	}
+
+	encode();
+	text = textLSA(lsa);
+
+	size_t bytes = 0;
+	for (size_t f = 0; f < fragments.size(); f++)
+		bytes += fragments[f].size();
+
+	printf("LSA with %d neighbors\n", neighbors);
+	printf("binary: %lu bytes in %lu fragments, encode %.2f us, decode %.2f us\n",
+		(unsigned long)bytes, (unsigned long)fragments.size(), timeit(encode), timeit(decode));
+	printf("text:   %lu bytes, decode %.2f us\n", (unsigned long)text.size(), timeit(decodeText));
+	return 0;
+}
@@ -0,0 +1,294 @@
+/*
+** Round trips HELLOs and LSAs through their binary encoding, and feeds the
+** decoders mutated, truncated and random messages. Whatever a decoder
+** accepts has to be self-consistent and come out the same when encoded
+** and decoded again.
+**
+** msg_test [iterations] [seed]
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "../xroutemsg.hh"
+
+using namespace std;
+
+#define ITERATIONS 100000
+
+// sizes from the wire format in xroutemsg.hh
+#define LSA_BYTES		56
+#define NEIGHBOR_BYTES	44
+
+static void check(const char *name, bool passed)
+{
+	printf("%s: %s\n", name, passed ? "PASS" : "FAIL");
+	if (!passed)
+		exit(-1);
+}
+
+static string randomXID(const char *type)
+{
+	static const char hex[] = "0123456789abcdef";
+	string xid(type);
+
+	for (int i = 0; i < 40; i++)
+		xid.push_back(hex[rand() % 16]);
+	return xid;
+}
+
+static bool wellFormed(const string &xid, const char *type)
+{
+	size_t n = strlen(type);
+
+	if (xid.compare(0, n, type) != 0 || xid.length() != n + 40)
+		return false;
+	for (size_t i = n; i < xid.length(); i++)
+		if (!isxdigit(xid[i]) || isupper(xid[i]))
+			return false;
+	return true;
+}
+
+static LSAMsg randomLSA(int neighbors)
+{
+	LSAMsg lsa;
+
+	lsa.dual_router = rand() % 2;
+	lsa.AD = randomXID("AD:");
+	lsa.HID = randomXID("HID:");
+	lsa.seq = rand();
+	lsa.age = rand() % 100;
+	lsa.fragment = 0;
+	lsa.fragments = 1;
+	for (int i = 0; i < neighbors; i++) {
+		LSANeighbor n;
+		n.AD = randomXID("AD:");
+		n.HID = randomXID("HID:");
+		n.cost = 1 + rand() % 1000;
+		lsa.neighbors.push_back(n);
+	}
+	return lsa;
+}
+
+static bool sameNeighbor(const LSANeighbor &a, const LSANeighbor &b)
+{
+	return a.AD == b.AD && a.HID == b.HID && a.cost == b.cost;
+}
+
+static bool sameHeader(const LSAMsg &a, const LSAMsg &b)
+{
+	return a.dual_router == b.dual_router && a.AD == b.AD && a.HID == b.HID
+		&& a.seq == b.seq && a.age == b.age;
+}
+
+// encodes lsa, decodes every fragment and checks the pieces add up to lsa
+static bool roundTrip(const LSAMsg &lsa)
+{
+	vector<string> fragments;
+	vector<LSANeighbor> neighbors;
+
+	if (!encodeLSA(lsa, fragments) || fragments.empty())
+		return false;
+
+	for (size_t f = 0; f < fragments.size(); f++) {
+		LSAMsg got;
+
+		if (fragments[f].size() > XROUTE_MAX_MSG
+				|| messageType(fragments[f].data(), fragments[f].size()) != LSA
+				|| !decodeLSA(fragments[f].data(), fragments[f].size(), got)
+				|| !sameHeader(lsa, got) || got.fragment != f || got.fragments != fragments.size())
+			return false;
+		neighbors.insert(neighbors.end(), got.neighbors.begin(), got.neighbors.end());
+	}
+
+	if (neighbors.size() != lsa.neighbors.size())
+		return false;
+	for (size_t i = 0; i < neighbors.size(); i++)
+		if (!sameNeighbor(neighbors[i], lsa.neighbors[i]))
+			return false;
+	return true;
+}
+
+// an LSA the decoder accepted must be a valid one
+static bool consistent(const char *msg, int len, const LSAMsg &lsa)
+{
+	if (lsa.fragment >= lsa.fragments || !wellFormed(lsa.AD, "AD:") || !wellFormed(lsa.HID, "HID:"))
+		return false;
+	if (msg[0] == 0 && len != LSA_BYTES + (int)lsa.neighbors.size() * NEIGHBOR_BYTES)
+		return false;
+
+	for (size_t i = 0; i < lsa.neighbors.size(); i++) {
+		const LSANeighbor &n = lsa.neighbors[i];
+		if (n.cost <= 0 || !wellFormed(n.AD, "AD:") || !wellFormed(n.HID, "HID:"))
+			return false;
+	}
+
+	// and come out the same when sent on
+	if (msg[0] != 0)
+		return true;
+
+	vector<string> fragments;
+	LSAMsg again;
+	return encodeLSA(lsa, fragments) && fragments.size() == 1
+		&& decodeLSA(fragments[0].data(), fragments[0].size(), again)
+		&& sameHeader(lsa, again) && again.neighbors.size() == lsa.neighbors.size();
+}
+
+// changes a few bytes, cuts the message short or runs on past its end
+static string mutate(const string &msg)
+{
+	string m(msg);
+
+	switch (rand() % 4) {
+		case 0:
+			m.resize(rand() % (m.size() + 1));
+			break;
+		case 1:
+			m.append(rand() % 64, (char)rand());
+			break;
+		default:
+			for (int i = 0, n = 1 + rand() % 4; i < n && !m.empty(); i++)
+				m[rand() % m.size()] = rand();
+			break;
+	}
+
+	// the count and fragment fields are where the decoder could go wrong
+	if (rand() % 4 == 0 && m.size() >= 16) {
+		m[14 + rand() % 2] = rand();
+		m[10 + rand() % 4] = rand();
+	}
+	return m;
+}
+
+int main(int argc, char **argv)
+{
+	int iterations = argc > 1 ? atoi(argv[1]) : ITERATIONS;
+	unsigned seed = argc > 2 ? atoi(argv[2]) : 7;
+	HelloMsg hello, got;
+	string msg;
+
+	srand(seed);
+
+	// HELLOs, XIDs are decoded in lowercase
+	hello.AD = "AD:00112233445566778899AABBCCDDEEFF00112233";
+	hello.HID = randomXID("HID:");
+	check("Msg Test 1", encodeHello(hello, msg) && messageType(msg.data(), msg.size()) == HELLO
+		&& decodeHello(msg.data(), msg.size(), got)
+		&& got.AD == normalizeXID(hello.AD) && got.HID == hello.HID
+		&& !decodeHello(msg.data(), msg.size() - 1, got));
+
+	hello.AD = "AD:0011";
+	bool bad = !encodeHello(hello, msg);
+	hello.AD = "AD:00112233445566778899aabbccddeeff0011223g";
+	bad = bad && !encodeHello(hello, msg);
+	hello.AD = "00112233445566778899aabbccddeeff00112233";
+	check("Msg Test 2", bad && !encodeHello(hello, msg));
+
+	// LSAs of every size up to one that takes several fragments
+	bool ok = true;
+	for (int n = 0; n <= 200 && ok; n++)
+		ok = roundTrip(randomLSA(n));
+	check("Msg Test 3", ok);
+
+	// a bad neighbor XID fails the whole LSA
+	LSAMsg lsa = randomLSA(30);
+	vector<string> fragments;
+	lsa.neighbors[29].HID = "HID:xyz";
+	check("Msg Test 4", !encodeLSA(lsa, fragments));
+
+	// non-positive costs are taken as 1
+	lsa = randomLSA(2);
+	lsa.neighbors[0].cost = 0;
+	lsa.neighbors[1].cost = -5;
+	LSAMsg decoded;
+	check("Msg Test 5", encodeLSA(lsa, fragments)
+		&& decodeLSA(fragments[0].data(), fragments[0].size(), decoded)
+		&& decoded.neighbors[0].cost == 1 && decoded.neighbors[1].cost == 1);
+
+	// ageing bumps the age in place, and stops at the top
+	lsa = randomLSA(3);
+	lsa.age = 0xfffe;
+	encodeLSA(lsa, fragments);
+	string &f = fragments[0];
+	ageLSA(&f[0], f.size());
+	ok = decodeLSA(f.data(), f.size(), decoded) && decoded.age == 0xffff;
+	ageLSA(&f[0], f.size());
+	check("Msg Test 6", ok && decodeLSA(f.data(), f.size(), decoded) && decoded.age == 0xffff
+		&& decoded.neighbors.size() == 3);
+
+	// text messages from older routers
+	string text = "1^1^AD:AA00000000000000000000000000000000000000^HID:bb00000000000000000000000000000000000000^42^2^"
+		"AD:1100000000000000000000000000000000000000^HID:2200000000000000000000000000000000000000^"
+		"AD:3300000000000000000000000000000000000000^HID:4400000000000000000000000000000000000000^7^";
+	check("Msg Test 7", decodeLSA(text.data(), text.size(), decoded) && decoded.dual_router
+		&& decoded.AD == "AD:aa00000000000000000000000000000000000000" && decoded.seq == 42
+		&& decoded.fragments == 1 && decoded.neighbors.size() == 2
+		&& decoded.neighbors[0].cost == 7 && decoded.neighbors[1].cost == 1);
+	string textLSA = text;
+	text = "0^AD:aa00000000000000000000000000000000000000^HID:bb00000000000000000000000000000000000000^";
+	check("Msg Test 8", decodeHello(text.data(), text.size(), got) && got.HID == "HID:bb00000000000000000000000000000000000000"
+		&& !decodeLSA(text.data(), text.size(), decoded));
+
+	// and their XIDs have to be as well formed as binary ones
+	text = "0^AD:aa00000000000000000000000000000000000000^HID:bb^";
+	bad = !decodeHello(text.data(), text.size(), got);
+	text = "1^0^AD:aa00000000000000000000000000000000000000^HID:bb00000000000000000000000000000000000000^1^1^"
+		"AD:1100000000000000000000000000000000000000^HID:22000000000000000000000000000000000000zz^";
+	check("Msg Test 9", bad && !decodeLSA(text.data(), text.size(), decoded));
+
+	// fuzz: every message is copied into a buffer of its exact size so a
+	//  sanitizer build catches reads past the end
+	vector<string> seeds;
+	for (int n = 0; n < 25; n += 6) {
+		encodeLSA(randomLSA(n), fragments);
+		seeds.push_back(fragments[0]);
+	}
+	encodeLSA(randomLSA(40), fragments);
+	seeds.insert(seeds.end(), fragments.begin(), fragments.end());
+	hello.AD = randomXID("AD:");
+	encodeHello(hello, msg);
+	seeds.push_back(msg);
+	seeds.push_back(textLSA);
+	seeds.push_back("0^AD:aa00000000000000000000000000000000000000^HID:bb00000000000000000000000000000000000000^");
+	seeds.push_back("1^0^AD:aa^HID:bb^1^3^AD:1^HID:2^");
+
+	int accepted = 0;
+	for (int i = 0; i < iterations; i++) {
+		string m;
+
+		if (i % 10 == 0) {
+			m.resize(rand() % 200);
+			for (size_t j = 0; j < m.size(); j++)
+				m[j] = rand();
+			if (!m.empty() && rand() % 2)
+				m[0] = 0;
+		} else {
+			m = mutate(seeds[rand() % seeds.size()]);
+		}
+
+		char *buf = new char[m.size()];
+		memcpy(buf, m.data(), m.size());
+
+		LSAMsg l;
+		if (decodeLSA(buf, m.size(), l)) {
+			accepted++;
+			if (!consistent(buf, m.size(), l)) {
+				printf("accepted a bad LSA at iteration %d\n", i);
+				check("Msg Test 10", false);
+			}
+		}
+		HelloMsg h;
+		if (decodeHello(buf, m.size(), h)
+				&& (!wellFormed(h.AD, "AD:") || !wellFormed(h.HID, "HID:"))) {
+			printf("accepted a bad HELLO at iteration %d\n", i);
+			check("Msg Test 10", false);
+		}
+		ageLSA(buf, m.size());
+		delete[] buf;
+	}
+	printf("%d messages, %d LSAs accepted\n", iterations, accepted);
+	check("Msg Test 10", true);
+
+	printf("all tests successful\n");
+	return 0;
+}
@@ -0,0 +1,99 @@
+/*
+** Feeds xrouted a flood of LSAs, one a millisecond, and checks that route
+** computations are held down while it lasts, that nothing received is left
+** uncomputed, and that once things are quiet again an LSA is acted on after
+** just SPF_DELAY.
+*/
+#include "topology.hh"
+
+#define FLOOD_MSEC 500
+#define QUIET_MSEC 2000
+#define MAX_FLOOD_RUNS 4	// one at 50 and 250 msec, the hold has doubled to 400 by then
+
+// LSAs are reflooded, there's nowhere for them to go here
+int Xsendto(int, const void *, size_t len, int, const struct sockaddr *, socklen_t)
+{
+	return len;
+}
+
+static uint32_t seq = 1;
+
+static void receiveLSA(int from, int to)
+{
+	LSAMsg lsa;
+	LSANeighbor nb;
+	vector<std::string> fragments;
+
+	lsa.dual_router = 0;
+	lsa.AD = adName(from);
+	lsa.HID = "HID:" + lsa.AD.substr(3);
+	lsa.seq = seq++;
+	lsa.age = 0;
+	lsa.fragment = 0;
+	lsa.fragments = 1;
+	nb.AD = adName(to);
+	nb.HID = "HID:" + nb.AD.substr(3);
+	nb.cost = 1;
+	lsa.neighbors.push_back(nb);
+
+	encodeLSA(lsa, fragments);
+	processLSA(lsa, fragments[0].data(), fragments[0].size());
+}
+
+// waits up to msec for the route computation timer, running it if it fires
+static bool waitSPF(int msec)
+{
+	struct pollfd pfd = { route_state.spf_timer, POLLIN, 0 };
+
+	if (poll(&pfd, 1, msec) > 0 && timerFired(pfd.fd)) {
+		runSPF();
+		return true;
+	}
+	return false;
+}
+
+static void check(const char *name, bool passed)
+{
+	printf("%s: %s\n", name, passed ? "PASS" : "FAIL");
+	if (!passed)
+		exit(-1);
+}
+
+int main()
+{
+	int runs = 0;
+	int64_t start, t;
+
+	openlog("spf_hold_test", LOG_PERROR, LOG_LOCAL4);
+	setlogmask(LOG_UPTO(LOG_NOTICE));
+
+	strcpy(route_state.myAD, adName(0).c_str());
+	route_state.spf_timer = makeTimer(0);
+	route_state.spf_last = 0;
+	route_state.spf_hold = SPF_MIN_HOLD;
+
+	start = now_msec();
+	while ((t = now_msec() - start) < FLOOD_MSEC) {
+		receiveLSA(1 + rand() % 50, 1 + rand() % 50);
+		if (waitSPF(1))
+			runs++;
+	}
+	printf("%d LSAs in %d msec, %d route computations\n", seq - 1, FLOOD_MSEC, runs);
+	check("Flood Hold Down Test", runs >= 1 && runs <= MAX_FLOOD_RUNS);
+
+	// the last of the flood still gets computed
+	while (!route_state.spf.dirty.empty() && waitSPF(SPF_MAX_HOLD))
+		runs++;
+	check("Flood Completion Test", route_state.spf.dirty.empty());
+
+	// wait out the hold, then a lone LSA
+	while (now_msec() - route_state.spf_last < QUIET_MSEC)
+		waitSPF(QUIET_MSEC);
+	receiveLSA(1, 2);
+	t = now_msec();
+	check("Quiet Test", waitSPF(SPF_DELAY * 4) && now_msec() - t < SPF_DELAY * 2
+		&& route_state.spf_hold == SPF_MIN_HOLD);
+
+	printf("all tests successful\n");
+	return 0;
+}
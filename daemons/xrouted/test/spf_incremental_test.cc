@@ -0,0 +1,107 @@
+/*
+** Makes random link changes to a topology, recomputing routes after each
+** one, and checks that the incremental computation ends up with the same
+** routes as one done from scratch would. Every route that changed has to
+** be queued for click.
+*/
+#include "topology.hh"
+
+int main(int argc, char **argv)
+{
+	int size = argc > 1 ? atoi(argv[1]) : 500;
+	int changes = argc > 2 ? atoi(argv[2]) : 1000;
+	double start, full, incremental = 0;
+	size_t queued = 0;
+	int bad;
+
+	openlog("spf_incremental_test", LOG_PERROR, LOG_LOCAL4);
+	setlogmask(LOG_UPTO(LOG_NOTICE));
+
+	Topology topo(size, 11);
+
+	start = now_ms();
+	calcShortestPath();
+	full = now_ms() - start;
+	route_state.ADrouteChanges.clear();
+
+	bad = topo.badRoutes();
+	printf("Full SPF Test: %s (%d bad routes)\n", bad ? "FAIL" : "PASS", bad);
+	if (bad)
+		exit(-1);
+
+	for (int c = 0; c < changes; c++) {
+		int i = rand() % size, j = rand() % size;
+		if (i == j)
+			continue;
+
+		map<std::string, RouteEntry> before = route_state.ADrouteTable;
+
+		switch (rand() % 5) {
+			case 0:		// new link, or a new cost for one
+			case 1:
+				topo.connect(i, j, 1 + rand() % (2 * MAX_LINK_COST));
+				topo.publish(i);
+				topo.publish(j);
+				break;
+
+			case 2:		// a link goes down
+				if (topo.links[i].size() > 1) {
+					j = topo.links[i].begin()->first;
+					topo.disconnect(i, j);
+					topo.publish(i);
+					topo.publish(j);
+				}
+				break;
+
+			case 3:		// a link gets much cheaper
+				if (!topo.links[i].empty()) {
+					j = topo.links[i].rbegin()->first;
+					topo.connect(i, j, 1);
+					topo.publish(i);
+					topo.publish(j);
+				}
+				break;
+
+			case 4:		// an AD's LSA ages out, or comes back
+				if (i == 0)
+					break;
+				if (route_state.networkTable.erase(adName(i)))
+					markChanged(internXID(adName(i)));
+				else
+					topo.publish(i);
+				break;
+		}
+
+		start = now_ms();
+		calcShortestPath();
+		incremental += now_ms() - start;
+
+		// everything that differs from before has to be queued
+		set<std::string> queue(route_state.ADrouteChanges.begin(), route_state.ADrouteChanges.end());
+		map<std::string, RouteEntry>::iterator it;
+		for (it = before.begin(); it != before.end(); ++it) {
+			map<std::string, RouteEntry>::iterator now = route_state.ADrouteTable.find(it->first);
+			if ((now == route_state.ADrouteTable.end() || now->second.nextHop != it->second.nextHop)
+					&& !queue.count(it->first))
+				bad++;
+		}
+		for (it = route_state.ADrouteTable.begin(); it != route_state.ADrouteTable.end(); ++it)
+			if (!before.count(it->first) && !queue.count(it->first))
+				bad++;
+		queued += route_state.ADrouteChanges.size();
+		route_state.ADrouteChanges.clear();
+
+		bad += topo.badRoutes();
+		if (bad) {
+			printf("Incremental SPF Test: FAIL (%d bad routes after change %d)\n", bad, c);
+			exit(-1);
+		}
+	}
+
+	printf("Incremental SPF Test: PASS\n");
+	printf("%d ADs: full SPF %.2f ms, %d changes %.3f ms each, %zu routes queued\n",
+		size, full, changes, incremental / changes, queued);
+
+	printf("all tests successful\n");
+	return 0;
+}
@@ -0,0 +1,29 @@
+/*
+** Computes routes from scratch over random topologies and checks that every
+** route leaves by a neighbor on a shortest path.
+*/
+#include "topology.hh"
+
+int main(int argc, char **argv)
+{
+	int size = argc > 1 ? atoi(argv[1]) : 3000;
+	int bad;
+	double start;
+
+	openlog("spf_test", LOG_PERROR, LOG_LOCAL4);
+	setlogmask(LOG_UPTO(LOG_NOTICE));
+
+	Topology topo(size, 7);
+
+	start = now_ms();
+	calcShortestPath();
+	printf("SPF over %d ADs: %.2f ms\n", size, now_ms() - start);
+
+	bad = topo.badRoutes();
+	printf("SPF Test: %s (%d bad routes)\n", bad ? "FAIL" : "PASS", bad);
+	if (bad)
+		exit(-1);
+
+	printf("all tests successful\n");
+	return 0;
+}
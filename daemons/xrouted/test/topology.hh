@@ -0,0 +1,162 @@
+/*
+** Random AD topologies for the xrouted tests. The tests include xrouted.cc
+** itself so they can drive its route computation without a click or a
+** network, and check the routes it comes up with against a plain Dijkstra
+** run over the same links.
+*/
+#define main xrouted_main
+#include "../xrouted.cc"
+#undef main
+
+#include <sys/time.h>
+
+#define MAX_LINK_COST 10
+
+static inline std::string adName(int i)
+{
+	char buf[MAX_XID_SIZE];
+
+	sprintf(buf, "AD:%040d", i);
+	return buf;
+}
+
+static inline double now_ms()
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+}
+
+class Topology {
+public:
+	int n;
+	vector< map<int, int> > links;	// links[i][j] is the cost of i -> j as i advertises it
+
+	// a random spanning tree, so everything is reachable, plus 2n more links.
+	// AD 0 is the router under test, and every other AD is made its
+	// neighbor so any of them can be a first hop
+	Topology(int size, unsigned seed) : n(size), links(size) {
+		srand(seed);
+		for (int i = 1; i < n; i++)
+			connect(i, rand() % i, 1 + rand() % MAX_LINK_COST);
+		for (int k = 0; k < 2 * n; k++) {
+			int i = rand() % n, j = rand() % n;
+			if (i != j)
+				connect(i, j, 1 + rand() % MAX_LINK_COST);
+		}
+
+		strcpy(route_state.myAD, adName(0).c_str());
+		for (int i = 1; i < n; i++) {
+			NeighborEntry e;
+			e.AD = adName(i);
+			e.HID = "HID:" + e.AD.substr(3);
+			e.cost = 1;
+			e.port = i;
+			route_state.neighborTable[e.AD] = e;
+		}
+		for (int i = 0; i < n; i++)
+			publish(i);
+	}
+
+	void connect(int i, int j, int cost) {
+		links[i][j] = links[j][i] = cost;
+	}
+
+	void disconnect(int i, int j) {
+		links[i].erase(j);
+		links[j].erase(i);
+	}
+
+	// hands xrouted i's links, as an LSA from i would
+	void publish(int i) {
+		NodeStateEntry e;
+
+		e.dest = adName(i);
+		e.id = internXID(e.dest);
+		e.seq = 1;
+		e.num_neighbors = links[i].size();
+		for (map<int, int>::iterator it = links[i].begin(); it != links[i].end(); ++it) {
+			e.neighbor_list.push_back(adName(it->first));
+			e.neighbor_ids.push_back(internXID(adName(it->first)));
+			e.neighbor_cost.push_back(it->second);
+		}
+		route_state.networkTable[e.dest] = e;
+		markChanged(e.id);
+	}
+
+	// ADs xrouted has an LSA for
+	vector<bool> advertised() {
+		vector<bool> known(n, false);
+
+		for (int i = 0; i < n; i++)
+			known[i] = route_state.networkTable.count(adName(i)) > 0;
+		return known;
+	}
+
+	// cost from src to every AD, -1 if there is no path. only ADs that have
+	// sent an LSA lead anywhere
+	vector<long> distances(int src, const vector<bool> &known) {
+		vector<long> dist(n, -1);
+		priority_queue< pair<long, int>, vector< pair<long, int> >, greater< pair<long, int> > > heap;
+
+		dist[src] = 0;
+		heap.push(make_pair(0L, src));
+		while (!heap.empty()) {
+			pair<long, int> top = heap.top();
+			heap.pop();
+			int u = top.second;
+			if (top.first > dist[u] || !known[u])
+				continue;
+			for (map<int, int>::iterator it = links[u].begin(); it != links[u].end(); ++it) {
+				long d = dist[u] + it->second;
+				if (dist[it->first] < 0 || d < dist[it->first]) {
+					dist[it->first] = d;
+					heap.push(make_pair(d, it->first));
+				}
+			}
+		}
+		return dist;
+	}
+
+	// number of ADs whose route in ADrouteTable is missing, shouldn't be
+	// there, or leaves by a neighbor that isn't on a shortest path
+	int badRoutes() {
+		vector<bool> known = advertised();
+		vector<long> dist = distances(0, known);
+		vector< pair<long, int> > order;
+		vector< set<int> > firstHops(n);
+		int bad = 0;
+
+		// the neighbors of AD 0 that shortest paths to each AD leave by,
+		// worked out nearest AD first. links are symmetric, so links[v]
+		// lists the ADs with a link to v
+		for (int v = 1; v < n; v++)
+			if (dist[v] >= 0)
+				order.push_back(make_pair(dist[v], v));
+		sort(order.begin(), order.end());
+		for (size_t k = 0; k < order.size(); k++) {
+			int v = order[k].second;
+			for (map<int, int>::iterator it = links[v].begin(); it != links[v].end(); ++it) {
+				int u = it->first;
+				if (!known[u] || dist[u] < 0 || dist[u] + links[u][v] != dist[v])
+					continue;
+				if (u == 0)
+					firstHops[v].insert(v);
+				else
+					firstHops[v].insert(firstHops[u].begin(), firstHops[u].end());
+			}
+		}
+
+		for (int d = 1; d < n; d++) {
+			map<std::string, RouteEntry>::iterator r = route_state.ADrouteTable.find(adName(d));
+			bool wanted = dist[d] >= 0 && known[d];
+
+			if (wanted != (r != route_state.ADrouteTable.end()))
+				bad++;
+			else if (wanted && !firstHops[d].count(atoi(r->second.nextHop.c_str() + 4)))
+				bad++;
+		}
+		return bad;
+	}
+};
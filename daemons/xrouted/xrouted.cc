@@ -8,8 +8,13 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <set>
+#include <queue>
+#include <functional>
 #include <time.h>
 #include <errno.h>
+#include <poll.h>
+#include <sys/timerfd.h>
 
 #include <sys/types.h>
 #include <netdb.h>
@@ -51,15 +56,29 @@ void listRoutes(std::string xidType)
 }
 
 
+/*
+** HIDs are looked up in the copy of click's HID table that route events keep
+** current. A neighbor's hello can get here before the event saying where it
+** was heard, so a miss still asks click.
+*/
 int interfaceNumber(std::string xidType, std::string xid)
 {
 	int rc;
 	vector<XIARouteEntry> routes;
+
+	if (xidType == "HID" && xr.eventSocket() >= 0) {
+		map<std::string, int32_t>::iterator it = route_state.hidPorts.find(normalizeXID(xid));
+		if (it != route_state.hidPorts.end())
+			return it->second;
+	}
+
 	if ((rc = xr.getRoutes(xidType, routes)) > 0) {
 		vector<XIARouteEntry>::iterator ir;
 		for (ir = routes.begin(); ir < routes.end(); ir++) {
 			XIARouteEntry r = *ir;
-			if ((r.xid).compare(xid) == 0) {
+			if (normalizeXID(r.xid) == normalizeXID(xid)) {
+				if (xidType == "HID" && xr.eventSocket() >= 0)
+					route_state.hidPorts[normalizeXID(xid)] = r.port;
 				return (int)(r.port);
 			}
 		}
@@ -67,92 +86,128 @@ int interfaceNumber(std::string xidType, std::string xid)
 	return -1;
 }
 
+void loadHIDPorts()
+{
+	vector<XIARouteEntry> routes;
+
+	route_state.hidPorts.clear();
+	if (xr.getRoutes("HID", routes) < 0)
+		return;
+
+	for (size_t i = 0; i < routes.size(); i++)
+		if (routes[i].xid != "-")
+			route_state.hidPorts[normalizeXID(routes[i].xid)] = routes[i].port;
+}
+
+void processRouteEvents()
+{
+	vector<XIARouteUpdate> events;
+	bool lost;
+
+	if (xr.readEvents(events, lost) < 0) {
+		syslog(LOG_WARNING, "error reading route events: %s", strerror(errno));
+		return;
+	}
+
+	if (lost) {
+		syslog(LOG_INFO, "route events were dropped, rereading the HID table");
+		loadHIDPorts();
+	}
+
+	for (size_t i = 0; i < events.size(); i++) {
+		XIARouteUpdate &e = events[i];
+
+		if (e.op != XR_ROUTE_NEIGHBOR)
+			syslog(LOG_INFO, "route %s: %s | %d | %s | %lu", e.op == XR_ROUTE_REMOVE ? "removed" : "set",
+				e.xid.c_str(), e.port, e.nextHop.c_str(), e.flags);
+
+		if (e.xid.compare(0, 4, "HID:") != 0 || e.xid == "HID:-")
+			continue;
+		if (e.op == XR_ROUTE_REMOVE) {
+			route_state.hidPorts.erase(e.xid);
+			continue;
+		}
+		route_state.hidPorts[e.xid] = e.port;
+
+		if (e.op != XR_ROUTE_NEIGHBOR)
+			continue;
+
+		// a neighbor that moved to another interface needs its routes redone
+		map<std::string, NeighborEntry>::iterator it;
+		for (it = route_state.neighborTable.begin(); it != route_state.neighborTable.end(); it++) {
+			if (it->second.HID == e.xid && it->second.port != e.port) {
+				syslog(LOG_INFO, "neighbor %s is now on port %d", e.xid.c_str(), e.port);
+				it->second.port = e.port;
+				route_state.spf.ready = false;
+				scheduleSPF();
+			}
+		}
+	}
+}
+
 
 // send Hello message (1-hop broadcast)
 int sendHello(){
 	// Send my AD and my HID to the directly connected neighbors
 	int rc;
-	char buffer[1024];
-	int buflen;
-	bzero(buffer, 1024);
-
-	/* Message format (delimiter=^)
-		message-type{Hello=0 or LSA=1}
-		source-AD
-		source-HID
-	*/
-	string hello;
-	hello.append("0^");
-	hello.append(route_state.myAD);
-	hello.append("^");
-	hello.append(route_state.myHID);
-	hello.append("^");
-	strcpy (buffer, hello.c_str());
-	buflen = strlen(buffer);
-	rc = Xsendto(route_state.sock, buffer, buflen, 0, (struct sockaddr*)&route_state.ddag, sizeof(sockaddr_x));
-	if(rc != buflen) {
-		syslog(LOG_WARNING, "ERROR sending hello. Tried sending %d bytes but rc=%d", buflen, rc);
+	HelloMsg hello;
+	string msg;
+
+	hello.AD = route_state.myAD;
+	hello.HID = route_state.myHID;
+	if (!encodeHello(hello, msg)) {
+		syslog(LOG_WARNING, "ERROR can't encode hello for %s", route_state.myAD);
+		return -1;
+	}
+
+	rc = Xsendto(route_state.sock, msg.data(), msg.size(), 0, (struct sockaddr*)&route_state.ddag, sizeof(sockaddr_x));
+	if(rc != (int)msg.size()) {
+		syslog(LOG_WARNING, "ERROR sending hello. Tried sending %zu bytes but rc=%d", msg.size(), rc);
 		return -1;
 	}
 	return 0;
 }
 
-// send LinkStateAdvertisement message (flooding)
+// send LinkStateAdvertisement message (flooding), in as many fragments as
+// my neighbors need
 int sendLSA() {
 	int rc;
-	char buffer[1024];
-	int buflen;
-	bzero(buffer, 1024);
-	/* Message format (delimiter=^)
-		message-type{Hello=0 or LSA=1}
-		router-type{XIA=0 or XIA-IPv4-Dual=1}
-		source-AD
-		source-HID
-		LSA-seq-num
-		num_neighbors
-		neighbor1-AD
-		neighbor1-HID
-		neighbor2-AD
-		neighbor2-HID
-		...
-	*/
-	string lsa;
-	char lsa_seq[10], num_neighbors[10], is_dual_router[10];
-
-	sprintf(lsa_seq, "%d", route_state.lsa_seq);
-	sprintf(num_neighbors, "%d", route_state.num_neighbors);
-	sprintf(is_dual_router, "%d", route_state.dual_router);
-
-	lsa.append("1^");
-	lsa.append(is_dual_router);
-	lsa.append("^");
-	lsa.append(route_state.myAD);
-	lsa.append("^");
-	lsa.append(route_state.myHID);
-	lsa.append("^");
-	lsa.append(lsa_seq);
-	lsa.append("^");
-	lsa.append(num_neighbors);
-	lsa.append("^");
+	LSAMsg lsa;
+	vector<string> fragments;
 
-	map<std::string, NeighborEntry>::iterator it;
+	lsa.dual_router = route_state.dual_router == 1;
+	lsa.AD = route_state.myAD;
+	lsa.HID = route_state.myHID;
+	lsa.seq = route_state.lsa_seq;
+	lsa.age = 0;
 
+	map<std::string, NeighborEntry>::iterator it;
   	for ( it=route_state.neighborTable.begin() ; it != route_state.neighborTable.end(); it++ ) {
-		lsa.append( it->second.AD );
-		lsa.append("^");
-		lsa.append( it->second.HID );
-		lsa.append("^");
+		LSANeighbor n;
+		n.AD = it->second.AD;
+		n.HID = it->second.HID;
+		n.cost = it->second.cost;
+		lsa.neighbors.push_back(n);
   	}
-	strcpy (buffer, lsa.c_str());
+
 	// increase the LSA seq
 	route_state.lsa_seq++;
 	route_state.lsa_seq = route_state.lsa_seq % MAX_SEQNUM;
-	buflen = strlen(buffer);
-	rc = Xsendto(route_state.sock, buffer, buflen, 0, (struct sockaddr*)&route_state.ddag, sizeof(sockaddr_x));
-	if(rc != buflen) {
-		syslog(LOG_WARNING, "ERROR sending LSA. Tried sending %d bytes but rc=%d", buflen, rc);
+
+	if (!encodeLSA(lsa, fragments)) {
+		syslog(LOG_WARNING, "ERROR can't encode LSA for %s", route_state.myAD);
 		return -1;
 	}
+
+	for (size_t i = 0; i < fragments.size(); i++) {
+		string &msg = fragments[i];
+
+		rc = Xsendto(route_state.sock, msg.data(), msg.size(), 0, (struct sockaddr*)&route_state.ddag, sizeof(sockaddr_x));
+		if(rc != (int)msg.size()) {
+			syslog(LOG_WARNING, "ERROR sending LSA. Tried sending %zu bytes but rc=%d", msg.size(), rc);
+			return -1;
+		}
+	}
 	return 0;
 }
 
@@ -189,37 +244,13 @@ void processHostRegister(const char* host_register_msg) {
 }
 
 // process an incoming Hello message
-int processHello(const char* hello_msg) {
+int processHello(const HelloMsg &hello) {
 	/* Procedure:
 		1. fill in the neighbor table
 		2. update my entry in the networkTable
 	*/
 	// 1. fill in the neighbor table
-	size_t found, start;
-	string msg, neighborAD, neighborHID, myAD;
-
-	start = 0;
-	msg = hello_msg;
-
- 	// read message-type
-	found=msg.find("^", start);
-  	if (found!=string::npos) {
-  		start = found+1;   // message-type was previously read
-  	}
-
-	// read neighborAD
-	found=msg.find("^", start);
-  	if (found!=string::npos) {
-  		neighborAD = msg.substr(start, found-start);
-  		start = found+1;  // forward the search point
-  	}
-
- 	// read neighborHID
-	found=msg.find("^", start);
-  	if (found!=string::npos) {
-  		neighborHID = msg.substr(start, found-start);
-  		start = found+1;  // forward the search point
-  	}
+	string neighborAD = hello.AD, neighborHID = hello.HID, myAD;
 
 	// fill in the table
 	map<std::string, NeighborEntry>::iterator it;
@@ -238,6 +269,7 @@ int processHello(const char* hello_msg) {
 
 		// increase the neighbor count
 		route_state.num_neighbors++;
+		scheduleSPF();
 	}
 
 	// 2. update my entry in the networkTable
@@ -254,6 +286,7 @@ int processHello(const char* hello_msg) {
 
 	NodeStateEntry entry;
 	entry.dest = myAD;
+	entry.id = internXID(myAD);
 	entry.seq = route_state.lsa_seq;
 	entry.num_neighbors = route_state.num_neighbors;
 
@@ -262,77 +295,36 @@ int processHello(const char* hello_msg) {
 
  		// fill my neighbors into my entry in the networkTable
  		entry.neighbor_list.push_back(it3->second.AD);
+ 		entry.neighbor_ids.push_back(internXID(it3->second.AD));
+ 		entry.neighbor_cost.push_back(it3->second.cost);
   	}
 
 	route_state.networkTable[myAD] = entry;
+	markChanged(entry.id);
 
 	return 1;
 }
 
-// process a LinkStateAdvertisement message
-int processLSA(const char* lsa_msg) {
+// true if LSA sequence number a comes after b, allowing for wrap around
+static bool newerSeq(uint32_t a, uint32_t b)
+{
+	return !(a <= b && b - a < 10000);
+}
+
+// process a LinkStateAdvertisement message, or one fragment of it
+int processLSA(const LSAMsg &lsa, const char *lsa_msg, int len) {
 
-	char buffer[1024];
-	bzero(buffer, 1024);
 	/* Procedure:
 		0. scan this LSA (mark AD with a DualRouter if there)
 		1. filter out the already seen LSA (via LSA-seq for this dest)
-		2. update the network table
-		3. rebroadcast this LSA
+		2. collect its neighbors until every fragment is in
+		3. update the network table
+		4. rebroadcast this LSA
 	*/
-	// 0. Read this LSA
-	size_t found, start;
-	string msg, routerType, destAD, destHID, lsa_seq, num_neighbors, neighborAD, neighborHID;
-
-	start = 0;
-	msg = lsa_msg;
-
- 	// read message-type
-	found=msg.find("^", start);
-  	if (found!=string::npos) {
-  		start = found+1;   // message-type was previously read
-  	}
-
-	// read routerType
-	found=msg.find("^", start);
-  	if (found!=string::npos) {
-  		routerType = msg.substr(start, found-start);
-  		start = found+1;  // forward the search point
-  	}
-  	int is_dual_router = atoi(routerType.c_str());
-
-	// read destAD
-	found=msg.find("^", start);
-  	if (found!=string::npos) {
-  		destAD = msg.substr(start, found-start);
-  		start = found+1;  // forward the search point
-  	}
-
- 	// read destHID
-	found=msg.find("^", start);
-  	if (found!=string::npos) {
-  		destHID = msg.substr(start, found-start);
-  		start = found+1;  // forward the search point
-  	}
-
-	// read LSA-seq-num
-	found=msg.find("^", start);
-  	if (found!=string::npos) {
-  		lsa_seq = msg.substr(start, found-start);
-  		start = found+1;  // forward the search point
-  	}
-  	int lsaSeq = atoi(lsa_seq.c_str());
-
- 	// read num_neighbors
-	found=msg.find("^", start);
-  	if (found!=string::npos) {
-  		num_neighbors = msg.substr(start, found-start);
-  		start = found+1;  // forward the search point
-  	}
-  	int numNeighbors = atoi(num_neighbors.c_str());
+	string destAD = lsa.AD;
 
   	// See if this LSA comes from AD with dualRouter
-  	if (is_dual_router == 1) {
+  	if (lsa.dual_router) {
   		route_state.dual_router_AD = destAD;
   	}
 
@@ -342,160 +334,471 @@ int processLSA(const char* lsa_msg) {
   		return 1;
   	}
 
-  	// 1. Filter out the already seen LSA
-	map<std::string, NodeStateEntry>::iterator it;
-	it=route_state.networkTable.find(destAD);
+  	// 1. Filter out the already seen LSA, or fragment of it
+	map<std::string, LSAFragments>::iterator it = route_state.lsaFragments.find(destAD);
 
-	if(it != route_state.networkTable.end()) {
-  		// If this originating AD has been known (i.e., already in the networkTable)
+	if (it != route_state.lsaFragments.end() && it->second.seq == lsa.seq) {
+		LSAFragments &f = it->second;
+		if (lsa.fragments != f.got.size() || f.got[lsa.fragment]) {
+			// If this fragment already seen, ignore it; do nothing
+			return 1;
+		}
+	} else if (it != route_state.lsaFragments.end() && !newerSeq(lsa.seq, it->second.seq)) {
+		return 1;
+	} else {
+		// the first fragment of a newer LSA, drop what was kept of the last one
+		LSAFragments &f = route_state.lsaFragments[destAD];
+		f.seq = lsa.seq;
+		f.got.assign(lsa.fragments, false);
+		f.missing = lsa.fragments;
+		f.neighbors.clear();
+		it = route_state.lsaFragments.find(destAD);
+	}
 
-  	  	if (lsaSeq <= it->second.seq  &&  it->second.seq - lsaSeq < 10000) {
-  	  		// If this LSA already seen, ignore this LSA; do nothing
-  			return 1;
-  		}
-  		// For now, delete this dest AD entry in networkTable (... we will re-insert the updated entry shortly)
-  		route_state.networkTable.erase (it);
-  	}
+	// 2. collect the neighbors
+	LSAFragments &f = it->second;
+	f.got[lsa.fragment] = true;
+	f.missing--;
+	f.neighbors.insert(f.neighbors.end(), lsa.neighbors.begin(), lsa.neighbors.end());
+
+	// 3. Update the network table once the whole LSA is in
+	if (f.missing == 0) {
+		NodeStateEntry entry;
+		entry.dest = destAD;
+		entry.id = internXID(destAD);
+		entry.seq = lsa.seq;
+		entry.num_neighbors = f.neighbors.size();
+
+		for (size_t i = 0; i < f.neighbors.size(); i++) {
+			entry.neighbor_list.push_back(f.neighbors[i].AD);
+			entry.neighbor_ids.push_back(internXID(f.neighbors[i].AD));
+			entry.neighbor_cost.push_back(f.neighbors[i].cost);
+		}
+		f.neighbors.clear();
 
-	// 2. Update the network table
-	NodeStateEntry entry;
-	entry.dest = destAD;
-	entry.seq = lsaSeq;
-	entry.num_neighbors = numNeighbors;
+		route_state.networkTable[destAD] = entry;
+		markChanged(entry.id);
+		scheduleSPF();
+	}
+
+	// 4. rebroadcast this LSA, unless it has been around too long
+	if (lsa.age < MAX_LSA_AGE) {
+		char buffer[XROUTE_MAX_MSG];
+
+		memcpy(buffer, lsa_msg, len);
+		ageLSA(buffer, len);
+		Xsendto(route_state.sock, buffer, len, 0, (struct sockaddr*)&route_state.ddag, sizeof(sockaddr_x));
+	}
+
+	return 1;
+}
 
-  	int i;
- 	for (i = 0; i < numNeighbors; i++) {
 
- 		// read neighborAD
-		found=msg.find("^", start);
-  		if (found!=string::npos) {
-  			neighborAD = msg.substr(start, found-start);
-  			start = found+1;  // forward the search point
-  		}
+int32_t internXID(const std::string &xid)
+{
+	map<std::string, int32_t>::iterator it = route_state.xidIds.find(xid);
 
- 		// read neighborHID
-		found=msg.find("^", start);
-  		if (found!=string::npos) {
-  			neighborHID = msg.substr(start, found-start);
-  			start = found+1;  // forward the search point
-  		}
+	if (it != route_state.xidIds.end())
+		return it->second;
 
- 		// fill the neighbors into the corresponding networkTable entry
- 		entry.neighbor_list.push_back(neighborAD);
+	int32_t id = route_state.xidNames.size();
+	route_state.xidIds[xid] = id;
+	route_state.xidNames.push_back(xid);
+	return id;
+}
 
- 	}
+// msec on a clock that doesn't jump
+static int64_t now_msec()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
 
-	route_state.networkTable[destAD] = entry;
-	//printf("LSA received: src=%s, seq=%d, num_neighbors=%d \n", (route_state.networkTable[destAD].dest).c_str(), route_state.networkTable[destAD].seq, route_state.networkTable[destAD].num_neighbors );
-	route_state.calc_dijstra_ticks++;
+// creates a timerfd, firing every interval msec if interval isn't 0
+static int makeTimer(int interval)
+{
+	int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
 
-	if (route_state.calc_dijstra_ticks == CALC_DIJKSTRA_INTERVAL) {
-		// Calculate Shortest Path algorithm
-		syslog(LOG_INFO, "Calcuating shortest paths\n");
-		calcShortestPath();
-		route_state.calc_dijstra_ticks = 0;
+	if (fd < 0) {
+		syslog(LOG_ALERT, "unable to create a timer: %s", strerror(errno));
+		exit(-1);
+	}
 
-		// update Routing table (click routing table as well)
-		updateClickRoutingTable();
+	if (interval) {
+		struct itimerspec its;
+		its.it_value.tv_sec = its.it_interval.tv_sec = interval / 1000;
+		its.it_value.tv_nsec = its.it_interval.tv_nsec = (interval % 1000) * 1000000;
+		timerfd_settime(fd, 0, &its, NULL);
 	}
+	return fd;
+}
 
-	// 5. rebroadcast this LSA
-	strcpy (buffer, lsa_msg);
-	Xsendto(route_state.sock, buffer, strlen(buffer), 0, (struct sockaddr*)&route_state.ddag, sizeof(sockaddr_x));
+// true if the timer fired, clearing it
+static bool timerFired(int fd)
+{
+	uint64_t expirations;
 
-	return 1;
+	return read(fd, &expirations, sizeof(expirations)) == sizeof(expirations);
 }
 
+/*
+** A flood of LSAs arrives over a short time, so rather than computing routes
+** for each one the computation waits SPF_DELAY for the rest, and is kept at
+** least spf_hold from the previous one. Each computation that follows the
+** last one within twice the hold time doubles it, up to SPF_MAX_HOLD, so a
+** network that keeps changing is recomputed less and less often; once
+** things settle it drops back to SPF_MIN_HOLD.
+*/
+void scheduleSPF()
+{
+	struct itimerspec its;
+
+	if (timerfd_gettime(route_state.spf_timer, &its) == 0
+			&& (its.it_value.tv_sec || its.it_value.tv_nsec))
+		return;		// already pending
+
+	int64_t wait = SPF_DELAY;
+	int64_t since = now_msec() - route_state.spf_last;
+	if (since < route_state.spf_hold && route_state.spf_hold - since > wait)
+		wait = route_state.spf_hold - since;
+
+	memset(&its, 0, sizeof(its));
+	its.it_value.tv_sec = wait / 1000;
+	its.it_value.tv_nsec = (wait % 1000) * 1000000;
+	timerfd_settime(route_state.spf_timer, 0, &its, NULL);
+}
+
+static void runSPF()
+{
+	int64_t now = now_msec();
+
+	syslog(LOG_INFO, "Calcuating shortest paths\n");
+	calcShortestPath();
+
+	// update Routing table (click routing table as well)
+	updateClickRoutingTable();
+
+	if (now - route_state.spf_last < 2 * route_state.spf_hold)
+		route_state.spf_hold = MIN(2 * route_state.spf_hold, SPF_MAX_HOLD);
+	else
+		route_state.spf_hold = SPF_MIN_HOLD;
+	route_state.spf_last = now;
+}
+
+void markChanged(int32_t id)
+{
+	route_state.spf.dirty.insert(id);
+}
+
+static const int64_t INF_COST = 0x7fffffffffffffffLL;
+
+typedef pair<int64_t, int32_t> HeapEntry;
+typedef priority_queue<HeapEntry, vector<HeapEntry>, greater<HeapEntry> > Heap;
+
+// take u's path to v if it is shorter than the one v has
+static bool relax(int32_t u, const LinkEntry &l, int32_t me, Heap &heap)
+{
+	SpfState &spf = route_state.spf;
+	int32_t v = l.node;
+	int64_t d = spf.dist[u] + l.cost;
+
+	if (spf.dist[u] == INF_COST || d >= spf.dist[v])
+		return false;
+
+	spf.dist[v] = d;
+	spf.parent[v] = u;
+	spf.firstHop[v] = (u == me) ? v : spf.firstHop[u];
+	spf.hops[v] = spf.hops[u] + 1;
+	heap.push(HeapEntry(d, v));
+	return true;
+}
+
+// Dijkstra with a binary heap. stale heap entries are skipped when popped
+// rather than updated in place
+static void runHeap(Heap &heap, int32_t me, vector<int32_t> &touched)
+{
+	SpfState &spf = route_state.spf;
+
+	while (!heap.empty()) {
+		HeapEntry top = heap.top();
+		heap.pop();
+
+		int32_t u = top.second;
+		if (top.first > spf.dist[u])
+			continue;
+
+		vector<LinkEntry> &out = spf.out[u];
+		for (size_t k = 0; k < out.size(); k++)
+			if (relax(u, out[k], me, heap))
+				touched.push_back(out[k].node);
+	}
+}
+
+// replaces the links node x advertises with the ones in its networkTable
+// entry. paths in the tree that went over a link now gone or dearer start
+// over from the node the link led to, links now cheaper are handed back to
+// be tried. returns true if the links changed at all
+static bool updateLinks(int32_t x, vector<int32_t> &invalid, vector< pair<int32_t, LinkEntry> > &cheaper)
+{
+	SpfState &spf = route_state.spf;
+	vector<LinkEntry> links;
+	map<std::string, NodeStateEntry>::iterator it;
+
+	it = route_state.networkTable.find(route_state.xidNames[x]);
+	spf.known[x] = (it != route_state.networkTable.end());
+	if (spf.known[x]) {
+		NodeStateEntry &e = it->second;
+		for (size_t i = 0; i < e.neighbor_ids.size(); i++) {
+			LinkEntry l;
+			l.node = e.neighbor_ids[i];
+			l.cost = i < e.neighbor_cost.size() ? e.neighbor_cost[i] : 1;
+			links.push_back(l);
+		}
+	}
+
+	vector<LinkEntry> &old = spf.out[x];
+	bool changed = false;
+	for (size_t i = 0; i < old.size(); i++) {
+		int32_t v = old[i].node;
+		bool kept = false;
+
+		for (size_t j = 0; j < links.size(); j++)
+			if (links[j].node == v && links[j].cost <= old[i].cost)
+				kept = true;
+		if (!kept && spf.parent[v] == x)
+			invalid.push_back(v);
+		changed = changed || !kept;
+
+		vector<LinkEntry> &in = spf.in[v];
+		for (size_t j = 0; j < in.size(); j++)
+			if (in[j].node == x) {
+				in[j] = in.back();
+				in.pop_back();
+				break;
+			}
+	}
+
+	for (size_t i = 0; i < links.size(); i++) {
+		int32_t v = links[i].node;
+		bool better = true;
+
+		for (size_t j = 0; j < old.size(); j++)
+			if (old[j].node == v && old[j].cost <= links[i].cost)
+				better = false;
+		if (better)
+			cheaper.push_back(make_pair(x, links[i]));
+		changed = changed || better;
+
+		LinkEntry l;
+		l.node = x;
+		l.cost = links[i].cost;
+		spf.in[v].push_back(l);
+	}
+
+	old.swap(links);
+	return changed;
+}
 
+// the route click should have for node v, false if there shouldn't be one
+static bool desiredRoute(int32_t v, int32_t me, RouteEntry &r)
+{
+	SpfState &spf = route_state.spf;
+
+	if (v == me || !spf.known[v] || spf.firstHop[v] < 0 || spf.hops[v] > MAX_HOP_COUNT)
+		return false;
+
+	map<std::string, NeighborEntry>::iterator nit;
+	nit = route_state.neighborTable.find(route_state.xidNames[spf.firstHop[v]]);
+	if (nit == route_state.neighborTable.end())
+		return false;
+
+	r.dest = route_state.xidNames[v];
+	r.nextHop = nit->second.HID;
+	r.port = nit->second.port;
+	r.flags = 0;
+	return true;
+}
+
+/*
+** Keeps the shortest path tree from the last run and only redoes the part of
+** it that the LSAs received since could have changed. Nodes reached over a
+** link that went away or got dearer are cut loose along with everything
+** below them in the tree and picked up again from their neighbors still in
+** the tree; links that got cheaper are relaxed. Either way the heap only sees
+** nodes whose path actually changes. The first run, or one where most of the
+** tree is cut loose, is done from scratch.
+**
+** Routes are compared against ADrouteTable, which holds what click has been
+** given, and the ones that differ are queued in ADrouteChanges for
+** updateClickRoutingTable().
+*/
 void calcShortestPath() {
 
-	// first, clear the current routing table
-	route_state.ADrouteTable.clear();
+	SpfState &spf = route_state.spf;
 
  	map<std::string, NodeStateEntry>::iterator it1;
-  	for ( it1=route_state.networkTable.begin() ; it1 != route_state.networkTable.end(); it1++ ) {
-
+	it1 = route_state.networkTable.begin();
+	while (it1 != route_state.networkTable.end()) {
  		// filter out an abnormal case
  		if(it1->second.num_neighbors == 0 || (it1->second.dest).empty() ) {
- 			route_state.networkTable.erase (it1);
+			markChanged(it1->second.id);
+ 			route_state.networkTable.erase (it1++);
+ 		} else {
+ 			it1++;
  		}
   	}
 
- 	map<std::string, NodeStateEntry> table;
-	table = route_state.networkTable;
-
-  	for ( it1=route_state.networkTable.begin() ; it1 != route_state.networkTable.end(); it1++ ) {
- 		// initialize the checking variable
- 		it1->second.checked = false;
- 		it1->second.cost = 10000000;
-  	}
+	string myAD = route_state.myAD;
+	int32_t me = internXID(myAD);
+	int32_t n = route_state.xidNames.size();
+	int32_t old_n = spf.dist.size();
+
+	spf.out.resize(n);
+	spf.in.resize(n);
+	spf.known.resize(n, false);
+	spf.dist.resize(n, INF_COST);
+	spf.parent.resize(n, -1);
+	spf.firstHop.resize(n, -1);
+	spf.hops.resize(n, 0);
+
+	// ids new since the last run have no links yet, pick up any that are
+	// already in the network table
+	if (old_n < n && spf.ready) {
+		for (int32_t v = old_n; v < n; v++)
+			if (route_state.networkTable.count(route_state.xidNames[v]))
+				markChanged(v);
+	}
+	if (!spf.ready) {
+		for (int32_t v = 0; v < n; v++)
+			markChanged(v);
+	}
 
-	// compute shortest path
-	// initialization
-	string myAD, tempAD;
-	myAD = route_state.myAD;
-	route_state.networkTable[myAD].checked = true;
-	route_state.networkTable[myAD].cost = 0;
-	table.erase(myAD);
-
-	vector<std::string>::iterator it2;
-	for ( it2=route_state.networkTable[myAD].neighbor_list.begin() ; it2 < route_state.networkTable[myAD].neighbor_list.end(); it2++ ) {
-
-		tempAD = (*it2).c_str();
-		route_state.networkTable[tempAD].cost = 1;
-		route_state.networkTable[tempAD].prevNode = myAD;
-	}
-
-	// loop
-	while (!table.empty()) {
-		int minCost = 10000000;
-		string selectedAD, tmpAD;
-		for ( it1=table.begin() ; it1 != table.end(); it1++ ) {
-			tmpAD = it1->second.dest;
-			if (route_state.networkTable[tmpAD].cost < minCost) {
-				minCost = route_state.networkTable[tmpAD].cost;
-				selectedAD = tmpAD;
-			}
-  		}
-		if(selectedAD.empty()) {
-			return;
+	vector<int32_t> invalid;
+	vector< pair<int32_t, LinkEntry> > cheaper;
+	bool mine = false;
+	set<int32_t>::iterator dit;
+	for (dit = spf.dirty.begin(); dit != spf.dirty.end(); ++dit)
+		if (updateLinks(*dit, invalid, cheaper) && *dit == me)
+			mine = true;
+
+	vector<int32_t> touched;
+	Heap heap;
+	bool full = !spf.ready;
+
+	if (!full && !invalid.empty()) {
+		// children of each node in the tree, laid out as a compressed array
+		vector<int32_t> first(n + 1, 0);
+		vector<int32_t> child(n);
+		for (int32_t v = 0; v < n; v++)
+			if (spf.parent[v] >= 0)
+				first[spf.parent[v] + 1]++;
+		for (int32_t u = 0; u < n; u++)
+			first[u + 1] += first[u];
+		vector<int32_t> fill(first.begin(), first.end() - 1);
+		for (int32_t v = 0; v < n; v++)
+			if (spf.parent[v] >= 0)
+				child[fill[spf.parent[v]]++] = v;
+
+		// cut the subtrees loose
+		vector<bool> cut(n, false);
+		for (size_t i = 0; i < invalid.size(); i++)
+			cut[invalid[i]] = true;
+		for (size_t i = 0; i < invalid.size(); i++) {
+			int32_t u = invalid[i];
+			for (int32_t k = first[u]; k < first[u + 1]; k++)
+				if (!cut[child[k]]) {
+					cut[child[k]] = true;
+					invalid.push_back(child[k]);
+				}
 		}
 
-  		table.erase(selectedAD);
-  		route_state.networkTable[selectedAD].checked = true;
+		if (invalid.size() > (size_t)n / 2)
+			full = true;
+		else {
+			for (size_t i = 0; i < invalid.size(); i++) {
+				int32_t v = invalid[i];
+				spf.dist[v] = INF_COST;
+				spf.parent[v] = -1;
+				spf.firstHop[v] = -1;
+				spf.hops[v] = 0;
+				touched.push_back(v);
+			}
 
- 		for ( it2=route_state.networkTable[selectedAD].neighbor_list.begin() ; it2 < route_state.networkTable[selectedAD].neighbor_list.end(); it2++ ) {
-			tempAD = (*it2).c_str();
-			if (route_state.networkTable[tempAD].checked != true) {
-				if (route_state.networkTable[tempAD].cost > route_state.networkTable[selectedAD].cost + 1) {
-					route_state.networkTable[tempAD].cost = route_state.networkTable[selectedAD].cost + 1;
-					route_state.networkTable[tempAD].prevNode = selectedAD;
+			// start them over from the neighbors still in the tree
+			for (size_t i = 0; i < invalid.size(); i++) {
+				int32_t v = invalid[i];
+				vector<LinkEntry> &in = spf.in[v];
+				for (size_t k = 0; k < in.size(); k++) {
+					if (cut[in[k].node])
+						continue;
+					LinkEntry l;
+					l.node = v;
+					l.cost = in[k].cost;
+					relax(in[k].node, l, me, heap);
 				}
 			}
 		}
 	}
 
-	string tempAD1, tempAD2;
-	int hop_count;
-	// set up the nexthop
-  	for ( it1=route_state.networkTable.begin() ; it1 != route_state.networkTable.end(); it1++ ) {
-
-  		tempAD1 = it1->second.dest;
-  		if ( myAD.compare(tempAD1) != 0 ) {
-  			tempAD2 = tempAD1;
-  			hop_count = 0;
-  			while (route_state.networkTable[tempAD2].prevNode.compare(myAD)!=0 && hop_count < MAX_HOP_COUNT) {
-  				tempAD2 = route_state.networkTable[tempAD2].prevNode;
-  				hop_count++;
-  			}
-  			if(hop_count < MAX_HOP_COUNT) {
-  				route_state.ADrouteTable[tempAD1].dest = tempAD1;
-  				route_state.ADrouteTable[tempAD1].nextHop = route_state.neighborTable[tempAD2].HID;
-  				route_state.ADrouteTable[tempAD1].port = route_state.neighborTable[tempAD2].port;
-  			}
-  		}
-  	}
-	printRoutingTable();
+	if (full) {
+		for (int32_t v = 0; v < n; v++) {
+			spf.dist[v] = INF_COST;
+			spf.parent[v] = -1;
+			spf.firstHop[v] = -1;
+			spf.hops[v] = 0;
+		}
+		spf.dist[me] = 0;
+		heap = Heap();
+		heap.push(HeapEntry(0, me));
+		touched.clear();
+	} else {
+		for (size_t i = 0; i < cheaper.size(); i++)
+			if (relax(cheaper[i].first, cheaper[i].second, me, heap))
+				touched.push_back(cheaper[i].second.node);
+	}
+	runHeap(heap, me, touched);
+
+	// set up the nexthop for the nodes whose path or status changed, or for
+	// all of them when the neighbors did
+	if (full || mine || spf.num_neighbors != route_state.neighborTable.size()) {
+		touched.clear();
+		for (int32_t v = 0; v < n; v++)
+			touched.push_back(v);
+	} else
+		touched.insert(touched.end(), spf.dirty.begin(), spf.dirty.end());
+
+	vector<bool> seen(n, false);
+	for (size_t i = 0; i < touched.size(); i++) {
+		int32_t v = touched[i];
+		if (seen[v])
+			continue;
+		seen[v] = true;
+
+		RouteEntry r;
+		const string &destAD = route_state.xidNames[v];
+		map<std::string, RouteEntry>::iterator rit = route_state.ADrouteTable.find(destAD);
+
+		if (desiredRoute(v, me, r)) {
+			if (rit != route_state.ADrouteTable.end()
+					&& rit->second.nextHop == r.nextHop && rit->second.port == r.port)
+				continue;
+			route_state.ADrouteTable[destAD] = r;
+		} else {
+			if (rit == route_state.ADrouteTable.end())
+				continue;
+			route_state.ADrouteTable.erase(rit);
+		}
+		route_state.ADrouteChanges.push_back(destAD);
+	}
+
+	spf.dirty.clear();
+	spf.num_neighbors = route_state.neighborTable.size();
+	spf.ready = true;
+
+	if (full)
+		printRoutingTable();
 }
 
 
@@ -512,27 +815,74 @@ void printRoutingTable() {
 
 void updateClickRoutingTable() {
 
-	int rc, port;
-	string destXID, nexthopXID;
+	int rc;
 	string default_AD("AD:-"), default_HID("HID:-"), default_4ID("IP:-");
+	vector<XIARouteUpdate> batch;
+
+	// only the routes that changed since the last update, all in one batch
+	for (size_t i = 0; i < route_state.ADrouteChanges.size(); i++) {
+		const string &destXID = route_state.ADrouteChanges[i];
+		map<std::string, RouteEntry>::iterator it1 = route_state.ADrouteTable.find(destXID);
+		XIARouteUpdate u;
+
+		u.xid = destXID;
+		if (it1 != route_state.ADrouteTable.end()) {
+			syslog(LOG_INFO, "route to %s via %s, port %d", destXID.c_str(), it1->second.nextHop.c_str(), it1->second.port);
+			u.op = XR_ROUTE_SET;
+			u.nextHop = it1->second.nextHop;
+			u.port = it1->second.port;
+			u.flags = 0xffff;
+		} else {
+			syslog(LOG_INFO, "route to %s removed", destXID.c_str());
+			u.op = XR_ROUTE_REMOVE;
+			u.port = 0;
+			u.flags = 0;
+		}
+		batch.push_back(u);
+	}
+	route_state.ADrouteChanges.clear();
+
+	// set default AD for 4ID traffic
+	RouteEntry default4ID = route_state.default4ID;
+	if (route_state.dual_router == 0) {
+		map<std::string, RouteEntry>::iterator it1 = route_state.ADrouteTable.find(route_state.dual_router_AD);
+
+		if (it1 != route_state.ADrouteTable.end()
+				&& (default4ID.port != it1->second.port || default4ID.nextHop != it1->second.nextHop)) {
+			XIARouteUpdate u;
+			u.op = XR_ROUTE_SET;
+			u.xid = default_4ID;
+			u.nextHop = it1->second.nextHop;
+			u.port = it1->second.port;
+			u.flags = 0xffff;
+			batch.push_back(u);
+
+			default4ID = it1->second;
+			default4ID.dest = default_4ID;
+		}
+	}
 
-  	map<std::string, RouteEntry>::iterator it1;
-  	for ( it1=route_state.ADrouteTable.begin() ; it1 != route_state.ADrouteTable.end(); it1++ ) {
- 		destXID = it1->second.dest;
- 		nexthopXID = it1->second.nextHop;
-		port =  it1->second.port;
-
-		if ((rc = xr.setRoute(destXID, port, nexthopXID, 0xffff)) != 0)
-			syslog(LOG_ERR, "error setting route %d", rc);
-
-		// set default AD for 4ID traffic
-		if (route_state.dual_router==0 && destXID.compare(route_state.dual_router_AD)==0) {
-			if ((rc = xr.setRoute(default_4ID, port, nexthopXID, 0xffff)) != 0)
-				syslog(LOG_ERR, "error setting route %d", rc);
+	if (batch.empty())
+		return;
+
+	if ((rc = xr.applyBatch(batch)) != 0) {
+		// go route by route so one the router won't take doesn't hold up
+		// the rest
+		syslog(LOG_ERR, "error applying %zu route changes %d, retrying one at a time", batch.size(), rc);
+		for (size_t i = 0; i < batch.size(); i++) {
+			XIARouteUpdate &u = batch[i];
+
+			if (u.op == XR_ROUTE_REMOVE)
+				rc = xr.delRoute(u.xid);
+			else
+				rc = xr.setRoute(u.xid, u.port, u.nextHop, u.flags);
+			if (rc != 0)
+				syslog(LOG_ERR, "error updating route to %s %d", u.xid.c_str(), rc);
+			else if (u.xid == default_4ID)
+				route_state.default4ID = default4ID;
 		}
-  	}
-  	listRoutes("AD");
-	listRoutes("HID");
+	} else
+		route_state.default4ID = default4ID;
 }
 
 
@@ -551,6 +901,10 @@ void initRouteState()
 		exit(-1);
 	}
 
+	// XIDs from other routers are read back in lowercase, match them
+	strcpy(route_state.myAD, normalizeXID(route_state.myAD).c_str());
+	strcpy(route_state.myHID, normalizeXID(route_state.myHID).c_str());
+
 	// make the src DAG (the one the routing process listens on)
 	struct addrinfo *ai;
 	if (Xgetaddrinfo(NULL, SID_XROUTE, NULL, &ai) != 0) {
@@ -562,7 +916,12 @@ void initRouteState()
 	route_state.num_neighbors = 0; // number of neighbor routers
 	route_state.lsa_seq = 0;	// LSA sequence number of this router
 	route_state.hello_seq = 0;  // hello seq number of this router
-	route_state.calc_dijstra_ticks = 0;
+	route_state.spf.ready = false;
+	route_state.spf_timer = makeTimer(0);
+	route_state.spf_last = 0;
+	route_state.spf_hold = SPF_MIN_HOLD;
+	route_state.spf.num_neighbors = 0;
+	route_state.default4ID.port = -1;
 
 	route_state.dual_router_AD = "NULL";
 	// mark if this is a dual XIA-IPv4 router
@@ -627,13 +986,10 @@ void config(int argc, char** argv)
 
 int main(int argc, char *argv[])
 {
-	int rc, selectRetVal, n;
-    size_t found, start;
+	int rc, n;
     socklen_t dlen;
-    char recv_message[1024];
+    char recv_message[XROUTE_MAX_MSG + 1];
     sockaddr_x theirDAG;
-    fd_set socks;
-    struct timeval timeoutval;
 	vector<string> routers;
 
 	config(argc, argv);
@@ -646,7 +1002,12 @@ int main(int argc, char *argv[])
 	}
 
 	xr.setRouter(hostname);
+
+	// hear about changes to the tables from here on, then read them once
+	if (xr.subscribe(XR_EVENTS_ROUTES | XR_EVENTS_NEIGHBORS) < 0)
+		syslog(LOG_WARNING, "unable to subscribe to route events: %s", strerror(errno));
 	listRoutes("AD");
+	loadHIDPorts();
 
    	// open socket for route process
    	route_state.sock=Xsocket(AF_XIA, SOCK_DGRAM, 0);
@@ -667,76 +1028,98 @@ int main(int argc, char *argv[])
    	}
 
 
-	time_t last_purge = time(NULL);
-	int iteration = 0;
+	// reads come back empty instead of waiting once the socket is drained
+	Xfcntl(route_state.sock, F_SETFL, O_NONBLOCK);
+
+	enum { SOCK, EVENTS, HELLO_TIMER, LSA_TIMER, SPF_TIMER, PURGE_TIMER, NUM_FDS };
+	struct pollfd fds[NUM_FDS];
+	memset(fds, 0, sizeof(fds));
+	fds[SOCK].fd = route_state.sock;
+	fds[EVENTS].fd = xr.eventSocket();
+	fds[HELLO_TIMER].fd = makeTimer(HELLO_INTERVAL);
+	fds[LSA_TIMER].fd = makeTimer(LSA_INTERVAL);
+	fds[SPF_TIMER].fd = route_state.spf_timer;
+	fds[PURGE_TIMER].fd = makeTimer(PURGE_INTERVAL);
+	for (int i = 0; i < NUM_FDS; i++)
+		fds[i].events = POLLIN;
+
 	while (1) {
-		iteration++;
-		FD_ZERO(&socks);
-		FD_SET(route_state.sock, &socks);
-		timeoutval.tv_sec = 0;
-		timeoutval.tv_usec = MAIN_LOOP_USEC *2; // Main loop runs every 1000 usec
-
-		// every 0.001 sec, check if any received packets
-		selectRetVal = Xselect(route_state.sock+1, &socks, NULL, NULL, &timeoutval);
-		if (selectRetVal > 0) {
-			// receiving a Hello or LSA packet
-			memset(&recv_message[0], 0, sizeof(recv_message));
-			dlen = sizeof(sockaddr_x);
-			n = Xrecvfrom(route_state.sock, recv_message, 1024, 0, (struct sockaddr*)&theirDAG, &dlen);
-			if (n < 0) {
-					perror("recvfrom");
+		// sleep until a message comes in or a timer goes off
+		if ((rc = Xpoll(fds, NUM_FDS, -1)) < 0) {
+			if (errno != EINTR) {
+				perror("Xpoll failed");
+				syslog(LOG_WARNING, "ERROR: Xpoll returned %d", rc);
 			}
+			continue;
+		}
+
+		// first, so hellos from a neighbor just heard from find its port
+		if (fds[EVENTS].revents)
+			processRouteEvents();
+
+		if (fds[SOCK].revents) {
+			// receiving Hello or LSA packets, as many as are waiting
+			for (int i = 0; i < RECV_BATCH; i++) {
+				dlen = sizeof(sockaddr_x);
+				n = Xrecvfrom(route_state.sock, recv_message, sizeof(recv_message) - 1, 0, (struct sockaddr*)&theirDAG, &dlen);
+				if (n < 0) {
+					if (errno != EWOULDBLOCK && errno != EAGAIN)
+						perror("recvfrom");
+					break;
+				}
+				recv_message[n] = 0;
 
-			string msg = recv_message;
-			start = 0;
-			found=msg.find("^");
-			if (found!=string::npos) {
-				string msg_type = msg.substr(start, found-start);
-				int type = atoi(msg_type.c_str());
-				switch (type) {
+				HelloMsg hello;
+				LSAMsg lsa;
+				switch (messageType(recv_message, n)) {
 					case HELLO:
 						// process the incoming Hello message
-						processHello(msg.c_str());
+						if (decodeHello(recv_message, n, hello))
+							processHello(hello);
 						break;
 					case LSA:
 						// process the incoming LSA message
-						processLSA(msg.c_str());
+						if (decodeLSA(recv_message, n, lsa))
+							processLSA(lsa, recv_message, n);
 						break;
 					case HOST_REGISTER:
 						// process the incoming host-register message
-						processHostRegister(msg.c_str());
+						processHostRegister(recv_message);
+						break;
+					case -1:
 						break;
 					default:
 						perror("unknown routing message");
 						break;
 				}
 			}
-		} else if (selectRetVal < 0) {
-			perror("Xselect failed");
-			syslog(LOG_WARNING, "ERROR: Xselect returned %d", selectRetVal);
-		}
-		// Send HELLO every 100 ms
-		if((iteration % HELLO_ITERS) == 0) {
-			// Except when we are sending an LSA
-			if((iteration % LSA_ITERS) != 0) {
-				route_state.hello_seq++;
-				if(sendHello()) {
-					syslog(LOG_WARNING, "ERROR: Failed sending hello");
-				}
-			}
 		}
+
 		// Send an LSA every 400 ms
-		if((iteration % LSA_ITERS) == 0) {
+		if (fds[LSA_TIMER].revents && timerFired(fds[LSA_TIMER].fd)) {
 			route_state.hello_seq = 0;
 			if(sendLSA()) {
 				syslog(LOG_WARNING, "ERROR: Failed sending LSA");
 			}
+
+			// the LSA stands in for a hello that is due at the same time
+			if (fds[HELLO_TIMER].revents)
+				timerFired(fds[HELLO_TIMER].fd);
+		}
+
+		// Send HELLO every 100 ms
+		if (fds[HELLO_TIMER].revents && timerFired(fds[HELLO_TIMER].fd)) {
+			route_state.hello_seq++;
+			if(sendHello()) {
+				syslog(LOG_WARNING, "ERROR: Failed sending hello");
+			}
 		}
 
-		time_t now = time(NULL);
-		if (now - last_purge >= 10)
-		{
-			last_purge = now;
+		if (fds[SPF_TIMER].revents && timerFired(fds[SPF_TIMER].fd))
+			runSPF();
+
+		if (fds[PURGE_TIMER].revents && timerFired(fds[PURGE_TIMER].fd)) {
+			time_t now = time(NULL);
 			map<string, time_t>::iterator iter;
 
 			iter = timeStamp.begin();
@@ -6,6 +6,7 @@
 #include <string>
 #include <vector>
 #include "../common/XIARouter.hh"
+#include "xroutemsg.hh"
 
 #include <sys/types.h>
 #include <netdb.h>
@@ -15,23 +16,23 @@
 #include <time.h>
 #include <signal.h>
 #include <map>
+#include <set>
 #include <math.h>
 #include <fcntl.h>
 using namespace std;
 
-// Main loop iterates every 1000 usec = 1 ms = 0.001 sec
-#define MAIN_LOOP_USEC 1000
-#define RECV_ITERS 2
-#define HELLO_ITERS 100
-#define LSA_ITERS 400
-#define CALC_DIJKSTRA_INTERVAL 4
+// timers, in msec
+#define HELLO_INTERVAL 100
+#define LSA_INTERVAL 400
+#define PURGE_INTERVAL 10000
+#define SPF_DELAY 50		// wait for the rest of a flood before computing routes
+#define SPF_MIN_HOLD 200	// least time between route computations
+#define SPF_MAX_HOLD 5000	// the hold time doubles up to this while the network churns
+#define RECV_BATCH 256		// messages read per wakeup before timers get a look in
 #define MAX_HOP_COUNT 50
 #define MAX_SEQNUM 100000
 #define MAX_XID_SIZE 100
-
-#define HELLO 0
-#define LSA 1
-#define HOST_REGISTER 2
+#define MAX_LSA_AGE MAX_HOP_COUNT	// reflooded this many times, an LSA goes no further
 
 
 #define BHID "HID:FFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFF"
@@ -56,17 +57,46 @@ typedef struct {
 
 typedef struct {
 	std::string dest;	// destination AD or HID
+	int32_t id;		// dest interned by internXID()
 	int32_t seq; 		// LSA seq of dest (for filtering purpose)	
 	int32_t num_neighbors;	// number of neighbors of dest AD
 	vector<std::string> neighbor_list; // neighbor AD list
-	
-	bool checked;	// used for calculating the shortest path
-	int32_t cost;	// cost from myAD to destAD
-	std::string prevNode; // previous node along the shortest path from myAD to destAD
+	vector<int32_t> neighbor_ids; // neighbor ADs interned by internXID()
+	vector<int32_t> neighbor_cost; // cost of the link to each neighbor
 	
 } NodeStateEntry; // extracted from incoming LSA
 
 
+// fragments of the latest LSA from an AD
+typedef struct {
+	uint32_t seq;
+	vector<bool> got;	// fragments received
+	int32_t missing;
+	vector<LSANeighbor> neighbors; // from the fragments received so far
+} LSAFragments;
+
+typedef struct {
+	int32_t node;		// the other end of the link
+	int32_t cost;
+} LinkEntry;
+
+// The shortest path tree and the links it was computed from, kept between
+// runs so a changed LSA only recomputes the part of the tree it affects
+typedef struct {
+	bool ready;		// a full computation has been done
+	std::set<int32_t> dirty; // nodes whose LSA came in since the last run
+	size_t num_neighbors;	// size of neighborTable at the last run
+
+	vector< vector<LinkEntry> > out; // links each node advertises
+	vector< vector<LinkEntry> > in;	// the same links, listed at the node they lead to
+	vector<bool> known;	// node is in the networkTable
+
+	vector<int64_t> dist;	// cost from myAD
+	vector<int32_t> parent;	// previous node on the path, -1 if none
+	vector<int32_t> firstHop; // neighbor of mine the path leaves by
+	vector<int32_t> hops;
+} SpfState;
+
 typedef struct RouteState {
 	int32_t sock; // socket for routing process
 	
@@ -85,14 +115,28 @@ typedef struct RouteState {
 	int32_t lsa_seq;	// LSA sequence number of this router
 	int32_t hello_seq;  // hello seq number of this router 
 	int32_t hello_lsa_ratio; // frequency ratio of hello:lsa (for timer purpose) 
-	int32_t calc_dijstra_ticks;   
 
-	map<std::string, RouteEntry> ADrouteTable; // map DestAD to route entry
+	int32_t spf_timer;	// timerfd, armed while a route computation is pending
+	int64_t spf_last;	// msec time of the last route computation
+	int32_t spf_hold;	// msec to keep between computations
+
+	map<std::string, RouteEntry> ADrouteTable; // map DestAD to route entry, as installed in click
+	vector<std::string> ADrouteChanges; // dests whose route changed since it was last installed
+	RouteEntry default4ID;	// default route for 4ID traffic, as installed in click
 	map<std::string, RouteEntry> HIDrouteTable; // map DestHID to route entry
 	
 	map<std::string, NeighborEntry> neighborTable; // map neighborAD to neighbor entry
+	map<std::string, int32_t> hidPorts; // map HID to its port in click's HID table, kept by route events
 	
 	map<std::string, NodeStateEntry> networkTable; // map DestAD to NodeState entry
+	map<std::string, LSAFragments> lsaFragments; // map DestAD to its latest LSA
+
+	// every AD seen so far, numbered densely so the shortest path
+	// computation can work on arrays instead of strings
+	map<std::string, int32_t> xidIds;
+	vector<std::string> xidNames;
+
+	SpfState spf;
 	
 } RouteState;
 
@@ -102,6 +146,12 @@ void listRoutes(std::string xidType);
 // returns an interface number to a neighbor HID
 int interfaceNumber(std::string xidType, std::string xid);
 
+// reloads hidPorts from click
+void loadHIDPorts();
+
+// applies the route table changes click has sent since the last call
+void processRouteEvents();
+
 // initialize the route state
 void initRouteState();
 
@@ -112,18 +162,29 @@ int sendHello();
 int sendLSA();
 
 // process an incoming Hello message
-int processHello(const char* hello_msg);
+int processHello(const HelloMsg &hello);
 
-// process a LinkStateAdvertisement message 
-int processLSA(const char* lsa_msg);
+// process a LinkStateAdvertisement message, lsa_msg is the message as
+// received so it can be reflooded
+int processLSA(const LSAMsg &lsa, const char *lsa_msg, int len);
 
 // process a Host Register message 
 void processHostRegister(const char* host_register_msg);
 
-// compute the shortest path (Dijkstra)
+// returns the dense id of an AD or HID, assigning one the first time it is seen
+int32_t internXID(const std::string &xid);
+
+// notes that the links advertised by an AD may have changed
+void markChanged(int32_t id);
+
+// compute the shortest path (Dijkstra), only for the nodes affected by
+// changes since the last run
 void calcShortestPath();
 
-// update the click routing table
+// arranges for the routes to be computed once the hold down allows
+void scheduleSPF();
+
+// push the routes that changed to the click routing table
 void updateClickRoutingTable();
 
 // print routing table
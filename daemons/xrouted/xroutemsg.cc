@@ -0,0 +1,305 @@
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <arpa/inet.h>
+#include "xroutemsg.hh"
+
+using namespace std;
+
+#define XID_BYTES		20
+#define HEADER_SIZE		4
+#define HELLO_SIZE		(HEADER_SIZE + 2 * XID_BYTES)
+#define LSA_SIZE		(HEADER_SIZE + 12 + 2 * XID_BYTES)
+#define NEIGHBOR_SIZE	(2 * XID_BYTES + 4)
+#define LSA_AGE_OFFSET	(HEADER_SIZE + 4)
+
+// neighbors that fit in one LSA message
+#define FRAGMENT_NEIGHBORS	((XROUTE_MAX_MSG - LSA_SIZE) / NEIGHBOR_SIZE)
+
+static const char hexdigits[] = "0123456789abcdef";
+
+// appends the raw bytes of a "TYPE:hex" XID
+static bool putXID(string &msg, const string &xid)
+{
+	size_t n = xid.find(':');
+	unsigned char raw[XID_BYTES];
+
+	if (n == string::npos || xid.length() - n - 1 != 2 * XID_BYTES)
+		return false;
+
+	const char *hex = xid.c_str() + n + 1;
+	for (int i = 0; i < XID_BYTES; i++) {
+		int hi = hex[2 * i], lo = hex[2 * i + 1];
+
+		if (!isxdigit(hi) || !isxdigit(lo))
+			return false;
+		hi = isdigit(hi) ? hi - '0' : tolower(hi) - 'a' + 10;
+		lo = isdigit(lo) ? lo - '0' : tolower(lo) - 'a' + 10;
+		raw[i] = (hi << 4) | lo;
+	}
+	msg.append((const char *)raw, XID_BYTES);
+	return true;
+}
+
+static void getXID(const char *type, const unsigned char *raw, string &xid)
+{
+	char buf[2 * XID_BYTES];
+
+	for (int i = 0; i < XID_BYTES; i++) {
+		buf[2 * i] = hexdigits[raw[i] >> 4];
+		buf[2 * i + 1] = hexdigits[raw[i] & 0xf];
+	}
+	xid.assign(type);
+	xid.append(buf, sizeof(buf));
+}
+
+static void putHeader(string &msg, int type, int flags)
+{
+	msg.push_back(0);
+	msg.push_back(XROUTE_VERSION);
+	msg.push_back(type);
+	msg.push_back(flags);
+}
+
+static void put16(string &msg, uint16_t v)
+{
+	v = htons(v);
+	msg.append((const char *)&v, sizeof(v));
+}
+
+static void put32(string &msg, uint32_t v)
+{
+	v = htonl(v);
+	msg.append((const char *)&v, sizeof(v));
+}
+
+static uint16_t get16(const unsigned char *p)
+{
+	return (p[0] << 8) | p[1];
+}
+
+static uint32_t get32(const unsigned char *p)
+{
+	return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+string normalizeXID(const string &xid)
+{
+	string s(xid);
+	size_t n = s.find(':');
+
+	if (n != string::npos)
+		for (size_t i = n + 1; i < s.length(); i++)
+			s[i] = tolower(s[i]);
+	return s;
+}
+
+int messageType(const char *msg, int len)
+{
+	if (len <= 0)
+		return -1;
+
+	if (msg[0] == 0) {
+		if (len < HEADER_SIZE || msg[1] != XROUTE_VERSION)
+			return -1;
+		return (unsigned char)msg[2];
+	}
+
+	// text message, the type comes before the first ^
+	const char *end = (const char *)memchr(msg, '^', len);
+	if (!end)
+		return -1;
+	return atoi(string(msg, end - msg).c_str());
+}
+
+// a text message XID, which has to be type followed by 40 hex digits
+static bool textXID(const string &field, const char *type, string &xid)
+{
+	size_t n = strlen(type);
+
+	if (field.compare(0, n, type) != 0 || field.length() != n + 2 * XID_BYTES)
+		return false;
+	for (size_t i = n; i < field.length(); i++)
+		if (!isxdigit(field[i]))
+			return false;
+
+	xid = normalizeXID(field);
+	return true;
+}
+
+// splits a text message into its ^ terminated fields
+static void textFields(const char *msg, int len, vector<string> &fields)
+{
+	const char *end = msg + strnlen(msg, len);
+
+	while (msg < end) {
+		const char *p = (const char *)memchr(msg, '^', end - msg);
+		if (!p)
+			break;
+		fields.push_back(string(msg, p - msg));
+		msg = p + 1;
+	}
+}
+
+bool decodeHello(const char *msg, int len, HelloMsg &hello)
+{
+	const unsigned char *p = (const unsigned char *)msg;
+
+	if (messageType(msg, len) != HELLO)
+		return false;
+
+	if (msg[0] != 0) {
+		vector<string> fields;
+
+		textFields(msg, len, fields);
+		return fields.size() >= 3 && textXID(fields[1], "AD:", hello.AD)
+			&& textXID(fields[2], "HID:", hello.HID);
+	}
+
+	if (len < HELLO_SIZE)
+		return false;
+	getXID("AD:", p + HEADER_SIZE, hello.AD);
+	getXID("HID:", p + HEADER_SIZE + XID_BYTES, hello.HID);
+	return true;
+}
+
+/*
+** Text LSAs carry the whole neighbor list in one message, followed by the
+** link costs if the sender was new enough to send them.
+*/
+static bool decodeTextLSA(const char *msg, int len, LSAMsg &lsa)
+{
+	vector<string> fields;
+
+	textFields(msg, len, fields);
+	if (fields.size() < 6)
+		return false;
+
+	int count = atoi(fields[5].c_str());
+	if (count < 0 || fields.size() < 6 + 2 * (size_t)count)
+		return false;
+
+	if (!textXID(fields[2], "AD:", lsa.AD) || !textXID(fields[3], "HID:", lsa.HID))
+		return false;
+
+	lsa.dual_router = atoi(fields[1].c_str()) == 1;
+	lsa.seq = atoi(fields[4].c_str());
+	lsa.age = 0;
+	lsa.fragment = 0;
+	lsa.fragments = 1;
+	lsa.neighbors.resize(count);
+
+	size_t costs = 6 + 2 * count;
+	for (int i = 0; i < count; i++) {
+		LSANeighbor &n = lsa.neighbors[i];
+		int cost = 1;
+
+		if (!textXID(fields[6 + 2 * i], "AD:", n.AD) || !textXID(fields[7 + 2 * i], "HID:", n.HID))
+			return false;
+		if (costs + i < fields.size())
+			cost = atoi(fields[costs + i].c_str());
+		n.cost = cost > 0 ? cost : 1;
+	}
+	return true;
+}
+
+bool decodeLSA(const char *msg, int len, LSAMsg &lsa)
+{
+	const unsigned char *p = (const unsigned char *)msg;
+
+	if (messageType(msg, len) != LSA)
+		return false;
+
+	if (msg[0] != 0)
+		return decodeTextLSA(msg, len, lsa);
+
+	if (len < LSA_SIZE)
+		return false;
+
+	lsa.dual_router = (p[3] & XROUTE_DUAL_ROUTER) != 0;
+	p += HEADER_SIZE;
+	lsa.seq = get32(p);
+	lsa.age = get16(p + 4);
+	lsa.fragment = get16(p + 6);
+	lsa.fragments = get16(p + 8);
+	int count = get16(p + 10);
+	p += 12;
+
+	if (lsa.fragment >= lsa.fragments || len != LSA_SIZE + count * NEIGHBOR_SIZE)
+		return false;
+
+	getXID("AD:", p, lsa.AD);
+	getXID("HID:", p + XID_BYTES, lsa.HID);
+	p += 2 * XID_BYTES;
+
+	lsa.neighbors.resize(count);
+	for (int i = 0; i < count; i++, p += NEIGHBOR_SIZE) {
+		LSANeighbor &n = lsa.neighbors[i];
+		int32_t cost = get32(p + 2 * XID_BYTES);
+
+		getXID("AD:", p, n.AD);
+		getXID("HID:", p + XID_BYTES, n.HID);
+		n.cost = cost > 0 ? cost : 1;
+	}
+	return true;
+}
+
+bool encodeHello(const HelloMsg &hello, string &msg)
+{
+	msg.clear();
+	msg.reserve(HELLO_SIZE);
+	putHeader(msg, HELLO, 0);
+	return putXID(msg, hello.AD) && putXID(msg, hello.HID);
+}
+
+bool encodeLSA(const LSAMsg &lsa, vector<string> &fragments)
+{
+	size_t total = lsa.neighbors.size();
+	size_t count = (total + FRAGMENT_NEIGHBORS - 1) / FRAGMENT_NEIGHBORS;
+
+	if (count == 0)
+		count = 1;
+	if (count > 0xffff)
+		return false;
+
+	fragments.clear();
+	fragments.resize(count);
+	for (size_t f = 0; f < count; f++) {
+		string &msg = fragments[f];
+		size_t first = f * FRAGMENT_NEIGHBORS;
+		size_t n = total - first < FRAGMENT_NEIGHBORS ? total - first : FRAGMENT_NEIGHBORS;
+
+		msg.reserve(LSA_SIZE + n * NEIGHBOR_SIZE);
+		putHeader(msg, LSA, lsa.dual_router ? XROUTE_DUAL_ROUTER : 0);
+		put32(msg, lsa.seq);
+		put16(msg, lsa.age);
+		put16(msg, f);
+		put16(msg, count);
+		put16(msg, n);
+		if (!putXID(msg, lsa.AD) || !putXID(msg, lsa.HID))
+			return false;
+
+		for (size_t i = first; i < first + n; i++) {
+			const LSANeighbor &nb = lsa.neighbors[i];
+
+			if (!putXID(msg, nb.AD) || !putXID(msg, nb.HID))
+				return false;
+			put32(msg, nb.cost);
+		}
+	}
+	return true;
+}
+
+void ageLSA(char *msg, int len)
+{
+	if (len < LSA_SIZE || msg[0] != 0)
+		return;
+
+	unsigned char *p = (unsigned char *)msg + LSA_AGE_OFFSET;
+	uint16_t age = get16(p);
+
+	if (age < 0xffff)
+		age++;
+	p[0] = age >> 8;
+	p[1] = age & 0xff;
+}
@@ -0,0 +1,81 @@
+#ifndef XROUTEMSG_HH
+#define XROUTEMSG_HH
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/*
+** Wire format of the messages routers exchange
+**
+** Messages are binary, multi-byte fields in network byte order:
+**
+**	header		zero (1), version (1), type (1), flags (1)
+**	HELLO		AD (20), HID (20)
+**	LSA			seq (4), age (2), fragment (2), fragments (2), count (2),
+**				AD (20), HID (20), then count neighbors of
+**				AD (20), HID (20), cost (4)
+**
+** XIDs are carried as their 20 raw bytes, the type is implied by the field.
+** The leading zero byte makes routers that only read the older text
+** messages ("type^field^...^") see an empty message and drop it; those
+** text messages are still accepted, and are how hosts register.
+**
+** An LSA whose neighbors don't fit in one message is split into fragments
+** that each carry the header fields and a share of the neighbors. The age
+** is bumped each time an LSA is reflooded.
+*/
+
+#define XROUTE_VERSION		1
+#define XROUTE_MAX_MSG		1024	// largest message sent or read
+
+// message types
+#define HELLO 0
+#define LSA 1
+#define HOST_REGISTER 2
+
+// LSA flags
+#define XROUTE_DUAL_ROUTER	0x01	// the AD has an XIA-IPv4 dual stack router
+
+typedef struct {
+	std::string AD;
+	std::string HID;
+} HelloMsg;
+
+typedef struct {
+	std::string AD;
+	std::string HID;
+	int32_t cost;
+} LSANeighbor;
+
+typedef struct {
+	bool dual_router;
+	std::string AD;		// AD the LSA describes
+	std::string HID;
+	uint32_t seq;
+	uint16_t age;
+	uint16_t fragment;	// index of this fragment
+	uint16_t fragments;	// fragments in the whole LSA
+	std::vector<LSANeighbor> neighbors;	// the ones in this fragment
+} LSAMsg;
+
+// type of a received message, or -1 if it can't be read
+int messageType(const char *msg, int len);
+
+// both return false if msg is malformed
+bool decodeHello(const char *msg, int len, HelloMsg &hello);
+bool decodeLSA(const char *msg, int len, LSAMsg &lsa);
+
+// both return false if an XID isn't "TYPE:" followed by 40 hex digits
+bool encodeHello(const HelloMsg &hello, std::string &msg);
+
+// splits lsa into as many fragments as its neighbors need, the fragment
+// fields of lsa are ignored
+bool encodeLSA(const LSAMsg &lsa, std::vector<std::string> &fragments);
+
+// bumps the age of a binary LSA in place before it is reflooded
+void ageLSA(char *msg, int len);
+
+// XIDs as the messages carry them, lowercase hex
+std::string normalizeXID(const std::string &xid);
+
+#endif
@@ -0,0 +1,264 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include "Xsocket.h"
+#include "Xkeys.h"
+#include "xns.h"
+
+#define TITLE "XIA Nameserver Load"
+#define PREFIX "nsload"
+#define MAX_THREADS 64
+#define TIMEOUT 1000	// ms to wait for a response before giving up on it
+
+typedef struct {
+	pthread_t thread;
+	unsigned seed;
+	unsigned long queries;	// requests answered
+	unsigned long names;	// names resolved by them
+	unsigned long failed;	// error responses
+	unsigned long timeouts;
+} Worker;
+
+int timetodie = 0;
+int verbose = 0;
+int threads = 4;
+int duration = 10;
+int batch = 1;
+int nregister = 0;
+
+char **names;
+int nnames;
+
+void handler(int)
+{
+	timetodie = 1;
+}
+
+void say(const char *fmt, ...)
+{
+	if (verbose) {
+		va_list args;
+
+		va_start(args, fmt);
+		vprintf(fmt, args);
+		va_end(args);
+	}
+}
+
+void die(const char *fmt, ...)
+{
+	va_list args;
+
+	va_start(args, fmt);
+	vfprintf(stdout, fmt, args);
+	va_end(args);
+	fprintf(stdout, "%s: exiting\n", TITLE);
+	exit(-1);
+}
+
+double now()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+** register count names of the form nsload<n>.xia, pointing at a new SID on
+** this host, and query those
+*/
+void register_names(int count)
+{
+	struct addrinfo hints, *ai;
+	char sid[50];
+	char name[64];
+
+	if (XmakeNewSID(sid, sizeof(sid)))
+		die("Unable to create a temporary SID\n");
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_flags = XAI_XIDSERV;
+	int rc = Xgetaddrinfo(NULL, sid, &hints, &ai);
+	if (rc != 0)
+		die("%s\n", Xgai_strerror(rc));
+
+	names = (char **)malloc(count * sizeof(char *));
+	for (int i = 0; i < count && !timetodie; i++) {
+		sprintf(name, "%s%d.xia", PREFIX, i);
+		if (XregisterName(name, (sockaddr_x *)ai->ai_addr) < 0)
+			die("Unable to register name %s\n", name);
+		names[nnames++] = strdup(name);
+	}
+	Xfreeaddrinfo(ai);
+	say("registered %d names\n", nnames);
+}
+
+void *load(void *arg)
+{
+	Worker *w = (Worker *)arg;
+	sockaddr_x ns_dag;
+	char pkt[NS_MAX_PACKET_SIZE];
+	int sock;
+
+	if ((sock = Xsocket(AF_XIA, SOCK_DGRAM, 0)) < 0)
+		die("Unable to create socket\n");
+	if (XreadNameServerDAG(sock, &ns_dag) < 0)
+		die("Unable to find nameserver address\n");
+
+	double end = now() + duration;
+	while (!timetodie && now() < end) {
+		ns_pkt query;
+
+		query.flags = 0;
+		query.dag = NULL;
+		if (batch == 1) {
+			query.type = NS_TYPE_QUERY;
+			query.name = names[rand_r(&w->seed) % nnames];
+		} else {
+			query.type = NS_TYPE_MQUERY;
+			query.count = batch;
+			for (int i = 0; i < batch; i++)
+				query.names[i] = names[rand_r(&w->seed) % nnames];
+		}
+		int len = make_ns_packet(&query, pkt, sizeof(pkt));
+
+		if (Xsendto(sock, pkt, len, 0, (struct sockaddr *)&ns_dag, sizeof(ns_dag)) < 0)
+			die("Error sending query (%s)\n", strerror(errno));
+
+		struct pollfd pfd;
+		pfd.fd = sock;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+		if (Xpoll(&pfd, 1, TIMEOUT) <= 0) {
+			w->timeouts++;
+			continue;
+		}
+
+		int rc = Xrecvfrom(sock, pkt, sizeof(pkt), 0, NULL, NULL);
+		if (rc < 0)
+			die("Error receiving response (%s)\n", strerror(errno));
+
+		ns_pkt resp;
+		get_ns_packet(pkt, rc, &resp);
+		w->queries++;
+
+		switch (resp.type) {
+			case NS_TYPE_RESPONSE_QUERY:
+				w->names++;
+				break;
+
+			case NS_TYPE_RESPONSE_MQUERY:
+				// answers that didn't fit aren't asked for again
+				for (int i = 0; i < resp.count; i++)
+					if (*resp.dags[i])
+						w->names++;
+				break;
+
+			default:
+				w->failed++;
+				break;
+		}
+	}
+
+	Xclose(sock);
+	return NULL;
+}
+
+void help()
+{
+	printf("usage: nsload [-v] [-t threads] [-d seconds] [-b batch] [-r count] [name ...]\n");
+	printf("where:\n");
+	printf(" -v : run in verbose mode\n");
+	printf(" -t : # of threads sending queries, each waits for its answer (default 4)\n");
+	printf(" -d : how long to run (default 10 seconds)\n");
+	printf(" -b : names per query, more than 1 sends batched queries (default 1, max %d)\n", NS_MAX_BATCH);
+	printf(" -r : register count names first and query those\n");
+	printf("name = names to query, picked at random\n");
+	exit(-1);
+}
+
+void configure(int argc, char** argv)
+{
+	int c;
+	opterr = 0;
+
+	while ((c = getopt(argc, argv, "hvt:d:b:r:")) != -1) {
+		switch (c) {
+			case 'v':
+				verbose = 1;
+				break;
+			case 't':
+				threads = MAX(1, MIN(atoi(optarg), MAX_THREADS));
+				break;
+			case 'd':
+				duration = MAX(1, atoi(optarg));
+				break;
+			case 'b':
+				batch = MAX(1, MIN(atoi(optarg), NS_MAX_BATCH));
+				break;
+			case 'r':
+				nregister = MAX(0, atoi(optarg));
+				break;
+			case 'h':
+			case '?':
+			default:
+				help();
+		}
+	}
+
+	if (optind != argc) {
+		names = &argv[optind];
+		nnames = argc - optind;
+	} else if (nregister == 0) {
+		help();
+	}
+}
+
+int main(int argc, char **argv)
+{
+	Worker workers[MAX_THREADS];
+
+	signal(SIGINT, handler);
+	signal(SIGTERM, handler);
+
+	configure(argc, argv);
+	if (nregister)
+		register_names(nregister);
+	if (nnames == 0)
+		die("No names to query\n");
+
+	say("%d threads querying %d names, %d per query, for %d seconds\n",
+		threads, nnames, batch, duration);
+
+	double start = now();
+	memset(workers, 0, sizeof(workers));
+	for (int i = 0; i < threads; i++) {
+		workers[i].seed = time(NULL) + i;
+		if (pthread_create(&workers[i].thread, NULL, load, &workers[i]) != 0)
+			die("Unable to start thread %d\n", i);
+	}
+
+	Worker total;
+	memset(&total, 0, sizeof(total));
+	for (int i = 0; i < threads; i++) {
+		pthread_join(workers[i].thread, NULL);
+		total.queries += workers[i].queries;
+		total.names += workers[i].names;
+		total.failed += workers[i].failed;
+		total.timeouts += workers[i].timeouts;
+	}
+	double elapsed = now() - start;
+
+	printf("%lu queries answered in %.2f seconds, %lu failed, %lu timed out\n",
+		total.queries, elapsed, total.failed, total.timeouts);
+	printf("%.0f queries/sec, %.0f names/sec\n",
+		total.queries / elapsed, total.names / elapsed);
+	return 0;
+}